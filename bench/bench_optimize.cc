@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: MIT License
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "instr.h"
+#include "optimize.h"
+#include "parse.h"
+
+/**
+ * Scaling benchmark for Optimizer::Run.
+ *
+ * Generates programs of growing size and nesting depth and reports the
+ * optimization time per operation.  If the optimizer is linear in the
+ * program size, the time per operation stays roughly the same.
+ * The speedup of optimizing the largest program with all cores is
+ * reported as well.
+ */
+
+static const int DEPTHS[] = {1250, 2500, 5000, 10000};
+
+// The time per operation of the largest program may be at most this
+// factor above the one of the smallest program.
+static const double MAX_GROWTH = 3.0;
+
+static const int REPEAT = 5;
+
+struct Shape {
+  const char *name;
+  std::string (*generate)(int depth);
+};
+
+static std::string repeat(const char *s, int count) {
+  std::string result{};
+  for (int i = 0; i < count; ++i) {
+    result += s;
+  }
+  return result;
+}
+
+static std::string nested_moves(int depth) {
+  return "+" + repeat("[>+", depth) + repeat("<-]", depth);
+}
+
+static std::string nested_multiply(int depth) {
+  return "+" + repeat("[", depth) + "->+<" + repeat("]", depth);
+}
+
+static std::string nested_double_guards(int depth) {
+  return "+" + repeat("[>[-]<", depth) + repeat("]", depth);
+}
+
+static std::string nested_clear(int depth) {
+  return "+" + repeat("[-[", depth) + "-" + repeat("]]", depth);
+}
+
+static std::string flat_copies(int depth) {
+  return repeat("+[->+>+<<]>>[-<<+>>]<<>", depth);
+}
+
+static const Shape SHAPES[] = {
+    {"nested-moves", nested_moves},
+    {"nested-multiply", nested_multiply},
+    {"nested-double-guards", nested_double_guards},
+    {"nested-clear", nested_clear},
+    {"flat-copies", flat_copies},
+};
+
+static size_t count_ops(OperationStream &stream) {
+  size_t count = 0;
+  for (auto *op : stream) {
+    (void) op;
+    ++count;
+  }
+  return count;
+}
+
+static double measure(const std::string &program, size_t *ops, unsigned int jobs = 1) {
+  double best = 0.0;
+  for (int i = 0; i < REPEAT; ++i) {
+    OperationStream stream = std::get<OperationStream>(Parse(program));
+    *ops = count_ops(stream);
+    const auto start = std::chrono::steady_clock::now();
+    Optimizer::Create(OptimizerLevel::O3, 1, jobs).Run(stream);
+    const auto stop = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(stop - start).count();
+    if (0 == i || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+int main() {
+  bool linear = true;
+  printf("%-22s %8s %10s %12s %10s\n", "shape", "depth", "ops", "time [ms]", "ns/op");
+  for (const Shape &shape : SHAPES) {
+    double first_ns_per_op = 0.0;
+    double last_ns_per_op = 0.0;
+    for (const int depth : DEPTHS) {
+      size_t ops = 0;
+      const double elapsed = measure(shape.generate(depth), &ops);
+      const double ns_per_op = elapsed * 1e9 / (double) ops;
+      if (0.0 == first_ns_per_op) {
+        first_ns_per_op = ns_per_op;
+      }
+      last_ns_per_op = ns_per_op;
+      printf("%-22s %8d %10zu %12.3f %10.2f\n", shape.name, depth, ops, elapsed * 1e3, ns_per_op);
+    }
+    if (last_ns_per_op > first_ns_per_op * MAX_GROWTH) {
+      printf("%s: time per operation grows with the program size\n", shape.name);
+      linear = false;
+    }
+  }
+  // Speedup of splitting the largest flat program, only reported
+  const unsigned int jobs = std::clamp(std::thread::hardware_concurrency(), 1u, Optimizer::MAX_JOBS);
+  if (jobs > 1) {
+    const std::string program = flat_copies(DEPTHS[std::size(DEPTHS) - 1]);
+    size_t ops = 0;
+    const double sequential = measure(program, &ops);
+    const double parallel = measure(program, &ops, jobs);
+    printf("flat-copies with %u jobs: %.3f ms, speedup %.2f\n", jobs, parallel * 1e3, sequential / parallel);
+  }
+  printf("%s\n", linear ? "Optimizer::Run is linear" : "Optimizer::Run is NOT linear");
+  return linear ? 0 : 1;
+}
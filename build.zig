@@ -53,20 +53,36 @@ pub fn build(b: *std.Build) void {
             "platform_windows.cc",
             "assembler_x86_64.cc",
             "assembler_aarch64.cc",
+            "code_cache.cc",
             "compiler.cc",
             "debug.cc",
+            "emit_asm.cc",
+            "emit_c.cc",
             "error.cc",
+            "executable.cc",
             "instr.cc",
             "interp.cc",
+            "loop_tree.cc",
             "mem.cc",
             "optimize.cc",
+            "opt_canonicalize.cc",
             "opt_comment_loop.cc",
             "opt_delay_ptr.cc",
             "opt_double_guard.cc",
             "opt_fusion_op.cc",
+            "opt_loop_invariant.cc",
+            "opt_merge_multiply.cc",
             "opt_multiply_loop.cc",
+            "opt_once_loop.cc",
             "opt_peep.cc",
+            "opt_trip_count.cc",
             "parse.cc",
+            "perf.cc",
+            "profile.cc",
+            "serialize.cc",
+            "tape_bounds.cc",
+            "trace.cc",
+            "tune.cc",
         },
         .flags = CXX_FLAGS.items
     });
@@ -100,11 +116,31 @@ pub fn build(b: *std.Build) void {
         .root = b.path("test"),
         .files = &.{
             "main.cc",
+            "test_code_cache.cc",
+            "test_compiler.cc",
+            "test_emit_asm.cc",
+            "test_emit_c.cc",
+            "test_executable.cc",
             "test_interp.cc",
+            "test_loop_tree.cc",
+            "test_opt_canonicalize.cc",
             "test_opt_comment_loop.cc",
+            "test_opt_delay_ptr.cc",
             "test_opt_double_guard.cc",
             "test_opt_fusion_op.cc",
+            "test_opt_loop_invariant.cc",
+            "test_opt_merge_multiply.cc",
             "test_opt_multiply_loop.cc",
+            "test_opt_once_loop.cc",
+            "test_opt_peep.cc",
+            "test_opt_trip_count.cc",
+            "test_optimize.cc",
+            "test_perf.cc",
+            "test_profile.cc",
+            "test_serialize.cc",
+            "test_tape_bounds.cc",
+            "test_trace.cc",
+            "test_tune.cc",
         },
         .flags = CXX_FLAGS.items,
     });
@@ -115,20 +151,36 @@ pub fn build(b: *std.Build) void {
             "platform_windows.cc",
             "assembler_x86_64.cc",
             "assembler_aarch64.cc",
+            "code_cache.cc",
             "compiler.cc",
             "debug.cc",
+            "emit_asm.cc",
+            "emit_c.cc",
             "error.cc",
+            "executable.cc",
             "instr.cc",
             "interp.cc",
+            "loop_tree.cc",
             "mem.cc",
             "optimize.cc",
+            "opt_canonicalize.cc",
             "opt_comment_loop.cc",
             "opt_delay_ptr.cc",
             "opt_double_guard.cc",
             "opt_fusion_op.cc",
+            "opt_loop_invariant.cc",
+            "opt_merge_multiply.cc",
             "opt_multiply_loop.cc",
+            "opt_once_loop.cc",
             "opt_peep.cc",
+            "opt_trip_count.cc",
             "parse.cc",
+            "perf.cc",
+            "profile.cc",
+            "serialize.cc",
+            "tape_bounds.cc",
+            "trace.cc",
+            "tune.cc",
         },
         .flags = CXX_FLAGS.items,
     });
@@ -2,35 +2,141 @@
 #ifndef BF_CC_ASSEMBLER_H
 #define BF_CC_ASSEMBLER_H 1
 
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
 #include "error.h"
 #include "instr.h"
 #include "mem.h"
 
-void EmitEntry(CodeArea &);
-void EmitExit(CodeArea &);
+/**
+ * Machine state handed between the interpreter and compiled code.  The
+ * code starts with the cell pointer and the loop counter of the state and
+ * stores them back when it returns.
+ */
+struct ExecState {
+  uint8_t *cell;
+  uintptr_t loop_counter;
+  // The operation at which the interpreter takes over, nullptr if the
+  // code ran to its end
+  Operation *resume;
+  // Identifies the exit the code took, for code with more than one exit
+  uintptr_t exit;
+};
+
+// Functions of bf-cc whose absolute addresses the code contains
+enum class RuntimeFunction : uint32_t {
+  READ = 1,
+  WRITE = 2,
+};
+
+/**
+ * An absolute address of a function of bf-cc in the code.  Code which
+ * runs in another process than the one which compiled it must be
+ * relocated, since the functions live at other addresses there.
+ */
+struct Relocation {
+  uint8_t *address;
+  RuntimeFunction function;
+};
+
+using Relocations = std::vector<Relocation>;
+
+// Points the address at the code to the function in this process, the code must be writable
+void Relocate(uint8_t *, RuntimeFunction);
+
+// Starts a function which takes a pointer to an ExecState, records the
+// relocations if given
+void EmitEntry(CodeArea &, Relocations * = nullptr);
+// Returns to the caller, which continues at resume
+void EmitExit(CodeArea &, Operation *resume = nullptr, uintptr_t exit = 0);
 
 void EmitNop(CodeArea &);
+// Pads with NOPs up to the next multiple of alignment, which must be a power of 2
+void EmitAlign(CodeArea &, size_t);
 
 void EmitIncrCell(CodeArea &, uint8_t, intptr_t);
 void EmitDecrCell(CodeArea &, uint8_t, intptr_t);
 
-void EmitImullCell(CodeArea &, uint8_t, intptr_t);
-void EmitDmullCell(CodeArea &, uint8_t, intptr_t);
+void EmitImullCell(CodeArea &, uint8_t, intptr_t, intptr_t);
+void EmitDmullCell(CodeArea &, uint8_t, intptr_t, intptr_t);
 
 void EmitSetCell(CodeArea &, uint8_t, intptr_t);
 
 void EmitIncrPtr(CodeArea &, intptr_t);
 void EmitDecrPtr(CodeArea &, intptr_t);
 
-void EmitRead(CodeArea &, EOFMode);
-void EmitWrite(CodeArea &);
+void EmitRead(CodeArea &, EOFMode, Relocations * = nullptr);
+void EmitWrite(CodeArea &, Relocations * = nullptr);
 
-void EmitJumpZero(CodeArea &);
+void EmitJump(CodeArea &);
+void PatchJump(CodeArea &, uint8_t *, uintptr_t);
+void EmitJumpZero(CodeArea &, intptr_t);
 void PatchJumpZero(CodeArea &, uint8_t *, uintptr_t);
-void EmitJumpNonZero(CodeArea &);
+void EmitJumpNonZero(CodeArea &, intptr_t);
 void PatchJumpNonZero(CodeArea &, uint8_t *, uintptr_t);
+// Jumps if the cell at the offset does not have the value
+void EmitJumpNotEqual(CodeArea &, intptr_t, uint8_t);
+void PatchJumpNotEqual(CodeArea &, uint8_t *, uintptr_t);
+
+// Calls function(argument), which returns the address where the code continues
+void EmitCallAndJump(CodeArea &, uintptr_t function, uintptr_t argument);
+
+void EmitSetLoopCounter(CodeArea &, uint32_t);
+void EmitLoopCounterJump(CodeArea &);
+void PatchLoopCounterJump(CodeArea &, uint8_t *, uintptr_t);
 
 void EmitFindCellHigh(CodeArea &, uint8_t, uintptr_t);
 void EmitFindCellLow(CodeArea &, uint8_t, uintptr_t);
 
+// Adds 1 to the 64-bit counter at the address
+void EmitCountUp(CodeArea &, uint64_t *);
+// Stores the clock of the profiler, see LoopCounters
+void EmitStartClock(CodeArea &, uint64_t *start);
+// Adds the clock minus the start to the total
+void EmitStopClock(CodeArea &, uint64_t *start, uint64_t *total);
+
+/**
+ * Heap of a standalone executable, in bytes.  The size and the guard in
+ * front and behind are multiples of STANDALONE_ALIGNMENT.
+ */
+struct StandaloneHeap {
+  size_t size;
+  size_t guard;
+  // The cell the program starts at, counted from the start of the heap
+  size_t origin;
+};
+
+/**
+ * Runtime of a standalone executable for Linux, which is emitted in front
+ * of the program.  The runtime maps the heap, runs the program and exits,
+ * and replaces bf_read and bf_write with buffered system calls.  The
+ * buffers live in a data segment, which follows the code at the next
+ * multiple of STANDALONE_ALIGNMENT.  The code is position independent,
+ * the runtime reaches the data segment PC-relative.
+ */
+struct StandaloneRuntime {
+  // The entry point of the executable
+  uint8_t *start;
+  uint8_t *read;
+  uint8_t *write;
+  // PC-relative references to the data segment, see PatchStandaloneData
+  std::vector<uint8_t *> data_refs;
+};
+
+// Segments are aligned for the largest page size of the architectures
+static constexpr size_t STANDALONE_ALIGNMENT = 1 << 16;
+// Output and input buffer, followed by their counters
+static constexpr size_t STANDALONE_DATA_SIZE = 8192 + 32;
+
+// Emits the runtime, the program must follow right behind it
+void EmitStandaloneRuntime(CodeArea &, StandaloneRuntime &, const StandaloneHeap &);
+// Points the references of the runtime to the data segment at the address
+void PatchStandaloneData(CodeArea &, const StandaloneRuntime &, uint8_t *);
+// Replaces EmitEntry, EmitRead and EmitWrite in standalone executables
+void EmitStandaloneEntry(CodeArea &, const StandaloneRuntime &);
+void EmitStandaloneRead(CodeArea &, const StandaloneRuntime &, EOFMode);
+void EmitStandaloneWrite(CodeArea &, const StandaloneRuntime &);
+
 #endif /* BF_CC_ASSEMBLER_H */
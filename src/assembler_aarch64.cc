@@ -3,7 +3,9 @@
 #include "platform.h"
 
 #if defined(IS_AARCH64)
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 #include "debug.h"
 #include "error.h"
@@ -26,6 +28,7 @@ enum class R : uint32_t {
 static const R R_CELL = R::X19;
 static const R R_READ = R::X20;
 static const R R_WRITE = R::X21;
+static const R R_LOOP = R::X22;
 static const R R_TMPX1 = R::X1;
 static const R R_TMPX2 = R::X2;
 static const R R_TMPX3 = R::X3;
@@ -257,6 +260,28 @@ public:
     return op;
   }
 
+  static constexpr uint32_t LDR(R regt, R regn, uint16_t imm = 0) noexcept {
+    uint32_t op = 0b11111001010000000000000000000000;
+    uint32_t rt = NormReg(regt, nullptr);
+    uint32_t rn = NormReg(regn, nullptr);
+    ASSERT(imm % 8 == 0 && imm / 8 <= 0xFFF, "Invalid LDR immediate: %u", imm);
+    op |= static_cast<uint32_t>((imm / 8) & 0xFFF) << 10;
+    op |= rn << 5;
+    op |= rt;
+    return op;
+  }
+
+  static constexpr uint32_t STR(R regt, R regn, uint16_t imm = 0) noexcept {
+    uint32_t op = 0b11111001000000000000000000000000;
+    uint32_t rt = NormReg(regt, nullptr);
+    uint32_t rn = NormReg(regn, nullptr);
+    ASSERT(imm % 8 == 0 && imm / 8 <= 0xFFF, "Invalid STR immediate: %u", imm);
+    op |= static_cast<uint32_t>((imm / 8) & 0xFFF) << 10;
+    op |= rn << 5;
+    op |= rt;
+    return op;
+  }
+
   static constexpr uint32_t B(int32_t imm) noexcept {
     uint32_t op = 0b00010100000000000000000000000000;
     ASSERT(imm <= INT32_C(0x2000000) && imm >= INT32_C(-0x2000000), "Invalid B immediate: %d", imm);
@@ -278,11 +303,45 @@ public:
     return op;
   }
 
+  static constexpr uint32_t BL(int32_t imm) noexcept {
+    uint32_t op = 0b10010100000000000000000000000000;
+    ASSERT(imm <= INT32_C(0x2000000) && imm >= INT32_C(-0x2000000), "Invalid BL immediate: %d", imm);
+    op |= static_cast<uint32_t>(imm) & 0x3ffffff;
+    return op;
+  }
+
+  static constexpr uint32_t ADR(R regd, int32_t imm, bool page = false) noexcept {
+    uint32_t op = page ? 0b10010000000000000000000000000000 : 0b00010000000000000000000000000000;
+    uint32_t rd = NormReg(regd, nullptr);
+    ASSERT(imm < 0x100000 && imm >= -0x100000, "Invalid ADR immediate: %d", imm);
+    op |= (static_cast<uint32_t>(imm) & 0b11) << 29;
+    op |= ((static_cast<uint32_t>(imm) >> 2) & 0x7FFFF) << 5;
+    op |= rd;
+    return op;
+  }
+
+  static constexpr uint32_t ADRP(R regd, int32_t imm) noexcept {
+    return ADR(regd, imm, true);
+  }
+
   static constexpr uint32_t BLR(R regn) noexcept {
     uint32_t op = 0b11010110001111110000000000000000;
     uint32_t rn = NormReg(regn, nullptr);
     return op | (rn << 5);
   }
+
+  static constexpr uint32_t BR(R regn) noexcept {
+    uint32_t op = 0b11010110000111110000000000000000;
+    uint32_t rn = NormReg(regn, nullptr);
+    return op | (rn << 5);
+  }
+
+  // MRS regt, CNTVCT_EL0
+  static constexpr uint32_t MRS_CNTVCT(R regt) noexcept {
+    uint32_t op = 0b11010101001110111110000001000000;
+    uint32_t rt = NormReg(regt, nullptr);
+    return op | rt;
+  }
 };
 
 /* ABI information
@@ -293,9 +352,12 @@ public:
    r19: cell pointer
    r20: address of bf_write
    r21: address of bf_read
+   r22: loop counter of counted loops
    r0: tmp1 register
    r1: tmp2 register
    r2: tmp3 register
+
+   The ExecState is stored right at the frame pointer.
  */
 
 void LoadImmediate32(CodeArea &mem, R target, uint32_t value) {
@@ -324,7 +386,7 @@ void LoadImmediate64(CodeArea &mem, R target, uint64_t value) {
   }
 }
 
-void EmitEntry(CodeArea &mem) {
+static void EmitFrame(CodeArea &mem) {
   // clang-format off
   mem.EmitCodeListing({
       // Save registers
@@ -334,20 +396,70 @@ void EmitEntry(CodeArea &mem) {
       0xF3, 0x53, 0xBF, 0xA9,
       // STP x21, x22, [sp, -16]!
       0xF5, 0x5B, 0xBF, 0xA9,
+      // Keep the ExecState for the exit
+      // STP x0, x1, [sp, -16]!
+      0xE0, 0x07, 0xBF, 0xA9,
       // Set FP
       // MOV x29, sp
       0xFD, 0x03, 0x00, 0x91,
-      // MOV x19, x0
-      0xF3, 0x03, 0x00, 0xAA,
     });
-  LoadImmediate64(mem, R_WRITE, (uintptr_t) bf_write);
-  LoadImmediate64(mem, R_READ, (uintptr_t) bf_read);
   // clang-format on
+  mem.EmitCode(__ LDR(R_CELL, R::X0, offsetof(ExecState, cell)));
+  mem.EmitCode(__ LDR(R_LOOP, R::X0, offsetof(ExecState, loop_counter)));
 }
 
-void EmitExit(CodeArea &mem) {
+static uintptr_t function_address(RuntimeFunction function) {
+  return RuntimeFunction::READ == function ? (uintptr_t) bf_read : (uintptr_t) bf_write;
+}
+
+/**
+ * Loads the address with all four moves, so that it can be relocated.
+ */
+static void LoadAddress(CodeArea &mem, R target, uintptr_t value) {
+  mem.EmitCode(__ MOVZ(target, static_cast<uint16_t>(value & 0xFFFF)));
+  for (uint8_t hw = 1; hw < 4; ++hw) {
+    mem.EmitCode(__ MOVK(target, static_cast<uint16_t>((value >> (16 * hw)) & 0xFFFF), hw));
+  }
+}
+
+void Relocate(uint8_t *address, RuntimeFunction function) {
+  // The moves of LoadAddress, which keep their register
+  uint32_t code[4];
+  std::memcpy(code, address, sizeof(code));
+  const R target = static_cast<R>(code[0] & 0x1F);
+  const uintptr_t value = function_address(function);
+  code[0] = __ MOVZ(target, static_cast<uint16_t>(value & 0xFFFF));
+  for (uint8_t hw = 1; hw < 4; ++hw) {
+    code[hw] = __ MOVK(target, static_cast<uint16_t>((value >> (16 * hw)) & 0xFFFF), hw);
+  }
+  std::memcpy(address, code, sizeof(code));
+}
+
+void EmitEntry(CodeArea &mem, Relocations *relocations) {
+  EmitFrame(mem);
+  if (nullptr != relocations) {
+    relocations->push_back(Relocation{.address = mem.CurrentWriteAddr(), .function = RuntimeFunction::WRITE});
+  }
+  LoadAddress(mem, R_WRITE, function_address(RuntimeFunction::WRITE));
+  if (nullptr != relocations) {
+    relocations->push_back(Relocation{.address = mem.CurrentWriteAddr(), .function = RuntimeFunction::READ});
+  }
+  LoadAddress(mem, R_READ, function_address(RuntimeFunction::READ));
+}
+
+void EmitExit(CodeArea &mem, Operation *resume, uintptr_t exit) {
+  mem.EmitCode(__ LDR(R::X0, R::X29));
+  mem.EmitCode(__ STR(R_CELL, R::X0, offsetof(ExecState, cell)));
+  mem.EmitCode(__ STR(R_LOOP, R::X0, offsetof(ExecState, loop_counter)));
+  LoadImmediate64(mem, R_TMPX1, (uintptr_t) resume);
+  mem.EmitCode(__ STR(R_TMPX1, R::X0, offsetof(ExecState, resume)));
+  LoadImmediate64(mem, R_TMPX1, exit);
+  mem.EmitCode(__ STR(R_TMPX1, R::X0, offsetof(ExecState, exit)));
   // clang-format off
   mem.EmitCodeListing({
+      // Drop the ExecState
+      // ADD sp, sp, 16
+      0xFF, 0x43, 0x00, 0x91,
       // LDP x21, x22, [sp], 16
       0xF5, 0x5B, 0xC1, 0xA8,
       // LDP x19, x20, [sp], 16
@@ -368,6 +480,12 @@ void EmitNop(CodeArea &mem) {
   mem.EmitCode(__ NOP());
 }
 
+void EmitAlign(CodeArea &mem, size_t alignment) {
+  while (0 != ((uintptr_t) mem.CurrentWriteAddr() & (alignment - 1))) {
+    mem.EmitCode(__ NOP());
+  }
+}
+
 static void EmitIncrDecrCell(CodeArea &mem, uint8_t amount, intptr_t offset, bool is_incr) {
   ASSERT(offset < INT32_MAX && offset > INT32_MIN, "check");
   R cell_reg = R_CELL;
@@ -395,34 +513,46 @@ void EmitDecrCell(CodeArea &mem, uint8_t amount, intptr_t offset) {
   EmitIncrDecrCell(mem, amount, offset, false);
 }
 
-void EmitImullCell(CodeArea &mem, uint8_t amount, intptr_t offset) {
-  ASSERT(0 != offset, "check");
+/**
+ * Returns a register holding the address of the cell at offset.
+ */
+static R EmitCellAddress(CodeArea &mem, R tmp, intptr_t offset) {
+  if (0 == offset) {
+    return R_CELL;
+  }
+  LoadImmediate64(mem, tmp, static_cast<uint64_t>(offset));
+  mem.EmitCode(__ ADD(tmp, R_CELL, tmp));
+  return tmp;
+}
+
+void EmitImullCell(CodeArea &mem, uint8_t amount, intptr_t offset, intptr_t source) {
+  ASSERT(source != offset, "check");
   R mul_amount = R::W1;
   R cur = R::W2;
   R orig = R::W4;
   R reg_offset = R::X3;
-  R reg_source_cell = R_CELL;
+  R reg_source_cell = EmitCellAddress(mem, R::X7, source);
   R reg_target_cell = R::X6;
   mem.EmitCode(__ LDRB(cur, reg_source_cell));
   LoadImmediate64(mem, reg_offset, static_cast<uint64_t>(offset));
-  mem.EmitCode(__ ADD(reg_target_cell, reg_source_cell, reg_offset));
+  mem.EmitCode(__ ADD(reg_target_cell, R_CELL, reg_offset));
   mem.EmitCode(__ LDRB(orig, reg_target_cell));
   mem.EmitCode(__ MOVZ(mul_amount, amount));
   mem.EmitCode(__ MADD(cur, cur, mul_amount, orig));
   mem.EmitCode(__ STRB(cur, reg_target_cell));
 }
 
-void EmitDmullCell(CodeArea &mem, uint8_t amount, intptr_t offset) {
-  ASSERT(0 != offset, "check");
+void EmitDmullCell(CodeArea &mem, uint8_t amount, intptr_t offset, intptr_t source) {
+  ASSERT(source != offset, "check");
   R mul_amount = R::W0;
   R cur = R::W1;
   R orig = R::W2;
   R reg_offset = R::X4;
-  R reg_source_cell = R_CELL;
+  R reg_source_cell = EmitCellAddress(mem, R::X7, source);
   R reg_target_cell = R::X6;
   mem.EmitCode(__ LDRB(cur, reg_source_cell));
   LoadImmediate64(mem, reg_offset, static_cast<uint64_t>(offset));
-  mem.EmitCode(__ ADD(reg_target_cell, reg_source_cell, reg_offset));
+  mem.EmitCode(__ ADD(reg_target_cell, R_CELL, reg_offset));
   mem.EmitCode(__ LDRB(orig, reg_target_cell));
   mem.EmitCode(__ MOVZ(mul_amount, amount));
   mem.EmitCode(__ MSUB(cur, cur, mul_amount, orig));
@@ -466,25 +596,29 @@ void EmitDecrPtr(CodeArea &mem, intptr_t amount) {
   }
 }
 
-void EmitRead(CodeArea &mem, EOFMode eof_mode) {
+void EmitRead(CodeArea &mem, EOFMode eof_mode, Relocations *) {
   mem.EmitCode(__ MOV(R::X0, R_CELL));
   mem.EmitCode(__ MOVZ(R::W1, static_cast<uint16_t>(eof_mode)));
   mem.EmitCode(__ BLR(R_READ));
 }
 
-void EmitWrite(CodeArea &mem) {
+void EmitWrite(CodeArea &mem, Relocations *) {
   mem.EmitCode(__ MOV(R::X0, R_CELL));
   mem.EmitCode(__ BLR(R_WRITE));
 }
 
-static void PrepareJump(CodeArea &mem) {
-  mem.EmitCode(__ LDRB(R_TMPW1, R_CELL));
-  mem.EmitCode(__ CMP(R_TMPW1, 0));
+static void PrepareJump(CodeArea &mem, intptr_t offset, uint8_t value = 0) {
+  if (offset < 0 || offset > 0xFFF) {
+    mem.EmitCode(__ LDRB(R_TMPW1, EmitCellAddress(mem, R_TMPX1, offset)));
+  } else {
+    mem.EmitCode(__ LDRB(R_TMPW1, R_CELL, static_cast<uint16_t>(offset)));
+  }
+  mem.EmitCode(__ CMP(R_TMPW1, value));
   // Jump will be patched later
   mem.EmitCode(__ BRK());
 }
 
-static void PatchJump(CodeArea &mem, uint8_t *position, uintptr_t offset, bool is_beq) {
+static void PatchConditionalJump(CodeArea &mem, uint8_t *position, uintptr_t offset, bool is_beq) {
   ASSERT((offset & 0b11) == 0, "check");
   intptr_t signed_offset = (intptr_t) offset;
   signed_offset /= 4;
@@ -497,20 +631,63 @@ static void PatchJump(CodeArea &mem, uint8_t *position, uintptr_t offset, bool i
   }
 }
 
-void EmitJumpZero(CodeArea &mem) {
-  PrepareJump(mem);
+void EmitJumpZero(CodeArea &mem, intptr_t offset) {
+  PrepareJump(mem, offset);
 }
 
 void PatchJumpZero(CodeArea &mem, uint8_t *position, uintptr_t offset) {
-  PatchJump(mem, position, offset, true);
+  PatchConditionalJump(mem, position, offset, true);
 }
 
-void EmitJumpNonZero(CodeArea &mem) {
-  PrepareJump(mem);
+void EmitJumpNonZero(CodeArea &mem, intptr_t offset) {
+  PrepareJump(mem, offset);
 }
 
 void PatchJumpNonZero(CodeArea &mem, uint8_t *position, uintptr_t offset) {
-  PatchJump(mem, position, offset, false);
+  PatchConditionalJump(mem, position, offset, false);
+}
+
+void EmitJumpNotEqual(CodeArea &mem, intptr_t offset, uint8_t value) {
+  PrepareJump(mem, offset, value);
+}
+
+void PatchJumpNotEqual(CodeArea &mem, uint8_t *position, uintptr_t offset) {
+  PatchConditionalJump(mem, position, offset, false);
+}
+
+void EmitJump(CodeArea &mem) {
+  // Jump will be patched later
+  mem.EmitCode(__ BRK());
+}
+
+void PatchJump(CodeArea &mem, uint8_t *position, uintptr_t offset) {
+  ASSERT((offset & 0b11) == 0, "check");
+  intptr_t signed_offset = (intptr_t) offset;
+  signed_offset /= 4;
+  signed_offset += 1;
+  mem.PatchCode(position - 4, __ B((int32_t) signed_offset));
+}
+
+void EmitCallAndJump(CodeArea &mem, uintptr_t function, uintptr_t argument) {
+  LoadImmediate64(mem, R::X0, argument);
+  LoadImmediate64(mem, R_TMPX2, function);
+  mem.EmitCode(__ BLR(R_TMPX2));
+  mem.EmitCode(__ BR(R::X0));
+}
+
+void EmitSetLoopCounter(CodeArea &mem, uint32_t count) {
+  LoadImmediate32(mem, R_LOOP, count);
+}
+
+void EmitLoopCounterJump(CodeArea &mem) {
+  mem.EmitCode(__ SUB(R_LOOP, R_LOOP, 1));
+  mem.EmitCode(__ CMP(R_LOOP, 0));
+  // Jump will be patched later
+  mem.EmitCode(__ BRK());
+}
+
+void PatchLoopCounterJump(CodeArea &mem, uint8_t *position, uintptr_t offset) {
+  PatchConditionalJump(mem, position, offset, false);
 }
 
 void EmitFindCellHigh(CodeArea &mem, uint8_t value, uintptr_t move_size) {
@@ -529,4 +706,294 @@ void EmitFindCellLow(CodeArea &mem, uint8_t value, uintptr_t move_size) {
   mem.EmitCode(__ BNE(-3));
 }
 
+void EmitCountUp(CodeArea &mem, uint64_t *counter) {
+  LoadImmediate64(mem, R_TMPX1, (uintptr_t) counter);
+  mem.EmitCode(__ LDR(R_TMPX2, R_TMPX1));
+  mem.EmitCode(__ ADD(R_TMPX2, R_TMPX2, 1));
+  mem.EmitCode(__ STR(R_TMPX2, R_TMPX1));
+}
+
+void EmitStartClock(CodeArea &mem, uint64_t *start) {
+  mem.EmitCode(__ MRS_CNTVCT(R_TMPX2));
+  LoadImmediate64(mem, R_TMPX1, (uintptr_t) start);
+  mem.EmitCode(__ STR(R_TMPX2, R_TMPX1));
+}
+
+void EmitStopClock(CodeArea &mem, uint64_t *start, uint64_t *total) {
+  mem.EmitCode(__ MRS_CNTVCT(R_TMPX2));
+  LoadImmediate64(mem, R_TMPX1, (uintptr_t) start);
+  mem.EmitCode(__ LDR(R_TMPX3, R_TMPX1));
+  mem.EmitCode(__ SUB(R_TMPX2, R_TMPX2, R_TMPX3));
+  LoadImmediate64(mem, R_TMPX1, (uintptr_t) total);
+  mem.EmitCode(__ LDR(R_TMPX3, R_TMPX1));
+  mem.EmitCode(__ ADD(R_TMPX3, R_TMPX3, R_TMPX2));
+  mem.EmitCode(__ STR(R_TMPX3, R_TMPX1));
+}
+
+/**
+ * Word offset from the current position to the target, for branches.
+ */
+static int32_t BranchOffset(CodeArea &mem, const uint8_t *target) {
+  return (int32_t) ((target - mem.CurrentWriteAddr()) / 4);
+}
+
+/**
+ * Loads the address of the data segment into x9.
+ */
+static void EmitDataAddress(CodeArea &mem, StandaloneRuntime &runtime) {
+  runtime.data_refs.push_back(mem.CurrentWriteAddr());
+  // ADRP x9, data, will be patched later
+  mem.EmitCode(__ ADRP(R::X9, 0));
+}
+
+/* Data segment of standalone executables
+
+   0:    output buffer, 4096 bytes
+   4096: input buffer, 4096 bytes
+   8192: bytes in the output buffer
+   8200: bytes in the input buffer
+   8208: bytes of the input buffer which were read
+   8216: set once the input ended
+
+   The routines of the runtime take their arguments like bf_read and
+   bf_write, and only change x0 to x15 and the link register.
+ */
+
+void EmitStandaloneRuntime(CodeArea &mem, StandaloneRuntime &runtime, const StandaloneHeap &heap) {
+  // The branches between the routines rely on their order and size
+  // clang-format off
+  uint8_t *fail = mem.CurrentWriteAddr();
+  mem.EmitCodeListing({
+      // MOV x0, 1
+      0x20, 0x00, 0x80, 0xD2,
+      // MOV x8, 94 (exit_group)
+      0xC8, 0x0B, 0x80, 0xD2,
+      // SVC 0
+      0x01, 0x00, 0x00, 0xD4,
+    });
+  // Writes the output buffer
+  uint8_t *flush = mem.CurrentWriteAddr();
+  EmitDataAddress(mem, runtime);
+  mem.EmitCodeListing({
+      // MOV x10, 0
+      0x0A, 0x00, 0x80, 0xD2,
+      // LDR x2, [x9, 8192]
+      0x22, 0x01, 0x50, 0xF9,
+      // SUBS x2, x2, x10
+      0x42, 0x00, 0x0A, 0xEB,
+      // B.LE "to the end"
+      0x2D, 0x01, 0x00, 0x54,
+      // ADD x1, x9, x10
+      0x21, 0x01, 0x0A, 0x8B,
+      // MOV x0, 1
+      0x20, 0x00, 0x80, 0xD2,
+      // MOV x8, 64 (write)
+      0x08, 0x08, 0x80, 0xD2,
+      // SVC 0
+      0x01, 0x00, 0x00, 0xD4,
+      // CMP x0, 0
+      0x1F, 0x00, 0x00, 0xF1,
+      // B.LE fail
+      0x6D, 0xFE, 0xFF, 0x54,
+      // ADD x10, x10, x0
+      0x4A, 0x01, 0x00, 0x8B,
+      // B "back to LDR"
+      0xF6, 0xFF, 0xFF, 0x17,
+      // STR xzr, [x9, 8192]
+      0x3F, 0x01, 0x10, 0xF9,
+      // RET
+      0xC0, 0x03, 0x5F, 0xD6,
+    });
+  runtime.write = mem.CurrentWriteAddr();
+  // LDRB w2, [x0]
+  mem.EmitCodeListing({0x02, 0x00, 0x40, 0x39});
+  EmitDataAddress(mem, runtime);
+  mem.EmitCodeListing({
+      // LDR x3, [x9, 8192]
+      0x23, 0x01, 0x50, 0xF9,
+      // STRB w2, [x9, x3]
+      0x22, 0x69, 0x23, 0x38,
+      // ADD x3, x3, 1
+      0x63, 0x04, 0x00, 0x91,
+      // STR x3, [x9, 8192]
+      0x23, 0x01, 0x10, 0xF9,
+      // CMP x3, 4096
+      0x7F, 0x04, 0x40, 0xF1,
+      // B.EQ flush
+      0x40, 0xFD, 0xFF, 0x54,
+      // RET
+      0xC0, 0x03, 0x5F, 0xD6,
+    });
+  runtime.read = mem.CurrentWriteAddr();
+  mem.EmitCodeListing({
+      // MOV x15, x30
+      0xEF, 0x03, 0x1E, 0xAA,
+      // MOV x13, x0
+      0xED, 0x03, 0x00, 0xAA,
+      // MOV w14, w1
+      0xEE, 0x03, 0x01, 0x2A,
+    });
+  mem.EmitCode(__ BL(BranchOffset(mem, flush)));
+  // MOV x30, x15
+  mem.EmitCodeListing({0xFE, 0x03, 0x0F, 0xAA});
+  EmitDataAddress(mem, runtime);
+  mem.EmitCodeListing({
+      // ADD x11, x9, 4096
+      0x2B, 0x05, 0x40, 0x91,
+      // LDR x2, [x9, 8200]
+      0x22, 0x05, 0x50, 0xF9,
+      // LDR x3, [x9, 8208]
+      0x23, 0x09, 0x50, 0xF9,
+      // CMP x3, x2
+      0x7F, 0x00, 0x02, 0xEB,
+      // B.LO "to LDRB"
+      0x83, 0x01, 0x00, 0x54,
+      // LDR x4, [x9, 8216]
+      0x24, 0x0D, 0x50, 0xF9,
+      // CBNZ x4, "to CMP w14, 1"
+      0x24, 0x02, 0x00, 0xB5,
+      // MOV x0, 0
+      0x00, 0x00, 0x80, 0xD2,
+      // MOV x1, x11
+      0xE1, 0x03, 0x0B, 0xAA,
+      // MOV x2, 4096
+      0x02, 0x00, 0x82, 0xD2,
+      // MOV x8, 63 (read)
+      0xE8, 0x07, 0x80, 0xD2,
+      // SVC 0
+      0x01, 0x00, 0x00, 0xD4,
+      // CMP x0, 0
+      0x1F, 0x00, 0x00, 0xF1,
+      // B.LE "to the end of the input"
+      0x0D, 0x01, 0x00, 0x54,
+      // STR x0, [x9, 8200]
+      0x20, 0x05, 0x10, 0xF9,
+      // MOV x3, 0
+      0x03, 0x00, 0x80, 0xD2,
+      // LDRB w5, [x11, x3]
+      0x65, 0x69, 0x63, 0x38,
+      // ADD x3, x3, 1
+      0x63, 0x04, 0x00, 0x91,
+      // STR x3, [x9, 8208]
+      0x23, 0x09, 0x10, 0xF9,
+      // STRB w5, [x13]
+      0xA5, 0x01, 0x00, 0x39,
+      // RET
+      0xC0, 0x03, 0x5F, 0xD6,
+      // MOV x4, 1
+      0x24, 0x00, 0x80, 0xD2,
+      // STR x4, [x9, 8216]
+      0x24, 0x0D, 0x10, 0xF9,
+      // CMP w14, 1 (KEEP)
+      0xDF, 0x05, 0x00, 0x71,
+      // B.EQ "to the last RET"
+      0xE0, 0x00, 0x00, 0x54,
+      // CMP w14, 2 (ZERO)
+      0xDF, 0x09, 0x00, 0x71,
+      // B.NE "to NEG_ONE"
+      0x61, 0x00, 0x00, 0x54,
+      // STRB wzr, [x13]
+      0xBF, 0x01, 0x00, 0x39,
+      // RET
+      0xC0, 0x03, 0x5F, 0xD6,
+      // MOV w5, 255
+      0xE5, 0x1F, 0x80, 0x52,
+      // STRB w5, [x13]
+      0xA5, 0x01, 0x00, 0x39,
+      // RET
+      0xC0, 0x03, 0x5F, 0xD6,
+    });
+  runtime.start = mem.CurrentWriteAddr();
+  mem.EmitCodeListing({
+      // MOV x0, 0
+      0x00, 0x00, 0x80, 0xD2,
+    });
+  LoadImmediate64(mem, R::X1, heap.size + 2 * heap.guard);
+  mem.EmitCodeListing({
+      // MOV x2, 0 (PROT_NONE)
+      0x02, 0x00, 0x80, 0xD2,
+      // MOV x3, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+      0x43, 0x04, 0x88, 0xD2,
+      // MOV x4, -1
+      0x04, 0x00, 0x80, 0x92,
+      // MOV x5, 0
+      0x05, 0x00, 0x80, 0xD2,
+      // MOV x8, 222 (mmap)
+      0xC8, 0x1B, 0x80, 0xD2,
+      // SVC 0
+      0x01, 0x00, 0x00, 0xD4,
+      // CMN x0, 4095
+      0x1F, 0xFC, 0x3F, 0xB1,
+      // B.LO "over the next branch"
+      0x43, 0x00, 0x00, 0x54,
+    });
+  mem.EmitCode(__ B(BranchOffset(mem, fail)));
+  // MOV x19, x0
+  mem.EmitCodeListing({0xF3, 0x03, 0x00, 0xAA});
+  LoadImmediate64(mem, R::X1, heap.guard);
+  mem.EmitCode(__ ADD(R::X0, R::X19, R::X1));
+  LoadImmediate64(mem, R::X1, heap.size);
+  mem.EmitCodeListing({
+      // MOV x2, PROT_READ | PROT_WRITE
+      0x62, 0x00, 0x80, 0xD2,
+      // MOV x8, 226 (mprotect)
+      0x48, 0x1C, 0x80, 0xD2,
+      // SVC 0
+      0x01, 0x00, 0x00, 0xD4,
+      // CBZ x0, "over the next branch"
+      0x40, 0x00, 0x00, 0xB4,
+    });
+  mem.EmitCode(__ B(BranchOffset(mem, fail)));
+  LoadImmediate64(mem, R::X1, heap.guard + heap.origin);
+  mem.EmitCode(__ ADD(R::X0, R::X19, R::X1));
+  mem.EmitCodeListing({
+      // The ExecState lives on the stack
+      // SUB sp, sp, 32
+      0xFF, 0x83, 0x00, 0xD1,
+      // STR x0, [sp]
+      0xE0, 0x03, 0x00, 0xF9,
+      // STP xzr, xzr, [sp, 8]
+      0xFF, 0xFF, 0x00, 0xA9,
+      // STR xzr, [sp, 24]
+      0xFF, 0x0F, 0x00, 0xF9,
+      // MOV x0, sp
+      0xE0, 0x03, 0x00, 0x91,
+      // BL "the program behind the runtime"
+      0x05, 0x00, 0x00, 0x94,
+    });
+  mem.EmitCode(__ BL(BranchOffset(mem, flush)));
+  mem.EmitCodeListing({
+      // MOV x0, 0
+      0x00, 0x00, 0x80, 0xD2,
+      // MOV x8, 94 (exit_group)
+      0xC8, 0x0B, 0x80, 0xD2,
+      // SVC 0
+      0x01, 0x00, 0x00, 0xD4,
+    });
+  // clang-format on
+}
+
+void PatchStandaloneData(CodeArea &mem, const StandaloneRuntime &runtime, uint8_t *data) {
+  // The data segment starts at a page, the code keeps its page offset
+  ASSERT(((uintptr_t) data & 0xFFF) == 0, "check");
+  for (uint8_t *ref : runtime.data_refs) {
+    const intptr_t pages = ((intptr_t) data >> 12) - ((intptr_t) ref >> 12);
+    mem.PatchCode(ref, __ ADRP(R::X9, (int32_t) pages));
+  }
+}
+
+void EmitStandaloneEntry(CodeArea &mem, const StandaloneRuntime &runtime) {
+  EmitFrame(mem);
+  mem.EmitCode(__ ADR(R_WRITE, (int32_t) (runtime.write - mem.CurrentWriteAddr())));
+  mem.EmitCode(__ ADR(R_READ, (int32_t) (runtime.read - mem.CurrentWriteAddr())));
+}
+
+void EmitStandaloneRead(CodeArea &mem, const StandaloneRuntime &, EOFMode eof_mode) {
+  EmitRead(mem, eof_mode);
+}
+
+void EmitStandaloneWrite(CodeArea &mem, const StandaloneRuntime &) {
+  EmitWrite(mem);
+}
+
 #endif
@@ -3,6 +3,8 @@
 #include "platform.h"
 
 #if defined(IS_X86_64)
+#include <cstring>
+
 #include "debug.h"
 #include "error.h"
 
@@ -22,6 +24,11 @@
    Frame pointer: rbp
    Stack pointer: rsp
 
+   ==== Internal ====
+
+   rdx: cell pointer
+   r12: loop counter of counted loops, callee saved
+
    The ABI defines a shadow spaces on the stack, which is a region
    right above the return address on the stack which is owned by the
    called function and can be used to either store function parameters
@@ -30,7 +37,13 @@
    can use it.
  */
 
-void EmitEntry(CodeArea &mem) {
+void Relocate(uint8_t *address, RuntimeFunction function) {
+  // The immediate of MOV rax, addr
+  const uintptr_t addr = RuntimeFunction::READ == function ? (uintptr_t) bf_read : (uintptr_t) bf_write;
+  std::memcpy(address, &addr, sizeof(addr));
+}
+
+void EmitEntry(CodeArea &mem, Relocations *) {
   // clang-format off
   // Just to be save, push ALL registers
   mem.EmitCodeListing({
@@ -50,33 +63,64 @@ void EmitEntry(CodeArea &mem) {
       0x52,        // PUSH rdx
       0x51,        // PUSH rcx
       0x50,        // PUSH rax
-      // rdx is used to hold the pointer to the current cell
-      // move the argument
+      // load the cell pointer and the loop counter from the ExecState
 #if defined(IS_WINDOWS)
-      // MOV rdx, rcx
-      0x48, 0x89, 0xCA,
+      // MOV rdx, [rcx]
+      0x48, 0x8B, 0x11,
+      // MOV r12, [rcx+8]
+      0x4C, 0x8B, 0x61, 0x08,
 #endif
 #if defined(IS_LINUX)
-      // MOV rdx, rdi
-      0x48, 0x89, 0xFA,
+      // MOV rdx, [rdi]
+      0x48, 0x8B, 0x17,
+      // MOV r12, [rdi+8]
+      0x4C, 0x8B, 0x67, 0x08,
 #endif
       // set the frame pointer for later use
       // MOV rbp, rsp
       0x48, 0x89, 0xE5,
       // allocate some space on the stack for saving rdx across
-      // calls and for windows shadow space
-      // SUB rsp, 80
-      0x48, 0x83, 0xEC, 0x50,
+      // calls and for windows shadow space, which also aligns the
+      // stack to 16 bytes for calls
+      // SUB rsp, 88
+      0x48, 0x83, 0xEC, 0x58,
     });
   // clang-format on
 }
 
-void EmitExit(CodeArea &mem) {
+void EmitExit(CodeArea &mem, Operation *resume, uintptr_t exit) {
   // clang-format off
   mem.EmitCodeListing({
+      // the ExecState is the saved argument register
+#if defined(IS_WINDOWS)
+      // MOV rax, [rbp+8]
+      0x48, 0x8B, 0x45, 0x08,
+#endif
+#if defined(IS_LINUX)
+      // MOV rax, [rbp+48]
+      0x48, 0x8B, 0x45, 0x30,
+#endif
+      // MOV [rax], rdx
+      0x48, 0x89, 0x10,
+      // MOV [rax+8], r12
+      0x4C, 0x89, 0x60, 0x08,
+      // MOV rcx, resume
+      0x48, 0xB9,
+    });
+  mem.EmitCode64((uintptr_t) resume);
+  mem.EmitCodeListing({
+      // MOV [rax+16], rcx
+      0x48, 0x89, 0x48, 0x10,
+      // MOV rcx, exit
+      0x48, 0xB9,
+    });
+  mem.EmitCode64(exit);
+  mem.EmitCodeListing({
+      // MOV [rax+24], rcx
+      0x48, 0x89, 0x48, 0x18,
       // Adjust the stack pointer back
-      // ADD rsp, 80
-      0x48, 0x83, 0xC4, 0x50,
+      // ADD rsp, 88
+      0x48, 0x83, 0xC4, 0x58,
       // pop all saved registers
       0x58,        // POP rax
       0x59,        // POP rcx
@@ -104,6 +148,43 @@ void EmitNop(CodeArea &mem) {
   mem.EmitCodeListing({0x90, 0x90, 0x90, 0x90});
 }
 
+void EmitAlign(CodeArea &mem, size_t alignment) {
+  size_t padding = (alignment - ((uintptr_t) mem.CurrentWriteAddr() & (alignment - 1))) & (alignment - 1);
+  // Multi-byte NOPs recommended by the optimization manuals
+  while (padding >= 9) {
+    mem.EmitCodeListing({0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00});
+    padding -= 9;
+  }
+  switch (padding) {
+  case 8:
+    mem.EmitCodeListing({0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00});
+    break;
+  case 7:
+    mem.EmitCodeListing({0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00});
+    break;
+  case 6:
+    mem.EmitCodeListing({0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00});
+    break;
+  case 5:
+    mem.EmitCodeListing({0x0F, 0x1F, 0x44, 0x00, 0x00});
+    break;
+  case 4:
+    mem.EmitCodeListing({0x0F, 0x1F, 0x40, 0x00});
+    break;
+  case 3:
+    mem.EmitCodeListing({0x0F, 0x1F, 0x00});
+    break;
+  case 2:
+    mem.EmitCodeListing({0x66, 0x90});
+    break;
+  case 1:
+    mem.EmitCodeListing({0x90});
+    break;
+  default:
+    break;
+  }
+}
+
 void EmitIncrCell(CodeArea &mem, uint8_t amount, intptr_t offset) {
   if (0 == offset) {
     // ADD byte[rdx], amount
@@ -134,40 +215,34 @@ void EmitDecrCell(CodeArea &mem, uint8_t amount, intptr_t offset) {
   }
 }
 
-void EmitImullCell(CodeArea &mem, uint8_t amount, intptr_t offset) {
-  GUARANTEE(offset != 0, "Imull with offset %zd", offset);
-  if (1 == amount) {
-    // MOV al, byte[rdx]
-    mem.EmitCodeListing({0x8A, 0x02});
-  } else {
-    // rdx needs to be saved, sinc MUL overwrites it
-    // MOV r8, rdx
-    mem.EmitCodeListing({0x49, 0x89, 0xD0});
-    // MOV rax, amount
-    mem.EmitCodeListing({0x48, 0xC7, 0xC0});
-    mem.EmitCode((uint32_t) amount);
-    // MOV bl, byte[rdx]
-    mem.EmitCodeListing({0x8A, 0x1A});
-    // MUL rbx
-    mem.EmitCodeListing({0x48, 0xF7, 0xE3});
-    // MOV rdx, r8
-    mem.EmitCodeListing({0x4C, 0x89, 0xC2});
-  }
-  if (128 > offset && -128 < offset) {
-    // ADD byte[rdx+offset], al
-    mem.EmitCodeListing({0x00, 0x42, (uint8_t) offset});
+/**
+ * Emits the ModRM byte and the displacement for the memory operand
+ * byte[rdx+offset].  reg is the register or the opcode extension.
+ */
+static void EmitCellOperand(CodeArea &mem, uint8_t reg, intptr_t offset) {
+  GUARANTEE(offset <= (intptr_t) INT32_MAX && offset >= (intptr_t) INT32_MIN, "Offset too large: %zd", offset);
+  const uint8_t r = (uint8_t) (reg << 3);
+  if (0 == offset) {
+    // [rdx]
+    mem.EmitCodeListing({(uint8_t) (0x02 | r)});
+  } else if (128 > offset && -128 < offset) {
+    // [rdx+disp8]
+    mem.EmitCodeListing({(uint8_t) (0x42 | r), (uint8_t) offset});
   } else {
-    // ADD byte[rdx+offset], al
-    mem.EmitCodeListing({0x00, 0x82});
+    // [rdx+disp32]
+    mem.EmitCodeListing({(uint8_t) (0x82 | r)});
     mem.EmitCode((uint32_t) offset);
   }
 }
 
-void EmitDmullCell(CodeArea &mem, uint8_t amount, intptr_t offset) {
-  GUARANTEE(offset != 0, "Imull with offset %zd", offset);
+/**
+ * Loads amount times the cell at source into al.
+ */
+static void EmitLoadProduct(CodeArea &mem, uint8_t amount, intptr_t source) {
   if (1 == amount) {
-    // MOV al, byte[rdx]
-    mem.EmitCodeListing({0x8A, 0x02});
+    // MOV al, byte[rdx+source]
+    mem.EmitCodeListing({0x8A});
+    EmitCellOperand(mem, 0, source);
   } else {
     // rdx needs to be saved, sinc MUL overwrites it
     // MOV r8, rdx
@@ -175,21 +250,30 @@ void EmitDmullCell(CodeArea &mem, uint8_t amount, intptr_t offset) {
     // MOV rax, amount
     mem.EmitCodeListing({0x48, 0xC7, 0xC0});
     mem.EmitCode((uint32_t) amount);
-    // MOV bl, byte[rdx]
-    mem.EmitCodeListing({0x8A, 0x1A});
+    // MOV bl, byte[rdx+source]
+    mem.EmitCodeListing({0x8A});
+    EmitCellOperand(mem, 3, source);
     // MUL rbx
     mem.EmitCodeListing({0x48, 0xF7, 0xE3});
     // MOV rdx, r8
     mem.EmitCodeListing({0x4C, 0x89, 0xC2});
   }
-  if (128 > offset && -128 < offset) {
-    // SUB byte[rdx+offset], al
-    mem.EmitCodeListing({0x28, 0x42, (uint8_t) offset});
-  } else {
-    // SUB byte[rdx+offset], al
-    mem.EmitCodeListing({0x28, 0x82});
-    mem.EmitCode((uint32_t) offset);
-  }
+}
+
+void EmitImullCell(CodeArea &mem, uint8_t amount, intptr_t offset, intptr_t source) {
+  GUARANTEE(offset != source, "Imull with offset %zd", offset);
+  EmitLoadProduct(mem, amount, source);
+  // ADD byte[rdx+offset], al
+  mem.EmitCodeListing({0x00});
+  EmitCellOperand(mem, 0, offset);
+}
+
+void EmitDmullCell(CodeArea &mem, uint8_t amount, intptr_t offset, intptr_t source) {
+  GUARANTEE(offset != source, "Dmull with offset %zd", offset);
+  EmitLoadProduct(mem, amount, source);
+  // SUB byte[rdx+offset], al
+  mem.EmitCodeListing({0x28});
+  EmitCellOperand(mem, 0, offset);
 }
 
 void EmitSetCell(CodeArea &mem, uint8_t amount, intptr_t offset) {
@@ -229,7 +313,7 @@ void EmitDecrPtr(CodeArea &mem, intptr_t amount) {
   }
 }
 
-void EmitRead(CodeArea &mem, EOFMode eof_mode) {
+void EmitRead(CodeArea &mem, EOFMode eof_mode, Relocations *relocations) {
   uintptr_t addr = (uintptr_t) bf_read;
   mem.EmitCodeListing({
       // Save rdx
@@ -242,6 +326,9 @@ void EmitRead(CodeArea &mem, EOFMode eof_mode) {
       0x48,
       0xB8,
   });
+  if (nullptr != relocations) {
+    relocations->push_back(Relocation{.address = mem.CurrentWriteAddr(), .function = RuntimeFunction::READ});
+  }
   mem.EmitCode64(addr);
   mem.EmitCodeListing({
 #if defined(IS_WINDOWS)
@@ -275,7 +362,7 @@ void EmitRead(CodeArea &mem, EOFMode eof_mode) {
   });
 }
 
-void EmitWrite(CodeArea &mem) {
+void EmitWrite(CodeArea &mem, Relocations *relocations) {
   uintptr_t addr = (uintptr_t) bf_write;
   mem.EmitCodeListing({
       // Save rdx
@@ -288,6 +375,9 @@ void EmitWrite(CodeArea &mem) {
       0x48,
       0xB8,
   });
+  if (nullptr != relocations) {
+    relocations->push_back(Relocation{.address = mem.CurrentWriteAddr(), .function = RuntimeFunction::WRITE});
+  }
   mem.EmitCode64(addr);
   mem.EmitCodeListing({
 #if defined(IS_WINDOWS)
@@ -314,11 +404,11 @@ void EmitWrite(CodeArea &mem) {
   });
 }
 
-void EmitJumpZero(CodeArea &mem) {
-  mem.EmitCodeListing({// CMP byte[rdx], 0
-                       0x80,
-                       0x3A,
-                       0x00,
+void EmitJumpZero(CodeArea &mem, intptr_t offset) {
+  // CMP byte[rdx+offset], 0
+  mem.EmitCodeListing({0x80});
+  EmitCellOperand(mem, 7, offset);
+  mem.EmitCodeListing({0x00,
                        // JZ
                        0x0F,
                        0x84,
@@ -337,11 +427,11 @@ void PatchJumpZero(CodeArea &mem, uint8_t *position, uintptr_t offset) {
   mem.PatchCode(position - 4, offset32);
 }
 
-void EmitJumpNonZero(CodeArea &mem) {
-  mem.EmitCodeListing({// CMP byte[rdx], 0
-                       0x80,
-                       0x3A,
-                       0x00,
+void EmitJumpNonZero(CodeArea &mem, intptr_t offset) {
+  // CMP byte[rdx+offset], 0
+  mem.EmitCodeListing({0x80});
+  EmitCellOperand(mem, 7, offset);
+  mem.EmitCodeListing({0x00,
                        // JNZ
                        0x0F,
                        0x85,
@@ -360,6 +450,90 @@ void PatchJumpNonZero(CodeArea &mem, uint8_t *position, uintptr_t offset) {
   mem.PatchCode(position - 4, offset32);
 }
 
+void EmitJumpNotEqual(CodeArea &mem, intptr_t offset, uint8_t value) {
+  // CMP byte[rdx+offset], value
+  mem.EmitCodeListing({0x80});
+  EmitCellOperand(mem, 7, offset);
+  mem.EmitCodeListing({value,
+                       // JNE
+                       0x0F,
+                       0x85,
+                       // Jump will be patched later
+                       0x00,
+                       0x00,
+                       0x00,
+                       0x00});
+}
+
+void PatchJumpNotEqual(CodeArea &mem, uint8_t *position, uintptr_t offset) {
+  PatchJumpNonZero(mem, position, offset);
+}
+
+void EmitJump(CodeArea &mem) {
+  // JMP, will be patched later
+  mem.EmitCodeListing({0xE9, 0x00, 0x00, 0x00, 0x00});
+}
+
+void PatchJump(CodeArea &mem, uint8_t *position, uintptr_t offset) {
+  PatchJumpNonZero(mem, position, offset);
+}
+
+void EmitCallAndJump(CodeArea &mem, uintptr_t function, uintptr_t argument) {
+  // clang-format off
+  mem.EmitCodeListing({
+      // Save rdx
+      // MOV [rbp], rdx
+      0x48, 0x89, 0x55, 0x00,
+#if defined(IS_WINDOWS)
+      // MOV rcx, argument
+      0x48, 0xB9,
+#endif
+#if defined(IS_LINUX)
+      // MOV rdi, argument
+      0x48, 0xBF,
+#endif
+  });
+  mem.EmitCode64(argument);
+  // MOV rax, function
+  mem.EmitCodeListing({0x48, 0xB8});
+  mem.EmitCode64(function);
+  mem.EmitCodeListing({
+      // CALL rax
+      0xFF, 0xD0,
+      // restore rdx
+      // MOV rdx, [rbp]
+      0x48, 0x8B, 0x55, 0x00,
+      // JMP rax
+      0xFF, 0xE0,
+  });
+  // clang-format on
+}
+
+void EmitSetLoopCounter(CodeArea &mem, uint32_t count) {
+  // MOV r12d, count
+  mem.EmitCodeListing({0x41, 0xBC});
+  mem.EmitCode(count);
+}
+
+void EmitLoopCounterJump(CodeArea &mem) {
+  mem.EmitCodeListing({// DEC r12
+                       0x49,
+                       0xFF,
+                       0xCC,
+                       // JNZ
+                       0x0F,
+                       0x85,
+                       // Jump will be patched later
+                       0x00,
+                       0x00,
+                       0x00,
+                       0x00});
+}
+
+void PatchLoopCounterJump(CodeArea &mem, uint8_t *position, uintptr_t offset) {
+  PatchJumpNonZero(mem, position, offset);
+}
+
 void EmitFindCellHigh(CodeArea &mem, uint8_t value, uintptr_t move_size) {
   GUARANTEE(move_size < (uintptr_t) UINT32_MAX, "move_size too large: %zu", move_size);
   mem.EmitCodeListing({
@@ -400,4 +574,384 @@ void EmitFindCellLow(CodeArea &mem, uint8_t value, uintptr_t move_size) {
   mem.EmitCodeListing({0xEB, 0xF2});
 }
 
+void EmitCountUp(CodeArea &mem, uint64_t *counter) {
+  // MOV rax, counter
+  mem.EmitCodeListing({0x48, 0xB8});
+  mem.EmitCode64((uintptr_t) counter);
+  // INC qword[rax]
+  mem.EmitCodeListing({0x48, 0xFF, 0x00});
+}
+
+/**
+ * Loads the time stamp counter into rax, rdx keeps the cell pointer.
+ */
+static void EmitReadClock(CodeArea &mem) {
+  // clang-format off
+  mem.EmitCodeListing({
+      // MOV rcx, rdx
+      0x48, 0x89, 0xD1,
+      // RDTSC
+      0x0F, 0x31,
+      // SHL rdx, 32
+      0x48, 0xC1, 0xE2, 0x20,
+      // OR rax, rdx
+      0x48, 0x09, 0xD0,
+      // MOV rdx, rcx
+      0x48, 0x89, 0xCA,
+  });
+  // clang-format on
+}
+
+void EmitStartClock(CodeArea &mem, uint64_t *start) {
+  EmitReadClock(mem);
+  // MOV rcx, start
+  mem.EmitCodeListing({0x48, 0xB9});
+  mem.EmitCode64((uintptr_t) start);
+  // MOV [rcx], rax
+  mem.EmitCodeListing({0x48, 0x89, 0x01});
+}
+
+void EmitStopClock(CodeArea &mem, uint64_t *start, uint64_t *total) {
+  EmitReadClock(mem);
+  // MOV rcx, start
+  mem.EmitCodeListing({0x48, 0xB9});
+  mem.EmitCode64((uintptr_t) start);
+  // SUB rax, [rcx]
+  mem.EmitCodeListing({0x48, 0x2B, 0x01});
+  // MOV rcx, total
+  mem.EmitCodeListing({0x48, 0xB9});
+  mem.EmitCode64((uintptr_t) total);
+  // ADD [rcx], rax
+  mem.EmitCodeListing({0x48, 0x01, 0x01});
+}
+
+/**
+ * Emits the 32-bit displacement from the end of the displacement to the
+ * target, which ends jumps and calls.
+ */
+static void EmitRelative(CodeArea &mem, const uint8_t *target) {
+  mem.EmitCode((uint32_t) (int32_t) (target - (mem.CurrentWriteAddr() + 4)));
+}
+
+/**
+ * Loads the address of the data segment into r8.
+ */
+static void EmitDataAddress(CodeArea &mem, StandaloneRuntime &runtime) {
+  // LEA r8, [rip+data]
+  mem.EmitCodeListing({0x4C, 0x8D, 0x05});
+  runtime.data_refs.push_back(mem.CurrentWriteAddr());
+  mem.EmitCode(0);
+}
+
+/* Data segment of standalone executables
+
+   0:    output buffer, 4096 bytes
+   4096: input buffer, 4096 bytes
+   8192: bytes in the output buffer
+   8200: bytes in the input buffer
+   8208: bytes of the input buffer which were read
+   8216: set once the input ended
+
+   The routines of the runtime take their arguments like bf_read and
+   bf_write, and only change volatile registers.
+ */
+
+void EmitStandaloneRuntime(CodeArea &mem, StandaloneRuntime &runtime, const StandaloneHeap &heap) {
+  // The jumps between the routines rely on their order and size
+  // clang-format off
+  uint8_t *fail = mem.CurrentWriteAddr();
+  mem.EmitCodeListing({
+      // MOV edi, 1
+      0xBF, 0x01, 0x00, 0x00, 0x00,
+      // MOV eax, 231 (exit_group)
+      0xB8, 0xE7, 0x00, 0x00, 0x00,
+      // SYSCALL
+      0x0F, 0x05,
+    });
+  // Writes the output buffer
+  uint8_t *flush = mem.CurrentWriteAddr();
+  EmitDataAddress(mem, runtime);
+  mem.EmitCodeListing({
+      // XOR r9d, r9d
+      0x45, 0x31, 0xC9,
+      // MOV rdx, [r8+8192]
+      0x49, 0x8B, 0x90, 0x00, 0x20, 0x00, 0x00,
+      // SUB rdx, r9
+      0x4C, 0x29, 0xCA,
+      // JLE "to the end"
+      0x7E, 0x1A,
+      // LEA rsi, [r8+r9]
+      0x4B, 0x8D, 0x34, 0x08,
+      // MOV edi, 1
+      0xBF, 0x01, 0x00, 0x00, 0x00,
+      // MOV eax, 1 (write)
+      0xB8, 0x01, 0x00, 0x00, 0x00,
+      // SYSCALL
+      0x0F, 0x05,
+      // TEST rax, rax
+      0x48, 0x85, 0xC0,
+      // JLE fail
+      0x7E, 0xC9,
+      // ADD r9, rax
+      0x49, 0x01, 0xC1,
+      // JMP "back to MOV rdx"
+      0xEB, 0xDA,
+      // MOV qword[r8+8192], 0
+      0x49, 0xC7, 0x80, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      // RET
+      0xC3,
+    });
+  runtime.write = mem.CurrentWriteAddr();
+  // MOVZX eax, byte[rdi]
+  mem.EmitCodeListing({0x0F, 0xB6, 0x07});
+  EmitDataAddress(mem, runtime);
+  mem.EmitCodeListing({
+      // MOV rcx, [r8+8192]
+      0x49, 0x8B, 0x88, 0x00, 0x20, 0x00, 0x00,
+      // MOV [r8+rcx], al
+      0x41, 0x88, 0x04, 0x08,
+      // INC rcx
+      0x48, 0xFF, 0xC1,
+      // MOV [r8+8192], rcx
+      0x49, 0x89, 0x88, 0x00, 0x20, 0x00, 0x00,
+      // CMP rcx, 4096
+      0x48, 0x81, 0xF9, 0x00, 0x10, 0x00, 0x00,
+      // JE flush
+      0x74, 0x9C,
+      // RET
+      0xC3,
+    });
+  runtime.read = mem.CurrentWriteAddr();
+  mem.EmitCodeListing({
+      // PUSH rdi
+      0x57,
+      // PUSH rsi
+      0x56,
+      // CALL flush
+      0xE8,
+    });
+  EmitRelative(mem, flush);
+  mem.EmitCodeListing({
+      // POP rsi
+      0x5E,
+      // POP rdi
+      0x5F,
+    });
+  EmitDataAddress(mem, runtime);
+  mem.EmitCodeListing({
+      // MOV rcx, [r8+8208]
+      0x49, 0x8B, 0x88, 0x10, 0x20, 0x00, 0x00,
+      // CMP rcx, [r8+8200]
+      0x49, 0x3B, 0x88, 0x08, 0x20, 0x00, 0x00,
+      // JB "to MOVZX"
+      0x72, 0x2E,
+      // CMP qword[r8+8216], 0
+      0x49, 0x83, 0xB8, 0x18, 0x20, 0x00, 0x00, 0x00,
+      // JNE "to CMP esi, 1"
+      0x75, 0x45,
+      // PUSH rdi
+      0x57,
+      // PUSH rsi
+      0x56,
+      // XOR edi, edi
+      0x31, 0xFF,
+      // LEA rsi, [r8+4096]
+      0x49, 0x8D, 0xB0, 0x00, 0x10, 0x00, 0x00,
+      // MOV edx, 4096
+      0xBA, 0x00, 0x10, 0x00, 0x00,
+      // XOR eax, eax (read)
+      0x31, 0xC0,
+      // SYSCALL
+      0x0F, 0x05,
+      // POP rsi
+      0x5E,
+      // POP rdi
+      0x5F,
+      // TEST rax, rax
+      0x48, 0x85, 0xC0,
+      // JLE "to the end of the input"
+      0x7E, 0x1F,
+      // MOV [r8+8200], rax
+      0x49, 0x89, 0x80, 0x08, 0x20, 0x00, 0x00,
+      // XOR ecx, ecx
+      0x31, 0xC9,
+      // MOVZX eax, byte[r8+rcx+4096]
+      0x41, 0x0F, 0xB6, 0x84, 0x08, 0x00, 0x10, 0x00, 0x00,
+      // INC rcx
+      0x48, 0xFF, 0xC1,
+      // MOV [r8+8208], rcx
+      0x49, 0x89, 0x88, 0x10, 0x20, 0x00, 0x00,
+      // MOV [rdi], al
+      0x88, 0x07,
+      // RET
+      0xC3,
+      // MOV qword[r8+8216], 1
+      0x49, 0xC7, 0x80, 0x18, 0x20, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+      // CMP esi, 1 (KEEP)
+      0x83, 0xFE, 0x01,
+      // JE "to the last RET"
+      0x74, 0x0C,
+      // CMP esi, 2 (ZERO)
+      0x83, 0xFE, 0x02,
+      // JNE "to NEG_ONE"
+      0x75, 0x04,
+      // MOV byte[rdi], 0
+      0xC6, 0x07, 0x00,
+      // RET
+      0xC3,
+      // MOV byte[rdi], 255
+      0xC6, 0x07, 0xFF,
+      // RET
+      0xC3,
+    });
+  runtime.start = mem.CurrentWriteAddr();
+  mem.EmitCodeListing({
+      // MOV eax, 9 (mmap)
+      0xB8, 0x09, 0x00, 0x00, 0x00,
+      // XOR edi, edi
+      0x31, 0xFF,
+      // MOV rsi, size
+      0x48, 0xBE,
+    });
+  mem.EmitCode64(heap.size + 2 * heap.guard);
+  mem.EmitCodeListing({
+      // XOR edx, edx (PROT_NONE)
+      0x31, 0xD2,
+      // MOV r10d, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+      0x41, 0xBA, 0x22, 0x40, 0x00, 0x00,
+      // MOV r8, -1
+      0x49, 0xC7, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF,
+      // XOR r9d, r9d
+      0x45, 0x31, 0xC9,
+      // SYSCALL
+      0x0F, 0x05,
+      // CMP rax, -4095
+      0x48, 0x3D, 0x01, 0xF0, 0xFF, 0xFF,
+      // JAE fail
+      0x0F, 0x83,
+    });
+  EmitRelative(mem, fail);
+  mem.EmitCodeListing({
+      // MOV rbx, rax
+      0x48, 0x89, 0xC3,
+      // MOV eax, 10 (mprotect)
+      0xB8, 0x0A, 0x00, 0x00, 0x00,
+      // MOV rdi, guard
+      0x48, 0xBF,
+    });
+  mem.EmitCode64(heap.guard);
+  mem.EmitCodeListing({
+      // ADD rdi, rbx
+      0x48, 0x01, 0xDF,
+      // MOV rsi, size
+      0x48, 0xBE,
+    });
+  mem.EmitCode64(heap.size);
+  mem.EmitCodeListing({
+      // MOV edx, PROT_READ | PROT_WRITE
+      0xBA, 0x03, 0x00, 0x00, 0x00,
+      // SYSCALL
+      0x0F, 0x05,
+      // TEST rax, rax
+      0x48, 0x85, 0xC0,
+      // JNE fail
+      0x0F, 0x85,
+    });
+  EmitRelative(mem, fail);
+  mem.EmitCodeListing({
+      // MOV rax, guard + origin
+      0x48, 0xB8,
+    });
+  mem.EmitCode64(heap.guard + heap.origin);
+  mem.EmitCodeListing({
+      // ADD rax, rbx
+      0x48, 0x01, 0xD8,
+      // The ExecState lives on the stack
+      // SUB rsp, 32
+      0x48, 0x83, 0xEC, 0x20,
+      // MOV [rsp], rax
+      0x48, 0x89, 0x04, 0x24,
+      // XOR eax, eax
+      0x31, 0xC0,
+      // MOV [rsp+8], rax
+      0x48, 0x89, 0x44, 0x24, 0x08,
+      // MOV [rsp+16], rax
+      0x48, 0x89, 0x44, 0x24, 0x10,
+      // MOV [rsp+24], rax
+      0x48, 0x89, 0x44, 0x24, 0x18,
+      // Pass the ExecState for both calling conventions
+      // MOV rdi, rsp
+      0x48, 0x89, 0xE7,
+      // MOV rcx, rsp
+      0x48, 0x89, 0xE1,
+      // CALL "the program behind the runtime"
+      0xE8, 0x0E, 0x00, 0x00, 0x00,
+      // CALL flush
+      0xE8,
+    });
+  EmitRelative(mem, flush);
+  mem.EmitCodeListing({
+      // XOR edi, edi
+      0x31, 0xFF,
+      // MOV eax, 231 (exit_group)
+      0xB8, 0xE7, 0x00, 0x00, 0x00,
+      // SYSCALL
+      0x0F, 0x05,
+    });
+  // clang-format on
+}
+
+void PatchStandaloneData(CodeArea &mem, const StandaloneRuntime &runtime, uint8_t *data) {
+  for (uint8_t *ref : runtime.data_refs) {
+    mem.PatchCode(ref, (uint32_t) (int32_t) (data - (ref + 4)));
+  }
+}
+
+void EmitStandaloneEntry(CodeArea &mem, const StandaloneRuntime &) {
+  EmitEntry(mem);
+}
+
+void EmitStandaloneRead(CodeArea &mem, const StandaloneRuntime &runtime, EOFMode eof_mode) {
+  // clang-format off
+  mem.EmitCodeListing({
+      // Save rdx
+      // MOV [rbp], rdx
+      0x48, 0x89, 0x55, 0x00,
+      // MOV rdi, rdx
+      0x48, 0x89, 0xD7,
+      // MOV esi, eof_mode
+      0xBE,
+    });
+  mem.EmitCode((uint32_t) eof_mode);
+  // CALL read
+  mem.EmitCodeListing({0xE8});
+  EmitRelative(mem, runtime.read);
+  mem.EmitCodeListing({
+      // restore rdx
+      // MOV rdx, [rbp]
+      0x48, 0x8B, 0x55, 0x00,
+    });
+  // clang-format on
+}
+
+void EmitStandaloneWrite(CodeArea &mem, const StandaloneRuntime &runtime) {
+  // clang-format off
+  mem.EmitCodeListing({
+      // Save rdx
+      // MOV [rbp], rdx
+      0x48, 0x89, 0x55, 0x00,
+      // MOV rdi, rdx
+      0x48, 0x89, 0xD7,
+      // CALL write
+      0xE8,
+    });
+  EmitRelative(mem, runtime.write);
+  mem.EmitCodeListing({
+      // restore rdx
+      // MOV rdx, [rbp]
+      0x48, 0x8B, 0x55, 0x00,
+    });
+  // clang-format on
+}
+
 #endif
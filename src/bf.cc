@@ -1,42 +1,104 @@
 // SPDX-License-Identifier: MIT License
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
+#include "code_cache.h"
 #include "compiler.h"
 #include "debug.h"
+#include "emit_asm.h"
+#include "emit_c.h"
 #include "error.h"
+#include "executable.h"
 #include "instr.h"
 #include "interp.h"
 #include "mem.h"
 #include "optimize.h"
 #include "parse.h"
+#include "perf.h"
 #include "platform.h"
+#include "profile.h"
+#include "serialize.h"
+#include "tape_bounds.h"
+#include "trace.h"
+#include "tune.h"
 
 enum class ExecMode {
   INTERPRETER = 'i',
   COMPILER = 'c',
+  TIERED = 't',
+  TRACE = 'r',
 };
 
+// Number of candidate pipelines measured by the autotuner
+static const unsigned int DEFAULT_TUNE_BUDGET = 100;
+
 static struct {
   std::string input_file_path{""};
-  size_t heap_size = DEFAULT_HEAP_SIZE;
+  // Derived from the tape bounds of the program, if not given
+  std::optional<size_t> heap_size{};
   ExecMode execution_mode = ExecMode::COMPILER;
   OptimizerLevel optimization_level = OptimizerLevel::O2;
+  unsigned int optimization_iterations = 1;
+  unsigned int optimization_jobs = 1;
+  std::string pipeline_file_path{""};
+  std::string tune_file_path{""};
+  unsigned int tune_budget = DEFAULT_TUNE_BUDGET;
+  // The default depends on the execution mode
+  std::optional<uint64_t> tier_up_iterations{};
+  bool lazy = false;
+  std::string profile_generate_path{""};
+  std::string profile_use_path{""};
+  // Report the loops of the run by their share of the run time
+  bool profile = false;
+  std::string output_path{""};
+  std::string cache_path{""};
+  std::string ir_output_path{""};
+  std::string c_output_path{""};
+  std::string asm_output_path{""};
+  // PerfLog::Output values
+  unsigned int perf_outputs = 0;
   EOFMode eof_mode = EOFMode::KEEP;
 } args;
 
 static void usage(void) {
-  fprintf(stderr, "Usage: %s [-h] [-O(0|1|2|3)] [-mMEMORY_SIZE] [(-i|-c)] [-e(keep|0|-1)]PROGRAM\n", program_name);
+  fprintf(stderr,
+          "Usage: %s [-h] [-O(0|1|2|3)] [-f[N]] [-jN] [-mMEMORY_SIZE] [(-i|-c|-t|-r)] [--lazy] [-e(keep|0|-1)] "
+          "[--pipeline=FILE] [--tune=FILE] [--profile-generate=FILE] [--profile-use=FILE] [--profile] [-o FILE] "
+          "[--cache=DIR] [--emit-ir=FILE] [--emit-c=FILE] [--emit-asm=FILE] "
+          "[--perf=(map|jitdump)] PROGRAM\n",
+          program_name);
   fprintf(stderr, "\n");
   fprintf(stderr, "Options:\n");
   fprintf(stderr, "  -O, --optimize=  Set the optimization level to 0, 1, 2, or 3\n");
+  fprintf(stderr, "  -f, --fixpoint=  Repeat the optimizer until nothing changes, at most N times\n");
+  fprintf(stderr, "  -j, --jobs=      Optimize large programs with N threads\n");
   fprintf(stderr, "  -m, --memory=    Set the heap memory size\n");
   fprintf(stderr, "  -i, --interp     Set the execution mode to: interpreter\n");
   fprintf(stderr, "  -c, --comp       Set the execution mode to: compiler\n");
+  fprintf(stderr, "  --lazy           Compile loops when they run for the first time\n");
+  fprintf(stderr, "  -t, --tiered     Set the execution mode to: interpreter, compile hot loops\n");
+  fprintf(stderr, "  -r, --trace      Set the execution mode to: interpreter, compile traces of hot loops\n");
+  fprintf(stderr, "  --tier-up=       Compile loops after N iterations in tiered and trace mode\n");
   fprintf(stderr, "  -e, --eof=       Set EOF to 'keep', '0', or '-1'\n");
+  fprintf(stderr, "  -o, --output=    Write a standalone executable to the file instead of running the program\n");
+  fprintf(stderr, "  --emit-ir=       Write the optimized program to the file, which runs in place of the source\n");
+  fprintf(stderr, "  --emit-c=        Write the optimized program to the file as C source\n");
+  fprintf(stderr, "  --emit-asm=      Write the compiled program to the file as GNU assembler source\n");
+  fprintf(stderr, "  --cache=         Keep the compiled code in the directory for the next run\n");
+  fprintf(stderr, "  --perf=          Describe the compiled code to perf with a 'map', a 'jitdump', or both\n");
+  fprintf(stderr, "  --pipeline=      Run the optimizer passes listed in the file\n");
+  fprintf(stderr, "  --tune=          Search the fastest pipeline for the input on stdin, write it to the file\n");
+  fprintf(stderr, "  --tune-budget=   Measure at most N candidate pipelines\n");
+  fprintf(stderr, "  --profile-generate=  Run with the interpreter and write the loop profile to the file\n");
+  fprintf(stderr, "  --profile-use=   Optimize and compile with the loop profile from the file\n");
+  fprintf(stderr, "  --profile        Report the entries, iterations and share of the run time of every loop\n");
   fprintf(stderr, "  -h, --help       Display this help message\n");
 }
 
@@ -48,6 +110,11 @@ static void parse_opts(int argc, char **argv) {
   std::string_view mem_size_string{""};
   std::string_view eof_mode_string{""};
   std::string_view dump_string{""};
+  std::string_view iterations_string{""};
+  std::string_view jobs_string{""};
+  std::string_view budget_string{""};
+  std::string_view tier_up_string{""};
+  std::string_view perf_string{""};
   while (argc--) {
     std::string_view this_arg(argv[0]);
     if (this_arg == "-h" || this_arg == "--help") {
@@ -63,6 +130,52 @@ static void parse_opts(int argc, char **argv) {
       if (opt_level == '\0' || this_arg.size() > 12 || opt_level < '0' || opt_level > '3') {
         Error("Invalid optimization level: %s", this_arg.data());
       }
+    } else if (this_arg == "-f" || this_arg == "--fixpoint") {
+      args.optimization_iterations = Optimizer::MAX_ITERATIONS;
+    } else if (this_arg.starts_with("-f")) {
+      iterations_string = this_arg.substr(2);
+    } else if (this_arg.starts_with("--fixpoint=")) {
+      iterations_string = this_arg.substr(11);
+    } else if (this_arg.starts_with("-j")) {
+      jobs_string = this_arg.substr(2);
+      if (jobs_string.empty()) {
+        Error("Invalid number of optimizer jobs: %s", this_arg.data());
+      }
+    } else if (this_arg.starts_with("--jobs=")) {
+      jobs_string = this_arg.substr(7);
+      if (jobs_string.empty()) {
+        Error("Invalid number of optimizer jobs: %s", this_arg.data());
+      }
+    } else if (this_arg.starts_with("--pipeline=")) {
+      args.pipeline_file_path = std::string(this_arg.substr(11));
+    } else if (this_arg.starts_with("--tune=")) {
+      args.tune_file_path = std::string(this_arg.substr(7));
+    } else if (this_arg.starts_with("--tune-budget=")) {
+      budget_string = this_arg.substr(14);
+    } else if (this_arg.starts_with("--profile-generate=")) {
+      args.profile_generate_path = std::string(this_arg.substr(19));
+    } else if (this_arg.starts_with("--profile-use=")) {
+      args.profile_use_path = std::string(this_arg.substr(14));
+    } else if (this_arg == "--profile") {
+      args.profile = true;
+    } else if (this_arg == "-o") {
+      if (0 == argc--) {
+        Error("Missing output file");
+      }
+      argv++;
+      args.output_path = std::string(argv[0]);
+    } else if (this_arg.starts_with("--output=")) {
+      args.output_path = std::string(this_arg.substr(9));
+    } else if (this_arg.starts_with("--emit-ir=")) {
+      args.ir_output_path = std::string(this_arg.substr(10));
+    } else if (this_arg.starts_with("--emit-c=")) {
+      args.c_output_path = std::string(this_arg.substr(9));
+    } else if (this_arg.starts_with("--emit-asm=")) {
+      args.asm_output_path = std::string(this_arg.substr(11));
+    } else if (this_arg.starts_with("--perf=")) {
+      perf_string = this_arg.substr(7);
+    } else if (this_arg.starts_with("--cache=")) {
+      args.cache_path = std::string(this_arg.substr(8));
     } else if (this_arg.starts_with("-m")) {
       mem_size_string = this_arg.substr(2);
     } else if (this_arg.starts_with("--memory=")) {
@@ -75,6 +188,14 @@ static void parse_opts(int argc, char **argv) {
       args.execution_mode = ExecMode::INTERPRETER;
     } else if (this_arg == "--comp" || this_arg == "-c") {
       args.execution_mode = ExecMode::COMPILER;
+    } else if (this_arg == "--lazy") {
+      args.lazy = true;
+    } else if (this_arg == "--tiered" || this_arg == "-t") {
+      args.execution_mode = ExecMode::TIERED;
+    } else if (this_arg == "--trace" || this_arg == "-r") {
+      args.execution_mode = ExecMode::TRACE;
+    } else if (this_arg.starts_with("--tier-up=")) {
+      tier_up_string = this_arg.substr(10);
     } else if (this_arg.starts_with("-e")) {
       eof_mode_string = this_arg.substr(2);
     } else if (this_arg.starts_with("--eof=")) {
@@ -97,6 +218,50 @@ static void parse_opts(int argc, char **argv) {
       args.heap_size = (size_t) result;
       mem_size_string = std::string_view{""};
     }
+    if (!iterations_string.empty()) {
+      char *end = NULL;
+      long result = 0;
+      errno = 0;
+      result = std::strtol(iterations_string.data(), &end, 10);
+      if (result < 1 || errno == ERANGE || NULL == end || *end != '\0') {
+        Error("Invalid number of optimizer iterations: %s", iterations_string.data());
+      }
+      args.optimization_iterations = (unsigned int) std::min(result, (long) Optimizer::MAX_ITERATIONS);
+      iterations_string = std::string_view{""};
+    }
+    if (!jobs_string.empty()) {
+      char *end = NULL;
+      long result = 0;
+      errno = 0;
+      result = std::strtol(jobs_string.data(), &end, 10);
+      if (result < 1 || errno == ERANGE || NULL == end || *end != '\0') {
+        Error("Invalid number of optimizer jobs: %s", jobs_string.data());
+      }
+      args.optimization_jobs = (unsigned int) std::min(result, (long) Optimizer::MAX_JOBS);
+      jobs_string = std::string_view{""};
+    }
+    if (!budget_string.empty()) {
+      char *end = NULL;
+      long result = 0;
+      errno = 0;
+      result = std::strtol(budget_string.data(), &end, 10);
+      if (result < 1 || errno == ERANGE || NULL == end || *end != '\0') {
+        Error("Invalid tuning budget: %s", budget_string.data());
+      }
+      args.tune_budget = (unsigned int) result;
+      budget_string = std::string_view{""};
+    }
+    if (!tier_up_string.empty()) {
+      char *end = NULL;
+      long long result = 0;
+      errno = 0;
+      result = std::strtoll(tier_up_string.data(), &end, 10);
+      if (result < 1 || errno == ERANGE || NULL == end || *end != '\0') {
+        Error("Invalid number of iterations: %s", tier_up_string.data());
+      }
+      args.tier_up_iterations = (uint64_t) result;
+      tier_up_string = std::string_view{""};
+    }
     if (!dump_string.empty()) {
       const size_t length = dump_string.size();
       size_t start = 0;
@@ -113,6 +278,17 @@ static void parse_opts(int argc, char **argv) {
       }
       dump_string = std::string_view{""};
     }
+    while (!perf_string.empty()) {
+      const std::string_view output = perf_string.substr(0, perf_string.find(','));
+      if ("map" == output) {
+        args.perf_outputs |= PerfLog::Output::MAP;
+      } else if ("jitdump" == output) {
+        args.perf_outputs |= PerfLog::Output::JITDUMP;
+      } else {
+        Error("Invalid perf output: %s", argv[0]);
+      }
+      perf_string.remove_prefix(std::min(perf_string.size(), output.size() + 1));
+    }
     if (!eof_mode_string.empty()) {
       if ("keep" == eof_mode_string) {
         args.eof_mode = EOFMode::KEEP;
@@ -147,42 +323,340 @@ static void parse_opts(int argc, char **argv) {
   if (args.input_file_path.empty()) {
     Error("No input file given");
   }
+  if (args.profile &&
+      (args.lazy || ExecMode::TIERED == args.execution_mode || ExecMode::TRACE == args.execution_mode)) {
+    Error("The profiler needs the interpreter or the compiler without --lazy");
+  }
+  if (0 != args.perf_outputs && (args.lazy || ExecMode::COMPILER != args.execution_mode)) {
+    Error("The perf output needs the compiler without --lazy");
+  }
+}
+
+static std::string read_stdin() {
+  std::string content{};
+  char buffer[4096];
+  size_t count = 0;
+  while ((count = std::fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+    content.append(buffer, count);
+  }
+  if (std::ferror(stdin)) {
+    Error(Err::IO(errno));
+  }
+  return content;
+}
+
+static void write_file(const std::string &path, const std::string &content) {
+  FILE *file = std::fopen(path.c_str(), "wb");
+  if (NULL == file || content.size() != std::fwrite(content.data(), 1, content.size(), file) ||
+      0 != std::fclose(file)) {
+    Error(Err::IO(errno));
+  }
+}
+
+static void tune(const std::string &program) {
+  const TuneOptions options{
+      .level = args.optimization_level,
+      .budget = args.tune_budget,
+      .heap_size = args.heap_size.value_or(DEFAULT_HEAP_SIZE),
+      .eof_mode = args.eof_mode,
+  };
+  TuneResult result = Ensure(Tune(program, read_stdin(), options));
+  write_file(args.tune_file_path, FormatPipeline(result.pipeline));
+  fprintf(stderr,
+          "Tried %u pipelines, %u rejected: %.6fs -> %.6fs\n",
+          result.candidates,
+          result.rejected,
+          result.baseline_seconds,
+          result.best_seconds);
+}
+
+/**
+ * Size, origin and guard pages of the heap for the program.
+ */
+struct HeapLayout {
+  size_t size;
+  size_t origin;
+  size_t guard_pages;
+};
+
+/**
+ * Lays out the heap for the program.  If the tape bounds of the program
+ * are known, the heap is exactly as large as needed, otherwise guard
+ * pages catch accesses outside of the heap.  An explicit size wins.
+ */
+static HeapLayout heap_layout(OperationStream &stream) {
+  const std::optional<TapeRange> range = AnalyzeTapeBounds(stream);
+  if (IsDumpEnabled("tape")) {
+    if (range) {
+      fprintf(stderr, "Tape: cells %zd to %zd (%zu cells)\n", range->low, range->high, range->Size());
+    } else {
+      fprintf(stderr, "Tape: unbounded, guard pages enabled\n");
+    }
+  }
+  if (!range) {
+    return HeapLayout{.size = args.heap_size.value_or(DEFAULT_HEAP_SIZE),
+                      .origin = 0,
+                      .guard_pages = std::max<size_t>(GUARD_PAGES, UNBOUNDED_GUARD_PAGES)};
+  }
+  const size_t origin = (size_t) -range->low;
+  if (args.heap_size) {
+    const size_t size = args.heap_size.value();
+    return HeapLayout{.size = size, .origin = range->Size() <= size ? origin : 0, .guard_pages = GUARD_PAGES};
+  }
+  return HeapLayout{.size = range->Size(), .origin = origin, .guard_pages = GUARD_PAGES};
+}
+
+static Heap create_heap(OperationStream &stream) {
+  const HeapLayout layout = heap_layout(stream);
+  return Ensure(Heap::Create(layout.size, layout.origin, layout.guard_pages));
+}
+
+/**
+ * Compiles the program into a standalone executable, with the same heap
+ * as a run of bf-cc.
+ */
+static void write_executable(OperationStream &stream) {
+  const HeapLayout layout = heap_layout(stream);
+  const auto align = [](size_t size) {
+    return (size + STANDALONE_ALIGNMENT - 1) / STANDALONE_ALIGNMENT * STANDALONE_ALIGNMENT;
+  };
+  const StandaloneHeap heap{.size = align(std::max<size_t>(layout.size, 1)),
+                            .guard = align(layout.guard_pages * Pagesize()),
+                            .origin = layout.origin};
+  const StandaloneCode code = Ensure(Compiler::CompileStandalone(stream, args.eof_mode, heap));
+  Ensure(WriteExecutable(args.output_path, code));
+}
+
+/**
+ * Lowers the program to C with the same heap as a run of bf-cc.
+ */
+static void write_c_source(OperationStream &stream) {
+  const HeapLayout layout = heap_layout(stream);
+  const CSourceHeap heap{.size = std::max<size_t>(layout.size, 1),
+                         .guard = layout.guard_pages * Pagesize(),
+                         .origin = layout.origin};
+  write_file(args.c_output_path, EmitCSource(stream, args.eof_mode, heap));
+}
+
+/**
+ * Returns true, if the file holds a serialized program.  The program on
+ * stdin is always source, checking it would consume it.
+ */
+static bool is_serialized(const std::string &path) {
+  if ("/dev/stdin" == path) {
+    return false;
+  }
+  FILE *file = std::fopen(path.c_str(), "rb");
+  if (NULL == file) {
+    return false;
+  }
+  char magic[8] = {};
+  const size_t count = std::fread(magic, 1, sizeof(magic), file);
+  std::fclose(file);
+  return IsSerializedStream(std::string_view(magic, count));
+}
+
+/**
+ * Maps the serialized program and reads its operations.
+ */
+static OperationStream load_serialized(const std::string &path) {
+  const size_t size = Ensure(FileSize(path));
+  uint8_t *mem = Ensure(MapFile(path, 0, size));
+  auto result = DeserializeStream(std::string_view((const char *) mem, size));
+  Deallocate(mem, size);
+  return Ensure(std::move(result));
+}
+
+/**
+ * Only whole compiled programs are cached.
+ */
+static bool use_cache() {
+  return !args.cache_path.empty() && ExecMode::COMPILER == args.execution_mode && !args.lazy &&
+         args.output_path.empty() && args.ir_output_path.empty() && args.c_output_path.empty() &&
+         args.asm_output_path.empty() && args.profile_generate_path.empty() && !args.profile &&
+         0 == args.perf_outputs && !IsDumpEnabled("prog") && !IsDumpEnabled("code");
+}
+
+/**
+ * The key of the program in the code cache, with everything its code and
+ * its heap depend on.
+ */
+static std::string cache_key(const std::string &program) {
+  std::string key{program};
+  char options[96];
+  std::snprintf(options,
+                sizeof(options),
+                "\n-O%d -f%u -e%d -m%d:%zu\n",
+                (int) args.optimization_level,
+                args.optimization_iterations,
+                (int) args.eof_mode,
+                (int) args.heap_size.has_value(),
+                args.heap_size.value_or(0));
+  key += options;
+  if (!args.pipeline_file_path.empty()) {
+    key += "pipeline\n" + Ensure(ReadWholeFile(args.pipeline_file_path));
+  }
+  if (!args.profile_use_path.empty()) {
+    key += "profile\n" + Ensure(ReadWholeFile(args.profile_use_path));
+  }
+  return key;
+}
+
+static void dump_heap(Heap &heap) {
+  if (IsDumpEnabled("heap")) {
+    size_t from = 0;
+    size_t to = 0;
+    std::sscanf(IsDumpEnabled("heap").value().data(), "%zu-%zu", &from, &to);
+    heap.Dump(from, to);
+  }
 }
 
 int main(int argc, char **argv) {
   parse_opts(argc, argv);
-  // Parse and optimize
-  std::string raw_content = Ensure(ReadWholeFile(args.input_file_path));
-  OperationStream stream = Ensure(Parse(raw_content));
-  Optimizer::Create(args.optimization_level).Run(stream);
+  // Serialized programs are optimized already
+  const bool serialized = is_serialized(args.input_file_path);
+  if (serialized && (!args.tune_file_path.empty() || !args.profile_generate_path.empty() ||
+                     !args.profile_use_path.empty() || args.profile || !args.cache_path.empty() ||
+                     0 != args.perf_outputs)) {
+    Error("Tuning, profiles, the code cache and perf need the source of the program");
+  }
+  std::string raw_content = serialized ? std::string{} : Ensure(ReadWholeFile(args.input_file_path));
+  if (!args.tune_file_path.empty()) {
+    tune(raw_content);
+    return 0;
+  }
+  std::optional<CodeCache> cache{};
+  std::string key{};
+  if (use_cache()) {
+    cache.emplace(Ensure(CodeCache::Create(args.cache_path)));
+    key = cache_key(raw_content);
+    if (std::optional<CachedCode> code = cache->Find(key)) {
+      if (IsDumpEnabled("cache")) {
+        fprintf(stderr, "Cache: hit %s\n", cache->Path(key).c_str());
+      }
+      const CachedHeap &layout = code->HeapLayout();
+      Heap heap = Ensure(Heap::Create(layout.size, layout.origin, layout.guard_pages));
+      code->RunCode(heap);
+      dump_heap(heap);
+      return 0;
+    }
+  }
+  OperationStream stream = OperationStream::Create();
+  std::optional<LoopProfile> profile{};
+  if (serialized) {
+    stream = load_serialized(args.input_file_path);
+  } else {
+    // Parse and optimize
+    std::vector<OptimizerPass> pipeline = Optimizer::DefaultPipeline(args.optimization_level);
+    if (!args.pipeline_file_path.empty()) {
+      // The content is terminated by a NUL character
+      const std::string config = Ensure(ReadWholeFile(args.pipeline_file_path));
+      pipeline = Ensure(ParsePipeline(config.c_str()));
+    }
+    stream = Ensure(Parse(raw_content));
+    if (!args.profile_use_path.empty()) {
+      const std::string content = Ensure(ReadWholeFile(args.profile_use_path));
+      profile.emplace(Ensure(LoopProfile::Parse(content.c_str(), raw_content)));
+      stream.SetProfile(&profile.value());
+    }
+    OptimizerStats stats =
+        Optimizer::Create(std::move(pipeline), args.optimization_iterations, args.optimization_jobs).Run(stream);
+    if (auto format = IsDumpEnabled("stats")) {
+      if ("json" == format.value()) {
+        stats.DumpJson();
+      } else {
+        stats.Dump();
+      }
+    }
+  }
   if (IsDumpEnabled("prog")) {
     stream.Dump2();
+  } else if (!args.ir_output_path.empty()) {
+    write_file(args.ir_output_path, SerializeStream(stream));
+  } else if (!args.c_output_path.empty()) {
+    write_c_source(stream);
+  } else if (!args.asm_output_path.empty()) {
+    const RelocatableCode code = Ensure(Compiler::CompileRelocatable(stream, args.eof_mode));
+    write_file(args.asm_output_path, EmitAssemblySource(code));
+  } else if (!args.output_path.empty()) {
+    write_executable(stream);
+  } else if (!args.profile_generate_path.empty()) {
+    Heap heap = create_heap(stream);
+    LoopProfile recorded = LoopProfile::Create(raw_content);
+    Interpreter::Create().Profile(heap, stream, args.eof_mode, recorded);
+    write_file(args.profile_generate_path, recorded.Serialize());
   } else {
     // Allocate heap
-    Heap heap = Ensure(Heap::Create(args.heap_size));
+    const HeapLayout layout = heap_layout(stream);
+    Heap heap = Ensure(Heap::Create(layout.size, layout.origin, layout.guard_pages));
     // Compile and execute
     switch (args.execution_mode) {
     case ExecMode::INTERPRETER: {
       Interpreter interpreter = Interpreter::Create();
-      interpreter.Run(heap, stream, args.eof_mode);
+      if (args.profile) {
+        LoopProfile recorded = LoopProfile::Create(raw_content);
+        const uint64_t operations = interpreter.Profile(heap, stream, args.eof_mode, recorded);
+        fputs(recorded.Report(raw_content, operations, "operations").c_str(), stderr);
+      } else {
+        interpreter.Run(heap, stream, args.eof_mode);
+      }
     } break;
     case ExecMode::COMPILER: {
+      if (cache) {
+        const RelocatableCode code = Ensure(Compiler::CompileRelocatable(stream, args.eof_mode));
+        const CachedHeap cached_heap{.size = layout.size, .origin = layout.origin, .guard_pages = layout.guard_pages};
+        // The program runs anyway if the cache can't be written
+        const bool stored = cache->Store(key, code, cached_heap).IsOk();
+        if (IsDumpEnabled("cache")) {
+          fprintf(stderr, "Cache: %s %s\n", stored ? "stored" : "cannot write", cache->Path(key).c_str());
+        }
+        Ensure(CachedCode::Load(code, cached_heap)).RunCode(heap);
+        break;
+      }
       Compiler compiler = Ensure(Compiler::Create());
-      Ensure(compiler.Compile(stream, args.eof_mode));
+      std::optional<PerfLog> perf{};
+      if (0 != args.perf_outputs) {
+        perf.emplace(Ensure(PerfLog::Create(args.perf_outputs, raw_content, args.input_file_path)));
+      }
+      std::optional<CodeCounters> counters{};
+      if (args.profile) {
+        counters.emplace(CodeCounters{.program = {0, 0, 0, 0}, .loops = {}});
+      }
+      Ensure(args.lazy ? compiler.CompileLazy(stream, args.eof_mode)
+                       : compiler.Compile(stream,
+                                          args.eof_mode,
+                                          perf ? &perf.value() : nullptr,
+                                          counters ? &counters.value() : nullptr));
       if (IsDumpEnabled("code")) {
         compiler.Dump();
         return 0;
       } else {
         compiler.RunCode(heap);
       }
+      if (counters) {
+        LoopProfile recorded = LoopProfile::Create(raw_content);
+        recorded.Add(counters.value());
+        fputs(recorded.Report(raw_content, counters->program.ticks, "ticks").c_str(), stderr);
+      }
+    } break;
+    case ExecMode::TIERED: {
+      Compiler compiler = Ensure(Compiler::Create());
+      TieredStats stats = Interpreter::Create().RunTiered(
+          heap, stream, args.eof_mode, compiler, args.tier_up_iterations.value_or(Interpreter::TIER_UP_ITERATIONS));
+      if (IsDumpEnabled("spec")) {
+        stats.Dump();
+      }
+    } break;
+    case ExecMode::TRACE: {
+      TraceJit jit = Ensure(TraceJit::Create());
+      Interpreter::Create().RunTraced(
+          heap, stream, args.eof_mode, jit, args.tier_up_iterations.value_or(Interpreter::TRACE_ITERATIONS));
+      if (IsDumpEnabled("code")) {
+        jit.Dump();
+      }
     } break;
     }
-    if (IsDumpEnabled("heap")) {
-      size_t from = 0;
-      size_t to = 0;
-      std::sscanf(IsDumpEnabled("heap").value().data(), "%zu-%zu", &from, &to);
-      heap.Dump(from, to);
-    }
+    dump_heap(heap);
   }
   return 0;
 }
@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: MIT License
+#include "code_cache.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "platform.h"
+
+#if defined(IS_X86_64)
+static constexpr uint32_t MACHINE = 62;
+#endif
+#if defined(IS_AARCH64)
+static constexpr uint32_t MACHINE = 183;
+#endif
+
+// Relocations patch at most this many bytes, the four moves on AArch64
+static constexpr uint64_t RELOCATION_SIZE = 16;
+
+static constexpr char MAGIC[8] = {'b', 'f', '-', 'c', 'c', 'j', 'i', 't'};
+
+/**
+ * Start of a cache file.  The relocations and the key follow, the code
+ * starts at the next multiple of the page size, so that it can be mapped.
+ */
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t machine;
+  uint64_t key_hash;
+  uint64_t key_size;
+  uint64_t code_offset;
+  uint64_t code_size;
+  uint64_t entry;
+  uint64_t relocations;
+  uint64_t heap_size;
+  uint64_t heap_origin;
+  uint64_t guard_pages;
+};
+
+struct CacheRelocation {
+  uint64_t offset;
+  uint64_t function;
+};
+
+/**
+ * FNV-1a hash of the key.
+ */
+static uint64_t hash(std::string_view key) {
+  uint64_t result = 0xCBF29CE484222325;
+  for (const char c : key) {
+    result = (result ^ (uint8_t) c) * 0x100000001B3;
+  }
+  return result;
+}
+
+static size_t align_page(size_t size) {
+  const size_t page_size = Pagesize();
+  return (size + page_size - 1) / page_size * page_size;
+}
+
+std::variant<CachedCode, Err> CachedCode::Relocate(uint8_t *mem,
+                                                   size_t size,
+                                                   size_t entry,
+                                                   const RelocatableCode::Relocations &relocations,
+                                                   const CachedHeap &heap) noexcept {
+  for (const auto &[offset, function] : relocations) {
+    ::Relocate(mem + offset, function);
+  }
+#if defined(IS_AARCH64)
+  // The instruction cache does not see the data writes
+  __builtin___clear_cache((char *) mem, (char *) mem + size);
+#endif
+  if (Err err = Protect(mem, size, PROTECT_RX); !err.IsOk()) {
+    // Allocated or mapped in whole pages, like the destructor releases it
+    Deallocate(mem, align_page(size));
+    return err;
+  }
+  return CachedCode(M{.mem = mem, .size = size, .entry = reinterpret_cast<CodeEntry>(mem + entry), .heap = heap});
+}
+
+std::variant<CachedCode, Err> CachedCode::Load(const RelocatableCode &code, const CachedHeap &heap) noexcept {
+  const size_t size = code.code.size();
+  auto alloc_result = Allocate(align_page(size));
+  if (alloc_result.index() != 0) {
+    return std::get<Err>(alloc_result);
+  }
+  uint8_t *mem = std::get<uint8_t *>(alloc_result);
+  if (Err err = Protect(mem, size, PROTECT_RW); !err.IsOk()) {
+    Deallocate(mem, align_page(size));
+    return err;
+  }
+  std::memcpy(mem, code.code.data(), size);
+  return Relocate(mem, size, code.entry, code.relocations, heap);
+}
+
+CachedCode::~CachedCode() {
+  if (m.mem) {
+    Deallocate(m.mem, align_page(m.size));
+    m.mem = nullptr;
+  }
+}
+
+std::variant<CodeCache, Err> CodeCache::Create(std::string_view directory) noexcept {
+  std::string path{directory};
+  while (path.size() > 1 && (path.back() == '/' || path.back() == '\\')) {
+    path.pop_back();
+  }
+  if (Err err = MakeDirectory(path); !err.IsOk()) {
+    return err;
+  }
+  return CodeCache(M{.directory = std::move(path)});
+}
+
+std::string CodeCache::Path(std::string_view key) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "/%016" PRIx64 ".bfc", hash(key));
+  return m.directory + name;
+}
+
+static void close_file(FILE *file) {
+  std::fclose(file);
+}
+
+std::optional<CachedCode> CodeCache::Find(std::string_view key) const noexcept {
+  const std::string path = Path(key);
+  const std::unique_ptr<FILE, void (*)(FILE *)> file{std::fopen(path.c_str(), "rb"), close_file};
+  if (!file) {
+    return std::nullopt;
+  }
+  CacheHeader header{};
+  if (1 != std::fread(&header, sizeof(header), 1, file.get()) || 0 != std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) ||
+      header.version != VERSION || header.machine != MACHINE || header.key_hash != hash(key) ||
+      header.key_size != key.size() || header.code_size < RELOCATION_SIZE || header.entry >= header.code_size ||
+      header.code_offset % Pagesize() != 0 || header.code_offset < sizeof(CacheHeader) + key.size() ||
+      header.relocations > (header.code_offset - sizeof(CacheHeader) - key.size()) / sizeof(CacheRelocation)) {
+    return std::nullopt;
+  }
+  RelocatableCode::Relocations relocations{};
+  for (uint64_t i = 0; i < header.relocations; ++i) {
+    CacheRelocation relocation{};
+    if (1 != std::fread(&relocation, sizeof(relocation), 1, file.get()) ||
+        relocation.offset > header.code_size - RELOCATION_SIZE ||
+        (relocation.function != (uint64_t) RuntimeFunction::READ &&
+         relocation.function != (uint64_t) RuntimeFunction::WRITE)) {
+      return std::nullopt;
+    }
+    relocations.emplace_back(relocation.offset, (RuntimeFunction) relocation.function);
+  }
+  // Keys of the same hash share the file, only the key it was stored for may use it
+  std::string stored_key(key.size(), '\0');
+  if (key.size() != std::fread(stored_key.data(), 1, key.size(), file.get()) || stored_key != key) {
+    return std::nullopt;
+  }
+  auto map_result = MapFile(path, header.code_offset, header.code_size);
+  if (map_result.index() != 0) {
+    return std::nullopt;
+  }
+  const CachedHeap heap{.size = header.heap_size, .origin = header.heap_origin, .guard_pages = header.guard_pages};
+  auto result = CachedCode::Relocate(
+      std::get<uint8_t *>(map_result), header.code_size, header.entry, relocations, heap);
+  if (result.index() != 0) {
+    return std::nullopt;
+  }
+  return std::get<CachedCode>(std::move(result));
+}
+
+Err CodeCache::Store(std::string_view key, const RelocatableCode &code, const CachedHeap &heap) const noexcept {
+  const size_t key_offset = sizeof(CacheHeader) + code.relocations.size() * sizeof(CacheRelocation);
+  const size_t code_offset = align_page(key_offset + key.size());
+  CacheHeader header{.magic = {},
+                     .version = VERSION,
+                     .machine = MACHINE,
+                     .key_hash = hash(key),
+                     .key_size = key.size(),
+                     .code_offset = code_offset,
+                     .code_size = code.code.size(),
+                     .entry = code.entry,
+                     .relocations = code.relocations.size(),
+                     .heap_size = heap.size,
+                     .heap_origin = heap.origin,
+                     .guard_pages = heap.guard_pages};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  std::vector<uint8_t> content(code_offset + code.code.size(), 0);
+  std::memcpy(content.data(), &header, sizeof(header));
+  uint8_t *relocations = content.data() + sizeof(header);
+  for (const auto &[offset, function] : code.relocations) {
+    const CacheRelocation relocation{.offset = offset, .function = (uint64_t) function};
+    std::memcpy(relocations, &relocation, sizeof(relocation));
+    relocations += sizeof(relocation);
+  }
+  std::memcpy(content.data() + key_offset, key.data(), key.size());
+  std::memcpy(content.data() + code_offset, code.code.data(), code.code.size());
+  // Concurrent runs must not see a partial file, it is renamed once complete
+  const std::string path = Path(key);
+  const std::string temporary =
+      path + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+  FILE *file = std::fopen(temporary.c_str(), "wb");
+  if (nullptr == file) {
+    return Err::IO(errno);
+  }
+  const bool written = content.size() == std::fwrite(content.data(), 1, content.size(), file);
+  const bool closed = 0 == std::fclose(file);
+  if (!written || !closed || 0 != std::rename(temporary.c_str(), path.c_str())) {
+    const int error = errno;
+    std::remove(temporary.c_str());
+    return Err::IO(error);
+  }
+  return Err::Ok();
+}
@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_CODE_CACHE_H
+#define BF_CC_CODE_CACHE_H 1
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+
+#include "assembler.h"
+#include "compiler.h"
+#include "error.h"
+#include "mem.h"
+
+/**
+ * The heap a cached program runs on, like the heap of a run of bf-cc.
+ */
+struct CachedHeap {
+  size_t size;
+  size_t origin;
+  size_t guard_pages;
+};
+
+/**
+ * Relocated code of a whole program, ready to run.
+ */
+class CachedCode final {
+public:
+  using CodeEntry = void (*)(ExecState *);
+
+private:
+  struct M {
+    uint8_t *mem;
+    size_t size;
+    CodeEntry entry;
+    CachedHeap heap;
+  } m;
+
+  explicit CachedCode(M m) noexcept : m(std::move(m)) {
+  }
+
+  CachedCode(const CachedCode &) = delete;
+  CachedCode &operator=(const CachedCode &) = delete;
+
+  friend class CodeCache;
+
+  static std::variant<CachedCode, Err> Relocate(
+      uint8_t *mem, size_t size, size_t entry, const RelocatableCode::Relocations &, const CachedHeap &) noexcept;
+
+public:
+  /**
+   * Copies the code into executable memory and relocates it.
+   */
+  static std::variant<CachedCode, Err> Load(const RelocatableCode &, const CachedHeap &) noexcept;
+
+  ~CachedCode();
+
+  CachedCode(CachedCode &&other) noexcept
+      : m(std::exchange(other.m, {nullptr, 0, nullptr, CachedHeap{.size = 0, .origin = 0, .guard_pages = 0}})) {
+  }
+
+  CachedCode &operator=(CachedCode &&other) noexcept {
+    std::swap(m, other.m);
+    return *this;
+  }
+
+  const CachedHeap &HeapLayout() const noexcept {
+    return m.heap;
+  }
+
+  void RunCode(Heap &heap) noexcept {
+    ExecState state{.cell = heap.CellAddress(), .loop_counter = 0, .resume = nullptr, .exit = 0};
+    m.entry(&state);
+    heap.SetCellAddress(state.cell);
+  }
+
+  size_t CodeSize() const noexcept {
+    return m.size;
+  }
+};
+
+/**
+ * Compiled programs on disk, so that the next run of the same program
+ * maps its code instead of parsing, optimizing and compiling it again.
+ *
+ * The caller describes everything the code depends on in a key, usually
+ * the program and the options.  The file of a key holds the code, its
+ * relocations, the heap and the key itself.  It is only used by bf-cc
+ * builds with the same VERSION on the same architecture.
+ */
+class CodeCache final {
+public:
+  // Changes whenever the compiler emits other code or the file format changes
+  static constexpr uint32_t VERSION = 2;
+
+private:
+  struct M {
+    std::string directory;
+  } m;
+
+  explicit CodeCache(M m) noexcept : m(std::move(m)) {
+  }
+
+public:
+  /**
+   * Uses the directory for the cache, which is created if needed.
+   */
+  static std::variant<CodeCache, Err> Create(std::string_view directory) noexcept;
+
+  /**
+   * The file of the key.
+   */
+  std::string Path(std::string_view key) const;
+
+  /**
+   * Maps and relocates the code of the key.  Returns nothing if there is
+   * no file for the key, if the file belongs to another key of the same
+   * hash, or if it was written by another build of bf-cc or is damaged.
+   */
+  std::optional<CachedCode> Find(std::string_view key) const noexcept;
+
+  /**
+   * Writes the code of the key, replacing the previous file.
+   */
+  Err Store(std::string_view key, const RelocatableCode &, const CachedHeap &) const noexcept;
+};
+
+#endif /* BF_CC_CODE_CACHE_H */
@@ -2,92 +2,432 @@
 #include "compiler.h"
 
 #include <cstdio>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "assembler.h"
 #include "debug.h"
 #include "error.h"
+#include "perf.h"
+#include "profile.h"
 
 #define DEBUG_COMP(x)
 
-Err Compiler::Compile(OperationStream &stream, EOFMode eof_mode) noexcept {
-  std::vector<std::pair<const Operation *, uint8_t *>> jump_list{};
+// Heads of hot loops start at this alignment
+static const size_t HOT_LOOP_ALIGNMENT = 16;
+
+// Lazily compiled programs are split into top-level regions of about this
+// many operations
+static const size_t REGION_SIZE = 1024;
+
+/**
+ * Returns true, if the label starts a loop which is hot in the profile.
+ */
+static bool is_hot_loop(const LoopProfile *profile, const Operation *label) {
+  const Operation *jump = (const Operation *) label->Operand1();
+  return profile && jump->IsAny({Instruction::JNZ, Instruction::DJNZ}) && profile->IsHot(label->Source());
+}
+
+/**
+ * Returns true, if all jumps of the loop target labels inside of it.
+ */
+static bool is_self_contained(OperationStream &stream, Operation *label) {
+  const Operation *back = (const Operation *) label->Operand1();
+  std::unordered_set<Operation::operand_type> labels{};
+  std::unordered_set<Operation::operand_type> targets{};
+  for (auto iter = stream.From(label); *iter != back; ++iter) {
+    if (iter->Is(Instruction::LABEL)) {
+      labels.insert((Operation::operand_type) *iter);
+    } else if (iter->IsJump()) {
+      targets.insert(iter->Operand1());
+    }
+  }
+  targets.insert(back->Operand1());
+  for (const auto target : targets) {
+    if (!labels.contains(target)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Returns true, if the label is the head of a loop.
+ */
+static bool is_loop(const Operation *label) {
+  return ((const Operation *) label->Operand1())->IsAny({Instruction::JNZ, Instruction::DJNZ});
+}
+
+/**
+ * A loop or a top-level region, whose code is emitted when it runs for
+ * the first time.
+ */
+struct LazyStub {
+  LazyCode *code;
+  Operation *first;
+  // The backward jump of a loop, nullptr for a top-level region
+  Operation *last;
+  // The jump of the stub, which is patched to the emitted code
+  uint8_t *jump;
+  // Where the code continues after a loop
+  uint8_t *continuation;
+};
+
+/**
+ * Code which is compiled when it runs for the first time.
+ */
+struct LazyCode {
+  CodeArea &mem;
+  OperationStream &stream;
+  EOFMode eof_mode;
+  std::vector<std::unique_ptr<LazyStub>> stubs;
+};
+
+/**
+ * How a range of operations is emitted.
+ */
+struct EmitContext {
+  CodeArea &mem;
+  const LoopProfile *profile;
+  EOFMode eof_mode;
+  // Speculations by their operation, if any
+  const std::unordered_map<const Operation *, Speculation *> *speculations;
+  // Guards of speculations, whose deoptimization is emitted after the code
+  std::vector<std::pair<Speculation *, uint8_t *>> guards;
+  // Set if loops are compiled lazily
+  LazyCode *lazy;
+  // Set if the code is part of a standalone executable
+  const StandaloneRuntime *runtime;
+  // Set if the code must be relocatable
+  Relocations *relocations;
+  // Set to record where the code of each operation starts
+  std::vector<std::pair<const Operation *, uint8_t *>> *operations;
+  // Set if the code counts loops
+  CodeCounters *counters;
+};
+
+/**
+ * The speculation about the operation, nullptr if there is none.
+ */
+static Speculation *speculation(const EmitContext &ctx, const Operation *op, Speculation::Kind kind) {
+  if (nullptr == ctx.speculations) {
+    return nullptr;
+  }
+  auto iter = ctx.speculations->find(op);
+  return iter == ctx.speculations->end() || iter->second->kind != kind ? nullptr : iter->second;
+}
+
+/**
+ * Emits a guard, which checks that the source cell of the multiplication
+ * has the speculated value, and the multiplication with a constant.
+ */
+static void emit_speculated_multiply(EmitContext &ctx, const Operation *op, Speculation *spec) {
+  EmitJumpNotEqual(ctx.mem, op->Operand3(), spec->value);
+  ctx.guards.push_back({spec, ctx.mem.CurrentWriteAddr()});
+  const uint8_t product = (uint8_t) (spec->value * op->Operand1());
+  if (0 == product) {
+    return;
+  }
+  if (op->Is(Instruction::IMUL_CELL)) {
+    EmitIncrCell(ctx.mem, product, op->Operand2());
+  } else {
+    EmitDecrCell(ctx.mem, product, op->Operand2());
+  }
+}
+
+/**
+ * The counters of the loop of the operation, nullptr if the code does
+ * not count loops.
+ */
+static LoopCounters *loop_counters(const EmitContext &ctx, const Operation *op) {
+  if (nullptr == ctx.counters || Operation::NO_SOURCE == op->Source()) {
+    return nullptr;
+  }
+  return &ctx.counters->loops.try_emplace(op->Source(), LoopCounters{0, 0, 0, 0}).first->second;
+}
+
+/**
+ * Returns true, if the guard ends with a loop of the same source, which
+ * is counted by the guard.
+ */
+static bool guards_loop(OperationStream::Iterator guard) {
+  const uint32_t source = guard->Source();
+  guard.JumpTo((Operation *) guard->Operand1());
+  --guard;
+  return guard->IsAny({Instruction::JNZ, Instruction::DJNZ}) && source == guard->Source();
+}
+
+/**
+ * Returns true, if the loop of the label or the backward jump is the end
+ * of a guard of the same source.
+ */
+static bool is_guarded(OperationStream::Iterator jump) {
+  if (jump->Is(Instruction::LABEL)) {
+    jump.JumpTo((Operation *) jump->Operand1());
+  }
+  const uint32_t source = jump->Source();
+  const Operation *next = *++jump;
+  return nullptr != next && next->Is(Instruction::LABEL) &&
+         ((const Operation *) next->Operand1())->Is(Instruction::JZ) && source == next->Source();
+}
+
+/**
+ * Emits the deoptimizations of the guards, which return to the interpreter
+ * at the operation of the speculation.
+ */
+static void emit_deoptimizations(EmitContext &ctx) {
+  for (const auto &[spec, jump] : ctx.guards) {
+    PatchJumpNotEqual(ctx.mem, jump, (uintptr_t) (ctx.mem.CurrentWriteAddr() - jump));
+    EmitExit(ctx.mem, spec->op, (uintptr_t) spec);
+  }
+  ctx.guards.clear();
+}
+
+static Err emit_operations(EmitContext &,
+                           OperationStream::Iterator,
+                           const OperationStream::Iterator,
+                           std::vector<std::pair<const Operation *, uint8_t *>> &);
+
+static void emit_lazy_stub(EmitContext &, Operation *, Operation *);
+
+/**
+ * The end of the top-level region which starts with the operation.
+ * Regions end after REGION_SIZE operations, but never inside of a loop or
+ * a guard.  Returns nullptr at the end of the program.
+ */
+static Operation *region_end(OperationStream &stream, Operation *first) {
+  size_t size = 0;
+  intptr_t depth = 0;
+  Operation *last = nullptr;
+  for (auto iter = stream.From(first); iter != stream.End(); ++iter) {
+    if (iter->Is(Instruction::JZ)) {
+      ++depth;
+    } else if (iter->Is(Instruction::LABEL)) {
+      depth += is_loop(*iter) ? 1 : -1;
+    } else if (iter->IsAny({Instruction::JNZ, Instruction::DJNZ})) {
+      --depth;
+    }
+    last = *iter;
+    if (0 == depth && ++size >= REGION_SIZE) {
+      break;
+    }
+  }
+  return last;
+}
+
+/**
+ * Called by the stub when the code gets there for the first time.  Emits
+ * the code of the stub and patches the stub to jump there right away.
+ */
+static uint8_t *compile_lazy_stub(LazyStub *stub) {
+  LazyCode &lazy = *stub->code;
+  Ensure(lazy.mem.MakeWritable());
+  uint8_t *code = lazy.mem.CurrentWriteAddr();
+  EmitContext ctx{.mem = lazy.mem,
+                  .profile = lazy.stream.Profile(),
+                  .eof_mode = lazy.eof_mode,
+                  .speculations = nullptr,
+                  .guards = {},
+                  .lazy = &lazy,
+                  .runtime = nullptr,
+                  .relocations = nullptr,
+                  .operations = nullptr,
+                  .counters = nullptr};
+  Operation *last = stub->continuation ? stub->last : region_end(lazy.stream, stub->first);
+  auto end = lazy.stream.From(last);
   std::vector<std::pair<const Operation *, uint8_t *>> label_list{};
-  void *entry = m.mem->CurrentWriteAddr();
-  m.entry = nullptr;
-  EmitEntry(*m.mem);
-  if (m.mem->HasWriteError()) {
-    return Err::OutOfMemory();
+  Ensure(emit_operations(ctx, lazy.stream.From(stub->first), ++end, label_list));
+  if (stub->continuation) {
+    // Back to the code after the loop
+    EmitJump(lazy.mem);
+    PatchJump(lazy.mem, lazy.mem.CurrentWriteAddr(), (uintptr_t) (stub->continuation - lazy.mem.CurrentWriteAddr()));
+  } else if (end != lazy.stream.End()) {
+    emit_lazy_stub(ctx, *end, nullptr);
+  } else {
+    EmitExit(lazy.mem);
+  }
+  PatchJump(lazy.mem, stub->jump, (uintptr_t) (code - stub->jump));
+  if (lazy.mem.HasWriteError()) {
+    Ensure(Err::OutOfMemory());
+  }
+  Ensure(lazy.mem.MakeExecutable());
+  return code;
+}
+
+/**
+ * Emits a stub for the loop from first to last, or for the top-level
+ * region which starts at first if last is nullptr.  The stub jumps to its
+ * compiled code, which is first emitted when the stub runs.
+ */
+static void emit_lazy_stub(EmitContext &ctx, Operation *first, Operation *last) {
+  auto stub = std::make_unique<LazyStub>(
+      LazyStub{.code = ctx.lazy, .first = first, .last = last, .jump = nullptr, .continuation = nullptr});
+  EmitJump(ctx.mem);
+  stub->jump = ctx.mem.CurrentWriteAddr();
+  PatchJump(ctx.mem, stub->jump, 0);
+  EmitCallAndJump(ctx.mem, (uintptr_t) compile_lazy_stub, (uintptr_t) stub.get());
+  if (last) {
+    stub->continuation = ctx.mem.CurrentWriteAddr();
   }
-  for (const Operation *op : stream) {
+  ctx.lazy->stubs.push_back(std::move(stub));
+}
+
+/**
+ * Emits the operations from iter up to end and records the code position
+ * of every label.  All jumps must target labels within the range.  Loops
+ * which are speculated to be never entered are left out, their label
+ * returns to the interpreter instead.  In lazy mode all loops but the
+ * first operation are left out and replaced by stubs.
+ */
+static Err emit_operations(EmitContext &ctx,
+                           OperationStream::Iterator iter,
+                           const OperationStream::Iterator end,
+                           std::vector<std::pair<const Operation *, uint8_t *>> &label_list) {
+  CodeArea &mem = ctx.mem;
+  const Operation *first = *iter;
+  std::vector<std::pair<const Operation *, uint8_t *>> jump_list{};
+  for (; iter != end; ++iter) {
+    const Operation *op = *iter;
+    if (nullptr != ctx.operations) {
+      ctx.operations->push_back({op, mem.CurrentWriteAddr()});
+    }
     switch (op->OpCode()) {
     case Instruction::NOP:
       DEBUG_COMP(printf("NOP\n"));
-      EmitNop(*m.mem);
+      EmitNop(mem);
       break;
     case Instruction::INCR_CELL:
       DEBUG_COMP(printf("INCR_CELL %zu %zu\n", op->Operand1(), op->Operand2()));
-      EmitIncrCell(*m.mem, (uint8_t) op->Operand1(), op->Operand2());
+      EmitIncrCell(mem, (uint8_t) op->Operand1(), op->Operand2());
       break;
     case Instruction::DECR_CELL:
       DEBUG_COMP(printf("DECR_CELL %zu %zu\n", op->Operand1(), op->Operand2()));
-      EmitDecrCell(*m.mem, (uint8_t) op->Operand1(), op->Operand2());
+      EmitDecrCell(mem, (uint8_t) op->Operand1(), op->Operand2());
       break;
     case Instruction::IMUL_CELL:
-      DEBUG_COMP(printf("IMUL_CELL %zu %zu\n", op->Operand1(), op->Operand2()));
-      EmitImullCell(*m.mem, (uint8_t) op->Operand1(), op->Operand2());
+      DEBUG_COMP(printf("IMUL_CELL %zu %zu %zu\n", op->Operand1(), op->Operand2(), op->Operand3()));
+      if (Speculation *spec = speculation(ctx, op, Speculation::Kind::CELL_VALUE)) {
+        emit_speculated_multiply(ctx, op, spec);
+      } else {
+        EmitImullCell(mem, (uint8_t) op->Operand1(), op->Operand2(), op->Operand3());
+      }
       break;
     case Instruction::DMUL_CELL:
-      DEBUG_COMP(printf("DMUL_CELL %zu %zu\n", op->Operand1(), op->Operand2()));
-      EmitDmullCell(*m.mem, (uint8_t) op->Operand1(), op->Operand2());
+      DEBUG_COMP(printf("DMUL_CELL %zu %zu %zu\n", op->Operand1(), op->Operand2(), op->Operand3()));
+      if (Speculation *spec = speculation(ctx, op, Speculation::Kind::CELL_VALUE)) {
+        emit_speculated_multiply(ctx, op, spec);
+      } else {
+        EmitDmullCell(mem, (uint8_t) op->Operand1(), op->Operand2(), op->Operand3());
+      }
       break;
     case Instruction::SET_CELL:
       DEBUG_COMP(printf("SET_CELL %zu %zu\n", op->Operand1(), op->Operand2()));
-      EmitSetCell(*m.mem, (uint8_t) op->Operand1(), op->Operand2());
+      EmitSetCell(mem, (uint8_t) op->Operand1(), op->Operand2());
       break;
     case Instruction::INCR_PTR:
       DEBUG_COMP(printf("INCR_PTR %zu\n", op->Operand1()));
-      EmitIncrPtr(*m.mem, op->Operand1());
+      EmitIncrPtr(mem, op->Operand1());
       break;
     case Instruction::DECR_PTR:
       DEBUG_COMP(printf("DECR_CELL %zu\n", op->Operand1()));
-      EmitDecrPtr(*m.mem, op->Operand1());
+      EmitDecrPtr(mem, op->Operand1());
       break;
     case Instruction::READ:
       DEBUG_COMP(printf("READ %zu %zu\n", op->Operand1(), op->Operand2()));
-      EmitIncrPtr(*m.mem, op->Operand2());
-      EmitRead(*m.mem, eof_mode);
-      EmitDecrPtr(*m.mem, op->Operand2());
+      EmitIncrPtr(mem, op->Operand2());
+      if (nullptr != ctx.runtime) {
+        EmitStandaloneRead(mem, *ctx.runtime, ctx.eof_mode);
+      } else {
+        EmitRead(mem, ctx.eof_mode, ctx.relocations);
+      }
+      EmitDecrPtr(mem, op->Operand2());
       break;
     case Instruction::WRITE:
       DEBUG_COMP(printf("WRITE %zu %zu\n", op->Operand1(), op->Operand2()));
-      EmitIncrPtr(*m.mem, op->Operand2());
-      EmitWrite(*m.mem);
-      EmitDecrPtr(*m.mem, op->Operand2());
+      EmitIncrPtr(mem, op->Operand2());
+      if (nullptr != ctx.runtime) {
+        EmitStandaloneWrite(mem, *ctx.runtime);
+      } else {
+        EmitWrite(mem, ctx.relocations);
+      }
+      EmitDecrPtr(mem, op->Operand2());
       break;
     case Instruction::JZ:
-      DEBUG_COMP(printf("JZ\n"));
-      EmitJumpZero(*m.mem);
-      jump_list.push_back({op, m.mem->CurrentWriteAddr()});
+      DEBUG_COMP(printf("JZ %zu\n", op->Operand2()));
+      if (LoopCounters *counters = loop_counters(ctx, op)) {
+        // Reaching the guard enters the loop, skipping it is an entry too
+        EmitCountUp(mem, &counters->entries);
+        EmitStartClock(mem, &counters->start);
+      }
+      EmitJumpZero(mem, op->Operand2());
+      jump_list.push_back({op, mem.CurrentWriteAddr()});
+      if (LoopCounters *counters = loop_counters(ctx, op); counters && !guards_loop(iter)) {
+        // A guard without its loop runs once
+        EmitCountUp(mem, &counters->iterations);
+      }
       break;
     case Instruction::JNZ:
-      DEBUG_COMP(printf("JNZ\n"));
-      EmitJumpNonZero(*m.mem);
-      jump_list.push_back({op, m.mem->CurrentWriteAddr()});
+      DEBUG_COMP(printf("JNZ %zu\n", op->Operand2()));
+      EmitJumpNonZero(mem, op->Operand2());
+      jump_list.push_back({op, mem.CurrentWriteAddr()});
+      if (LoopCounters *counters = loop_counters(ctx, op); counters && !is_guarded(iter)) {
+        EmitStopClock(mem, &counters->start, &counters->ticks);
+      }
+      break;
+    case Instruction::DJNZ:
+      DEBUG_COMP(printf("DJNZ %zu\n", op->Operand2()));
+      EmitLoopCounterJump(mem);
+      jump_list.push_back({op, mem.CurrentWriteAddr()});
+      if (LoopCounters *counters = loop_counters(ctx, op); counters && !is_guarded(iter)) {
+        EmitStopClock(mem, &counters->start, &counters->ticks);
+      }
       break;
     case Instruction::LABEL:
-      label_list.push_back({op, m.mem->CurrentWriteAddr()});
+      if (Speculation *spec = speculation(ctx, op, Speculation::Kind::LOOP_NOT_ENTERED)) {
+        EmitExit(mem, *iter, (uintptr_t) spec);
+        iter.JumpTo((Operation *) op->Operand1());
+        break;
+      }
+      if (ctx.lazy && op != first && is_loop(op)) {
+        emit_lazy_stub(ctx, *iter, (Operation *) op->Operand1());
+        iter.JumpTo((Operation *) op->Operand1());
+        break;
+      }
+      if (LoopCounters *counters = loop_counters(ctx, (const Operation *) op->Operand1());
+          counters && is_loop(op) && !is_guarded(iter)) {
+        EmitCountUp(mem, &counters->entries);
+        EmitStartClock(mem, &counters->start);
+      }
+      if (((const Operation *) op->Operand1())->Is(Instruction::DJNZ)) {
+        // The backward jump goes past the initialization
+        EmitSetLoopCounter(mem, (uint32_t) ((const Operation *) op->Operand1())->Operand2());
+      }
+      if (is_hot_loop(ctx.profile, op)) {
+        // The padding runs once per entry, the aligned body on every iteration
+        EmitAlign(mem, HOT_LOOP_ALIGNMENT);
+      }
+      label_list.push_back({op, mem.CurrentWriteAddr()});
+      if (LoopCounters *counters = loop_counters(ctx, (const Operation *) op->Operand1())) {
+        if (is_loop(op)) {
+          EmitCountUp(mem, &counters->iterations);
+        } else {
+          // Both ways through the guard end here
+          EmitStopClock(mem, &counters->start, &counters->ticks);
+        }
+      }
       break;
     case Instruction::FIND_CELL_HIGH:
       DEBUG_COMP(printf("FIND_CELL_HIGH %zu %zu\n", op->Operand1(), op->Operand2()));
-      EmitFindCellHigh(*m.mem, (uint8_t) op->Operand1(), (uintptr_t) op->Operand2());
+      EmitFindCellHigh(mem, (uint8_t) op->Operand1(), (uintptr_t) op->Operand2());
       break;
     case Instruction::FIND_CELL_LOW:
       DEBUG_COMP(printf("FIND_CELL_LOW %zu %zu\n", op->Operand1(), op->Operand2()));
-      EmitFindCellLow(*m.mem, (uint8_t) op->Operand1(), (uintptr_t) op->Operand2());
+      EmitFindCellLow(mem, (uint8_t) op->Operand1(), (uintptr_t) op->Operand2());
       break;
     }
-    if (m.mem->HasWriteError()) {
+    if (mem.HasWriteError()) {
       return Err::OutOfMemory();
     }
   }
@@ -101,13 +441,69 @@ Err Compiler::Compile(OperationStream &stream, EOFMode eof_mode) noexcept {
       }
     }
     ASSERT(target_pos > (uint8_t *) 0, "Label not found");
-    ASSERT(jump->IsAny({Instruction::JZ, Instruction::JNZ}), "Invalid op code in jump list");
+    ASSERT(jump->IsJump(), "Invalid op code in jump list");
     if (jump->Is(Instruction::JZ)) {
-      PatchJumpZero(*m.mem, code_pos, (uintptr_t) (target_pos - code_pos));
+      PatchJumpZero(mem, code_pos, (uintptr_t) (target_pos - code_pos));
     } else if (jump->Is(Instruction::JNZ)) {
-      PatchJumpNonZero(*m.mem, code_pos, (uintptr_t) (target_pos - code_pos));
+      PatchJumpNonZero(mem, code_pos, (uintptr_t) (target_pos - code_pos));
+    } else if (jump->Is(Instruction::DJNZ)) {
+      PatchLoopCounterJump(mem, code_pos, (uintptr_t) (target_pos - code_pos));
     }
   }
+  return Err::Ok();
+}
+
+Compiler::Compiler(M m) noexcept : m(std::move(m)) {
+}
+
+std::variant<Compiler, Err> Compiler::Create() {
+  auto mem = CodeArea::Create();
+  if (0 != mem.index()) {
+    return std::get<Err>(std::move(mem));
+  }
+  return Compiler(
+      M{.entry = nullptr, .mem = std::make_unique<CodeArea>(std::move(std::get<CodeArea>(mem))), .lazy = nullptr});
+}
+
+Compiler::~Compiler() = default;
+
+Compiler::Compiler(Compiler &&other) noexcept : m(std::exchange(other.m, {nullptr, nullptr, nullptr})) {
+}
+
+Compiler &Compiler::operator=(Compiler &&other) noexcept {
+  m = std::move(other.m);
+  return *this;
+}
+
+Err Compiler::Compile(OperationStream &stream, EOFMode eof_mode, PerfLog *perf, CodeCounters *counters) noexcept {
+  void *entry = m.mem->CurrentWriteAddr();
+  m.entry = nullptr;
+  std::vector<std::pair<const Operation *, uint8_t *>> operations{};
+  EmitEntry(*m.mem);
+  if (nullptr != counters) {
+    EmitStartClock(*m.mem, &counters->program.start);
+  }
+  if (m.mem->HasWriteError()) {
+    return Err::OutOfMemory();
+  }
+  EmitContext ctx{.mem = *m.mem,
+                  .profile = stream.Profile(),
+                  .eof_mode = eof_mode,
+                  .speculations = nullptr,
+                  .guards = {},
+                  .lazy = nullptr,
+                  .runtime = nullptr,
+                  .relocations = nullptr,
+                  .operations = nullptr == perf ? nullptr : &operations,
+                  .counters = counters};
+  std::vector<std::pair<const Operation *, uint8_t *>> label_list{};
+  if (Err err = emit_operations(ctx, stream.Begin(), stream.End(), label_list); !err.IsOk()) {
+    return err;
+  }
+  operations.push_back({nullptr, m.mem->CurrentWriteAddr()});
+  if (nullptr != counters) {
+    EmitStopClock(*m.mem, &counters->program.start, &counters->program.ticks);
+  }
   EmitExit(*m.mem);
   if (m.mem->HasWriteError()) {
     return Err::OutOfMemory();
@@ -117,5 +513,175 @@ Err Compiler::Compile(OperationStream &stream, EOFMode eof_mode) noexcept {
     return err;
   }
   m.entry = reinterpret_cast<CodeEntry>(entry);
+  if (nullptr != perf) {
+    perf->RecordCode((const uint8_t *) entry, (size_t) (m.mem->CurrentWriteAddr() - (uint8_t *) entry), operations);
+  }
+  return Err::Ok();
+}
+
+std::variant<StandaloneCode, Err> Compiler::CompileStandalone(OperationStream &stream,
+                                                               EOFMode eof_mode,
+                                                               const StandaloneHeap &heap) noexcept {
+  auto mem_result = CodeArea::Create();
+  if (0 != mem_result.index()) {
+    return std::get<Err>(mem_result);
+  }
+  CodeArea &mem = std::get<CodeArea>(mem_result);
+  const uint8_t *code = mem.CurrentWriteAddr();
+  StandaloneRuntime runtime{.start = nullptr, .read = nullptr, .write = nullptr, .data_refs = {}};
+  EmitStandaloneRuntime(mem, runtime, heap);
+  EmitStandaloneEntry(mem, runtime);
+  EmitContext ctx{.mem = mem,
+                  .profile = stream.Profile(),
+                  .eof_mode = eof_mode,
+                  .speculations = nullptr,
+                  .guards = {},
+                  .lazy = nullptr,
+                  .runtime = &runtime,
+                  .relocations = nullptr,
+                  .operations = nullptr,
+                  .counters = nullptr};
+  std::vector<std::pair<const Operation *, uint8_t *>> label_list{};
+  if (Err err = emit_operations(ctx, stream.Begin(), stream.End(), label_list); !err.IsOk()) {
+    return err;
+  }
+  EmitExit(mem);
+  if (mem.HasWriteError()) {
+    return Err::OutOfMemory();
+  }
+  const size_t size = (size_t) (mem.CurrentWriteAddr() - code);
+  const size_t data_offset = (size + STANDALONE_ALIGNMENT - 1) / STANDALONE_ALIGNMENT * STANDALONE_ALIGNMENT;
+  PatchStandaloneData(mem, runtime, mem.CurrentWriteAddr() + (data_offset - size));
+  return StandaloneCode{.code = std::vector<uint8_t>(code, code + size),
+                        .entry = (size_t) (runtime.start - code),
+                        .data_offset = data_offset,
+                        .data_size = STANDALONE_DATA_SIZE};
+}
+
+std::variant<RelocatableCode, Err> Compiler::CompileRelocatable(OperationStream &stream, EOFMode eof_mode) noexcept {
+  auto mem_result = CodeArea::Create();
+  if (0 != mem_result.index()) {
+    return std::get<Err>(mem_result);
+  }
+  CodeArea &mem = std::get<CodeArea>(mem_result);
+  const uint8_t *code = mem.CurrentWriteAddr();
+  Relocations relocations{};
+  std::vector<std::pair<const Operation *, uint8_t *>> operations{};
+  EmitEntry(mem, &relocations);
+  EmitContext ctx{.mem = mem,
+                  .profile = stream.Profile(),
+                  .eof_mode = eof_mode,
+                  .speculations = nullptr,
+                  .guards = {},
+                  .lazy = nullptr,
+                  .runtime = nullptr,
+                  .relocations = &relocations,
+                  .operations = &operations,
+                  .counters = nullptr};
+  std::vector<std::pair<const Operation *, uint8_t *>> label_list{};
+  if (Err err = emit_operations(ctx, stream.Begin(), stream.End(), label_list); !err.IsOk()) {
+    return err;
+  }
+  operations.push_back({nullptr, mem.CurrentWriteAddr()});
+  EmitExit(mem);
+  if (mem.HasWriteError()) {
+    return Err::OutOfMemory();
+  }
+  RelocatableCode result{.code = std::vector<uint8_t>(code, (const uint8_t *) mem.CurrentWriteAddr()),
+                         .entry = 0,
+                         .relocations = {},
+                         .operations = {}};
+  result.relocations.reserve(relocations.size());
+  for (const Relocation &relocation : relocations) {
+    result.relocations.emplace_back((size_t) (relocation.address - code), relocation.function);
+  }
+  result.operations.reserve(operations.size());
+  for (const auto &[op, address] : operations) {
+    result.operations.emplace_back((size_t) (address - code), op);
+  }
+  return result;
+}
+
+std::variant<Compiler::LoopEntries, Err> Compiler::CompileLoop(
+    OperationStream &stream,
+    Operation *label,
+    EOFMode eof_mode,
+    const std::vector<Speculation *> &speculations) noexcept {
+  ASSERT(label->Is(Instruction::LABEL), "Loops start with a label");
+  Operation *back = (Operation *) label->Operand1();
+  if (!back->IsAny({Instruction::JNZ, Instruction::DJNZ}) || !is_self_contained(stream, label)) {
+    return LoopEntries{};
+  }
+  if (Err err = m.mem->MakeWritable(); !err.IsOk()) {
+    return err;
+  }
+  std::unordered_map<const Operation *, Speculation *> by_op{};
+  for (Speculation *spec : speculations) {
+    by_op.insert_or_assign(spec->op, spec);
+  }
+  EmitContext ctx{.mem = *m.mem,
+                  .profile = stream.Profile(),
+                  .eof_mode = eof_mode,
+                  .speculations = &by_op,
+                  .guards = {},
+                  .lazy = nullptr,
+                  .runtime = nullptr,
+                  .relocations = nullptr,
+                  .operations = nullptr,
+                  .counters = nullptr};
+  std::vector<std::pair<const Operation *, uint8_t *>> label_list{};
+  auto end = stream.From(back);
+  if (Err err = emit_operations(ctx, stream.From(label), ++end, label_list); !err.IsOk()) {
+    return err;
+  }
+  EmitExit(*m.mem);
+  emit_deoptimizations(ctx);
+  // Every loop of the body gets an entry, which jumps right to its body
+  // with the loop counter of the interpreter
+  LoopEntries entries{};
+  for (const auto &[loop, label_pos] : label_list) {
+    if (((const Operation *) loop->Operand1())->IsAny({Instruction::JNZ, Instruction::DJNZ})) {
+      entries.push_back({loop, reinterpret_cast<CodeEntry>(m.mem->CurrentWriteAddr())});
+      EmitEntry(*m.mem);
+      EmitJump(*m.mem);
+      PatchJump(*m.mem, m.mem->CurrentWriteAddr(), (uintptr_t) (label_pos - m.mem->CurrentWriteAddr()));
+    }
+  }
+  if (m.mem->HasWriteError()) {
+    return Err::OutOfMemory();
+  }
+  if (Err err = m.mem->MakeExecutable(); !err.IsOk()) {
+    return err;
+  }
+  return entries;
+}
+
+Err Compiler::CompileLazy(OperationStream &stream, EOFMode eof_mode) noexcept {
+  m.entry = nullptr;
+  m.lazy = std::make_unique<LazyCode>(LazyCode{.mem = *m.mem, .stream = stream, .eof_mode = eof_mode, .stubs = {}});
+  void *entry = m.mem->CurrentWriteAddr();
+  EmitEntry(*m.mem);
+  if (nullptr != stream.First()) {
+    EmitContext ctx{.mem = *m.mem,
+                    .profile = stream.Profile(),
+                    .eof_mode = eof_mode,
+                    .speculations = nullptr,
+                    .guards = {},
+                    .lazy = m.lazy.get(),
+                    .runtime = nullptr,
+                    .relocations = nullptr,
+                    .operations = nullptr,
+                    .counters = nullptr};
+    emit_lazy_stub(ctx, stream.First(), nullptr);
+  } else {
+    EmitExit(*m.mem);
+  }
+  if (m.mem->HasWriteError()) {
+    return Err::OutOfMemory();
+  }
+  if (Err err = m.mem->MakeExecutable(); !err.IsOk()) {
+    return err;
+  }
+  m.entry = reinterpret_cast<CodeEntry>(entry);
   return Err::Ok();
 }
@@ -4,49 +4,147 @@
 
 #include <memory>
 #include <utility>
+#include <vector>
 
+#include "assembler.h"
 #include "error.h"
 #include "instr.h"
 #include "mem.h"
 
+struct CodeCounters;
+struct LazyCode;
+class PerfLog;
+
+/**
+ * An assumption about the program, which holds most of the time.  The
+ * compiled code checks it with a cheap guard.  If the guard fails, the
+ * code deoptimizes: it returns to the interpreter at the operation, and
+ * reports the speculation in ExecState::exit.
+ */
+struct Speculation {
+  enum class Kind {
+    // The loop of the label is never entered
+    LOOP_NOT_ENTERED,
+    // The source cell of the multiplication always has the value
+    CELL_VALUE,
+  };
+
+  Kind kind;
+  Operation *op;
+  uint8_t value;
+  // How often the guard failed
+  uint64_t failures;
+};
+
+/**
+ * Code of a standalone executable, the runtime followed by the program.
+ * Offsets count from the start of the code.
+ */
+struct StandaloneCode {
+  std::vector<uint8_t> code;
+  size_t entry;
+  // The data segment, which the runtime expects at this offset
+  size_t data_offset;
+  size_t data_size;
+};
+
+/**
+ * Code of the whole program, which can run in another process once it is
+ * relocated.  Offsets count from the start of the code.
+ */
+struct RelocatableCode {
+  // The addresses of functions of bf-cc in the code
+  using Relocations = std::vector<std::pair<size_t, RuntimeFunction>>;
+
+  std::vector<uint8_t> code;
+  size_t entry;
+  Relocations relocations;
+  // Where the code of each operation starts, in the order of the code,
+  // followed by the start of the exit with nullptr
+  std::vector<std::pair<size_t, const Operation *>> operations;
+};
+
 class Compiler final {
-private:
-  using CodeEntry = void (*)(uint8_t *);
+public:
+  using CodeEntry = void (*)(ExecState *);
+  // Entries of a compiled loop, by the labels of the loops inside of it
+  using LoopEntries = std::vector<std::pair<const Operation *, CodeEntry>>;
 
+private:
   struct M {
     CodeEntry entry;
     std::unique_ptr<CodeArea> mem;
+    std::unique_ptr<LazyCode> lazy;
   } m;
 
-  explicit Compiler(M m) : m(std::move(m)) {
-  }
+  explicit Compiler(M m) noexcept;
 
   Compiler(const Compiler &) = delete;
   Compiler &operator=(const Compiler &) = delete;
 
 public:
-  static std::variant<Compiler, Err> Create() {
-    auto mem = CodeArea::Create();
-    if (0 != mem.index()) {
-      return std::get<Err>(std::move(mem));
-    }
-    return Compiler(M{.entry = nullptr, .mem = std::make_unique<CodeArea>(std::move(std::get<CodeArea>(mem)))});
-  }
+  static std::variant<Compiler, Err> Create();
 
-  Compiler(Compiler &&other) noexcept : m(std::exchange(other.m, {nullptr, nullptr})) {
-  }
+  ~Compiler();
 
-  Compiler &operator=(Compiler &&other) noexcept {
-    m = std::move(other.m);
-    return *this;
-  }
+  Compiler(Compiler &&other) noexcept;
+
+  Compiler &operator=(Compiler &&other) noexcept;
+
+  /**
+   * Compiles the whole program.  The code is described to perf, if a log
+   * is given.  If counters are given, the code counts the entries and
+   * iterations of every loop and the clock ticks it runs.
+   */
+  Err Compile(OperationStream &, EOFMode, PerfLog * = nullptr, CodeCounters * = nullptr) noexcept;
 
-  Err Compile(OperationStream &, EOFMode) noexcept;
+  /**
+   * Compiles only a stub for the program.  Top-level regions and loops
+   * are compiled when they run for the first time, and their stubs are
+   * patched to jump right to the compiled code.  The stream must not
+   * change as long as the code runs.
+   */
+  Err CompileLazy(OperationStream &, EOFMode) noexcept;
+
+  /**
+   * Compiles the program for a standalone executable, which needs neither
+   * the compiler nor the C library at runtime.  The code does not depend
+   * on the address it is loaded at.
+   */
+  static std::variant<StandaloneCode, Err> CompileStandalone(OperationStream &,
+                                                             EOFMode,
+                                                             const StandaloneHeap &) noexcept;
+
+  /**
+   * Compiles the program like Compile, into code which can be stored and
+   * run by another process, see CodeCache.
+   */
+  static std::variant<RelocatableCode, Err> CompileRelocatable(OperationStream &, EOFMode) noexcept;
+
+  /**
+   * Compiles the loop of the label, which returns after the loop ended.
+   * The loop and every loop inside of it can be entered at its label with
+   * the state of the interpreter, which runs the next iteration of an
+   * active loop.  The code relies on the speculations, which must stay
+   * alive as long as the code.  Returns no entries for loops which jump
+   * out of their body.
+   *
+   * Can be called after Compile and after other loops were compiled,
+   * previously compiled code stays valid.
+   */
+  std::variant<LoopEntries, Err> CompileLoop(OperationStream &,
+                                             Operation *label,
+                                             EOFMode,
+                                             const std::vector<Speculation *> &speculations = {}) noexcept;
 
   void RunCode(Heap &heap) noexcept {
-    CodeEntry entry = m.entry;
-    uint8_t *heap_addr = heap.BaseAddress();
-    entry(heap_addr);
+    ExecState state{.cell = heap.CellAddress(), .loop_counter = 0, .resume = nullptr, .exit = 0};
+    m.entry(&state);
+    heap.SetCellAddress(state.cell);
+  }
+
+  size_t CodeSize() const noexcept {
+    return m.mem->Size();
   }
 
   void Dump() const noexcept {
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: MIT License
+#include "emit_asm.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "platform.h"
+
+#if defined(IS_X86_64)
+static constexpr const char *COMMENT = "#";
+// The immediate of MOV rax, addr
+static constexpr size_t RELOCATION_SIZE = 8;
+#endif
+#if defined(IS_AARCH64)
+static constexpr const char *COMMENT = "//";
+// The four moves of LoadAddress
+static constexpr size_t RELOCATION_SIZE = 16;
+#endif
+
+// Bytes per line of data directives
+static constexpr size_t LINE_SIZE = 16;
+
+static const char *instruction_name(Instruction code) {
+  switch (code) {
+  case Instruction::NOP:
+    return "NOP";
+  case Instruction::INCR_CELL:
+    return "INCR_CELL";
+  case Instruction::DECR_CELL:
+    return "DECR_CELL";
+  case Instruction::IMUL_CELL:
+    return "IMUL_CELL";
+  case Instruction::DMUL_CELL:
+    return "DMUL_CELL";
+  case Instruction::SET_CELL:
+    return "SET_CELL";
+  case Instruction::INCR_PTR:
+    return "INCR_PTR";
+  case Instruction::DECR_PTR:
+    return "DECR_PTR";
+  case Instruction::READ:
+    return "READ";
+  case Instruction::WRITE:
+    return "WRITE";
+  case Instruction::JZ:
+    return "JZ";
+  case Instruction::JNZ:
+    return "JNZ";
+  case Instruction::LABEL:
+    return "LABEL";
+  case Instruction::FIND_CELL_LOW:
+    return "FIND_CELL_LOW";
+  case Instruction::FIND_CELL_HIGH:
+    return "FIND_CELL_HIGH";
+  case Instruction::DJNZ:
+    return "DJNZ";
+  }
+  return "?";
+}
+
+static const char *symbol(RuntimeFunction function) {
+  return RuntimeFunction::READ == function ? "bf_read" : "bf_write";
+}
+
+/**
+ * The comment of a block, the operation with its operands and the offset
+ * in the source.  The partner of jumps and labels is left out, it is an
+ * address.  The block without operation is the exit.
+ */
+static void emit_comment(std::string &out, const Operation *op) {
+  if (nullptr == op) {
+    out += "\n\t";
+    out += COMMENT;
+    out += " exit\n";
+    return;
+  }
+  char line[128];
+  const bool linked = op->IsJump() || op->Is(Instruction::LABEL);
+  int length = std::snprintf(line, sizeof(line), "\n\t%s %s", COMMENT, instruction_name(op->OpCode()));
+  if (!linked) {
+    length += std::snprintf(line + length, sizeof(line) - (size_t) length, " %" PRIdPTR ",", op->Operand1());
+  }
+  length += std::snprintf(line + length,
+                          sizeof(line) - (size_t) length,
+                          " %" PRIdPTR ", %" PRIdPTR,
+                          op->Operand2(),
+                          op->Operand3());
+  if (Operation::NO_SOURCE != op->Source()) {
+    std::snprintf(line + length, sizeof(line) - (size_t) length, " (source %" PRIu32 ")", op->Source());
+  }
+  out += line;
+  out += '\n';
+}
+
+static void emit_code(std::string &out, const std::vector<uint8_t> &code, size_t from, size_t to) {
+  char line[32];
+#if defined(IS_X86_64)
+  for (size_t start = from; start < to; start += LINE_SIZE) {
+    out += "\t.byte\t";
+    for (size_t i = start; i < to && i < start + LINE_SIZE; ++i) {
+      std::snprintf(line, sizeof(line), i == start ? "0x%02x" : ", 0x%02x", code[i]);
+      out += line;
+    }
+    out += '\n';
+  }
+#endif
+#if defined(IS_AARCH64)
+  // Instructions, so that tools do not take them for data
+  for (size_t i = from; i + 4 <= to; i += 4) {
+    uint32_t instruction = 0;
+    std::memcpy(&instruction, code.data() + i, sizeof(instruction));
+    std::snprintf(line, sizeof(line), "\t.inst\t0x%08" PRIx32 "\n", instruction);
+    out += line;
+  }
+#endif
+}
+
+static void emit_relocation(std::string &out,
+                            const std::vector<uint8_t> &code,
+                            size_t offset,
+                            RuntimeFunction function) {
+  char line[64];
+#if defined(IS_X86_64)
+  (void) code;
+  (void) offset;
+  std::snprintf(line, sizeof(line), "\t.quad\t%s\n", symbol(function));
+  out += line;
+#endif
+#if defined(IS_AARCH64)
+  // The moves keep their register
+  const unsigned int target = code[offset] & 0x1F;
+  static const char *const MOVES[] = {
+      "\tmovz\tx%u, #:abs_g0_nc:%s\n",
+      "\tmovk\tx%u, #:abs_g1_nc:%s, lsl 16\n",
+      "\tmovk\tx%u, #:abs_g2_nc:%s, lsl 32\n",
+      "\tmovk\tx%u, #:abs_g3:%s, lsl 48\n",
+  };
+  for (const char *move : MOVES) {
+    std::snprintf(line, sizeof(line), move, target, symbol(function));
+    out += line;
+  }
+#endif
+}
+
+/**
+ * Emits the code in the range, with the relocations in it as symbols.
+ */
+static void emit_range(std::string &out, const RelocatableCode &code, size_t &relocation, size_t from, size_t to) {
+  while (from < to) {
+    size_t end = to;
+    if (relocation < code.relocations.size() && code.relocations[relocation].first < to) {
+      end = code.relocations[relocation].first;
+    }
+    emit_code(out, code.code, from, end);
+    from = end;
+    if (end < to) {
+      emit_relocation(out, code.code, end, code.relocations[relocation].second);
+      from += RELOCATION_SIZE;
+      ++relocation;
+    }
+  }
+}
+
+std::string EmitAssemblySource(const RelocatableCode &code) {
+  std::string out{};
+  out += COMMENT;
+  out += " Generated by bf-cc\n\t.text\n\t.globl\tbf_program\n";
+#if defined(IS_LINUX)
+  out += "\t.type\tbf_program, %function\n";
+#endif
+  out += "bf_program:\n\t";
+  out += COMMENT;
+  out += " entry\n";
+  size_t relocation = 0;
+  size_t offset = 0;
+  for (const auto &[start, op] : code.operations) {
+    if (offset < start) {
+      emit_range(out, code, relocation, offset, start);
+      offset = start;
+    }
+    emit_comment(out, op);
+  }
+  emit_range(out, code, relocation, offset, code.code.size());
+#if defined(IS_LINUX)
+  out += "\t.size\tbf_program, .-bf_program\n";
+  // The code does not need an executable stack
+  out += "\t.section\t.note.GNU-stack,\"\",%progbits\n";
+#endif
+  return out;
+}
@@ -0,0 +1,19 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_EMIT_ASM_H
+#define BF_CC_EMIT_ASM_H 1
+
+#include <string>
+
+#include "compiler.h"
+
+/**
+ * Writes the code as source for the GNU assembler, with a comment for the
+ * operation of each block of code.  The backends emit machine code only,
+ * so the code is listed as data directives, which assemble to the same
+ * bytes.  The addresses of the runtime are references to the symbols
+ * bf_read and bf_write.  The code is the function bf_program, which takes
+ * an ExecState like the code of the compiler.
+ */
+std::string EmitAssemblySource(const RelocatableCode &);
+
+#endif /* BF_CC_EMIT_ASM_H */
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: MIT License
+#include "emit_c.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// What bf_read does at the end of the input, by EOF mode
+static const char *EOF_STATEMENTS[] = {
+    "",
+    "return;",
+    "input = 0;",
+    "input = 255;",
+};
+
+template <typename... Args>
+static void append(std::string &out, const char *format, Args... args) {
+  const size_t start = out.size();
+  const int length = std::snprintf(nullptr, 0, format, args...);
+  out.resize(start + (size_t) length + 1);
+  std::snprintf(out.data() + start, (size_t) length + 1, format, args...);
+  out.resize(start + (size_t) length);
+}
+
+static void indent(std::string &out, size_t depth) {
+  out.append(2 * depth, ' ');
+}
+
+static long long operand(intptr_t value) {
+  return (long long) value;
+}
+
+static unsigned int cell_value(intptr_t value) {
+  return (uint8_t) value;
+}
+
+static void emit_operation(std::string &out, const Operation *op) {
+  switch (op->OpCode()) {
+  case Instruction::INCR_CELL:
+    append(out, "p[%lld] += %u;\n", operand(op->Operand2()), cell_value(op->Operand1()));
+    break;
+  case Instruction::DECR_CELL:
+    append(out, "p[%lld] -= %u;\n", operand(op->Operand2()), cell_value(op->Operand1()));
+    break;
+  case Instruction::IMUL_CELL:
+    append(out,
+           "p[%lld] += %uu * p[%lld];\n",
+           operand(op->Operand2()),
+           cell_value(op->Operand1()),
+           operand(op->Operand3()));
+    break;
+  case Instruction::DMUL_CELL:
+    append(out,
+           "p[%lld] -= %uu * p[%lld];\n",
+           operand(op->Operand2()),
+           cell_value(op->Operand1()),
+           operand(op->Operand3()));
+    break;
+  case Instruction::SET_CELL:
+    append(out, "p[%lld] = %u;\n", operand(op->Operand2()), cell_value(op->Operand1()));
+    break;
+  case Instruction::INCR_PTR:
+    append(out, "p += %lld;\n", operand(op->Operand1()));
+    break;
+  case Instruction::DECR_PTR:
+    append(out, "p -= %lld;\n", operand(op->Operand1()));
+    break;
+  case Instruction::READ:
+    append(out, "bf_read(&p[%lld]);\n", operand(op->Operand2()));
+    break;
+  case Instruction::WRITE:
+    append(out, "putchar(p[%lld]);\n", operand(op->Operand2()));
+    break;
+  case Instruction::FIND_CELL_HIGH:
+    append(out, "while (*p != %u) p += %lld;\n", cell_value(op->Operand1()), operand(op->Operand2()));
+    break;
+  case Instruction::FIND_CELL_LOW:
+    append(out, "while (*p != %u) p -= %lld;\n", cell_value(op->Operand1()), operand(op->Operand2()));
+    break;
+  default:
+    break;
+  }
+}
+
+/**
+ * Emits jumps and labels as blocks.  A guard right around a loop on the
+ * same cell is a while loop, other guards are if statements and other
+ * loops do-while loops.
+ */
+static void emit_structured(std::string &out, const std::vector<const Operation *> &ops) {
+  std::unordered_map<const Operation *, size_t> indices{};
+  for (size_t i = 0; i < ops.size(); ++i) {
+    indices.emplace(ops[i], i);
+  }
+  std::unordered_set<const Operation *> while_loops{};
+  size_t depth = 1;
+  for (size_t i = 0; i < ops.size(); ++i) {
+    const Operation *op = ops[i];
+    const Operation *partner = (const Operation *) op->Operand1();
+    switch (op->OpCode()) {
+    case Instruction::JZ: {
+      // The loop must fill the guard, from right behind the jump to right before its label
+      const Operation *next = i + 1 < ops.size() ? ops[i + 1] : nullptr;
+      const Operation *loop = nullptr != next && next->Is(Instruction::LABEL) ? (const Operation *) next->Operand1()
+                                                                               : nullptr;
+      indent(out, depth++);
+      if (nullptr != loop && loop->Is(Instruction::JNZ) && loop->Operand2() == op->Operand2() &&
+          indices.at(loop) + 1 == indices.at(partner)) {
+        while_loops.insert(next);
+        while_loops.insert(loop);
+        while_loops.insert(partner);
+        append(out, "while (p[%lld]) {\n", operand(op->Operand2()));
+        break;
+      }
+      append(out, "if (p[%lld]) {\n", operand(op->Operand2()));
+    } break;
+    case Instruction::LABEL:
+      if (while_loops.contains(op)) {
+        break;
+      }
+      if (partner->Is(Instruction::JZ)) {
+        indent(out, --depth);
+        out += "}\n";
+      } else {
+        indent(out, depth++);
+        if (partner->Is(Instruction::DJNZ)) {
+          append(out, "counter = %lld;\n", operand(partner->Operand2()));
+          indent(out, depth - 1);
+        }
+        out += "do {\n";
+      }
+      break;
+    case Instruction::JNZ:
+      indent(out, --depth);
+      if (while_loops.contains(op)) {
+        out += "}\n";
+      } else {
+        append(out, "} while (p[%lld]);\n", operand(op->Operand2()));
+      }
+      break;
+    case Instruction::DJNZ:
+      indent(out, --depth);
+      out += "} while (--counter);\n";
+      break;
+    default:
+      indent(out, depth);
+      emit_operation(out, op);
+      break;
+    }
+  }
+}
+
+/**
+ * Emits jumps as gotos to the labels, which are named after their index.
+ */
+static void emit_unstructured(std::string &out, const std::vector<const Operation *> &ops) {
+  std::unordered_map<const Operation *, size_t> indices{};
+  for (size_t i = 0; i < ops.size(); ++i) {
+    indices.emplace(ops[i], i);
+  }
+  const auto label = [&indices](intptr_t target) -> long long {
+    const auto found = indices.find((const Operation *) target);
+    return indices.end() == found ? -1 : (long long) found->second;
+  };
+  for (size_t i = 0; i < ops.size(); ++i) {
+    const Operation *op = ops[i];
+    const Operation *partner = (const Operation *) op->Operand1();
+    switch (op->OpCode()) {
+    case Instruction::JZ:
+      append(out, "  if (!p[%lld]) goto L%lld;\n", operand(op->Operand2()), label(op->Operand1()));
+      break;
+    case Instruction::JNZ:
+      append(out, "  if (p[%lld]) goto L%lld;\n", operand(op->Operand2()), label(op->Operand1()));
+      break;
+    case Instruction::DJNZ:
+      append(out, "  if (--counter) goto L%lld;\n", label(op->Operand1()));
+      break;
+    case Instruction::LABEL:
+      // Entering a counted loop sets the counter, its jump continues after that
+      if (nullptr != partner && partner->Is(Instruction::DJNZ)) {
+        append(out, "  counter = %lld;\n", operand(partner->Operand2()));
+      }
+      append(out, "L%zu:;\n", i);
+      break;
+    default:
+      indent(out, 1);
+      emit_operation(out, op);
+      break;
+    }
+  }
+}
+
+std::string EmitCSource(OperationStream &stream, EOFMode eof_mode, const CSourceHeap &heap) {
+  std::vector<const Operation *> ops{};
+  ops.reserve(stream.Size());
+  bool reads = false;
+  bool counted = false;
+  for (const Operation *op : stream) {
+    if (op->Is(Instruction::NOP)) {
+      continue;
+    }
+    reads = reads || op->Is(Instruction::READ);
+    counted = counted || op->Is(Instruction::DJNZ);
+    ops.push_back(op);
+  }
+  std::string out{"/* Generated by bf-cc */\n#include <stdint.h>\n#include <stdio.h>\n\n"};
+  if (reads) {
+    append(out,
+           "static void bf_read(uint8_t *c) {\n"
+           "  int input;\n"
+           "  fflush(stdout);\n"
+           "  input = getchar();\n"
+           "  if (EOF == input) {\n"
+           "    %s\n"
+           "  }\n"
+           "  *c = (uint8_t) input;\n"
+           "}\n\n",
+           EOF_STATEMENTS[(uint32_t) eof_mode]);
+  }
+  append(out,
+         "int main(void) {\n"
+         "  static uint8_t tape[%zu];\n"
+         "  uint8_t *p = tape + %zu;\n",
+         heap.guard + heap.size + heap.guard,
+         heap.guard + heap.origin);
+  if (counted) {
+    out += "  uintptr_t counter;\n";
+  }
+  out += "\n";
+  if (stream.IsStructured()) {
+    emit_structured(out, ops);
+  } else {
+    emit_unstructured(out, ops);
+  }
+  out += "  return 0;\n}\n";
+  return out;
+}
@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_EMIT_C_H
+#define BF_CC_EMIT_C_H 1
+
+#include <cstddef>
+#include <string>
+
+#include "instr.h"
+
+/**
+ * Tape of the C program, in cells.  The guard in front and behind only
+ * keeps programs with unknown tape bounds inside the array, it does not
+ * catch accesses outside of the tape.
+ */
+struct CSourceHeap {
+  size_t size;
+  size_t guard;
+  // The cell the program starts at, counted from the start of the tape
+  size_t origin;
+};
+
+/**
+ * Lowers the optimized program to a portable C program, so that it can be
+ * compiled by a C compiler instead of bf-cc.  The program is a single
+ * main function with the tape as a static array, loops become while and
+ * do-while statements.  Jumps which are not nested become gotos.
+ */
+std::string EmitCSource(OperationStream &, EOFMode, const CSourceHeap &);
+
+#endif /* BF_CC_EMIT_C_H */
@@ -24,7 +24,8 @@ void Error(const char *fmt, ...) {
 
 void Error(const Err &error) {
   char native_err_str[256] = {};
-  if (error.NativeErrno() != 0) {
+  if (error.NativeErrno() != 0 && error.Code() != Err::Code::INVALID_PIPELINE &&
+      error.Code() != Err::Code::INVALID_PROFILE && error.Code() != Err::Code::INVALID_IR) {
     std::string err_string = NativeErrorToString(error.NativeErrno());
     sprintf(native_err_str, ": %s", err_string.c_str());
   }
@@ -44,6 +45,18 @@ void Error(const Err &error) {
   case Err::Code::IO:
     Error("IO error%s", native_err_str);
     break;
+  case Err::Code::INVALID_PIPELINE:
+    Error("Unknown optimizer pass in line %lld of the pipeline", (long long) error.NativeErrno());
+    break;
+  case Err::Code::INVALID_PROFILE:
+    Error("Invalid entry in line %lld of the profile", (long long) error.NativeErrno());
+    break;
+  case Err::Code::PROFILE_MISMATCH:
+    Error("The profile was recorded for another program");
+    break;
+  case Err::Code::INVALID_IR:
+    Error("Invalid serialized program at offset %lld", (long long) error.NativeErrno());
+    break;
   case Err::Code::CODE_INVALID_OFFSET:
     Error("Cannot emmit instruction - invalid offset");
   case Err::Code::OK:
@@ -18,6 +18,10 @@ public:
     MEM_PROTECT,
     CODE_INVALID_OFFSET,
     IO,
+    INVALID_PIPELINE,
+    INVALID_PROFILE,
+    PROFILE_MISMATCH,
+    INVALID_IR,
   };
 
 private:
@@ -51,6 +55,21 @@ public:
   static Err IO(const int64_t err) noexcept {
     return Err(M{.code = Err::Code::IO, .native = err});
   }
+  // The native error is the line number of the invalid entry
+  static Err InvalidPipeline(const int64_t line) noexcept {
+    return Err(M{.code = Err::Code::INVALID_PIPELINE, .native = line});
+  }
+  // The native error is the line number of the invalid entry
+  static Err InvalidProfile(const int64_t line) noexcept {
+    return Err(M{.code = Err::Code::INVALID_PROFILE, .native = line});
+  }
+  static Err ProfileMismatch() noexcept {
+    return Err(M{.code = Err::Code::PROFILE_MISMATCH, .native = 0});
+  }
+  // The native error is the offset of the invalid byte
+  static Err InvalidIR(const int64_t offset) noexcept {
+    return Err(M{.code = Err::Code::INVALID_IR, .native = offset});
+  }
 
   inline bool IsOk() const noexcept {
     return m.code == Err::Code::OK;
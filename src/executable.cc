@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: MIT License
+#include "executable.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include "assembler.h"
+#include "platform.h"
+
+// The code starts at this offset, in the file and in memory
+static const size_t CODE_OFFSET = 0x1000;
+
+static const size_t ELF_HEADER_SIZE = 64;
+static const size_t PROGRAM_HEADER_SIZE = 56;
+static const size_t PROGRAM_HEADER_COUNT = 3;
+
+static const uint32_t PT_LOAD = 1;
+static const uint32_t PT_GNU_STACK = 0x6474E551;
+static const uint32_t PF_X = 1;
+static const uint32_t PF_W = 2;
+static const uint32_t PF_R = 4;
+
+/**
+ * Appends the value in little endian byte order.
+ */
+template <typename T>
+static void put(std::string &out, T value) {
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    out += (char) (uint8_t) (value >> (8 * i));
+  }
+}
+
+static void put_program_header(std::string &out,
+                               uint32_t type,
+                               uint32_t flags,
+                               uint64_t offset,
+                               uint64_t address,
+                               uint64_t file_size,
+                               uint64_t memory_size,
+                               uint64_t alignment) {
+  put<uint32_t>(out, type);
+  put<uint32_t>(out, flags);
+  put<uint64_t>(out, offset);
+  put<uint64_t>(out, address);
+  put<uint64_t>(out, address);
+  put<uint64_t>(out, file_size);
+  put<uint64_t>(out, memory_size);
+  put<uint64_t>(out, alignment);
+}
+
+std::string BuildExecutable(const StandaloneCode &code) {
+  std::string out{};
+  out.reserve(CODE_OFFSET + code.code.size());
+  // ELF64, little endian, current version, System V ABI
+  out.append("\x7F"
+             "ELF\x02\x01\x01\x00",
+             8);
+  out.append(8, '\0');
+  // ET_DYN, without an interpreter the kernel loads it at any address
+  put<uint16_t>(out, 3);
+#if defined(IS_X86_64)
+  put<uint16_t>(out, 62);
+#endif
+#if defined(IS_AARCH64)
+  put<uint16_t>(out, 183);
+#endif
+  put<uint32_t>(out, 1);
+  put<uint64_t>(out, CODE_OFFSET + code.entry);
+  put<uint64_t>(out, ELF_HEADER_SIZE);
+  // No section headers
+  put<uint64_t>(out, 0);
+  put<uint32_t>(out, 0);
+  put<uint16_t>(out, ELF_HEADER_SIZE);
+  put<uint16_t>(out, PROGRAM_HEADER_SIZE);
+  put<uint16_t>(out, PROGRAM_HEADER_COUNT);
+  put<uint16_t>(out, 0);
+  put<uint16_t>(out, 0);
+  put<uint16_t>(out, 0);
+  // The headers are part of the code segment
+  const size_t code_end = CODE_OFFSET + code.code.size();
+  put_program_header(out, PT_LOAD, PF_R | PF_X, 0, 0, code_end, code_end, STANDALONE_ALIGNMENT);
+  // The data segment has the same offset to the alignment as the code
+  put_program_header(out,
+                     PT_LOAD,
+                     PF_R | PF_W,
+                     CODE_OFFSET,
+                     CODE_OFFSET + code.data_offset,
+                     0,
+                     code.data_size,
+                     STANDALONE_ALIGNMENT);
+  put_program_header(out, PT_GNU_STACK, PF_R | PF_W, 0, 0, 0, 0, 16);
+  out.resize(CODE_OFFSET, '\0');
+  out.append((const char *) code.code.data(), code.code.size());
+  return out;
+}
+
+Err WriteExecutable(std::string_view path, const StandaloneCode &code) {
+  const std::string path_string{path};
+  return WriteExecutableFile(path_string, BuildExecutable(code));
+}
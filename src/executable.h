@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_EXECUTABLE_H
+#define BF_CC_EXECUTABLE_H 1
+
+#include <string>
+#include <string_view>
+
+#include "compiler.h"
+#include "error.h"
+
+/**
+ * Builds a static, position independent ELF64 executable for Linux on the
+ * host architecture.  The code is loaded read-only and executable, the
+ * data segment of the runtime is zero-initialized and not part of the
+ * file.
+ */
+std::string BuildExecutable(const StandaloneCode &);
+
+/**
+ * Builds the executable and writes it to the file.
+ */
+Err WriteExecutable(std::string_view path, const StandaloneCode &);
+
+#endif /* BF_CC_EXECUTABLE_H */
@@ -2,8 +2,10 @@
 #include "instr.h"
 
 #include <cstdio>
+#include <vector>
 
 #include "debug.h"
+#include "loop_tree.h"
 
 void Operation::Dump() const {
   printf("%zu ", (uintptr_t) this);
@@ -44,6 +46,9 @@ void Operation::Dump() const {
   case Instruction::JNZ: {
     putchar(']');
   } break;
+  case Instruction::DJNZ: {
+    putchar('}');
+  } break;
   case Instruction::LABEL: {
     putchar('#');
   } break;
@@ -57,7 +62,7 @@ void Operation::Dump() const {
     putchar('?');
   } break;
   }
-  printf(" %zd %zd\n", Operand1(), Operand2());
+  printf(" %zd %zd %zd\n", Operand1(), Operand2(), Operand3());
 }
 
 void OperationStream::Swap(Operation *left, Operation *right) {
@@ -85,6 +90,77 @@ void OperationStream::Swap(Operation *left, Operation *right) {
   if (right->m.prev != NULL) right->m.prev->m.next = right;
 }
 
+OperationStream OperationStream::CreateBlock(size_t count) {
+  OperationStream stream = OperationStream::Create();
+  if (0 == count) {
+    return stream;
+  }
+  Operation *block = static_cast<Operation *>(::operator new(count * sizeof(Operation), std::nothrow));
+  if (!block) {
+    Error(Err::OutOfMemory());
+  }
+  for (size_t i = 0; i < count; ++i) {
+    Operation *op = new (block + i) Operation(Operation::Create(Instruction::NOP));
+    op->m.prev = i > 0 ? block + i - 1 : nullptr;
+    op->m.next = i + 1 < count ? block + i + 1 : nullptr;
+  }
+  stream.m.head = block;
+  stream.m.tail = block + count - 1;
+  stream.m.length = count;
+  stream.m.block = block;
+  stream.m.block_size = count;
+  return stream;
+}
+
+OperationStream OperationStream::Split(Operation *first) {
+  ASSERT(nullptr == m.loops, "Can not split a stream with a loop tree");
+  ASSERT(nullptr == m.block, "Can not split a stream with a block");
+  OperationStream rest = OperationStream::Create();
+  rest.m.profile = m.profile;
+  if (nullptr == first) {
+    return rest;
+  }
+  size_t length = 0;
+  for (Operation *op = first; op; op = op->m.next) {
+    ++length;
+  }
+  rest.m.head = first;
+  rest.m.tail = m.tail;
+  rest.m.length = length;
+  m.tail = first->m.prev;
+  m.length -= length;
+  if (m.tail) {
+    m.tail->m.next = nullptr;
+  } else {
+    m.head = nullptr;
+  }
+  first->m.prev = nullptr;
+  return rest;
+}
+
+void OperationStream::Concat(OperationStream &other) {
+  ASSERT(nullptr == m.loops && nullptr == other.m.loops, "Can not concat streams with a loop tree");
+  ASSERT(nullptr == other.m.block, "Can not concat a stream with a block");
+  if (nullptr == other.m.head) {
+    return;
+  }
+  if (m.tail) {
+    m.tail->m.next = other.m.head;
+    other.m.head->m.prev = m.tail;
+  } else {
+    m.head = other.m.head;
+  }
+  m.tail = other.m.tail;
+  m.length += other.m.length;
+  other.m.head = nullptr;
+  other.m.tail = nullptr;
+  other.m.length = 0;
+}
+
+void OperationStream::ForgetLoop(Operation *instr) {
+  m.loops->Remove(instr);
+}
+
 void OperationStream::Dump() {
   for (auto *instr : *this) {
     instr->Dump();
@@ -92,7 +168,7 @@ void OperationStream::Dump() {
 }
 
 static bool is_single_jump(const OperationStream::Iterator &iter) {
-  if (((Operation *) iter->Operand1())->Is(Instruction::JNZ)) {
+  if (((Operation *) iter->Operand1())->IsAny({Instruction::JNZ, Instruction::DJNZ})) {
     return false;
   }
   return !(iter - 1)->Is(Instruction::JNZ);
@@ -114,10 +190,10 @@ void OperationStream::Dump2() {
       printf("-{%zu, %zd}", iter->Operand1(), iter->Operand2());
     } break;
     case Instruction::IMUL_CELL: {
-      printf("*{%zu, %zd}", iter->Operand1(), iter->Operand2());
+      printf("*{%zu, %zd, %zd}", iter->Operand1(), iter->Operand2(), iter->Operand3());
     } break;
     case Instruction::DMUL_CELL: {
-      printf("/{%zu, %zd}", iter->Operand1(), iter->Operand2());
+      printf("/{%zu, %zd, %zd}", iter->Operand1(), iter->Operand2(), iter->Operand3());
     } break;
     case Instruction::SET_CELL: {
       printf("={%zu, %zd}", iter->Operand1(), iter->Operand2());
@@ -135,15 +211,31 @@ void OperationStream::Dump2() {
       printf(".{%zd}", iter->Operand2());
     } break;
     case Instruction::JZ: {
-      printf("\n%*s[\n%*s", indent_level, "", indent_level + 2, "");
+      printf("\n%*s[", indent_level, "");
+      if (0 != iter->Operand2()) {
+        printf("{%zd}", iter->Operand2());
+      }
+      printf("\n%*s", indent_level + 2, "");
       indent_level += 2;
     } break;
     case Instruction::JNZ: {
+      indent_level -= 2;
+      printf("\n%*s]", indent_level, "");
+      if (0 != iter->Operand2()) {
+        printf("{%zd}", iter->Operand2());
+      }
+      printf("\n%*s", indent_level, "");
+    } break;
+    case Instruction::DJNZ: {
       indent_level -= 2;
       printf("\n%*s]\n%*s", indent_level, "", indent_level, "");
     } break;
     case Instruction::LABEL: {
-      if (is_single_jump(iter)) {
+      const Operation *jump = (Operation *) iter->Operand1();
+      if (jump->Is(Instruction::DJNZ)) {
+        printf("\n%*s[x%zd\n%*s", indent_level, "", jump->Operand2(), indent_level + 2, "");
+        indent_level += 2;
+      } else if (is_single_jump(iter)) {
         indent_level -= 2;
         printf("\n%*s#\n%*s", indent_level, "", indent_level, "");
       }
@@ -198,6 +290,9 @@ void OperationStream::Verify() {
     } break;
     case Instruction::JNZ: {
     } break;
+    case Instruction::DJNZ: {
+      GUARANTEE(iter->Operand2() > 0, "Counted loop with invalid count: %zd", iter->Operand2());
+    } break;
     case Instruction::LABEL: {
     } break;
     case Instruction::FIND_CELL_LOW: {
@@ -212,6 +307,30 @@ void OperationStream::Verify() {
   }
 }
 
+bool OperationStream::IsStructured() {
+  std::vector<const Operation *> open{};
+  for (const Operation *op : *this) {
+    if (!op->IsJump() && !op->Is(Instruction::LABEL)) {
+      continue;
+    }
+    const Operation *partner = (const Operation *) op->Operand1();
+    if (nullptr == partner || (!partner->IsJump() && !partner->Is(Instruction::LABEL)) ||
+        (const Operation *) partner->Operand1() != op ||
+        op->Is(Instruction::LABEL) == partner->Is(Instruction::LABEL)) {
+      return false;
+    }
+    if (op->Is(Instruction::JZ) || (op->Is(Instruction::LABEL) && !partner->Is(Instruction::JZ))) {
+      // Opens a guard or a loop, which its partner closes
+      open.push_back(partner);
+    } else if (open.empty() || open.back() != op) {
+      return false;
+    } else {
+      open.pop_back();
+    }
+  }
+  return open.empty();
+}
+
 bool OperationStream::Iterator::LookingAt(const std::initializer_list<Instruction> pattern) {
   if (0 == pattern.size()) {
     return true;
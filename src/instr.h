@@ -4,6 +4,7 @@
 
 #include <cstdint>
 #include <initializer_list>
+#include <new>
 #include <utility>
 
 #include "error.h"
@@ -14,24 +15,30 @@
  * See the Operation class for the actual operation, Instruction is
  * only the OpCode of the Operation.
  *
- * Each operation can have up to two operands.  The operands for each
- * Instruction are (NULL means ignored and should be 0):
+ * Each operation can have up to three operands.  The operands for each
+ * Instruction are (NULL means ignored and should be 0, the third operand
+ * is NULL if not given):
  *
- *   NOP             [NULL, NULL]          Do nothing
- *   INCR_CELL       [AMOUNT, PTR OFFSET]  Increment the cell at PTR OFFSET by AMOUNT
- *   DECR_CELL       [AMOUNT, PTR OFFSET]  Decrement the cell at PTR OFFSET by AMOUNT
- *   IMUL_CELL       [AMOUNT, PTR OFFSET]  Increment cell at PTR OFFSET by a multiple of the current cell
- *   DMUL_CELL       [AMOUNT, PTR OFFSET]  Decrement cell at PTR OFFSET by a multiple of the current cell
- *   SET_CELL        [VALUE, PTR OFFSET]   Set the cell at PTR OFFSET to VALUE
- *   INCR_PTR        [AMOUNT, NULL]        Increment the cell pointer by AMOUNT
- *   DECR_PTR        [AMOUNT, NULL]        Decrement the cell pointer by AMOUNT
- *   READ            [NULL, PTR OFFSET]    Read from STDIN into the cell at PTR OFFSET
- *   WRITE           [NULL, PTR OFFSET]    Write to STDOUT the value from cell at PTR OFFSET
- *   JZ              [ADDR, NULL]          Jump to the label at ADDR if the cell value is 0
- *   JNZ             [ADDR, NULL]          Jump to the label at ADDR if the cell value is not 0
- *   LABEL           [ADDR, NULL]          Destination for jumps, ADDR is the jump which jumps to this label
- *   FIND_CELL_LOW   [VALUE, MOVE AMOUNT]  Find cell with VALUE, move the cell pointer downwards by MOVE AMOUNT
- *   FIND_CELL_HIGH  [VALUE, MOVE AMOUNT]  Find cell with VALUE, move the cell pointer upwards by MOVE AMOUNT
+ *   NOP             [NULL, NULL]                      Do nothing
+ *   INCR_CELL       [AMOUNT, PTR OFFSET]              Increment the cell at PTR OFFSET by AMOUNT
+ *   DECR_CELL       [AMOUNT, PTR OFFSET]              Decrement the cell at PTR OFFSET by AMOUNT
+ *   IMUL_CELL       [AMOUNT, PTR OFFSET, SRC OFFSET]  Add AMOUNT times cell SRC OFFSET to cell PTR OFFSET
+ *   DMUL_CELL       [AMOUNT, PTR OFFSET, SRC OFFSET]  Subtract AMOUNT times cell SRC OFFSET from cell PTR OFFSET
+ *   SET_CELL        [VALUE, PTR OFFSET]               Set the cell at PTR OFFSET to VALUE
+ *   INCR_PTR        [AMOUNT, NULL]                    Increment the cell pointer by AMOUNT
+ *   DECR_PTR        [AMOUNT, NULL]                    Decrement the cell pointer by AMOUNT
+ *   READ            [NULL, PTR OFFSET]                Read from STDIN into the cell at PTR OFFSET
+ *   WRITE           [NULL, PTR OFFSET]                Write to STDOUT the value from cell at PTR OFFSET
+ *   JZ              [ADDR, PTR OFFSET]                Jump to the label at ADDR if the cell at PTR OFFSET is 0
+ *   JNZ             [ADDR, PTR OFFSET]                Jump to the label at ADDR if the cell at PTR OFFSET is not 0
+ *   DJNZ            [ADDR, COUNT]                     Decrement the loop counter, jump to the label at ADDR if not 0
+ *   LABEL           [ADDR, NULL]                      Destination for jumps, ADDR is the jump which jumps to this label
+ *   FIND_CELL_LOW   [VALUE, MOVE AMOUNT]              Find cell with VALUE, move the pointer downwards by MOVE AMOUNT
+ *   FIND_CELL_HIGH  [VALUE, MOVE AMOUNT]              Find cell with VALUE, move the pointer upwards by MOVE AMOUNT
+ *
+ * A DJNZ closes a counted loop.  Entering its label sets the loop counter
+ * to COUNT, jumping back to the label does not.  Counted loops do not
+ * contain other loops, so there is only a single loop counter.
  */
 enum class Instruction : uint32_t {
   NOP = 1 << 0,
@@ -50,6 +57,7 @@ enum class Instruction : uint32_t {
   LABEL = 1 << 13,
   FIND_CELL_LOW = 1 << 14,
   FIND_CELL_HIGH = 1 << 15,
+  DJNZ = 1 << 16,
 };
 
 // Keep this in sync with the platform do_read functions!
@@ -65,12 +73,16 @@ class Operation final {
 public:
   typedef intptr_t operand_type;
 
+  // Source offset of operations which were not parsed from the program
+  static constexpr uint32_t NO_SOURCE = UINT32_MAX;
+
 private:
   struct M {
     Instruction code{Instruction::NOP};
+    uint32_t source{NO_SOURCE};
     Operation *next{nullptr};
     Operation *prev{nullptr};
-    intptr_t operands[2]{0, 0};
+    intptr_t operands[3]{0, 0, 0};
   } m;
 
   Operation(const Operation &) = delete;
@@ -79,21 +91,23 @@ private:
   explicit Operation(M m) : m(std::move(m)) {
   }
 
-  static Operation Create(enum Instruction code, intptr_t op1 = 0, intptr_t op2 = 0) {
+  static Operation Create(enum Instruction code, intptr_t op1 = 0, intptr_t op2 = 0, intptr_t op3 = 0) {
     return Operation(M{
         .code = code,
+        .source = NO_SOURCE,
         .next = nullptr,
         .prev = nullptr,
-        .operands = {op1, op2},
+        .operands = {op1, op2, op3},
     });
   }
 
-  static Operation *Allocate(enum Instruction code, intptr_t op1 = 0, intptr_t op2 = 0) {
+  static Operation *Allocate(enum Instruction code, intptr_t op1 = 0, intptr_t op2 = 0, intptr_t op3 = 0) {
     Operation *instr = new (std::nothrow) Operation(M{
         .code = code,
+        .source = NO_SOURCE,
         .next = nullptr,
         .prev = nullptr,
-        .operands = {op1, op2},
+        .operands = {op1, op2, op3},
     });
     if (!instr) {
       Error(Err::OutOfMemory());
@@ -102,7 +116,7 @@ private:
   }
 
 public:
-  Operation(Operation &&other) : m(std::exchange(other.m, {Instruction::NOP, nullptr, nullptr, {0, 0}})) {
+  Operation(Operation &&other) : m(std::exchange(other.m, {Instruction::NOP, NO_SOURCE, nullptr, nullptr, {0, 0, 0}})) {
   }
 
   Operation &operator=(Operation &&other) noexcept {
@@ -134,7 +148,20 @@ public:
   }
 
   inline bool IsJump() const {
-    return m.code == Instruction::JZ || m.code == Instruction::JNZ;
+    return m.code == Instruction::JZ || m.code == Instruction::JNZ || m.code == Instruction::DJNZ;
+  }
+
+  /**
+   * Offset of the character in the program this operation was parsed
+   * from.  All jumps and labels of a loop carry the offset of its opening
+   * bracket, which identifies the loop independent of the optimizations.
+   */
+  inline uint32_t Source() const noexcept {
+    return m.source;
+  }
+
+  inline void SetSource(uint32_t source) noexcept {
+    m.source = source;
   }
 
   inline intptr_t Operand1() const {
@@ -153,15 +180,31 @@ public:
     m.operands[1] = val;
   }
 
+  inline intptr_t Operand3() const {
+    return m.operands[2];
+  }
+
+  inline void SetOperand3(intptr_t val) {
+    m.operands[2] = val;
+  }
+
   void Dump() const;
 };
 
+class LoopTree;
+class LoopProfile;
+
 class OperationStream final {
 private:
   struct M {
     Operation *head;
     Operation *tail;
     std::size_t length;
+    LoopTree *loops;
+    const LoopProfile *profile;
+    // Operations allocated together by CreateBlock
+    Operation *block;
+    std::size_t block_size;
   } m;
 
   OperationStream(const OperationStream &) = delete;
@@ -170,6 +213,15 @@ private:
   explicit OperationStream(M m) : m(std::move(m)) {
   }
 
+  /**
+   * Deletes the operation, unless it lives in the block of the stream.
+   */
+  inline void Free(Operation *instr) {
+    if ((uintptr_t) instr - (uintptr_t) m.block >= m.block_size * sizeof(Operation)) {
+      delete instr;
+    }
+  }
+
 public:
   OperationStream(OperationStream &&other) noexcept : m(std::exchange(other.m, {})) {
   }
@@ -183,16 +235,26 @@ public:
     return OperationStream(M{});
   }
 
+  /**
+   * Creates a stream of count NOPs with a single allocation.  The
+   * operations are consecutive in memory, the n-th one is at First() + n.
+   * Operations added later are allocated one by one as usual.
+   */
+  static OperationStream CreateBlock(std::size_t count);
+
   ~OperationStream() {
     Operation *op = m.head;
     while (op) {
       Operation *next = op->m.next;
-      delete op;
+      Free(op);
       op = next;
     }
+    ::operator delete(m.block);
     m.head = nullptr;
     m.tail = nullptr;
     m.length = 0;
+    m.block = nullptr;
+    m.block_size = 0;
   }
 
   inline Operation *First() {
@@ -203,8 +265,36 @@ public:
     return m.tail;
   }
 
-  inline void Append(Instruction code, intptr_t op1 = 0, intptr_t op2 = 0) {
-    Operation *instr = Operation::Allocate(code, op1, op2);
+  inline std::size_t Size() const noexcept {
+    return m.length;
+  }
+
+  /**
+   * The loop nesting tree attached to this stream, if any.
+   * Deleting jumps or labels keeps the attached tree up to date.
+   */
+  inline LoopTree *Loops() {
+    return m.loops;
+  }
+
+  inline void SetLoops(LoopTree *loops) {
+    m.loops = loops;
+  }
+
+  /**
+   * The recorded execution profile of the program, nullptr if there is
+   * none.  Streams split off this stream share the profile.
+   */
+  inline const LoopProfile *Profile() const noexcept {
+    return m.profile;
+  }
+
+  inline void SetProfile(const LoopProfile *profile) noexcept {
+    m.profile = profile;
+  }
+
+  inline void Append(Instruction code, intptr_t op1 = 0, intptr_t op2 = 0, intptr_t op3 = 0) {
+    Operation *instr = Operation::Allocate(code, op1, op2, op3);
     ++m.length;
     if (!m.head) {
       m.head = instr;
@@ -218,8 +308,8 @@ public:
     }
   }
 
-  inline void Prepend(Instruction code, intptr_t op1 = 0, intptr_t op2 = 0) {
-    Operation *instr = Operation::Allocate(code, op1, op2);
+  inline void Prepend(Instruction code, intptr_t op1 = 0, intptr_t op2 = 0, intptr_t op3 = 0) {
+    Operation *instr = Operation::Allocate(code, op1, op2, op3);
     ++m.length;
     if (!m.head) {
       m.head = instr;
@@ -233,15 +323,17 @@ public:
     }
   }
 
-  inline void InsertBefore(Operation *instr, Instruction code, intptr_t op1 = 0, intptr_t op2 = 0) {
+  inline void InsertBefore(
+      Operation *instr, Instruction code, intptr_t op1 = 0, intptr_t op2 = 0, intptr_t op3 = 0) {
     if (nullptr == instr) {
-      Append(code, op1, op2);
+      Append(code, op1, op2, op3);
     } else if (nullptr == instr->m.prev) {
-      Prepend(code, op1, op2);
+      Prepend(code, op1, op2, op3);
     } else {
       Operation *prev = instr->m.prev;
       Operation *next = instr;
-      Operation *new_instr = Operation::Allocate(code, op1, op2);
+      Operation *new_instr = Operation::Allocate(code, op1, op2, op3);
+      ++m.length;
       prev->m.next = new_instr;
       next->m.prev = new_instr;
       new_instr->m.next = next;
@@ -275,12 +367,37 @@ public:
   }
 
   inline void Delete(Operation *instr) {
+    if (m.loops && (instr->IsJump() || instr->Is(Instruction::LABEL))) {
+      ForgetLoop(instr);
+    }
     Unlink(*instr);
-    delete instr;
+    Free(instr);
+  }
+
+  void ForgetLoop(Operation *instr);
+
+  /**
+   * Returns true, if operations of the stream live in a block, see
+   * CreateBlock.  Such a stream can not be split.
+   */
+  inline bool HasBlock() const noexcept {
+    return nullptr != m.block;
   }
 
   void Swap(Operation *left, Operation *right);
 
+  /**
+   * Moves the operations from the given one up to the end into a new
+   * stream.  Jumps and labels must not be split from their partners, and
+   * neither a loop tree nor a block may be attached.
+   */
+  OperationStream Split(Operation *first);
+
+  /**
+   * Moves all operations of the other stream to the end of this stream.
+   */
+  void Concat(OperationStream &other);
+
   class Iterator final {
   private:
     struct M {
@@ -435,6 +552,12 @@ public:
   void Dump2();
 
   void Verify();
+
+  /**
+   * Returns true, if every jump and its label point at each other, guards
+   * jump forward, loops jump backward, and guards and loops nest.
+   */
+  bool IsStructured();
 };
 
 #endif /* BF_CC_INSTR_H */
@@ -2,16 +2,478 @@
 #include "interp.h"
 
 #include <cstdint>
+#include <cinttypes>
 #include <cstdio>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
 
+#include "compiler.h"
 #include "instr.h"
 #include "mem.h"
 #include "platform.h"
+#include "profile.h"
+#include "trace.h"
 
-void Interpreter::Run(Heap &heap, OperationStream &stream, EOFMode eof_mode) const {
+static bool is_backward_jump(const Operation *op) {
+  return op->IsAny({Instruction::JNZ, Instruction::DJNZ});
+}
+
+/**
+ * Loop counters of a profiling run.  Loops start when their label is
+ * entered, every backward jump adds an iteration, and leaving the loop
+ * records the count.  A guard which is skipped records an entry without
+ * iterations.  A guard which has no loop left inside counts as a loop
+ * which runs once.
+ *
+ * The cost of a loop are the operations from its guard, or its label if
+ * it has none, up to the end of the guard, or its backward jump.
+ */
+struct ActiveLoop {
+  LoopStats *stats;
+  uint64_t iterations;
+  // The executed operations when the loop was reached
+  uint64_t start;
+  // Set while the guard of the loop runs
+  bool guarded;
+};
+
+struct LoopRecorder {
+  LoopProfile &profile;
+  std::unordered_map<uint32_t, ActiveLoop> active;
+  // Executed operations
+  uint64_t operations;
+};
+
+static ActiveLoop &active_loop(LoopRecorder &recorder, uint32_t id) {
+  auto [iter, inserted] =
+      recorder.active.try_emplace(id, ActiveLoop{.stats = nullptr, .iterations = 0, .start = 0, .guarded = false});
+  if (inserted) {
+    iter->second.stats = &recorder.profile.Loop(id);
+  }
+  return iter->second;
+}
+
+static void record_cost(LoopRecorder &recorder, ActiveLoop &loop) {
+  loop.stats->cost += recorder.operations - loop.start;
+  loop.guarded = false;
+}
+
+static void record_guard(LoopRecorder &recorder, OperationStream &stream, const Operation *jump, bool taken) {
+  if (Operation::NO_SOURCE == jump->Source()) {
+    return;
+  }
+  ActiveLoop &loop = active_loop(recorder, jump->Source());
+  loop.start = recorder.operations;
+  loop.guarded = true;
+  if (taken) {
+    loop.stats->Record(0);
+    record_cost(recorder, loop);
+    return;
+  }
+  const Operation *before_label = *(stream.From((Operation *) jump->Operand1()) - 1);
+  if (!is_backward_jump(before_label) || before_label->Source() != jump->Source()) {
+    loop.stats->Record(1);
+  }
+}
+
+static void record_guard_end(LoopRecorder &recorder, const Operation *label) {
+  if (Operation::NO_SOURCE == label->Source()) {
+    return;
+  }
+  ActiveLoop &loop = active_loop(recorder, label->Source());
+  if (loop.guarded) {
+    record_cost(recorder, loop);
+  }
+}
+
+static void record_entry(LoopRecorder &recorder, const Operation *label) {
+  if (Operation::NO_SOURCE == label->Source()) {
+    return;
+  }
+  ActiveLoop &loop = active_loop(recorder, label->Source());
+  loop.iterations = 1;
+  if (!loop.guarded) {
+    loop.start = recorder.operations;
+  }
+}
+
+static void record_backward_jump(LoopRecorder &recorder, const Operation *jump, bool taken) {
+  if (Operation::NO_SOURCE == jump->Source()) {
+    return;
+  }
+  ActiveLoop &loop = active_loop(recorder, jump->Source());
+  if (taken) {
+    ++loop.iterations;
+  } else {
+    loop.stats->Record(loop.iterations);
+    if (!loop.guarded) {
+      record_cost(recorder, loop);
+    }
+  }
+}
+
+/**
+ * Loops of a tiered run.  Loops count their entries and iterations while
+ * they run in the interpreter.  A compiled loop is a region, which can be
+ * entered at the label of every loop inside of it.
+ *
+ * Regions are compiled with speculations from what the interpreter saw:
+ * loops which never ran are side exits back to the interpreter, and
+ * multiplications whose source cell always had the same value multiply
+ * with a constant behind a guard.  A failed guard returns to the
+ * interpreter at the operation of the speculation.  Failed value guards
+ * compile the region again right away, without the speculation, too many
+ * side exits compile the region again as well.
+ */
+struct TieredLoop {
+  uint64_t entries;
+  uint64_t iterations;
+  uint64_t side_exits;
+  // Set if the loop could not be compiled
+  bool interpreted;
+};
+
+struct LoopEntry {
+  Compiler::CodeEntry code;
+  // The outermost compiled loop around the label
+  Operation *region;
+};
+
+/**
+ * The value of the source cell of a multiplication, as far as the
+ * interpreter saw it.
+ */
+struct ValueProfile {
+  uint8_t value;
+  bool varies;
+};
+
+struct LoopTiers {
+  Compiler &compiler;
+  EOFMode eof_mode;
+  uint64_t threshold;
+  std::unordered_map<const Operation *, TieredLoop> loops;
+  std::unordered_map<const Operation *, LoopEntry> entries;
+  std::unordered_map<const Operation *, ValueProfile> values;
+  // Compiled code refers to its speculations, they are never dropped
+  std::deque<Speculation> speculations;
+  TieredStats stats;
+};
+
+static TieredLoop &tiered_loop(LoopTiers &tiers, const Operation *label) {
+  return tiers.loops
+      .try_emplace(label, TieredLoop{.entries = 0, .iterations = 0, .side_exits = 0, .interpreted = false})
+      .first->second;
+}
+
+/**
+ * Records the value of the source cell of a multiplication.
+ */
+static void record_value(LoopTiers &tiers, const Operation *op, uint8_t value) {
+  auto [iter, inserted] = tiers.values.try_emplace(op, ValueProfile{.value = value, .varies = false});
+  if (!inserted && iter->second.value != value) {
+    iter->second.varies = true;
+  }
+}
+
+/**
+ * Collects the speculations of the region from the loop and value
+ * profiles.
+ */
+static std::vector<Speculation *> speculate(LoopTiers &tiers, OperationStream &stream, Operation *label) {
+  std::vector<Speculation *> result{};
+  for (auto iter = stream.From(label) + 1; *iter != (Operation *) label->Operand1(); ++iter) {
+    if (iter->Is(Instruction::LABEL) && is_backward_jump((Operation *) iter->Operand1())
+        && 0 == tiered_loop(tiers, *iter).entries) {
+      tiers.speculations.push_back(
+          Speculation{.kind = Speculation::Kind::LOOP_NOT_ENTERED, .op = *iter, .value = 0, .failures = 0});
+      result.push_back(&tiers.speculations.back());
+    } else if (iter->Is(Instruction::IMUL_CELL) || iter->Is(Instruction::DMUL_CELL)) {
+      auto profile = tiers.values.find(*iter);
+      if (profile != tiers.values.end() && !profile->second.varies) {
+        tiers.speculations.push_back(Speculation{
+            .kind = Speculation::Kind::CELL_VALUE, .op = *iter, .value = profile->second.value, .failures = 0});
+        result.push_back(&tiers.speculations.back());
+      }
+    }
+  }
+  return result;
+}
+
+static void compile_region(LoopTiers &tiers, OperationStream &stream, Operation *label) {
+  TieredLoop &region = tiered_loop(tiers, label);
+  const std::vector<Speculation *> speculations = speculate(tiers, stream, label);
+  auto compiled = tiers.compiler.CompileLoop(stream, label, tiers.eof_mode, speculations);
+  region.side_exits = 0;
+  // Loops which can't be compiled keep running in the interpreter
+  region.interpreted = 0 != compiled.index() || std::get<Compiler::LoopEntries>(compiled).empty();
+  if (!region.interpreted) {
+    ++tiers.stats.compilations;
+    tiers.stats.speculations += speculations.size();
+    for (const auto &[loop, code] : std::get<Compiler::LoopEntries>(compiled)) {
+      tiers.entries.insert_or_assign(loop, LoopEntry{.code = code, .region = label});
+    }
+  }
+}
+
+/**
+ * Counts an iteration of the loop, compiles it when it crosses the
+ * threshold.
+ */
+static void tier_up(LoopTiers &tiers, OperationStream &stream, Operation *label) {
+  TieredLoop &loop = tiered_loop(tiers, label);
+  if (!loop.interpreted && ++loop.iterations >= tiers.threshold && !tiers.entries.contains(label)) {
+    compile_region(tiers, stream, label);
+  }
+}
+
+/**
+ * Enters the compiled code at the label, if there is any, with the loop
+ * counter of the interpreter.  The code returns at the end of its region,
+ * and the iterator moves to the backward jump of the region, or at a
+ * failed guard, and the iterator moves to the operation in front of the
+ * one which the interpreter has to run instead.  For side exits, this is
+ * the label of the loop which is left to the interpreter, which is
+ * entered right away.  Either way the interpreter continues after the
+ * iterator.
+ */
+static void run_compiled(
+    LoopTiers &tiers, OperationStream &stream, Heap &heap, OperationStream::Iterator &iter, intptr_t &loop_counter) {
+  auto entry = tiers.entries.find(*iter);
+  if (entry == tiers.entries.end()) {
+    return;
+  }
+  ExecState state{
+      .cell = heap.CellAddress(), .loop_counter = (uintptr_t) loop_counter, .resume = nullptr, .exit = 0};
+  while (entry != tiers.entries.end()) {
+    Operation *region = entry->second.region;
+    entry->second.code(&state);
+    if (nullptr == state.resume) {
+      iter.JumpTo((Operation *) region->Operand1());
+      break;
+    }
+    Speculation *spec = (Speculation *) state.exit;
+    ++spec->failures;
+    ++tiers.stats.failures;
+    iter.JumpTo(state.resume);
+    if (spec->kind == Speculation::Kind::CELL_VALUE) {
+      // The interpreter runs the multiplication with the actual value
+      --iter;
+      tiers.values.insert_or_assign(spec->op, ValueProfile{.value = spec->value, .varies = true});
+      ++tiers.stats.deoptimizations;
+      compile_region(tiers, stream, region);
+      break;
+    }
+    // The interpreter enters the loop at the side exit
+    ++tiered_loop(tiers, state.resume).entries;
+    const Operation *jump = (const Operation *) state.resume->Operand1();
+    if (jump->Is(Instruction::DJNZ)) {
+      state.loop_counter = (uintptr_t) jump->Operand2();
+    }
+    if (++tiered_loop(tiers, region).side_exits >= tiers.threshold) {
+      ++tiers.stats.deoptimizations;
+      compile_region(tiers, stream, region);
+    }
+    entry = tiers.entries.find(state.resume);
+  }
+  heap.SetCellAddress(state.cell);
+  loop_counter = (intptr_t) state.loop_counter;
+}
+
+void TieredStats::Dump() const noexcept {
+  fprintf(stderr, "compilations:    %" PRIu64 "\n", compilations);
+  fprintf(stderr, "speculations:    %" PRIu64 "\n", speculations);
+  fprintf(stderr, "guard failures:  %" PRIu64 "\n", failures);
+  fprintf(stderr, "deoptimizations: %" PRIu64 "\n", deoptimizations);
+}
+
+/**
+ * Loops and the trace recorder of a traced run.  Loops which run threshold
+ * iterations are recorded for one iteration, from the head of the loop up
+ * to its backward jump.  Exits which are taken threshold times start to
+ * record a side trace, which ends at the backward jump as well.  A single
+ * trace is recorded at a time.
+ *
+ * Inner loops with a trace tree of their own are recorded as a single
+ * step, and run in their own compiled code meanwhile.  Other inner loops
+ * must not run more than one iteration, or the recording is aborted.
+ */
+struct TracedLoop {
+  uint64_t iterations;
+  // Recordings, which includes aborted ones and discarded trees
+  uint32_t recordings;
+};
+
+struct TraceRecorder {
+  TraceJit &jit;
+  EOFMode eof_mode;
+  uint64_t threshold;
+  std::unordered_map<const Operation *, TracedLoop> loops;
+  // The loop of the trace which is recorded, nullptr if there is none
+  Operation *loop;
+  // The exit at which the side trace starts, nullptr for the loop itself
+  TraceExit *exit;
+  Trace trace;
+  // The backward jump of the inlined loop which runs at the moment
+  const Operation *inlined;
+};
+
+// Loops and exits are recorded at most this often
+static const uint32_t MAX_RECORDINGS = 4;
+
+static TracedLoop &traced_loop(TraceRecorder &tracer, const Operation *label) {
+  return tracer.loops.try_emplace(label, TracedLoop{.iterations = 0, .recordings = 0}).first->second;
+}
+
+static void start_recording(TraceRecorder &tracer, Operation *loop, TraceExit *exit) {
+  tracer.loop = loop;
+  tracer.exit = exit;
+  tracer.trace.clear();
+  tracer.inlined = nullptr;
+}
+
+static void stop_recording(TraceRecorder &tracer, bool compile) {
+  Err err = Err::Ok();
+  if (compile && nullptr == tracer.exit) {
+    err = tracer.jit.CompileTrace(tracer.loop, tracer.trace, tracer.eof_mode);
+  } else if (compile) {
+    err = tracer.jit.CompileSideTrace(tracer.exit, tracer.trace, tracer.eof_mode);
+  }
+  if (!compile || !err.IsOk()) {
+    // Try again after threshold more iterations or exits
+    if (nullptr == tracer.exit) {
+      traced_loop(tracer, tracer.loop).iterations = 0;
+    } else {
+      tracer.exit->count = 0;
+      ++tracer.exit->recordings;
+    }
+  }
+  tracer.loop = nullptr;
+}
+
+/**
+ * Records the operation, which the interpreter executes next.
+ */
+static void record_step(TraceRecorder &tracer, Operation *op, Heap &heap, intptr_t loop_counter) {
+  bool taken = false;
+  if (op->Is(Instruction::JZ)) {
+    taken = heap.GetCell(op->Operand2()) == 0;
+  } else if (op->Is(Instruction::JNZ)) {
+    taken = heap.GetCell(op->Operand2()) != 0;
+  } else if (op->Is(Instruction::DJNZ)) {
+    taken = loop_counter != 1;
+  }
+  const Operation *back = (const Operation *) tracer.loop->Operand1();
+  if (nullptr != tracer.inlined) {
+    if (op == back) {
+      stop_recording(tracer, false);
+    } else if (op == tracer.inlined && !taken) {
+      tracer.inlined = nullptr;
+    }
+    return;
+  }
+  if (op != back && is_backward_jump(op) && taken) {
+    stop_recording(tracer, false);
+    return;
+  }
+  if (op->Is(Instruction::LABEL) && is_backward_jump((const Operation *) op->Operand1()) && tracer.jit.Find(op)) {
+    tracer.inlined = (const Operation *) op->Operand1();
+    taken = true;
+  }
+  tracer.trace.push_back(TraceStep{.op = op, .taken = taken});
+  if (op == back) {
+    stop_recording(tracer, true);
+  } else if (tracer.trace.size() >= TraceJit::MAX_TRACE_LENGTH) {
+    stop_recording(tracer, false);
+  }
+}
+
+/**
+ * Counts the exit the trace code took.  Exits at guards of the tree start
+ * a side trace, other exits which are taken often record the whole loop
+ * again, which picks up the current trees of its inner loops.
+ */
+static void trace_exit(TraceRecorder &tracer, TraceExit *exit) {
+  if (++exit->count < tracer.threshold || nullptr != tracer.loop
+      || exit->resume == (Operation *) exit->loop->Operand1()) {
+    return;
+  }
+  if (exit->linkable) {
+    if (!exit->linked && exit->recordings < MAX_RECORDINGS) {
+      start_recording(tracer, exit->loop, exit);
+    }
+    return;
+  }
+  TracedLoop &loop = traced_loop(tracer, exit->loop);
+  if (loop.recordings < MAX_RECORDINGS) {
+    tracer.jit.Discard(exit->loop);
+    loop.iterations = 0;
+  }
+}
+
+/**
+ * Runs the trace tree of the loop, if there is one.  Moves the iterator to
+ * the operation where the interpreter continues, and returns true in that
+ * case.
+ */
+static bool run_trace(TraceRecorder &tracer, Heap &heap, OperationStream::Iterator &iter, intptr_t &loop_counter) {
+  TraceJit::CodeEntry code = tracer.jit.Find(*iter);
+  if (nullptr == code) {
+    return false;
+  }
+  ExecState state{
+      .cell = heap.CellAddress(), .loop_counter = (uintptr_t) loop_counter, .resume = nullptr, .exit = 0};
+  code(&state);
+  heap.SetCellAddress(state.cell);
+  loop_counter = (intptr_t) state.loop_counter;
+  iter.JumpTo(state.resume);
+  trace_exit(tracer, (TraceExit *) state.exit);
+  return true;
+}
+
+/**
+ * Counts an iteration of the loop, and starts to record it when it gets
+ * hot.  Runs its trace tree otherwise.
+ */
+static bool trace_loop(TraceRecorder &tracer, Heap &heap, OperationStream::Iterator &iter, intptr_t &loop_counter) {
+  Operation *label = *iter;
+  TracedLoop &loop = traced_loop(tracer, label);
+  if (nullptr == tracer.loop && ++loop.iterations >= tracer.threshold && loop.recordings < MAX_RECORDINGS
+      && nullptr == tracer.jit.Find(label)) {
+    ++loop.recordings;
+    start_recording(tracer, label, nullptr);
+    return false;
+  }
+  return run_trace(tracer, heap, iter, loop_counter);
+}
+
+enum class RunMode {
+  PLAIN,
+  PROFILE,
+  TIERED,
+  TRACED,
+};
+
+template <RunMode MODE>
+static void run(Heap &heap,
+                OperationStream &stream,
+                EOFMode eof_mode,
+                LoopRecorder *recorder,
+                LoopTiers *tiers,
+                TraceRecorder *tracer) {
   auto iter = stream.Begin();
   const auto end = stream.End();
+  intptr_t loop_counter = 0;
   while (iter != end) {
+    if constexpr (MODE == RunMode::PROFILE) {
+      ++recorder->operations;
+    }
+    if constexpr (MODE == RunMode::TRACED) {
+      if (nullptr != tracer->loop) {
+        record_step(*tracer, *iter, heap, loop_counter);
+      }
+    }
     switch (iter->OpCode()) {
     case Instruction::NOP: {
     } break;
@@ -22,12 +484,18 @@ void Interpreter::Run(Heap &heap, OperationStream &stream, EOFMode eof_mode) con
       heap.DecrementCell((uint8_t) iter->Operand1(), iter->Operand2());
     } break;
     case Instruction::IMUL_CELL: {
-      uint8_t cur = heap.GetCell(0);
+      uint8_t cur = heap.GetCell(iter->Operand3());
+      if constexpr (MODE == RunMode::TIERED) {
+        record_value(*tiers, *iter, cur);
+      }
       cur *= iter->Operand1();
       heap.IncrementCell(cur, iter->Operand2());
     } break;
     case Instruction::DMUL_CELL: {
-      uint8_t cur = heap.GetCell(0);
+      uint8_t cur = heap.GetCell(iter->Operand3());
+      if constexpr (MODE == RunMode::TIERED) {
+        record_value(*tiers, *iter, cur);
+      }
       cur *= iter->Operand1();
       heap.DecrementCell(cur, iter->Operand2());
     } break;
@@ -50,16 +518,75 @@ void Interpreter::Run(Heap &heap, OperationStream &stream, EOFMode eof_mode) con
       bf_write(&output);
     } break;
     case Instruction::JZ: {
-      if (heap.GetCell(0) == 0) {
+      const bool taken = heap.GetCell(iter->Operand2()) == 0;
+      if constexpr (MODE == RunMode::PROFILE) {
+        record_guard(*recorder, stream, *iter, taken);
+      }
+      if (taken) {
         iter.JumpTo((Operation *) iter->Operand1());
       }
     } break;
     case Instruction::JNZ: {
-      if (heap.GetCell(0) != 0) {
+      const bool taken = heap.GetCell(iter->Operand2()) != 0;
+      if constexpr (MODE == RunMode::PROFILE) {
+        record_backward_jump(*recorder, *iter, taken);
+      }
+      if (taken) {
         iter.JumpTo((Operation *) iter->Operand1());
+        if constexpr (MODE == RunMode::TIERED) {
+          tier_up(*tiers, stream, *iter);
+          run_compiled(*tiers, stream, heap, iter, loop_counter);
+        }
+        if constexpr (MODE == RunMode::TRACED) {
+          if (trace_loop(*tracer, heap, iter, loop_counter)) {
+            continue;
+          }
+        }
+      }
+    } break;
+    case Instruction::DJNZ: {
+      const bool taken = --loop_counter != 0;
+      if constexpr (MODE == RunMode::PROFILE) {
+        record_backward_jump(*recorder, *iter, taken);
+      }
+      if (taken) {
+        iter.JumpTo((Operation *) iter->Operand1());
+        if constexpr (MODE == RunMode::TIERED) {
+          tier_up(*tiers, stream, *iter);
+          run_compiled(*tiers, stream, heap, iter, loop_counter);
+        }
+        if constexpr (MODE == RunMode::TRACED) {
+          if (trace_loop(*tracer, heap, iter, loop_counter)) {
+            continue;
+          }
+        }
       }
     } break;
     case Instruction::LABEL: {
+      // Only entering a loop gets here, jumps continue after the label
+      const Operation *jump = (Operation *) iter->Operand1();
+      if (jump->Is(Instruction::DJNZ)) {
+        loop_counter = jump->Operand2();
+      }
+      if constexpr (MODE == RunMode::TIERED) {
+        if (is_backward_jump(jump)) {
+          ++tiered_loop(*tiers, *iter).entries;
+          run_compiled(*tiers, stream, heap, iter, loop_counter);
+        }
+      }
+      if constexpr (MODE == RunMode::PROFILE) {
+        if (is_backward_jump(jump)) {
+          record_entry(*recorder, *iter);
+        } else {
+          // The guard ran its body, skipped guards continue after the label
+          record_guard_end(*recorder, *iter);
+        }
+      }
+      if constexpr (MODE == RunMode::TRACED) {
+        if (is_backward_jump(jump) && run_trace(*tracer, heap, iter, loop_counter)) {
+          continue;
+        }
+      }
     } break;
     case Instruction::FIND_CELL_HIGH: {
       const uint8_t val = (uint8_t) iter->Operand1();
@@ -77,3 +604,46 @@ void Interpreter::Run(Heap &heap, OperationStream &stream, EOFMode eof_mode) con
     ++iter;
   }
 }
+
+void Interpreter::Run(Heap &heap, OperationStream &stream, EOFMode eof_mode) const {
+  run<RunMode::PLAIN>(heap, stream, eof_mode, nullptr, nullptr, nullptr);
+}
+
+uint64_t Interpreter::Profile(Heap &heap, OperationStream &stream, EOFMode eof_mode, LoopProfile &profile) const {
+  // Loops which never run are part of the profile as well
+  for (const Operation *op : stream) {
+    if ((op->Is(Instruction::JZ) || is_backward_jump(op)) && Operation::NO_SOURCE != op->Source()) {
+      profile.Loop(op->Source());
+    }
+  }
+  LoopRecorder recorder{.profile = profile, .active = {}, .operations = 0};
+  run<RunMode::PROFILE>(heap, stream, eof_mode, &recorder, nullptr, nullptr);
+  return recorder.operations;
+}
+
+TieredStats Interpreter::RunTiered(
+    Heap &heap, OperationStream &stream, EOFMode eof_mode, Compiler &compiler, uint64_t threshold) const {
+  LoopTiers tiers{.compiler = compiler,
+                  .eof_mode = eof_mode,
+                  .threshold = threshold,
+                  .loops = {},
+                  .entries = {},
+                  .values = {},
+                  .speculations = {},
+                  .stats = {.compilations = 0, .speculations = 0, .failures = 0, .deoptimizations = 0}};
+  run<RunMode::TIERED>(heap, stream, eof_mode, nullptr, &tiers, nullptr);
+  return tiers.stats;
+}
+
+void Interpreter::RunTraced(
+    Heap &heap, OperationStream &stream, EOFMode eof_mode, TraceJit &jit, uint64_t threshold) const {
+  TraceRecorder tracer{.jit = jit,
+                       .eof_mode = eof_mode,
+                       .threshold = threshold,
+                       .loops = {},
+                       .loop = nullptr,
+                       .exit = nullptr,
+                       .trace = {},
+                       .inlined = nullptr};
+  run<RunMode::TRACED>(heap, stream, eof_mode, nullptr, nullptr, &tracer);
+}
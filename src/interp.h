@@ -2,10 +2,34 @@
 #ifndef BF_CC_INTERP_H
 #define BF_CC_INTERP_H 1
 
+#include <cstdint>
+
+#include "compiler.h"
 #include "instr.h"
 #include "mem.h"
+#include "profile.h"
+#include "trace.h"
+
+/**
+ * Counters of a tiered run.  Deoptimizations count the regions which are
+ * compiled again because their speculations failed.
+ */
+struct TieredStats {
+  uint64_t compilations;
+  uint64_t speculations;
+  uint64_t failures;
+  uint64_t deoptimizations;
+
+  void Dump() const noexcept;
+};
 
 class Interpreter final {
+public:
+  // Loops are compiled in a tiered run after this many iterations
+  static constexpr uint64_t TIER_UP_ITERATIONS = 1 << 10;
+  // Loops are recorded in a traced run after this many iterations
+  static constexpr uint64_t TRACE_ITERATIONS = 1 << 6;
+
 private:
   Interpreter() {
   }
@@ -16,6 +40,30 @@ public:
   }
 
   void Run(Heap &, OperationStream &, EOFMode) const;
+
+  /**
+   * Runs the program and records how often every loop is entered, how
+   * many iterations it runs and how many operations it executes.
+   * Returns the operations executed by the whole program.
+   */
+  uint64_t Profile(Heap &, OperationStream &, EOFMode, LoopProfile &) const;
+
+  /**
+   * Starts to run the program in the interpreter and compiles every loop
+   * which runs threshold iterations.  The compiled loop takes over with
+   * the next iteration, or with the next entry for counted loops, and
+   * works on the same heap.  Compiled loops speculate on the profile
+   * of the interpreter and fall back to it if a speculation fails.
+   */
+  TieredStats RunTiered(Heap &, OperationStream &, EOFMode, Compiler &, uint64_t threshold = TIER_UP_ITERATIONS) const;
+
+  /**
+   * Starts to run the program in the interpreter, and records a trace of
+   * every loop which runs threshold iterations.  The compiled trace runs
+   * the loop from its next iteration on, on the same heap.  Guards of the
+   * trace which fail threshold times record side traces.
+   */
+  void RunTraced(Heap &, OperationStream &, EOFMode, TraceJit &, uint64_t threshold = TRACE_ITERATIONS) const;
 };
 
 #endif /* BF_CC_INTERP_H */
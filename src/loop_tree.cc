@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: MIT License
+#include "loop_tree.h"
+
+#include <cstdio>
+
+#include "debug.h"
+#include "instr.h"
+
+LoopNode *LoopNode::LiveParent() noexcept {
+  LoopNode *parent = m.parent;
+  while (parent->m.removed) {
+    parent = parent->m.parent;
+  }
+  // Compress the path, so following the same links again is cheap
+  LoopNode *cur = this;
+  while (cur->m.parent != parent) {
+    LoopNode *next = cur->m.parent;
+    cur->m.parent = parent;
+    cur = next;
+  }
+  return parent;
+}
+
+LoopNode *LoopNode::Parent() noexcept {
+  LoopNode *parent = LiveParent();
+  return parent->IsRoot() ? nullptr : parent;
+}
+
+LoopTree LoopTree::Build(OperationStream &stream) {
+  LoopTree tree(M{});
+  tree.m.nodes.push_back(LoopNode(LoopNode::M{
+      .first = nullptr,
+      .last = nullptr,
+      .parent = nullptr,
+      .first_child = nullptr,
+      .last_child = nullptr,
+      .prev_sibling = nullptr,
+      .next_sibling = nullptr,
+      .id = 0,
+      .removed = false,
+  }));
+  std::vector<LoopNode *> stack{tree.Root()};
+  uint32_t next_id = 1;
+  for (Operation *op : stream) {
+    const bool is_begin =
+        op->Is(Instruction::JZ) ||
+        (op->Is(Instruction::LABEL) && ((Operation *) op->Operand1())->IsAny({Instruction::JNZ, Instruction::DJNZ}));
+    const bool is_end = op->IsAny({Instruction::JNZ, Instruction::DJNZ}) || (op->Is(Instruction::LABEL) && !is_begin);
+    if (is_begin) {
+      LoopNode *parent = stack.back();
+      tree.m.nodes.push_back(LoopNode(LoopNode::M{
+          .first = op,
+          .last = (Operation *) op->Operand1(),
+          .parent = parent,
+          .first_child = nullptr,
+          .last_child = nullptr,
+          .prev_sibling = parent->m.last_child,
+          .next_sibling = nullptr,
+          .id = next_id++,
+          .removed = false,
+      }));
+      LoopNode *node = &tree.m.nodes.back();
+      if (parent->m.last_child) {
+        parent->m.last_child->m.next_sibling = node;
+      } else {
+        parent->m.first_child = node;
+      }
+      parent->m.last_child = node;
+      tree.m.index[op] = node;
+      stack.push_back(node);
+    } else if (is_end) {
+      GUARANTEE(stack.size() > 1, "Unbalanced jump %p", (void *) op);
+      LoopNode *node = stack.back();
+      GUARANTEE(node->m.last == op, "Jumps are not properly nested at %p", (void *) op);
+      stack.pop_back();
+      tree.m.index[op] = node;
+      tree.m.post_order.push_back(node);
+    }
+  }
+  GUARANTEE(stack.size() == 1, "Unbalanced jumps");
+  return tree;
+}
+
+LoopNode *LoopTree::Find(const Operation *op) const {
+  auto iter = m.index.find(op);
+  if (iter == m.index.end()) {
+    return nullptr;
+  }
+  return iter->second;
+}
+
+void LoopTree::Remove(const Operation *op) {
+  LoopNode *node = Find(op);
+  if (nullptr == node) {
+    return;
+  }
+  m.index.erase(node->m.first);
+  m.index.erase(node->m.last);
+  node->m.removed = true;
+  // Replace the node with its children in the sibling list of the parent.
+  // The parent links of the children are fixed lazily, see LoopNode::Parent.
+  LoopNode *parent = node->LiveParent();
+  LoopNode *before = node->m.prev_sibling;
+  LoopNode *after = node->m.next_sibling;
+  LoopNode *first = after;
+  LoopNode *last = before;
+  if (node->m.first_child) {
+    first = node->m.first_child;
+    last = node->m.last_child;
+    first->m.prev_sibling = before;
+    last->m.next_sibling = after;
+  }
+  if (before) {
+    before->m.next_sibling = first;
+  } else {
+    parent->m.first_child = first;
+  }
+  if (after) {
+    after->m.prev_sibling = last;
+  } else {
+    parent->m.last_child = last;
+  }
+  node->m.first_child = nullptr;
+  node->m.last_child = nullptr;
+  node->m.prev_sibling = nullptr;
+  node->m.next_sibling = nullptr;
+}
+
+size_t LoopTree::Size() const noexcept {
+  size_t count = 0;
+  for (const LoopNode *node : m.post_order) {
+    if (!node->IsRemoved()) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+static void dump_node(const LoopNode *node, int indent) {
+  for (; node; node = node->NextSibling()) {
+    printf("%*s%s %u\n", indent, "", node->IsGuard() ? "guard" : "loop", node->Id());
+    dump_node(node->FirstChild(), indent + 2);
+  }
+}
+
+void LoopTree::Dump() const {
+  dump_node(FirstTopLevel(), 0);
+}
@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_LOOP_TREE_H
+#define BF_CC_LOOP_TREE_H 1
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "instr.h"
+
+/**
+ * A node of the loop nesting tree.
+ *
+ * Every jump together with its label spans a region of the operation
+ * stream.  A JZ and its label form a forward region (a guard), a label
+ * and its JNZ form a backward region (the loop itself).  A freshly parsed
+ * loop is a guard with a single loop as child.  Optimizations might
+ * remove either of them, e.g. multiplicative loops keep the guard only.
+ * A loop closed by a DJNZ is a counted loop.
+ */
+class LoopNode final {
+  friend class LoopTree;
+
+private:
+  struct M {
+    Operation *first;
+    Operation *last;
+    LoopNode *parent;
+    LoopNode *first_child;
+    LoopNode *last_child;
+    LoopNode *prev_sibling;
+    LoopNode *next_sibling;
+    uint32_t id;
+    bool removed;
+  } m;
+
+  explicit LoopNode(M m) noexcept : m(std::move(m)) {
+  }
+
+  LoopNode(const LoopNode &) = delete;
+  LoopNode &operator=(const LoopNode &) = delete;
+
+  bool IsRoot() const noexcept {
+    return nullptr == m.first;
+  }
+
+  LoopNode *LiveParent() noexcept;
+
+public:
+  LoopNode(LoopNode &&) noexcept = default;
+
+  /**
+   * The JZ of a guard or the label of a loop.
+   */
+  inline Operation *First() const noexcept {
+    return m.first;
+  }
+
+  /**
+   * The label of a guard or the JNZ (DJNZ) of a loop.
+   */
+  inline Operation *Last() const noexcept {
+    return m.last;
+  }
+
+  inline bool IsGuard() const noexcept {
+    return m.first->Is(Instruction::JZ);
+  }
+
+  inline bool IsLoop() const noexcept {
+    return m.first->Is(Instruction::LABEL);
+  }
+
+  inline bool IsCounted() const noexcept {
+    return m.last->Is(Instruction::DJNZ);
+  }
+
+  /**
+   * Ids are assigned in stream order when the tree is built and never
+   * change afterwards.
+   */
+  inline uint32_t Id() const noexcept {
+    return m.id;
+  }
+
+  inline bool IsRemoved() const noexcept {
+    return m.removed;
+  }
+
+  /**
+   * Returns true, if there is no other jump or label between First and Last.
+   */
+  inline bool IsInnermost() const noexcept {
+    return nullptr == m.first_child;
+  }
+
+  /**
+   * The closest enclosing region, nullptr for top-level regions.
+   */
+  LoopNode *Parent() noexcept;
+
+  inline LoopNode *FirstChild() const noexcept {
+    return m.first_child;
+  }
+
+  inline LoopNode *NextSibling() const noexcept {
+    return m.next_sibling;
+  }
+};
+
+/**
+ * Loop nesting tree.
+ *
+ * Built once with a single pass over the stream.  Jumps and labels are
+ * always properly nested, so every region is either disjoint from or
+ * contained within any other region.
+ *
+ * The tree references the jumps and labels directly, inserting straight
+ * line operations never invalidates it.  If the tree is attached to a
+ * stream, deleting a jump or a label removes its node and moves all child
+ * nodes to the parent.  Removing a node is O(1), the parent links of the
+ * moved children are fixed lazily.
+ */
+class LoopTree final {
+private:
+  struct M {
+    std::deque<LoopNode> nodes;
+    std::vector<LoopNode *> post_order;
+    std::unordered_map<const Operation *, LoopNode *> index;
+  } m;
+
+  explicit LoopTree(M m) noexcept : m(std::move(m)) {
+  }
+
+  LoopTree(const LoopTree &) = delete;
+  LoopTree &operator=(const LoopTree &) = delete;
+
+  LoopNode *Root() noexcept {
+    return &m.nodes.front();
+  }
+
+  const LoopNode *Root() const noexcept {
+    return &m.nodes.front();
+  }
+
+public:
+  LoopTree(LoopTree &&) noexcept = default;
+
+  LoopTree &operator=(LoopTree &&) noexcept = default;
+
+  static LoopTree Build(OperationStream &);
+
+  /**
+   * Returns the node the given jump or label belongs to.
+   */
+  LoopNode *Find(const Operation *) const;
+
+  /**
+   * Removes the node of the given jump or label from the tree.
+   * Does nothing if the operation does not belong to a node.
+   */
+  void Remove(const Operation *);
+
+  /**
+   * All nodes, children before their parents.  Contains removed nodes.
+   */
+  const std::vector<LoopNode *> &PostOrder() const noexcept {
+    return m.post_order;
+  }
+
+  /**
+   * The first top-level region.
+   */
+  LoopNode *FirstTopLevel() const noexcept {
+    return Root()->FirstChild();
+  }
+
+  /**
+   * Number of nodes which have not been removed.
+   */
+  size_t Size() const noexcept;
+
+  void Dump() const;
+};
+
+/**
+ * Makes sure a loop tree is attached to the stream for the lifetime of
+ * this object.  If there already is one, it is reused.
+ */
+class ScopedLoopTree final {
+private:
+  OperationStream &stream;
+  std::optional<LoopTree> owned;
+
+  ScopedLoopTree(const ScopedLoopTree &) = delete;
+  ScopedLoopTree &operator=(const ScopedLoopTree &) = delete;
+
+public:
+  explicit ScopedLoopTree(OperationStream &s) : stream(s), owned() {
+    if (nullptr == stream.Loops()) {
+      owned.emplace(LoopTree::Build(stream));
+      stream.SetLoops(&owned.value());
+    }
+  }
+
+  ~ScopedLoopTree() {
+    if (owned.has_value()) {
+      stream.SetLoops(nullptr);
+    }
+  }
+
+  LoopTree &operator*() {
+    return *stream.Loops();
+  }
+
+  LoopTree *operator->() {
+    return stream.Loops();
+  }
+};
+
+#endif /* BF_CC_LOOP_TREE_H */
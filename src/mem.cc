@@ -12,34 +12,37 @@
 
 #include "platform.h"
 
-std::variant<Heap, Err> Heap::Create(size_t size) noexcept {
+std::variant<Heap, Err> Heap::Create(size_t size, size_t origin, size_t guard_pages) noexcept {
   const size_t page_size = Pagesize();
   if (size > (UINT32_MAX >> 1)) {
     return Err::OutOfMemory();
   }
+  ASSERT(origin < size, "origin outside of memory area");
   // Round size up to page_size
   size = ((size + page_size - 1) / page_size) * page_size;
   // Add guard pages in the front and the back
-  size += page_size * (GUARD_PAGES * 2);
+  size += page_size * (guard_pages * 2);
   auto alloc_result = Allocate(size);
   if (alloc_result.index() != 0) {
     return std::get<Err>(alloc_result);
   }
   uint8_t *mem = std::get<uint8_t *>(alloc_result);
-  Err err = Protect(mem + page_size * GUARD_PAGES, size - (page_size * GUARD_PAGES * 2), PROTECT_RW);
+  Err err = Protect(mem + page_size * guard_pages, size - (page_size * guard_pages * 2), PROTECT_RW);
   if (!err.IsOk()) {
     return err;
   }
   return Heap(M{.page_size = page_size,
                 .allocated = size,
-                .available = size - (page_size * 2 * GUARD_PAGES),
-                .data_pointer = 0,
-                .data = mem + (page_size * GUARD_PAGES)});
+                .available = size - (page_size * 2 * guard_pages),
+                .guard_pages = guard_pages,
+                .origin = origin,
+                .data_pointer = (int64_t) origin,
+                .data = mem + (page_size * guard_pages)});
 }
 
 Heap::~Heap() {
   if (m.data) {
-    Deallocate(m.data - (m.page_size * GUARD_PAGES), m.allocated);
+    Deallocate(m.data - (m.page_size * m.guard_pages), m.allocated);
     m.data = nullptr;
   }
 }
@@ -49,18 +52,18 @@ void Heap::Dump(size_t from, size_t to) const noexcept {
   if (to <= from) {
     return;
   }
-  to = std::min(to, m.available);
-  from = std::min(from, m.available);
+  const size_t available = m.available - m.origin;
+  to = std::min(to, available);
+  from = std::min(from, available);
   to = (to + row_count) / row_count * row_count;
   from = from / row_count * row_count;
   printf("Heap dump for cells %zu to %zu\n", from, to - 1);
-  uint8_t *ptr = m.data;
-  ptr += from;
+  uint8_t *const start = m.data + m.origin;
+  uint8_t *ptr = start + from;
   size_t count = from;
-  const size_t available = m.available;
   const int digits = static_cast<int>(std::ceil(std::log10(static_cast<double>(available))));
   while (count < available && count < to) {
-    printf("%0*zu  ", digits, ptr - m.data);
+    printf("%0*zu  ", digits, ptr - start);
     for (size_t i = 0; count < available && i < row_count; ++i) {
       if (i % 4 == 0) {
         printf("  ");
@@ -128,5 +131,13 @@ void CodeArea::PatchData(uint8_t *p, const uint8_t *data, const size_t length) {
 }
 
 Err CodeArea::MakeExecutable() {
+#if defined(IS_AARCH64)
+  // The instruction cache does not see the data writes
+  __builtin___clear_cache((char *) m.mem, (char *) m.mem + m.size);
+#endif
   return Protect(m.mem, m.allocated, PROTECT_RX);
 }
+
+Err CodeArea::MakeWritable() {
+  return Protect(m.mem, m.allocated, PROTECT_RW);
+}
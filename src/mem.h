@@ -10,6 +10,9 @@
 #define GUARD_PAGES 0
 #endif
 
+// Guard pages of a heap for a program whose tape bounds are unknown
+#define UNBOUNDED_GUARD_PAGES 16
+
 #include <cstdint>
 #include <iterator>
 #include <utility>
@@ -24,6 +27,8 @@ private:
     size_t page_size;
     size_t allocated;
     size_t available;
+    size_t guard_pages;
+    size_t origin;
     int64_t data_pointer;
     uint8_t *data;
   } m;
@@ -35,11 +40,16 @@ private:
   Heap &operator=(const Heap &) = delete;
 
 public:
-  static std::variant<Heap, Err> Create(size_t size) noexcept;
+  /**
+   * Maps size cells with guard pages in front and behind.  The program
+   * starts at the cell origin, cells in front of it are available to
+   * programs which move left first.
+   */
+  static std::variant<Heap, Err> Create(size_t size, size_t origin = 0, size_t guard_pages = GUARD_PAGES) noexcept;
 
   ~Heap();
 
-  Heap(Heap &&other) noexcept : m(std::exchange(other.m, {0, 0, 0, 0, nullptr})) {
+  Heap(Heap &&other) noexcept : m(std::exchange(other.m, {0, 0, 0, 0, 0, 0, nullptr})) {
   }
 
   Heap &operator=(Heap &&other) noexcept {
@@ -83,10 +93,27 @@ public:
     return m.data;
   }
 
+  /**
+   * The address of the current cell.
+   */
+  inline uint8_t *CellAddress() noexcept {
+    return m.data + m.data_pointer;
+  }
+
+  /**
+   * Moves the data pointer to the cell at the address.
+   */
+  inline void SetCellAddress(uint8_t *cell) noexcept {
+    m.data_pointer = cell - m.data;
+  }
+
   inline int64_t DataPointer() const noexcept {
     return m.data_pointer;
   }
 
+  /**
+   * Dumps the cells from, to, counted from the origin.
+   */
   void Dump(size_t, size_t) const noexcept;
 };
 
@@ -148,8 +175,21 @@ public:
     return m.mem + m.size;
   }
 
+  /**
+   * Number of bytes of code emitted so far.
+   */
+  inline size_t Size() const noexcept {
+    return m.size - m.page_size;
+  }
+
   Err MakeExecutable();
 
+  /**
+   * Allows emitting more code after MakeExecutable.  Code which was
+   * already emitted must not run until MakeExecutable is called again.
+   */
+  Err MakeWritable();
+
   bool HasWriteError() const noexcept {
     return m.err;
   };
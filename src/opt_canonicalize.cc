@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: MIT License
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "debug.h"
+#include "instr.h"
+#include "optimize.h"
+
+/**
+ * Net effect of a block on a single cell.  Either the cell is set to a
+ * value, or the value is added to it.  Multiplications are kept apart.
+ */
+struct CellEffect {
+  bool set;
+  uint8_t value;
+};
+
+/**
+ * A multiply-add, target += amount * source.
+ */
+struct MulTerm {
+  intptr_t target;
+  intptr_t source;
+  uint8_t amount;
+};
+
+/**
+ * An operation of the canonical form.
+ */
+struct Emitted {
+  Instruction code;
+  intptr_t op1;
+  intptr_t op2;
+  intptr_t op3;
+
+  bool operator==(const Emitted &) const = default;
+};
+
+/**
+ * The operations of the current block and their net effect.
+ */
+struct Block {
+  std::map<intptr_t, CellEffect> cells;
+  std::vector<MulTerm> terms;
+  std::vector<Operation *> ops;
+};
+
+static bool is_written(const Block &block, intptr_t offset) {
+  if (block.cells.contains(offset)) {
+    return true;
+  }
+  return std::any_of(
+      block.terms.begin(), block.terms.end(), [offset](const MulTerm &t) { return t.target == offset; });
+}
+
+static bool is_set(const Block &block, intptr_t offset) {
+  auto iter = block.cells.find(offset);
+  return iter != block.cells.end() && iter->second.set;
+}
+
+static void add_operation(Block &block, Operation *op) {
+  block.ops.push_back(op);
+  const uint8_t amount = (uint8_t) op->Operand1();
+  switch (op->OpCode()) {
+  case Instruction::INCR_CELL:
+  case Instruction::DECR_CELL: {
+    CellEffect &cell = block.cells[op->Operand2()];
+    cell.value = (uint8_t) (cell.value + (op->Is(Instruction::INCR_CELL) ? amount : -amount));
+  } break;
+  case Instruction::SET_CELL: {
+    // Everything before is overwritten
+    block.cells[op->Operand2()] = CellEffect{.set = true, .value = amount};
+    std::erase_if(block.terms, [op](const MulTerm &t) { return t.target == op->Operand2(); });
+  } break;
+  case Instruction::IMUL_CELL:
+  case Instruction::DMUL_CELL: {
+    const uint8_t signed_amount = op->Is(Instruction::IMUL_CELL) ? amount : (uint8_t) -amount;
+    auto term = std::find_if(block.terms.begin(), block.terms.end(), [op](const MulTerm &t) {
+      return t.target == op->Operand2() && t.source == op->Operand3();
+    });
+    if (term == block.terms.end()) {
+      block.terms.push_back(MulTerm{.target = op->Operand2(), .source = op->Operand3(), .amount = signed_amount});
+    } else {
+      term->amount = (uint8_t) (term->amount + signed_amount);
+    }
+  } break;
+  default:
+    UNREACHABLE();
+  }
+}
+
+/**
+ * The canonical form: multiplications first, they read the cells as they
+ * were before the block.  Then one store or update per cell, sorted by
+ * offset.
+ */
+static std::vector<Emitted> canonical_form(const Block &block) {
+  std::vector<Emitted> result{};
+  for (const MulTerm &term : block.terms) {
+    if (0 == term.amount) {
+      continue;
+    }
+    if (term.amount < 128) {
+      result.push_back(Emitted{Instruction::IMUL_CELL, term.amount, term.target, term.source});
+    } else {
+      result.push_back(Emitted{Instruction::DMUL_CELL, (uint8_t) -term.amount, term.target, term.source});
+    }
+  }
+  for (const auto &[offset, cell] : block.cells) {
+    if (cell.set) {
+      result.push_back(Emitted{Instruction::SET_CELL, cell.value, offset, 0});
+    } else if (0 != cell.value && cell.value < 128) {
+      result.push_back(Emitted{Instruction::INCR_CELL, cell.value, offset, 0});
+    } else if (0 != cell.value) {
+      result.push_back(Emitted{Instruction::DECR_CELL, (uint8_t) -cell.value, offset, 0});
+    }
+  }
+  return result;
+}
+
+/**
+ * Replaces the operations of the block with the canonical form in front
+ * of the given operation.  Returns whether anything changed.
+ */
+static bool flush(OperationStream &stream, Block &block, Operation *before) {
+  const std::vector<Emitted> canonical = canonical_form(block);
+  bool same = canonical.size() == block.ops.size();
+  for (size_t i = 0; same && i < block.ops.size(); ++i) {
+    const Operation *op = block.ops[i];
+    same = canonical[i] == Emitted{op->OpCode(), op->Operand1(), op->Operand2(), op->Operand3()};
+  }
+  if (!same) {
+    for (const Emitted &e : canonical) {
+      stream.InsertBefore(before, e.code, e.op1, e.op2, e.op3);
+    }
+    for (Operation *op : block.ops) {
+      stream.Delete(op);
+    }
+  }
+  block.cells.clear();
+  block.terms.clear();
+  block.ops.clear();
+  return !same;
+}
+
+/**
+ * Canonicalize straight-line blocks.
+ *
+ * A block is a sequence of cell updates between jumps, labels, pointer
+ * moves, find cell, and I/O.  The block is replaced by its net effect,
+ * one operation per cell, sorted by offset.
+ *
+ *   +{1, 2} +{1, 3} -{1, 2} ={0, 1}   becomes   ={0, 1} +{1, 3}
+ *
+ * Multiplications are emitted first.  A multiplication which reads a cell
+ * written before in the same block, or which adds to a cell set before,
+ * starts a new block.
+ *
+ * This optimization requires delayed moves to be applied before.
+ */
+size_t OptCanonicalize(OperationStream &stream) {
+  size_t rewrites = 0;
+  Block block{.cells = {}, .terms = {}, .ops = {}};
+  auto iter = stream.Begin();
+  const auto end = stream.End();
+  while (iter != end) {
+    Operation *op = *iter++;
+    switch (op->OpCode()) {
+    case Instruction::NOP:
+      break;
+    case Instruction::INCR_CELL:
+    case Instruction::DECR_CELL:
+    case Instruction::SET_CELL:
+      add_operation(block, op);
+      break;
+    case Instruction::IMUL_CELL:
+    case Instruction::DMUL_CELL:
+      if (is_written(block, op->Operand3()) || is_set(block, op->Operand2())) {
+        rewrites += flush(stream, block, op);
+      }
+      add_operation(block, op);
+      break;
+    case Instruction::INCR_PTR:
+    case Instruction::DECR_PTR:
+    case Instruction::READ:
+    case Instruction::WRITE:
+    case Instruction::JZ:
+    case Instruction::JNZ:
+    case Instruction::DJNZ:
+    case Instruction::LABEL:
+    case Instruction::FIND_CELL_LOW:
+    case Instruction::FIND_CELL_HIGH:
+      rewrites += flush(stream, block, op);
+      break;
+    }
+  }
+  rewrites += flush(stream, block, nullptr);
+  return rewrites;
+}
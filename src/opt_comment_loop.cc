@@ -11,7 +11,8 @@
  * the optimizer faster, in case the comment loop contains a lot of
  * operations.
  */
-void OptCommentLoop(OperationStream &stream) {
+size_t OptCommentLoop(OperationStream &stream) {
+  size_t rewrites = 0;
   auto iter = stream.Begin();
   auto end = stream.End();
   for (;;) {
@@ -19,15 +20,15 @@ void OptCommentLoop(OperationStream &stream) {
       ++iter;
     }
     if (iter == end || !iter->Is(Instruction::JZ)) {
-      return;
+      return rewrites;
     }
     auto loop_end = iter;
     loop_end.JumpTo((Operation *) iter->Operand1());
     ASSERT(loop_end->Is(Instruction::LABEL), "check");
-    ASSERT((loop_end - 1)->Is(Instruction::JNZ), "check");
     while (iter != loop_end) {
       stream.Delete(iter++);
     }
     stream.Delete(iter++);
+    ++rewrites;
   }
 }
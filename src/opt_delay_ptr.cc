@@ -1,50 +1,161 @@
 // SPDX-License-Identifier: MIT License
+#include <vector>
+
+#include "debug.h"
 #include "instr.h"
+#include "loop_tree.h"
 #include "optimize.h"
 
-void OptDelayPtr(OperationStream &stream) {
+/**
+ * Finds the regions which do not move the cell pointer.
+ *
+ * A region is balanced, if the pointer moves of its own operations add up
+ * to 0, it does not contain a find cell operation, and all nested regions
+ * are balanced.  The cell pointer is the same at the start, at every jump,
+ * and at the end of a balanced region.  The result is indexed by node id.
+ */
+static std::vector<bool> find_balanced_regions(OperationStream &stream, LoopTree &loops) {
+  struct OpenRegion {
+    LoopNode *node;
+    intptr_t moves;
+    bool balanced;
+  };
+  std::vector<bool> balanced(loops.PostOrder().size() + 1, false);
+  std::vector<OpenRegion> open{};
+  for (Operation *op : stream) {
+    switch (op->OpCode()) {
+    case Instruction::INCR_PTR:
+      if (!open.empty()) {
+        open.back().moves += op->Operand1();
+      }
+      break;
+    case Instruction::DECR_PTR:
+      if (!open.empty()) {
+        open.back().moves -= op->Operand1();
+      }
+      break;
+    case Instruction::FIND_CELL_LOW:
+    case Instruction::FIND_CELL_HIGH:
+      if (!open.empty()) {
+        open.back().balanced = false;
+      }
+      break;
+    case Instruction::JZ:
+    case Instruction::JNZ:
+    case Instruction::DJNZ:
+    case Instruction::LABEL: {
+      LoopNode *node = loops.Find(op);
+      if (nullptr == node) {
+        break;
+      }
+      if (node->First() == op) {
+        open.push_back(OpenRegion{.node = node, .moves = 0, .balanced = true});
+      } else {
+        ASSERT(!open.empty() && open.back().node == node, "Jumps are not properly nested");
+        const OpenRegion region = open.back();
+        open.pop_back();
+        balanced[node->Id()] = region.balanced && 0 == region.moves;
+        if (!balanced[node->Id()] && !open.empty()) {
+          open.back().balanced = false;
+        }
+      }
+    } break;
+    default:
+      break;
+    }
+  }
+  return balanced;
+}
+
+/**
+ * Delay pointer moves.
+ *
+ * Pointer moves are removed and the accumulated offset is added to the
+ * operand offsets instead.  The offset is only materialized in front of
+ * find cell operations and at the jumps and labels of regions which move
+ * the cell pointer.  Balanced regions are entered with the offset, the
+ * conditions of their jumps and the operations within are rewritten to
+ * use it.
+ *
+ *   > [- > + <] <   becomes   [{1} -{1, 1} +{1, 2} ]{1}
+ */
+size_t OptDelayPtr(OperationStream &stream) {
+  ScopedLoopTree loops(stream);
+  const std::vector<bool> balanced = find_balanced_regions(stream, *loops);
   auto iter = stream.Begin();
   const auto end = stream.End();
   intptr_t offset = 0;
+  // Pointer moves removed since the last flush, used to count rewrites.
+  // Moving the same pointer move around again is not a rewrite.
+  size_t moves = 0;
+  size_t rewrites = 0;
+  // Materialize the offset in front of the current operation
+  auto flush = [&]() {
+    if (offset != 0) {
+      Instruction code = (offset > 0) ? Instruction::INCR_PTR : Instruction::DECR_PTR;
+      stream.InsertBefore(*iter, code, (offset > 0) ? offset : -offset, 0);
+      offset = 0;
+      --moves;
+    }
+    rewrites += moves;
+    moves = 0;
+  };
   while (iter != end) {
     switch (iter->OpCode()) {
     case Instruction::NOP: {
       ++iter;
     } break;
-    case Instruction::DMUL_CELL:
-    case Instruction::IMUL_CELL:
-    case Instruction::FIND_CELL_LOW:
-    case Instruction::FIND_CELL_HIGH:
     case Instruction::JZ:
     case Instruction::JNZ:
+    case Instruction::DJNZ:
     case Instruction::LABEL: {
+      LoopNode *node = loops->Find(*iter);
+      if (node && balanced[node->Id()]) {
+        if (iter->IsAny({Instruction::JZ, Instruction::JNZ}) && offset != 0) {
+          iter->SetOperand2(iter->Operand2() + offset);
+          ++rewrites;
+        }
+      } else {
+        flush();
+      }
+      ++iter;
+    } break;
+    case Instruction::FIND_CELL_LOW:
+    case Instruction::FIND_CELL_HIGH: {
+      flush();
+      ++iter;
+    } break;
+    case Instruction::DMUL_CELL:
+    case Instruction::IMUL_CELL: {
       if (offset != 0) {
-        Instruction code = (offset > 0) ? Instruction::INCR_PTR : Instruction::DECR_PTR;
-        offset = (offset > 0) ? offset : -offset;
-        stream.InsertBefore(*iter, code, offset, 0);
-        offset = 0;
+        iter->SetOperand2(iter->Operand2() + offset);
+        iter->SetOperand3(iter->Operand3() + offset);
+        ++rewrites;
       }
       ++iter;
     } break;
     case Instruction::SET_CELL:
     case Instruction::INCR_CELL:
-    case Instruction::DECR_CELL: {
-      iter->SetOperand2(offset);
+    case Instruction::DECR_CELL:
+    case Instruction::WRITE:
+    case Instruction::READ: {
+      if (offset != 0) {
+        iter->SetOperand2(iter->Operand2() + offset);
+        ++rewrites;
+      }
       ++iter;
     } break;
     case Instruction::INCR_PTR: {
       offset += iter->Operand1();
+      ++moves;
       stream.Delete(iter++);
     } break;
     case Instruction::DECR_PTR: {
       offset -= iter->Operand1();
+      ++moves;
       stream.Delete(iter++);
     } break;
-    case Instruction::WRITE:
-    case Instruction::READ: {
-      iter->SetOperand2(offset);
-      ++iter;
-    } break;
     }
   }
+  return rewrites + moves;
 }
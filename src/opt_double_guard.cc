@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: MIT License
 #include "instr.h"
+#include "loop_tree.h"
 #include "optimize.h"
 
 /**
@@ -13,55 +14,88 @@
  * Delayed pointer increment and multiplicative loop optimization helps
  * to remove even more guards.
  */
-void OptDoubleGuard(OperationStream &stream) {
+static bool remove_next_guard(OperationStream &stream, Operation *jump) {
   const auto end = stream.End();
-  for (auto iter = stream.Begin(); iter != end; ++iter) {
-    if (!iter->IsJump()) {
+  auto iter = stream.From(jump);
+  auto cur = iter + 1;
+  const intptr_t condition = jump->Operand2();
+  // Look at all the operations up to the next jump.
+  // If there is no pointer movement and no operation is
+  // using the condition cell, the next jump can be removed.
+  while (cur != end) {
+    bool do_break = false;
+    switch (cur->OpCode()) {
+    case Instruction::NOP:
+    case Instruction::LABEL:
+      break;
+    case Instruction::INCR_CELL:
+    case Instruction::DECR_CELL:
+    case Instruction::IMUL_CELL:
+    case Instruction::DMUL_CELL:
+    case Instruction::SET_CELL:
+    case Instruction::READ:
+    case Instruction::WRITE:
+      if (condition == cur->Operand2()) {
+        do_break = true;
+      }
+      break;
+    case Instruction::INCR_PTR:
+    case Instruction::DECR_PTR:
+    case Instruction::FIND_CELL_LOW:
+    case Instruction::FIND_CELL_HIGH:
+      do_break = true;
+      break;
+    case Instruction::JZ:
+    case Instruction::JNZ:
+    case Instruction::DJNZ:
+      do_break = true;
+      break;
+    }
+    if (do_break) {
+      break;
+    }
+    ++cur;
+  }
+  // Jump must be of the same type and test the same cell!
+  if (cur != iter && cur != end && cur->Is(iter->OpCode()) && cur->Operand2() == condition) {
+    auto jump_label = cur;
+    jump_label.JumpTo((Operation *) cur->Operand1());
+    stream.Delete(cur);
+    stream.Delete(jump_label);
+    return true;
+  }
+  return false;
+}
+
+size_t OptDoubleGuard(OperationStream &stream) {
+  ScopedLoopTree loops(stream);
+  size_t rewrites = 0;
+  // Visit all jumps in stream order by walking the loop tree.  A JZ is
+  // visited before the children of its guard, a JNZ after the children
+  // of its loop.  Removed nodes are replaced by their children, so the
+  // walk simply continues with whatever is linked now.
+  LoopNode *node = loops->FirstTopLevel();
+  while (node) {
+    if (node->IsGuard()) {
+      rewrites += remove_next_guard(stream, node->First());
+    }
+    if (node->FirstChild()) {
+      node = node->FirstChild();
       continue;
     }
-    auto cur = iter + 1;
-    // Look at all the operations up to the next jump.
-    // If there is no pointer movement and no operation is
-    // using the current cell, the next jump can be removed.
-    while (cur != end) {
-      bool do_break = false;
-      switch (cur->OpCode()) {
-      case Instruction::NOP:
-      case Instruction::LABEL:
-        break;
-      case Instruction::INCR_CELL:
-      case Instruction::DECR_CELL:
-      case Instruction::IMUL_CELL:
-      case Instruction::DMUL_CELL:
-      case Instruction::SET_CELL:
-      case Instruction::READ:
-      case Instruction::WRITE:
-        if (0 == cur->Operand2()) {
-          do_break = true;
-        }
-        break;
-      case Instruction::INCR_PTR:
-      case Instruction::DECR_PTR:
-      case Instruction::FIND_CELL_LOW:
-      case Instruction::FIND_CELL_HIGH:
-        do_break = true;
-        break;
-      case Instruction::JZ:
-      case Instruction::JNZ:
-        do_break = true;
+    for (;;) {
+      if (node->IsLoop() && !node->IsCounted()) {
+        rewrites += remove_next_guard(stream, node->Last());
+      }
+      if (node->NextSibling()) {
+        node = node->NextSibling();
         break;
       }
-      if (do_break) {
+      node = node->Parent();
+      if (nullptr == node) {
         break;
       }
-      ++cur;
-    }
-    // Jump must be of the same type!
-    if (cur != iter && cur != end && cur->Is(iter->OpCode())) {
-      auto jump_label = cur;
-      jump_label.JumpTo((Operation *) cur->Operand1());
-      stream.Delete(cur);
-      stream.Delete(jump_label);
     }
   }
+  return rewrites;
 }
@@ -8,7 +8,8 @@
  * Fuses consecutive increment and decrement operations for the pointer
  * and the current cell.  Does not merge together different instructions.
  */
-void OptFusionOp(OperationStream &stream) {
+size_t OptFusionOp(OperationStream &stream) {
+  size_t rewrites = 0;
   auto iter = stream.Begin();
   const auto end = stream.End();
   // Split between incr/decr of cells and pointer, because of potential
@@ -22,24 +23,28 @@ void OptFusionOp(OperationStream &stream) {
       while (iter != end && iter->OpCode() == seq_cmd && iter->Operand2() == seq_head->Operand2()) {
         amount += iter->Operand1();
         stream.Delete(iter++);
+        ++rewrites;
       }
       amount = amount % 256;
       if (amount == 0) {
         stream.Delete(seq_head);
+        ++rewrites;
       } else {
-        seq_head->SetOperand1(amount % 256);
+        seq_head->SetOperand1(amount);
       }
     } else if (seq_cmd == Instruction::INCR_PTR || seq_cmd == Instruction::DECR_PTR) {
+      // Pointer moves must not wrap around, the heap is larger than 256 cells
       auto seq_head = iter++;
       Operation::operand_type amount = seq_head->Operand1();
       while (iter != end && iter->OpCode() == seq_cmd) {
         amount += iter->Operand1();
         stream.Delete(iter++);
+        ++rewrites;
       }
-      amount = amount % 256;
-      seq_head->SetOperand1(amount % 256);
+      seq_head->SetOperand1(amount);
     } else {
       ++iter;
     }
   }
+  return rewrites;
 }
@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: MIT License
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "debug.h"
+#include "instr.h"
+#include "loop_tree.h"
+#include "optimize.h"
+
+/**
+ * Cell accesses of a region, relative to the cell pointer at the start
+ * of the region.  Only meaningful for balanced regions, the cell pointer
+ * never moves inside of them.
+ */
+struct RegionAccesses {
+  bool balanced;
+  std::unordered_map<intptr_t, size_t> count;
+};
+
+static void count_access(RegionAccesses &region, intptr_t offset) {
+  ++region.count[offset];
+}
+
+/**
+ * Collects the accesses of the children of the given node.  The largest
+ * map is taken over, the others are merged into it.
+ */
+static void merge_children(std::vector<RegionAccesses> &regions, LoopNode *node) {
+  RegionAccesses &region = regions[node->Id()];
+  LoopNode *largest = nullptr;
+  for (LoopNode *child = node->FirstChild(); child; child = child->NextSibling()) {
+    const RegionAccesses &child_region = regions[child->Id()];
+    region.balanced = region.balanced && child_region.balanced;
+    if (!largest || child_region.count.size() > regions[largest->Id()].count.size()) {
+      largest = child;
+    }
+  }
+  if (region.balanced && largest) {
+    region.count = std::move(regions[largest->Id()].count);
+    for (LoopNode *child = node->FirstChild(); child; child = child->NextSibling()) {
+      if (child != largest) {
+        for (const auto &[offset, count] : regions[child->Id()].count) {
+          region.count[offset] += count;
+        }
+      }
+    }
+  }
+  for (LoopNode *child = node->FirstChild(); child; child = child->NextSibling()) {
+    std::unordered_map<intptr_t, size_t>{}.swap(regions[child->Id()].count);
+  }
+}
+
+/**
+ * Visits the operations of the node which are not part of a child region,
+ * including the condition of the node itself.
+ * Returns the SET_CELL operations found.
+ */
+static std::vector<Operation *> scan_direct_operations(OperationStream &stream,
+                                                       LoopTree &loops,
+                                                       LoopNode *node,
+                                                       RegionAccesses &region) {
+  std::vector<Operation *> stores{};
+  auto iter = stream.From(node->First()) + 1;
+  const auto end = stream.From(node->Last());
+  while (iter != end) {
+    switch (iter->OpCode()) {
+    case Instruction::NOP:
+      break;
+    case Instruction::JZ:
+    case Instruction::JNZ:
+    case Instruction::DJNZ:
+    case Instruction::LABEL: {
+      // The start of a child region, skip the whole region
+      LoopNode *child = loops.Find(*iter);
+      if (child && child->First() == *iter) {
+        ASSERT(child != node, "Nested region expected");
+        iter.JumpTo(child->Last());
+      }
+    } break;
+    case Instruction::SET_CELL:
+      stores.push_back(*iter);
+      count_access(region, iter->Operand2());
+      break;
+    case Instruction::IMUL_CELL:
+    case Instruction::DMUL_CELL:
+      count_access(region, iter->Operand3());
+      count_access(region, iter->Operand2());
+      break;
+    case Instruction::INCR_CELL:
+    case Instruction::DECR_CELL:
+    case Instruction::READ:
+    case Instruction::WRITE:
+      count_access(region, iter->Operand2());
+      break;
+    case Instruction::INCR_PTR:
+    case Instruction::DECR_PTR:
+    case Instruction::FIND_CELL_LOW:
+    case Instruction::FIND_CELL_HIGH:
+      region.balanced = false;
+      break;
+    }
+    ++iter;
+  }
+  // The condition cell is read on every entry or iteration
+  if (!node->IsCounted()) {
+    Operation *condition = node->IsLoop() ? node->Last() : node->First();
+    count_access(region, condition->Operand2());
+  }
+  return stores;
+}
+
+/**
+ * Loop invariant code motion.
+ *
+ * A loop is balanced, if the cell pointer does not move inside of it.
+ * In a balanced loop, every operation accesses the same cell in every
+ * iteration.  If the only accesses to a cell are unconditional stores,
+ * the last one always wins and nothing in the loop observes it.
+ *
+ *   [ >[-]< - ]
+ *
+ * The loop clears the next cell in every iteration, once is enough.
+ *
+ * A single store is hoisted in front of the loop label, multiple stores
+ * are replaced by the last one after the backward jump.  Both places are
+ * only reached if the loop body runs at least once, so a loop which is
+ * skipped by its guard still does not store anything.
+ *
+ * This optimization requires delayed moves to be applied before.
+ */
+size_t OptLoopInvariant(OperationStream &stream) {
+  ScopedLoopTree loops(stream);
+  size_t rewrites = 0;
+  const auto &order = loops->PostOrder();
+  std::vector<RegionAccesses> regions(order.size() + 1, RegionAccesses{.balanced = true, .count = {}});
+  for (LoopNode *node : order) {
+    if (node->IsRemoved()) {
+      continue;
+    }
+    RegionAccesses &region = regions[node->Id()];
+    merge_children(regions, node);
+    const std::vector<Operation *> stores = scan_direct_operations(stream, *loops, node, region);
+    if (!region.balanced) {
+      std::unordered_map<intptr_t, size_t>{}.swap(region.count);
+      continue;
+    }
+    if (!node->IsLoop() || stores.empty()) {
+      continue;
+    }
+    // Stores which are not invariant are left alone
+    std::unordered_map<intptr_t, size_t> remaining{};
+    for (Operation *store : stores) {
+      ++remaining[store->Operand2()];
+    }
+    std::erase_if(remaining, [&region](const auto &entry) { return region.count[entry.first] != entry.second; });
+    Operation *loop_exit = *(stream.From(node->Last()) + 1);
+    for (Operation *store : stores) {
+      const intptr_t offset = store->Operand2();
+      auto entry = remaining.find(offset);
+      if (entry == remaining.end()) {
+        continue;
+      }
+      if (--entry->second == 0) {
+        // The last store wins
+        Operation *target = (1 == region.count[offset]) ? node->First() : loop_exit;
+        stream.InsertBefore(target, Instruction::SET_CELL, store->Operand1(), offset);
+        region.count.erase(offset);
+      }
+      stream.Delete(store);
+      ++rewrites;
+    }
+  }
+  return rewrites;
+}
@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: MIT License
+#include <cstdint>
+#include <map>
+
+#include "debug.h"
+#include "instr.h"
+#include "loop_tree.h"
+#include "optimize.h"
+
+// Looking for a store which clears a cell skips at most this many blocks,
+// which keeps chains of blocks linear.
+static const size_t SKIP_LIMIT = 8;
+
+/**
+ * A guard which only contains multiplications by its condition cell.
+ * The cells are relative to the value of the counter c before the block.
+ *
+ *   target += amount * c   for all terms
+ *   c = factor * c
+ */
+struct MultiplyBlock {
+  intptr_t counter;
+  std::map<intptr_t, uint8_t> terms;
+  uint8_t factor;
+};
+
+/**
+ * Recognizes the blocks generated by the multiplicative loop optimization.
+ */
+static bool parse_block(OperationStream &stream, LoopNode *node, MultiplyBlock &block) {
+  if (node->IsRemoved() || !node->IsGuard() || !node->IsInnermost()) {
+    return false;
+  }
+  block = MultiplyBlock{.counter = node->First()->Operand2(), .terms = {}, .factor = 1};
+  auto iter = stream.From(node->First()) + 1;
+  const auto end = stream.From(node->Last());
+  for (; iter != end; ++iter) {
+    if (iter->Is(Instruction::NOP)) {
+      continue;
+    }
+    if (0 == block.factor) {
+      // The counter must be cleared last
+      return false;
+    }
+    if (iter->Is(Instruction::SET_CELL) && 0 == iter->Operand1() && block.counter == iter->Operand2()) {
+      block.factor = 0;
+    } else if (iter->IsAny({Instruction::IMUL_CELL, Instruction::DMUL_CELL}) && block.counter == iter->Operand3() &&
+               block.counter != iter->Operand2()) {
+      const uint8_t amount = (uint8_t) iter->Operand1();
+      uint8_t &term = block.terms[iter->Operand2()];
+      term = (uint8_t) (term + (iter->Is(Instruction::IMUL_CELL) ? amount : -amount));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Returns true, if the cell is known to be 0 right before the given
+ * operation.  Either it was set to 0, it is the counter of a block which
+ * was left before, or the tape is still in its initial state.
+ */
+static bool known_zero(OperationStream &stream, LoopTree &loops, Operation *entry, intptr_t cell) {
+  auto iter = stream.From(entry);
+  const auto begin = stream.Begin();
+  size_t skipped = 0;
+  while (iter != begin) {
+    --iter;
+    switch (iter->OpCode()) {
+    case Instruction::NOP:
+    case Instruction::WRITE:
+      break;
+    case Instruction::SET_CELL:
+      if (cell == iter->Operand2()) {
+        return 0 == iter->Operand1();
+      }
+      break;
+    case Instruction::INCR_CELL:
+    case Instruction::DECR_CELL:
+    case Instruction::READ:
+    case Instruction::IMUL_CELL:
+    case Instruction::DMUL_CELL:
+      if (cell == iter->Operand2()) {
+        return false;
+      }
+      break;
+    case Instruction::LABEL: {
+      // The counter of a block is 0 after it, other cells the block does
+      // not write keep their value
+      LoopNode *node = loops.Find(*iter);
+      MultiplyBlock block{};
+      if (!node || node->Last() != *iter || !parse_block(stream, node, block)) {
+        return false;
+      }
+      if (cell == block.counter) {
+        return 0 == block.factor;
+      }
+      if (block.terms.contains(cell) || ++skipped > SKIP_LIMIT) {
+        return false;
+      }
+      iter.JumpTo(node->First());
+    } break;
+    case Instruction::INCR_PTR:
+    case Instruction::DECR_PTR:
+    case Instruction::FIND_CELL_LOW:
+    case Instruction::FIND_CELL_HIGH:
+    case Instruction::JZ:
+    case Instruction::JNZ:
+    case Instruction::DJNZ:
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Combines two blocks into one.  The counter of the second block holds
+ * scale times the counter of the first block when the second block is
+ * entered.  Returns false, if the counter of the result cannot be
+ * expressed by a block.
+ */
+static bool compose(MultiplyBlock &first, const MultiplyBlock &second, uint8_t scale) {
+  // The counter of the first block after both blocks
+  uint8_t factor = (uint8_t) (second.factor * scale);
+  if (first.counter != second.counter) {
+    auto term = second.terms.find(first.counter);
+    factor = (uint8_t) (first.factor + (term == second.terms.end() ? 0 : term->second * scale));
+  }
+  if (factor > 1) {
+    return false;
+  }
+  if (first.counter != second.counter) {
+    // The counter of the second block was 0 before the first block
+    first.terms[second.counter] = (uint8_t) (second.factor * scale);
+  }
+  for (const auto &[target, amount] : second.terms) {
+    if (first.counter != target) {
+      first.terms[target] = (uint8_t) (first.terms[target] + amount * scale);
+    }
+  }
+  first.factor = factor;
+  return true;
+}
+
+static void delete_region(OperationStream &stream, Operation *first, Operation *last) {
+  auto iter = stream.From(first);
+  const auto stop = stream.From(last);
+  while (iter != stop) {
+    stream.Delete(iter++);
+  }
+  stream.Delete(last);
+}
+
+/**
+ * Replaces the body of the guard with the block.  A block which does
+ * nothing is removed together with its guard.
+ */
+static void rewrite(OperationStream &stream, LoopNode *node, const MultiplyBlock &block) {
+  Operation *label = node->Last();
+  auto iter = stream.From(node->First()) + 1;
+  while (*iter != label) {
+    stream.Delete(iter++);
+  }
+  bool empty = 1 == block.factor;
+  for (const auto &[target, amount] : block.terms) {
+    if (0 == amount) {
+      continue;
+    }
+    if (amount < 128) {
+      stream.InsertBefore(label, Instruction::IMUL_CELL, amount, target, block.counter);
+    } else {
+      stream.InsertBefore(label, Instruction::DMUL_CELL, (uint8_t) -amount, target, block.counter);
+    }
+    empty = false;
+  }
+  if (empty) {
+    delete_region(stream, node->First(), label);
+  } else if (0 == block.factor) {
+    stream.InsertBefore(label, Instruction::SET_CELL, 0, block.counter);
+  }
+}
+
+/**
+ * Returns true, if there is nothing but NOPs between the two nodes.
+ */
+static bool adjacent(OperationStream &stream, LoopNode *node, LoopNode *next) {
+  auto iter = stream.From(node->Last()) + 1;
+  for (; *iter != next->First(); ++iter) {
+    if (!iter->Is(Instruction::NOP)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Merge multiplicative loops which share a counter.
+ *
+ * Copying a cell with a temporary and restoring it afterwards becomes two
+ * blocks, each behind its own guard.
+ *
+ *   [ - > + > + < < ] > > [ - < < + > > ]
+ *
+ * If the temporary was 0 before, the second block adds the counter of
+ * the first block back to it.  Both blocks are merged into one, which
+ * leaves the counter and the temporary alone.
+ *
+ *   [ *{1, 1, 0} ]
+ *
+ * A following block on the same counter is merged as well, as long as
+ * the counter is not cleared before.  Merged blocks load the counter only
+ * once, and blocks which do nothing at all are removed.
+ *
+ * This optimization requires the multiplicative loop optimization to be
+ * applied before.
+ */
+size_t OptMergeMultiply(OperationStream &stream) {
+  ScopedLoopTree loops(stream);
+  size_t rewrites = 0;
+  for (LoopNode *node : loops->PostOrder()) {
+    MultiplyBlock block{};
+    if (!parse_block(stream, node, block)) {
+      continue;
+    }
+    bool merged = false;
+    for (LoopNode *next = node->NextSibling(); next && adjacent(stream, node, next); next = node->NextSibling()) {
+      MultiplyBlock second{};
+      if (!parse_block(stream, next, second)) {
+        break;
+      }
+      uint8_t scale = 0;
+      if (block.counter == second.counter) {
+        scale = block.factor;
+      } else if (known_zero(stream, *loops, node->First(), second.counter)) {
+        scale = block.terms[second.counter];
+      } else {
+        break;
+      }
+      if (!compose(block, second, scale)) {
+        break;
+      }
+      delete_region(stream, next->First(), next->Last());
+      merged = true;
+      ++rewrites;
+    }
+    if (merged) {
+      rewrite(stream, node, block);
+    }
+  }
+  return rewrites;
+}
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: MIT License
 #include "debug.h"
 #include "instr.h"
+#include "loop_tree.h"
 #include "optimize.h"
 
 static bool try_optimize_loop(OperationStream &stream,
@@ -18,45 +19,30 @@ static bool try_optimize_loop(OperationStream &stream,
  *
  * This optimization requires fusion and delayd moves to be applied before.
  */
-void OptMultiplyLoop(OperationStream &stream) {
-  auto iter = stream.Begin();
-  const auto end = stream.End();
-  while (iter != end) {
-    if (iter->Is(Instruction::JNZ)) {
-      bool jump_found = false;
-      auto loop_start = iter;
-      auto loop_end = iter;
-      loop_start.JumpTo((Operation *) loop_end->Operand1());
-      auto cur = loop_start;
-      ASSERT(loop_start->Is(Instruction::LABEL), "check");
-      ASSERT(loop_end->Is(Instruction::JNZ), "check");
-      // Find the end of the loop.  Stop if another loop starts.
-      while (cur != loop_end) {
-        if (cur->IsJump()) {
-          jump_found = true;
-          break;
-        }
-        ++cur;
-      }
-      if (!jump_found) {
-        // go beyond the loop
-        iter = loop_end + 2;
-        if (try_optimize_loop(stream, loop_start, loop_end)) {
-          // Delete the backward jump and its label
-          stream.Delete(loop_start);
-          stream.Delete(loop_end);
-        }
-      } else {
-        ++iter;
-      }
-    } else {
-      ++iter;
+size_t OptMultiplyLoop(OperationStream &stream) {
+  ScopedLoopTree loops(stream);
+  size_t rewrites = 0;
+  // Only innermost loops can be multiplicative loops, they do not contain
+  // any other jump.  Converting a loop never turns its parent into an
+  // innermost loop, because the guard stays.
+  for (LoopNode *node : loops->PostOrder()) {
+    if (node->IsRemoved() || !node->IsLoop() || node->IsCounted() || !node->IsInnermost()) {
+      continue;
+    }
+    auto loop_start = stream.From(node->First());
+    auto loop_end = stream.From(node->Last());
+    if (try_optimize_loop(stream, loop_start, loop_end)) {
+      // Delete the backward jump and its label
+      stream.Delete(loop_start);
+      stream.Delete(loop_end);
+      ++rewrites;
     }
   }
+  return rewrites;
 }
 
-static inline bool is_loop_counter_decrement(const OperationStream::Iterator &iter) {
-  return iter->Is(Instruction::DECR_CELL) && iter->Operand1() == 1 && iter->Operand2() == 0;
+static inline bool is_loop_counter_decrement(const OperationStream::Iterator &iter, intptr_t counter) {
+  return iter->Is(Instruction::DECR_CELL) && iter->Operand1() == 1 && iter->Operand2() == counter;
 }
 
 static bool try_optimize_loop(OperationStream &stream,
@@ -64,6 +50,8 @@ static bool try_optimize_loop(OperationStream &stream,
                               const OperationStream::Iterator end) {
   ASSERT(iter->Is(Instruction::LABEL), "check");
   ASSERT(end->Is(Instruction::JNZ), "check");
+  // The loop counter is the cell the loop condition tests
+  const intptr_t counter = end->Operand2();
   unsigned int counter_access_count = 0;
   // Check for an appropriate loop
   for (auto cur = iter + 1; cur != end; ++cur) {
@@ -73,7 +61,7 @@ static bool try_optimize_loop(OperationStream &stream,
     }
     // only one operation is allowed to access the counter
     // it needs to decrement it by 1
-    if (0 == cur->Operand2()) {
+    if (counter == cur->Operand2()) {
       ++counter_access_count;
       if (counter_access_count > 1 || !cur->Is(Instruction::DECR_CELL) || cur->Operand1() != 1) {
         return false;
@@ -90,16 +78,18 @@ static bool try_optimize_loop(OperationStream &stream,
   // might get out of bounds, if the program exploits that.
   auto cur = iter + 1;
   while (cur != end) {
-    if (is_loop_counter_decrement(cur)) {
+    if (is_loop_counter_decrement(cur, counter)) {
       stream.Delete(cur++);
     } else if (cur->Is(Instruction::INCR_CELL)) {
       cur->SetOpCode(Instruction::IMUL_CELL);
+      cur->SetOperand3(counter);
       cur++;
     } else {
       cur->SetOpCode(Instruction::DMUL_CELL);
+      cur->SetOperand3(counter);
       cur++;
     }
   }
-  stream.InsertBefore(*cur, Instruction::SET_CELL, 0, 0);
+  stream.InsertBefore(*cur, Instruction::SET_CELL, 0, counter);
   return true;
 }
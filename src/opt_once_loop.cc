@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: MIT License
+#include <cstdint>
+#include <vector>
+
+#include "debug.h"
+#include "instr.h"
+#include "loop_tree.h"
+#include "optimize.h"
+
+/**
+ * Checks whether the condition cell is zero when the backward jump is
+ * reached.  The body is walked backwards from the jump up to the first
+ * operation which decides it.  A loop which tests the condition cell
+ * only exits if it is zero, and a guard which tests it only skips its
+ * body if it is zero, so the walk continues into the guarded body.
+ *
+ * The guards passed on the way are collected, the answer is the same
+ * for their own bodies.  Remembering it keeps deeply nested guards from
+ * being walked again for every enclosing loop.
+ */
+enum class Cleared : uint8_t {
+  UNKNOWN,
+  YES,
+  NO,
+};
+
+static bool walk_body(OperationStream &stream,
+                      LoopTree &loops,
+                      const std::vector<Cleared> &guards,
+                      std::vector<LoopNode *> &passed,
+                      LoopNode *node) {
+  const intptr_t condition = node->Last()->Operand2();
+  auto iter = stream.From(node->Last());
+  const auto begin = stream.From(node->First());
+  while (--iter != begin) {
+    switch (iter->OpCode()) {
+    case Instruction::NOP:
+    case Instruction::WRITE:
+      break;
+    case Instruction::SET_CELL:
+      if (condition == iter->Operand2()) {
+        return 0 == iter->Operand1();
+      }
+      break;
+    case Instruction::INCR_CELL:
+    case Instruction::DECR_CELL:
+    case Instruction::IMUL_CELL:
+    case Instruction::DMUL_CELL:
+    case Instruction::READ:
+      if (condition == iter->Operand2()) {
+        return false;
+      }
+      break;
+    case Instruction::JNZ:
+      return condition == iter->Operand2();
+    case Instruction::LABEL: {
+      LoopNode *guard = loops.Find(*iter);
+      if (!guard || !guard->IsGuard() || guard->Last() != *iter || guard->First()->Operand2() != condition) {
+        return false;
+      }
+      if (Cleared::UNKNOWN != guards[guard->Id()]) {
+        return Cleared::YES == guards[guard->Id()];
+      }
+      passed.push_back(guard);
+    } break;
+    case Instruction::INCR_PTR:
+    case Instruction::DECR_PTR:
+    case Instruction::FIND_CELL_LOW:
+    case Instruction::FIND_CELL_HIGH:
+    case Instruction::JZ:
+    case Instruction::DJNZ:
+      return false;
+    }
+  }
+  return false;
+}
+
+static bool clears_condition(OperationStream &stream,
+                             LoopTree &loops,
+                             std::vector<Cleared> &guards,
+                             std::vector<LoopNode *> &passed,
+                             LoopNode *node) {
+  passed.clear();
+  const bool cleared = walk_body(stream, loops, guards, passed, node);
+  for (LoopNode *guard : passed) {
+    guards[guard->Id()] = cleared ? Cleared::YES : Cleared::NO;
+  }
+  return cleared;
+}
+
+/**
+ * Lower loops which run at most once.
+ *
+ * If the body of a loop always clears the cell the loop tests, the
+ * backward jump is never taken.
+ *
+ *   [ - > + < [-] ]
+ *   [ > + < [ - > + < ] ]
+ *
+ * The loop label and the backward jump are removed, what remains is the
+ * guard with the body as a conditional block.  A loop without a guard
+ * is always entered, its body becomes straight line code.
+ *
+ * This optimization requires delayed moves to be applied before.
+ */
+size_t OptOnceLoop(OperationStream &stream) {
+  ScopedLoopTree loops(stream);
+  size_t rewrites = 0;
+  const auto &order = loops->PostOrder();
+  std::vector<Cleared> guards(order.size() + 1, Cleared::UNKNOWN);
+  std::vector<LoopNode *> passed{};
+  for (LoopNode *node : order) {
+    if (node->IsRemoved() || !node->IsLoop() || node->IsCounted()) {
+      continue;
+    }
+    if (!clears_condition(stream, *loops, guards, passed, node)) {
+      continue;
+    }
+    Operation *label = node->First();
+    stream.Delete(node->Last());
+    stream.Delete(label);
+    ++rewrites;
+  }
+  return rewrites;
+}
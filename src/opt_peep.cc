@@ -1,115 +1,318 @@
 // SPDX-License-Identifier: MIT License
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
 #include "debug.h"
 #include "instr.h"
 #include "optimize.h"
 
 /**
- * Replace loops with a single increment or decrement operation with
- * a set to zero.
- *
- * [+] [-]
+ * Constraint on an operand of a pattern operation.
  */
-static void ReplaceSingleInstructionLoops(OperationStream &stream) {
-  static const auto incr_pattern = {
-      Instruction::JZ, Instruction::LABEL, Instruction::INCR_CELL, Instruction::JNZ, Instruction::LABEL};
-  static const auto decr_pattern = {
-      Instruction::JZ, Instruction::LABEL, Instruction::DECR_CELL, Instruction::JNZ, Instruction::LABEL};
-  auto iter = stream.Begin();
-  const auto end = stream.End();
-  while (iter != end) {
-    if (iter.LookingAt(incr_pattern) || iter.LookingAt(decr_pattern)) {
-      auto jz = iter++;
-      auto label1 = iter++;
-      auto incr_decr = iter++;
-      auto jnz = iter++;
-      auto label2 = iter++;
-      if (jz->Operand1() == (Operation::operand_type) *label2 && jnz->Operand1() == (Operation::operand_type) *label1
-          && incr_decr->Operand1() % 2 == 1) {
-        ASSERT(label2->Operand1() == (Operation::operand_type) *jz, "check");
-        ASSERT(label1->Operand1() == (Operation::operand_type) *jnz, "check");
-        jz->SetOpCode(Instruction::SET_CELL);
-        jz->SetOperand1(0);
-        stream.Delete(label1);
-        stream.Delete(incr_decr);
-        stream.Delete(jnz);
-        stream.Delete(label2);
-      }
-    } else {
-      ++iter;
-    }
-  }
+enum class Match : uint8_t {
+  // Anything
+  ANY,
+  // The constant given by value
+  EQUAL,
+  // An odd number
+  ODD,
+  // The operation at position value of the match
+  AT,
+  // Binds the variable given by value on first use, must be equal to it afterwards
+  BIND,
+};
+
+struct Operand {
+  Match match;
+  intptr_t value;
+};
+
+/**
+ * Computes an operand of a replacement operation from the variables.
+ * Sums and differences are amounts and wrap around at 256.
+ */
+enum class Compute : uint8_t {
+  CONSTANT,
+  VARIABLE,
+  SUM,
+  DIFFERENCE,
+};
+
+struct Result {
+  Compute compute;
+  intptr_t a;
+  intptr_t b;
+};
+
+struct PatternOp {
+  Instruction code;
+  Operand op1;
+  Operand op2;
+};
+
+struct ReplacementOp {
+  Instruction code;
+  Result op1;
+  Result op2;
+};
+
+/**
+ * Replaces a sequence of operations with a shorter one.
+ */
+struct Rule {
+  std::vector<PatternOp> pattern;
+  std::vector<ReplacementOp> replacement;
+};
+
+// Variables of the rules
+enum Variable : size_t {
+  X,
+  A,
+  B,
+  VARIABLES,
+};
+
+static constexpr Operand any{Match::ANY, 0};
+
+static constexpr Operand equal(int value) {
+  return Operand{Match::EQUAL, value};
+}
+
+static constexpr Operand odd{Match::ODD, 0};
+
+static constexpr Operand at(int position) {
+  return Operand{Match::AT, position};
+}
+
+static constexpr Operand bind(Variable var) {
+  return Operand{Match::BIND, (intptr_t) var};
+}
+
+static constexpr Result constant(int value) {
+  return Result{Compute::CONSTANT, value, 0};
+}
+
+static constexpr Result variable(Variable var) {
+  return Result{Compute::VARIABLE, (intptr_t) var, 0};
+}
+
+static constexpr Result sum(Variable a, Variable b) {
+  return Result{Compute::SUM, (intptr_t) a, (intptr_t) b};
+}
+
+static constexpr Result difference(Variable a, Variable b) {
+  return Result{Compute::DIFFERENCE, (intptr_t) a, (intptr_t) b};
 }
 
 /**
- * Replaces loops with a single increment/decrement pointer operation
- * into a find cell operation.
- *
- * [<] [>]
+ * The peephole rules.  New patterns only need a new entry here.
+ * If multiple rules match, the longest one wins, and from rules of the
+ * same length the first one.
  */
-static void ReplaceFindCellLoops(OperationStream &stream) {
-  static const auto high_pattern = {
-      Instruction::JZ, Instruction::LABEL, Instruction::INCR_PTR, Instruction::JNZ, Instruction::LABEL};
-  static const auto low_pattern = {
-      Instruction::JZ, Instruction::LABEL, Instruction::DECR_PTR, Instruction::JNZ, Instruction::LABEL};
-  auto iter = stream.Begin();
-  const auto end = stream.End();
-  while (iter != end) {
-    if (iter.LookingAt(high_pattern) || iter.LookingAt(low_pattern)) {
-      auto jz = iter++;
-      auto label1 = iter++;
-      auto incr_decr = iter++;
-      auto jnz = iter++;
-      auto label2 = iter++;
-      if (jz->Operand1() == (Operation::operand_type) *label2 && jnz->Operand1() == (Operation::operand_type) *label1) {
-        if (incr_decr->Is(Instruction(Instruction::INCR_PTR))) {
-          jz->SetOpCode(Instruction::FIND_CELL_HIGH);
-        } else {
-          jz->SetOpCode(Instruction::FIND_CELL_LOW);
-        }
-        jz->SetOperand1(0);
-        jz->SetOperand2(incr_decr->Operand1());
-        stream.Delete(label1);
-        stream.Delete(incr_decr);
-        stream.Delete(jnz);
-        stream.Delete(label2);
+static const std::vector<Rule> &rules() {
+  using enum Instruction;
+  static const std::vector<Rule> rules = {
+      // [+] [-] clear the cell, if the amount is odd
+      {{{JZ, at(4), bind(X)},
+        {LABEL, at(3), any},
+        {INCR_CELL, odd, bind(X)},
+        {JNZ, at(1), bind(X)},
+        {LABEL, at(0), any}},
+       {{SET_CELL, constant(0), variable(X)}}},
+      {{{JZ, at(4), bind(X)},
+        {LABEL, at(3), any},
+        {DECR_CELL, odd, bind(X)},
+        {JNZ, at(1), bind(X)},
+        {LABEL, at(0), any}},
+       {{SET_CELL, constant(0), variable(X)}}},
+      // [>] [<] find a zero cell
+      {{{JZ, at(4), equal(0)},
+        {LABEL, at(3), any},
+        {INCR_PTR, bind(A), any},
+        {JNZ, at(1), equal(0)},
+        {LABEL, at(0), any}},
+       {{FIND_CELL_HIGH, constant(0), variable(A)}}},
+      {{{JZ, at(4), equal(0)},
+        {LABEL, at(3), any},
+        {DECR_PTR, bind(A), any},
+        {JNZ, at(1), equal(0)},
+        {LABEL, at(0), any}},
+       {{FIND_CELL_LOW, constant(0), variable(A)}}},
+      // Updates of a cell which is set before
+      {{{SET_CELL, bind(A), bind(X)}, {INCR_CELL, bind(B), bind(X)}}, {{SET_CELL, sum(A, B), variable(X)}}},
+      {{{SET_CELL, bind(A), bind(X)}, {DECR_CELL, bind(B), bind(X)}}, {{SET_CELL, difference(A, B), variable(X)}}},
+      // Updates of a cell which is set afterwards
+      {{{INCR_CELL, any, bind(X)}, {SET_CELL, bind(A), bind(X)}}, {{SET_CELL, variable(A), variable(X)}}},
+      {{{DECR_CELL, any, bind(X)}, {SET_CELL, bind(A), bind(X)}}, {{SET_CELL, variable(A), variable(X)}}},
+      {{{SET_CELL, any, bind(X)}, {SET_CELL, bind(A), bind(X)}}, {{SET_CELL, variable(A), variable(X)}}},
+  };
+  return rules;
+}
+
+// Instructions are single bits, DJNZ is the highest
+static constexpr size_t OPCODES = std::bit_width((uint32_t) Instruction::DJNZ);
+
+/**
+ * A node of the trie over the opcodes of all patterns.
+ */
+struct TrieNode {
+  std::array<int32_t, OPCODES> next;
+  // The rules whose pattern ends here
+  std::vector<const Rule *> rules;
+};
+
+static size_t opcode_index(Instruction code) {
+  const size_t index = (size_t) std::countr_zero((uint32_t) code);
+  ASSERT(index < OPCODES, "Unknown opcode");
+  return index;
+}
+
+static std::vector<TrieNode> compile(const std::vector<Rule> &rules) {
+  std::vector<TrieNode> trie{};
+  trie.push_back(TrieNode{});
+  trie.back().next.fill(-1);
+  for (const Rule &rule : rules) {
+    GUARANTEE(rule.replacement.size() < rule.pattern.size(), "Replacement must be shorter than its pattern");
+    size_t node = 0;
+    for (const PatternOp &op : rule.pattern) {
+      const size_t index = opcode_index(op.code);
+      if (trie[node].next[index] < 0) {
+        trie[node].next[index] = (int32_t) trie.size();
+        trie.push_back(TrieNode{});
+        trie.back().next.fill(-1);
       }
-    } else {
-      ++iter;
+      node = (size_t) trie[node].next[index];
     }
+    trie[node].rules.push_back(&rule);
+  }
+  return trie;
+}
+
+static size_t longest_pattern(const std::vector<Rule> &rules) {
+  size_t longest = 0;
+  for (const Rule &rule : rules) {
+    longest = std::max(longest, rule.pattern.size());
   }
+  return longest;
+}
+
+struct Bindings {
+  std::array<intptr_t, VARIABLES> values;
+  std::array<bool, VARIABLES> bound;
+};
+
+static bool match_operand(const Operand &operand, intptr_t value, Operation *const *ops, Bindings &bindings) {
+  switch (operand.match) {
+  case Match::ANY:
+    return true;
+  case Match::EQUAL:
+    return value == operand.value;
+  case Match::ODD:
+    return value % 2 == 1;
+  case Match::AT:
+    return value == (Operation::operand_type) ops[operand.value];
+  case Match::BIND: {
+    const size_t var = (size_t) operand.value;
+    if (bindings.bound[var]) {
+      return bindings.values[var] == value;
+    }
+    bindings.values[var] = value;
+    bindings.bound[var] = true;
+    return true;
+  }
+  }
+  UNREACHABLE();
+}
+
+static bool match_rule(const Rule &rule, Operation *const *ops, Bindings &bindings) {
+  bindings.bound.fill(false);
+  for (size_t i = 0; i < rule.pattern.size(); ++i) {
+    const PatternOp &op = rule.pattern[i];
+    if (!match_operand(op.op1, ops[i]->Operand1(), ops, bindings) ||
+        !match_operand(op.op2, ops[i]->Operand2(), ops, bindings)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static intptr_t compute(const Result &result, const Bindings &bindings) {
+  switch (result.compute) {
+  case Compute::CONSTANT:
+    return result.a;
+  case Compute::VARIABLE:
+    return bindings.values[(size_t) result.a];
+  case Compute::SUM:
+    return (uint8_t) (bindings.values[(size_t) result.a] + bindings.values[(size_t) result.b]);
+  case Compute::DIFFERENCE:
+    return (uint8_t) (bindings.values[(size_t) result.a] - bindings.values[(size_t) result.b]);
+  }
+  UNREACHABLE();
 }
 
 /**
- * Merges set cell with following incr/decr cell operations.
+ * Peephole optimizations.
+ *
+ * The patterns of all rules are compiled into a trie over their opcodes.
+ * Starting at every operation, the trie is followed as long as the opcodes
+ * match, and the operands of all rules ending on the way are checked.
+ * The longest matching rule is applied and matching continues right in
+ * front of its replacement, which may be part of another match.
+ *
+ * Replacements are shorter than their patterns and matching only backs
+ * up by the length of the longest pattern, so a single traversal applies
+ * all rules and is linear in the size of the stream.
  */
-static void MergeSetIncrDecr(OperationStream &stream) {
-  static const auto incr_pattern = {Instruction::SET_CELL, Instruction::INCR_CELL};
-  static const auto decr_pattern = {Instruction::SET_CELL, Instruction::DECR_CELL};
+size_t OptPeep(OperationStream &stream) {
+  static const std::vector<TrieNode> trie = compile(rules());
+  static const size_t longest = longest_pattern(rules());
+  size_t rewrites = 0;
+  std::vector<Operation *> ops{};
+  Bindings bindings{};
   auto iter = stream.Begin();
   const auto end = stream.End();
   while (iter != end) {
-    if (iter.LookingAt(incr_pattern)) {
-      auto &set = iter;
-      auto incr = iter + 1;
-      if (set->Operand2() == incr->Operand2()) {
-        set->SetOperand1((set->Operand1() + incr->Operand1()) % 256);
-        stream.Delete(incr);
+    // Follow the trie and remember the longest match
+    ops.clear();
+    const Rule *found = nullptr;
+    Bindings found_bindings{};
+    size_t node = 0;
+    for (auto cur = iter; cur != end; ++cur) {
+      const int32_t next = trie[node].next[opcode_index(cur->OpCode())];
+      if (next < 0) {
+        break;
       }
-    } else if (iter.LookingAt(decr_pattern)) {
-      auto &set = iter;
-      auto decr = iter + 1;
-      if (set->Operand2() == decr->Operand2()) {
-        set->SetOperand1((set->Operand1() - decr->Operand1() + 256) % 256);
-        stream.Delete(decr);
+      node = (size_t) next;
+      ops.push_back(*cur);
+      for (const Rule *rule : trie[node].rules) {
+        if (match_rule(*rule, ops.data(), bindings)) {
+          found = rule;
+          found_bindings = bindings;
+          break;
+        }
       }
-    } else {
+    }
+    if (nullptr == found) {
       ++iter;
+      continue;
+    }
+    const size_t length = found->pattern.size();
+    iter = stream.From(ops[length - 1]) + 1;
+    for (size_t i = 0; i < length; ++i) {
+      stream.Delete(ops[i]);
     }
+    for (const ReplacementOp &op : found->replacement) {
+      stream.InsertBefore(*iter, op.code, compute(op.op1, found_bindings), compute(op.op2, found_bindings));
+    }
+    // Continue in front of the replacement, a new match may start there
+    const auto begin = stream.Begin();
+    for (size_t i = 0; i < found->replacement.size() + longest - 1 && iter != begin; ++i) {
+      --iter;
+    }
+    ++rewrites;
   }
-}
-
-void OptPeep(OperationStream &stream) {
-  ReplaceSingleInstructionLoops(stream);
-  ReplaceFindCellLoops(stream);
-  MergeSetIncrDecr(stream);
+  return rewrites;
 }
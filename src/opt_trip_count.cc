@@ -0,0 +1,313 @@
+// SPDX-License-Identifier: MIT License
+#include <cstdint>
+#include <map>
+
+#include "debug.h"
+#include "instr.h"
+#include "loop_tree.h"
+#include "optimize.h"
+#include "profile.h"
+
+// Loops are unrolled, if the copies of the body add up to at most this
+// many operations.
+static const size_t UNROLL_LIMIT = 32;
+
+// The limit for loops which are hot in the profile
+static const size_t HOT_UNROLL_LIMIT = 128;
+
+/**
+ * What the body of a loop does with the loop counter.
+ */
+struct CounterUse {
+  // Net change of the counter in a single iteration
+  uint8_t step;
+  // Operations which are not counter updates
+  size_t other_ops;
+  // Only cell updates, no I/O or multiplications
+  bool pure;
+};
+
+/**
+ * Inspects the body of an innermost loop.  The counter may only be
+ * changed by increments and decrements, and must not be read otherwise.
+ * The cell pointer must not move.
+ */
+static bool inspect_body(OperationStream &stream, LoopNode *node, intptr_t counter, CounterUse &use) {
+  use = CounterUse{.step = 0, .other_ops = 0, .pure = true};
+  auto iter = stream.From(node->First()) + 1;
+  const auto end = stream.From(node->Last());
+  for (; iter != end; ++iter) {
+    switch (iter->OpCode()) {
+    case Instruction::NOP:
+      break;
+    case Instruction::INCR_CELL:
+    case Instruction::DECR_CELL:
+      if (counter == iter->Operand2()) {
+        const uint8_t amount = (uint8_t) iter->Operand1();
+        use.step = (uint8_t) (use.step + (iter->Is(Instruction::INCR_CELL) ? amount : -amount));
+      } else {
+        ++use.other_ops;
+      }
+      break;
+    case Instruction::SET_CELL:
+      if (counter == iter->Operand2()) {
+        return false;
+      }
+      ++use.other_ops;
+      break;
+    case Instruction::IMUL_CELL:
+    case Instruction::DMUL_CELL:
+      if (counter == iter->Operand2() || counter == iter->Operand3()) {
+        return false;
+      }
+      ++use.other_ops;
+      use.pure = false;
+      break;
+    case Instruction::READ:
+    case Instruction::WRITE:
+      if (counter == iter->Operand2()) {
+        return false;
+      }
+      ++use.other_ops;
+      use.pure = false;
+      break;
+    case Instruction::INCR_PTR:
+    case Instruction::DECR_PTR:
+    case Instruction::FIND_CELL_LOW:
+    case Instruction::FIND_CELL_HIGH:
+    case Instruction::JZ:
+    case Instruction::JNZ:
+    case Instruction::DJNZ:
+    case Instruction::LABEL:
+      return false;
+    }
+  }
+  return 0 != use.step;
+}
+
+/**
+ * Finds the store which sets the counter before the loop is entered.
+ * Only operations which do not touch the counter may be in between.
+ */
+static Operation *find_counter_store(OperationStream &stream, Operation *entry, intptr_t counter) {
+  auto iter = stream.From(entry);
+  const auto begin = stream.Begin();
+  while (iter != begin) {
+    --iter;
+    switch (iter->OpCode()) {
+    case Instruction::NOP:
+      break;
+    case Instruction::SET_CELL:
+      if (counter == iter->Operand2()) {
+        return *iter;
+      }
+      break;
+    case Instruction::INCR_CELL:
+    case Instruction::DECR_CELL:
+    case Instruction::READ:
+    case Instruction::WRITE:
+      if (counter == iter->Operand2()) {
+        return nullptr;
+      }
+      break;
+    case Instruction::IMUL_CELL:
+    case Instruction::DMUL_CELL:
+      if (counter == iter->Operand2() || counter == iter->Operand3()) {
+        return nullptr;
+      }
+      break;
+    case Instruction::INCR_PTR:
+    case Instruction::DECR_PTR:
+    case Instruction::FIND_CELL_LOW:
+    case Instruction::FIND_CELL_HIGH:
+    case Instruction::JZ:
+    case Instruction::JNZ:
+    case Instruction::DJNZ:
+    case Instruction::LABEL:
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Number of iterations until the counter reaches 0, or 0 if it never does.
+ */
+static size_t trip_count(uint8_t start, uint8_t step) {
+  uint8_t value = start;
+  for (size_t trips = 1; trips <= 256; ++trips) {
+    value = (uint8_t) (value + step);
+    if (0 == value) {
+      return trips;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Replaces the body by its net effect after the given number of
+ * iterations.  Only used for bodies which update cells by constants.
+ */
+static void evaluate(OperationStream &stream, LoopNode *node, intptr_t counter, size_t trips, Operation *entry) {
+  struct Effect {
+    bool set;
+    uint8_t value;
+  };
+  if (0 == trips) {
+    return;
+  }
+  std::map<intptr_t, Effect> effects{};
+  auto iter = stream.From(node->First()) + 1;
+  const auto end = stream.From(node->Last());
+  for (; iter != end; ++iter) {
+    if (iter->Is(Instruction::NOP) || counter == iter->Operand2()) {
+      continue;
+    }
+    Effect &effect = effects[iter->Operand2()];
+    const uint8_t amount = (uint8_t) iter->Operand1();
+    if (iter->Is(Instruction::SET_CELL)) {
+      effect = Effect{.set = true, .value = amount};
+    } else {
+      effect.value = (uint8_t) (effect.value + (iter->Is(Instruction::INCR_CELL) ? amount : -amount));
+    }
+  }
+  for (const auto &[offset, effect] : effects) {
+    if (effect.set) {
+      stream.InsertBefore(entry, Instruction::SET_CELL, effect.value, offset);
+    } else if (const uint8_t total = (uint8_t) (effect.value * trips); 0 != total) {
+      stream.InsertBefore(entry, Instruction::INCR_CELL, total, offset);
+    }
+  }
+}
+
+/**
+ * Copies the body without the counter updates in front of the loop.
+ */
+static void unroll(OperationStream &stream, LoopNode *node, intptr_t counter, size_t trips, Operation *entry) {
+  const auto end = stream.From(node->Last());
+  for (size_t i = 0; i < trips; ++i) {
+    for (auto iter = stream.From(node->First()) + 1; iter != end; ++iter) {
+      const bool counter_update = iter->IsAny({Instruction::INCR_CELL, Instruction::DECR_CELL}) &&
+                                  counter == iter->Operand2();
+      if (!iter->Is(Instruction::NOP) && !counter_update) {
+        stream.InsertBefore(entry, iter->OpCode(), iter->Operand1(), iter->Operand2(), iter->Operand3());
+      }
+    }
+  }
+}
+
+/**
+ * Turns the loop into a counted loop.  The guard is not needed anymore,
+ * the loop runs at least once.
+ */
+static void count_in_register(
+    OperationStream &stream, LoopNode *node, LoopNode *guard, intptr_t counter, size_t trips) {
+  Operation *jump = node->Last();
+  if (guard) {
+    stream.Delete(guard->Last());
+    stream.Delete(guard->First());
+  }
+  auto iter = stream.From(node->First()) + 1;
+  while (*iter != jump) {
+    if (iter->IsAny({Instruction::INCR_CELL, Instruction::DECR_CELL}) && counter == iter->Operand2()) {
+      stream.Delete(iter++);
+    } else {
+      ++iter;
+    }
+  }
+  jump->SetOpCode(Instruction::DJNZ);
+  jump->SetOperand2((intptr_t) trips);
+}
+
+/**
+ * Deletes the operations from first to last, both included.
+ */
+static void delete_region(OperationStream &stream, Operation *first, Operation *last) {
+  auto iter = stream.From(first);
+  const auto stop = stream.From(last);
+  while (iter != stop) {
+    stream.Delete(iter++);
+  }
+  stream.Delete(last);
+}
+
+/**
+ * The unroll limit of the loop.  Without a profile all loops get the
+ * default limit, cold loops are never unrolled.
+ */
+static size_t unroll_limit(const LoopProfile *profile, LoopNode *node) {
+  if (nullptr == profile) {
+    return UNROLL_LIMIT;
+  }
+  const uint32_t id = node->First()->Source();
+  if (profile->IsCold(id)) {
+    return 0;
+  }
+  return profile->IsHot(id) ? HOT_UNROLL_LIMIT : UNROLL_LIMIT;
+}
+
+/**
+ * Loops with a constant trip count.
+ *
+ * If the loop counter is set right before the loop and only changed by
+ * a constant in every iteration, the number of iterations is known.
+ *
+ *   =5 [ - > +++ < ]
+ *
+ * A body which only updates cells by constants is evaluated, the loop
+ * above becomes +15 in the next cell.  Other small loops are unrolled.
+ * Everything else becomes a counted loop, which keeps the counter in
+ * a register and no longer touches the counter cell inside the loop.
+ * The counter cell is 0 after the loop in all cases, so the store in
+ * front of the loop is changed to store 0.
+ *
+ * Only innermost loops are handled.  With a profile, hot loops are
+ * unrolled up to a larger size, and loops which never ran stay counted
+ * loops.
+ *
+ * This optimization requires delayed moves to be applied before.
+ */
+size_t OptTripCount(OperationStream &stream) {
+  ScopedLoopTree loops(stream);
+  size_t rewrites = 0;
+  for (LoopNode *node : loops->PostOrder()) {
+    if (node->IsRemoved() || !node->IsLoop() || node->IsCounted() || !node->IsInnermost()) {
+      continue;
+    }
+    const intptr_t counter = node->Last()->Operand2();
+    CounterUse use{};
+    if (!inspect_body(stream, node, counter, use)) {
+      continue;
+    }
+    // The guard of the loop, if it still directly surrounds it
+    LoopNode *guard = node->Parent();
+    if (guard && !(guard->IsGuard() && *(stream.From(guard->First()) + 1) == node->First() &&
+                   *(stream.From(node->Last()) + 1) == guard->Last() && counter == guard->First()->Operand2())) {
+      guard = nullptr;
+    }
+    Operation *entry = guard ? guard->First() : node->First();
+    Operation *store = find_counter_store(stream, entry, counter);
+    if (nullptr == store) {
+      continue;
+    }
+    const uint8_t start = (uint8_t) store->Operand1();
+    const size_t trips = (guard && 0 == start) ? 0 : trip_count(start, use.step);
+    if (0 == trips && 0 != start) {
+      // The loop never terminates
+      continue;
+    }
+    store->SetOperand1(0);
+    if (use.pure) {
+      evaluate(stream, node, counter, trips, entry);
+    } else if (trips * use.other_ops <= unroll_limit(stream.Profile(), node)) {
+      unroll(stream, node, counter, trips, entry);
+    } else {
+      count_in_register(stream, node, guard, counter, trips);
+      ++rewrites;
+      continue;
+    }
+    delete_region(stream, entry, guard ? guard->Last() : node->Last());
+    ++rewrites;
+  }
+  return rewrites;
+}
@@ -1,24 +1,273 @@
 // SPDX-License-Identifier: MIT License
 #include "optimize.h"
 
-#include "instr.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
 
-void Optimizer::Run(OperationStream &stream) const noexcept {
-  static const OptimizerPass pipeline[] = {
-      OptimizerPass::Create("Remove comment loops", OptCommentLoop, OptimizerLevel::O1),
-      OptimizerPass::Create("Fuse operators", OptFusionOp, OptimizerLevel::O1),
-      OptimizerPass::Create("Peephole", OptPeep, OptimizerLevel::O2),
-      OptimizerPass::Create("Delay Moves", OptDelayPtr, OptimizerLevel::O2),
-      OptimizerPass::Create("Multiplicative Loops", OptMultiplyLoop, OptimizerLevel::O3),
-      OptimizerPass::Create("Remove double guards", OptDoubleGuard, OptimizerLevel::O3),
-  };
+#include "debug.h"
+#include "instr.h"
+#include "loop_tree.h"
 
-  for (const auto &stage : pipeline) {
-    if (stage.Level() <= m.level) {
-      stage.Run(stream);
+/**
+ * Runs a single pass and measures it.
+ */
+static OptimizerPassStats run_pass(OperationStream &stream, const OptimizerPass &pass, unsigned int iteration) {
+  const size_t ops_before = stream.Size();
+  const auto start = std::chrono::steady_clock::now();
+  const size_t rewrites = pass.Run(stream);
+  const auto stop = std::chrono::steady_clock::now();
 #if defined(DEBUG_BUILD)
-      stream.Verify();
+  stream.Verify();
 #endif
+  return OptimizerPassStats{
+      .name = pass.Name(),
+      .iteration = iteration,
+      .ops_before = ops_before,
+      .ops_after = stream.Size(),
+      .rewrites = rewrites,
+      .nanos = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count(),
+  };
+}
+
+/**
+ * Splits the stream in front of top-level regions into at most count
+ * parts of roughly the same size.  The first part is the stream itself.
+ */
+static std::vector<OperationStream> partition(OperationStream &stream, size_t count) {
+  const size_t target = std::max(Optimizer::MIN_PARTITION_SIZE, stream.Size() / count);
+  std::vector<Operation *> cuts{};
+  size_t depth = 0;
+  size_t size = 0;
+  for (Operation *op : stream) {
+    // A guard starts at its JZ, a loop at its label
+    const bool opens = op->Is(Instruction::JZ) ||
+                       (op->Is(Instruction::LABEL) && !((Operation *) op->Operand1())->Is(Instruction::JZ));
+    if (0 == depth && opens && size >= target && cuts.size() + 1 < count) {
+      cuts.push_back(op);
+      size = 0;
+    }
+    ++size;
+    if (opens) {
+      ++depth;
+    } else if (op->IsJump() || op->Is(Instruction::LABEL)) {
+      --depth;
+    }
+  }
+  std::vector<OperationStream> parts{};
+  parts.reserve(cuts.size() + 1);
+  parts.push_back(std::move(stream));
+  // Every split takes everything behind the cut, so split from the back
+  for (auto cut = cuts.rbegin(); cut != cuts.rend(); ++cut) {
+    parts.push_back(parts.front().Split(*cut));
+  }
+  std::reverse(parts.begin() + 1, parts.end());
+  return parts;
+}
+
+/**
+ * Runs the passes on the parts of the program concurrently, one thread
+ * per part.  The statistics of the parts are summed up, so the time is
+ * the time spent in all threads.  Returns the number of rewrites.
+ */
+static size_t run_partitioned(OperationStream &stream,
+                              std::span<const OptimizerPass> passes,
+                              size_t jobs,
+                              unsigned int iteration,
+                              OptimizerStats &stats) {
+  std::vector<OperationStream> parts = partition(stream, jobs);
+  std::vector<std::vector<OptimizerPassStats>> part_stats(parts.size());
+  auto run = [&](size_t part) {
+    ScopedLoopTree loops(parts[part]);
+    for (const auto &pass : passes) {
+      part_stats[part].push_back(run_pass(parts[part], pass, iteration));
+    }
+  };
+  std::vector<std::thread> threads{};
+  for (size_t part = 1; part < parts.size(); ++part) {
+    threads.emplace_back(run, part);
+  }
+  run(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  stream = std::move(parts.front());
+  for (size_t part = 1; part < parts.size(); ++part) {
+    stream.Concat(parts[part]);
+  }
+  size_t rewrites = 0;
+  for (size_t i = 0; i < part_stats.front().size(); ++i) {
+    OptimizerPassStats total = part_stats.front()[i];
+    for (size_t part = 1; part < parts.size(); ++part) {
+      total.ops_before += part_stats[part][i].ops_before;
+      total.ops_after += part_stats[part][i].ops_after;
+      total.rewrites += part_stats[part][i].rewrites;
+      total.nanos += part_stats[part][i].nanos;
+    }
+    rewrites += total.rewrites;
+    stats.Add(total);
+  }
+  return rewrites;
+}
+
+// All passes in their default order
+static const OptimizerPass PASSES[] = {
+    OptimizerPass::Create(
+        "comment-loop", "Remove comment loops", OptCommentLoop, OptimizerLevel::O1, OptimizerScope::PROGRAM),
+    OptimizerPass::Create("fusion", "Fuse operators", OptFusionOp, OptimizerLevel::O1, OptimizerScope::REGION),
+    OptimizerPass::Create("peephole", "Peephole", OptPeep, OptimizerLevel::O2, OptimizerScope::REGION),
+    OptimizerPass::Create("delay-ptr", "Delay Moves", OptDelayPtr, OptimizerLevel::O2, OptimizerScope::PROGRAM),
+    OptimizerPass::Create(
+        "canonicalize", "Canonicalize blocks", OptCanonicalize, OptimizerLevel::O2, OptimizerScope::REGION),
+    OptimizerPass::Create("once-loop", "Lower once loops", OptOnceLoop, OptimizerLevel::O2, OptimizerScope::REGION),
+    OptimizerPass::Create(
+        "trip-count", "Constant trip counts", OptTripCount, OptimizerLevel::O3, OptimizerScope::REGION),
+    OptimizerPass::Create(
+        "multiply-loop", "Multiplicative Loops", OptMultiplyLoop, OptimizerLevel::O3, OptimizerScope::REGION),
+    OptimizerPass::Create(
+        "merge-multiply", "Merge multiply loops", OptMergeMultiply, OptimizerLevel::O3, OptimizerScope::PROGRAM),
+    OptimizerPass::Create(
+        "loop-invariant", "Loop invariant stores", OptLoopInvariant, OptimizerLevel::O3, OptimizerScope::REGION),
+    OptimizerPass::Create(
+        "double-guard", "Remove double guards", OptDoubleGuard, OptimizerLevel::O3, OptimizerScope::REGION),
+};
+
+std::vector<OptimizerPass> Optimizer::DefaultPipeline(OptimizerLevel level) {
+  std::vector<OptimizerPass> pipeline{};
+  for (const auto &pass : PASSES) {
+    if (pass.Level() <= level) {
+      pipeline.push_back(pass);
+    }
+  }
+  return pipeline;
+}
+
+const OptimizerPass *Optimizer::FindPass(std::string_view key) {
+  for (const auto &pass : PASSES) {
+    if (key == pass.Key()) {
+      return &pass;
+    }
+  }
+  return nullptr;
+}
+
+OptimizerStats Optimizer::Run(OperationStream &stream) const noexcept {
+  const std::span<const OptimizerPass> passes{m.pipeline};
+
+  OptimizerStats stats = OptimizerStats::Create();
+  // A stream with a loop tree of the caller or a block is never split
+  const bool splittable = nullptr == stream.Loops() && !stream.HasBlock();
+  // Build the loop tree once, the passes keep it up to date.  While the
+  // stream is split, the parts have their own trees.
+  std::optional<ScopedLoopTree> loops{};
+  loops.emplace(stream);
+  for (unsigned int iteration = 1; iteration <= m.iterations; ++iteration) {
+    size_t rewrites = 0;
+    size_t stage = 0;
+    while (stage < passes.size()) {
+      size_t last = stage;
+      while (last < passes.size() && OptimizerScope::REGION == passes[last].Scope()) {
+        ++last;
+      }
+      const size_t jobs = std::min((size_t) m.jobs, stream.Size() / MIN_PARTITION_SIZE);
+      if (last > stage && splittable && jobs > 1) {
+        loops.reset();
+        rewrites += run_partitioned(stream, passes.subspan(stage, last - stage), jobs, iteration, stats);
+        loops.emplace(stream);
+        stage = last;
+        continue;
+      }
+      const OptimizerPassStats pass_stats = run_pass(stream, passes[stage], iteration);
+      rewrites += pass_stats.rewrites;
+      stats.Add(pass_stats);
+      ++stage;
+    }
+    stats.FinishIteration(0 == rewrites);
+    if (0 == rewrites) {
+      break;
+    }
+  }
+  return stats;
+}
+
+void OptimizerStats::Dump() const {
+  fprintf(stderr,
+          "%4s  %-24s %10s %10s %10s %12s\n",
+          "iter",
+          "pass",
+          "ops before",
+          "ops after",
+          "rewrites",
+          "time [us]");
+  for (const auto &pass : m.passes) {
+    fprintf(stderr,
+            "%4u  %-24s %10zu %10zu %10zu %12.3f\n",
+            pass.iteration,
+            pass.name,
+            pass.ops_before,
+            pass.ops_after,
+            pass.rewrites,
+            (double) pass.nanos / 1000.0);
+  }
+  fprintf(stderr, "%u iteration(s), %s\n", m.iterations, m.fixpoint ? "fixpoint reached" : "budget exhausted");
+}
+
+void OptimizerStats::DumpJson() const {
+  fprintf(stderr, "{\"iterations\": %u, \"fixpoint\": %s, \"passes\": [", m.iterations, m.fixpoint ? "true" : "false");
+  const char *separator = "";
+  for (const auto &pass : m.passes) {
+    fprintf(stderr,
+            "%s\n  {\"name\": \"%s\", \"iteration\": %u, \"ops_before\": %zu, \"ops_after\": %zu, \"rewrites\": %zu, "
+            "\"nanos\": %llu}",
+            separator,
+            pass.name,
+            pass.iteration,
+            pass.ops_before,
+            pass.ops_after,
+            pass.rewrites,
+            (unsigned long long) pass.nanos);
+    separator = ",";
+  }
+  fprintf(stderr, "\n]}\n");
+}
+
+std::variant<std::vector<OptimizerPass>, Err> ParsePipeline(std::string_view content) {
+  std::vector<OptimizerPass> pipeline{};
+  int64_t line_number = 0;
+  while (!content.empty()) {
+    ++line_number;
+    const size_t newline = content.find('\n');
+    std::string_view line = content.substr(0, newline);
+    content.remove_prefix(newline == std::string_view::npos ? content.size() : newline + 1);
+    while (!line.empty() && std::isspace((unsigned char) line.front())) {
+      line.remove_prefix(1);
     }
+    while (!line.empty() && std::isspace((unsigned char) line.back())) {
+      line.remove_suffix(1);
+    }
+    if (line.empty() || line.front() == '#') {
+      continue;
+    }
+    const OptimizerPass *pass = Optimizer::FindPass(line);
+    if (nullptr == pass) {
+      return Err::InvalidPipeline(line_number);
+    }
+    pipeline.push_back(*pass);
+  }
+  return pipeline;
+}
+
+std::string FormatPipeline(const std::vector<OptimizerPass> &pipeline) {
+  std::string result{"# bf-cc optimizer pipeline, one pass per line\n"};
+  for (const auto &pass : pipeline) {
+    result += pass.Key();
+    result += '\n';
   }
+  return result;
 }
@@ -2,19 +2,42 @@
 #ifndef BF_CC_OPTIMIZE_H
 #define BF_CC_OPTIMIZE_H 1
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "error.h"
 #include "instr.h"
 
-void OptCommentLoop(OperationStream &);
+/*
+ * Every pass returns the number of rewrites it performed.  The optimizer
+ * uses it to detect whether the pipeline reached a fixpoint.
+ */
 
-void OptFusionOp(OperationStream &);
+size_t OptCommentLoop(OperationStream &);
 
-void OptPeep(OperationStream &);
+size_t OptFusionOp(OperationStream &);
 
-void OptDelayPtr(OperationStream &);
+size_t OptPeep(OperationStream &);
 
-void OptMultiplyLoop(OperationStream &);
+size_t OptDelayPtr(OperationStream &);
 
-void OptDoubleGuard(OperationStream &);
+size_t OptCanonicalize(OperationStream &);
+
+size_t OptOnceLoop(OperationStream &);
+
+size_t OptTripCount(OperationStream &);
+
+size_t OptMultiplyLoop(OperationStream &);
+
+size_t OptMergeMultiply(OperationStream &);
+
+size_t OptLoopInvariant(OperationStream &);
+
+size_t OptDoubleGuard(OperationStream &);
 
 enum class OptimizerLevel {
   O0 = '0',
@@ -23,53 +46,203 @@ enum class OptimizerLevel {
   O3 = '3',
 };
 
-class Optimizer final {
-public:
+/**
+ * Statistics for a single run of a single pass.
+ */
+struct OptimizerPassStats {
+  const char *name;
+  unsigned int iteration;
+  size_t ops_before;
+  size_t ops_after;
+  size_t rewrites;
+  uint64_t nanos;
+};
+
+class OptimizerStats final {
 private:
   struct M {
-    OptimizerLevel level;
+    std::vector<OptimizerPassStats> passes;
+    unsigned int iterations;
+    bool fixpoint;
   } m;
 
-  explicit Optimizer(M m) : m(std::move(m)) {
+  explicit OptimizerStats(M m) : m(std::move(m)) {
   }
 
 public:
-  void Run(OperationStream &) const noexcept;
-
-  static Optimizer Create(OptimizerLevel level) noexcept {
-    return Optimizer(M{
-        .level = level,
+  static OptimizerStats Create() {
+    return OptimizerStats(M{
+        .passes = {},
+        .iterations = 0,
+        .fixpoint = false,
     });
   }
+
+  void Add(OptimizerPassStats pass) {
+    m.passes.push_back(std::move(pass));
+  }
+
+  void FinishIteration(bool fixpoint) {
+    ++m.iterations;
+    m.fixpoint = fixpoint;
+  }
+
+  const std::vector<OptimizerPassStats> &Passes() const {
+    return m.passes;
+  }
+
+  unsigned int Iterations() const {
+    return m.iterations;
+  }
+
+  /**
+   * Returns true, if the last iteration did not rewrite anything.
+   */
+  bool ReachedFixpoint() const {
+    return m.fixpoint;
+  }
+
+  /**
+   * Prints a human readable table to stderr.
+   */
+  void Dump() const;
+
+  /**
+   * Prints a single JSON object to stderr.
+   */
+  void DumpJson() const;
+};
+
+enum class OptimizerScope {
+  // The pass needs the whole program, e.g. it relies on the initial
+  // state of the tape at the start or drops pointer moves at the end
+  PROGRAM,
+  // The pass only looks at the operations it is given, it can run on
+  // any sequence of complete top-level regions
+  REGION,
 };
 
 class OptimizerPass {
 private:
   struct M {
+    const char *key;
     const char *name;
-    void (*function)(OperationStream &);
+    size_t (*function)(OperationStream &);
     OptimizerLevel level;
+    OptimizerScope scope;
   } m;
 
   explicit OptimizerPass(M m) : m(std::move(m)) {
   }
 
 public:
-  static OptimizerPass Create(const char *name, void (*function)(OperationStream &), OptimizerLevel level) {
-    return OptimizerPass(M{.name = name, .function = function, .level = level});
+  static OptimizerPass Create(const char *key,
+                              const char *name,
+                              size_t (*function)(OperationStream &),
+                              OptimizerLevel level,
+                              OptimizerScope scope) {
+    return OptimizerPass(M{.key = key, .name = name, .function = function, .level = level, .scope = scope});
+  }
+
+  /**
+   * Short name used in pipeline configuration files.
+   */
+  const char *Key() const {
+    return m.key;
   }
 
   OptimizerLevel Level() const {
     return m.level;
   }
 
+  OptimizerScope Scope() const {
+    return m.scope;
+  }
+
   const char *Name() const {
     return m.name;
   }
 
-  void Run(OperationStream &stream) const {
-    m.function(stream);
+  size_t Run(OperationStream &stream) const {
+    return m.function(stream);
+  }
+};
+
+class Optimizer final {
+public:
+  /**
+   * Upper bound for the number of pipeline iterations in fixpoint mode.
+   */
+  static constexpr unsigned int MAX_ITERATIONS = 16;
+
+  /**
+   * Upper bound for the number of threads.
+   */
+  static constexpr unsigned int MAX_JOBS = 64;
+
+  /**
+   * Programs are only split into parts of at least this many operations.
+   */
+  static constexpr size_t MIN_PARTITION_SIZE = 1 << 14;
+
+private:
+  struct M {
+    std::vector<OptimizerPass> pipeline;
+    unsigned int iterations;
+    unsigned int jobs;
+  } m;
+
+  explicit Optimizer(M m) : m(std::move(m)) {
+  }
+
+public:
+  /**
+   * Runs the pipeline until no pass rewrites anything anymore, but at most
+   * as often as configured.
+   *
+   * With more than one job, large programs are split in front of top-level
+   * regions.  Consecutive region passes run on the parts concurrently, the
+   * parts are joined again for program passes.
+   */
+  OptimizerStats Run(OperationStream &) const noexcept;
+
+  /**
+   * The default pipeline with all passes up to the given level.
+   */
+  static Optimizer Create(OptimizerLevel level, unsigned int iterations = 1, unsigned int jobs = 1) noexcept {
+    return Create(DefaultPipeline(level), iterations, jobs);
+  }
+
+  /**
+   * A custom pipeline, all passes run regardless of their level.
+   */
+  static Optimizer Create(std::vector<OptimizerPass> pipeline,
+                          unsigned int iterations = 1,
+                          unsigned int jobs = 1) noexcept {
+    return Optimizer(M{
+        .pipeline = std::move(pipeline),
+        .iterations = iterations,
+        .jobs = jobs,
+    });
   }
+
+  static std::vector<OptimizerPass> DefaultPipeline(OptimizerLevel level);
+
+  /**
+   * Returns the pass with the given key, nullptr if there is none.
+   */
+  static const OptimizerPass *FindPass(std::string_view key);
 };
 
+/**
+ * Parses a pipeline configuration, one pass key per line.  Empty lines
+ * and lines starting with # are ignored.
+ */
+std::variant<std::vector<OptimizerPass>, Err> ParsePipeline(std::string_view);
+
+/**
+ * The pipeline configuration which ParsePipeline reads back.
+ */
+std::string FormatPipeline(const std::vector<OptimizerPass> &);
+
 #endif /* BF_CC_OPTIMIZE_H */
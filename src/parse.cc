@@ -1,7 +1,9 @@
 // SPDX-License-Identifier: MIT License
 #include "parse.h"
 
+#include <algorithm>
 #include <string_view>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -12,8 +14,9 @@
 std::variant<OperationStream, Err> Parse(const std::string_view input) {
   OperationStream stream = OperationStream::Create();
   std::vector<Operation *> jump_stack{};
-  for (const char c : input) {
-    switch (c) {
+  for (size_t offset = 0; offset < input.size(); ++offset) {
+    const uint32_t source = (uint32_t) offset;
+    switch (input[offset]) {
     case '+': {
       stream.Append(Instruction::INCR_CELL, 1, 0);
     } break;
@@ -34,6 +37,7 @@ std::variant<OperationStream, Err> Parse(const std::string_view input) {
     } break;
     case '[': {
       stream.Append(Instruction::JZ, 0);
+      stream.Last()->SetSource(source);
       jump_stack.push_back(stream.Last());
       stream.Append(Instruction::LABEL, 0);
       jump_stack.push_back(stream.Last());
@@ -45,12 +49,18 @@ std::variant<OperationStream, Err> Parse(const std::string_view input) {
       jump_stack.pop_back();
       stream.Append(Instruction::JNZ, (Operation::operand_type) label);
       label->SetOperand1((Operation::operand_type) stream.Last());
+      stream.Last()->SetSource(other->Source());
       stream.Append(Instruction::LABEL, (Operation::operand_type) other);
       other->SetOperand1((Operation::operand_type) stream.Last());
+      stream.Last()->SetSource(other->Source());
     } break;
     default:
       break;
     }
+    // Closing brackets already got the offset of their opening bracket
+    if (stream.Last() && Operation::NO_SOURCE == stream.Last()->Source()) {
+      stream.Last()->SetSource(source);
+    }
   }
   if (0 != jump_stack.size()) {
     return Err::UnmatchedJump();
@@ -60,3 +70,33 @@ std::variant<OperationStream, Err> Parse(const std::string_view input) {
 #endif
   return stream;
 }
+
+std::unordered_map<uint32_t, uint32_t> LoopEnds(std::string_view program) {
+  std::unordered_map<uint32_t, uint32_t> ends{};
+  std::vector<uint32_t> starts{};
+  for (size_t offset = 0; offset < program.size(); ++offset) {
+    if ('[' == program[offset]) {
+      starts.push_back((uint32_t) offset);
+    } else if (']' == program[offset] && !starts.empty()) {
+      ends.emplace(starts.back(), (uint32_t) offset);
+      starts.pop_back();
+    }
+  }
+  return ends;
+}
+
+SourceLines SourceLines::Create(std::string_view program) {
+  std::vector<uint32_t> starts{0};
+  for (size_t offset = 0; offset < program.size(); ++offset) {
+    if ('\n' == program[offset]) {
+      starts.push_back((uint32_t) (offset + 1));
+    }
+  }
+  return SourceLines(M{.starts = std::move(starts)});
+}
+
+SourcePosition SourceLines::Position(uint32_t offset) const noexcept {
+  // The last line which starts at or before the offset
+  const auto line = std::upper_bound(m.starts.begin(), m.starts.end(), offset) - 1;
+  return SourcePosition{.line = (uint32_t) (line - m.starts.begin() + 1), .column = offset - *line + 1};
+}
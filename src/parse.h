@@ -2,12 +2,49 @@
 #ifndef BF_CC_PARSE_H
 #define BF_CC_PARSE_H 1
 
+#include <cstdint>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <variant>
+#include <vector>
 
 #include "error.h"
 #include "instr.h"
 
 std::variant<OperationStream, Err> Parse(const std::string_view);
 
+/**
+ * The offset of the matching ] of every [ in the program.  Operations
+ * only keep the offset of the [, which identifies the loop.
+ */
+std::unordered_map<uint32_t, uint32_t> LoopEnds(std::string_view);
+
+/**
+ * Line and column of a character of the program, both counted from 1.
+ */
+struct SourcePosition {
+  uint32_t line;
+  uint32_t column;
+};
+
+/**
+ * Finds the line and column of source offsets, like Operation::Source.
+ */
+class SourceLines final {
+private:
+  struct M {
+    // Offset of the first character of every line
+    std::vector<uint32_t> starts;
+  } m;
+
+  explicit SourceLines(M m) noexcept : m(std::move(m)) {
+  }
+
+public:
+  static SourceLines Create(std::string_view program);
+
+  SourcePosition Position(uint32_t offset) const noexcept;
+};
+
 #endif /* BF_CC_PARSE_H */
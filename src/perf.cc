@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: MIT License
+#include "perf.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+
+#include "platform.h"
+
+#if defined(IS_X86_64)
+static constexpr uint32_t MACHINE = 62;
+#endif
+#if defined(IS_AARCH64)
+static constexpr uint32_t MACHINE = 183;
+#endif
+
+// The jitdump format of perf, see tools/perf/Documentation/jitdump-specification.txt
+static constexpr uint32_t JITDUMP_MAGIC = 0x4A695444;
+static constexpr uint32_t JITDUMP_VERSION = 1;
+static constexpr uint32_t JIT_CODE_LOAD = 0;
+static constexpr uint32_t JIT_CODE_DEBUG_INFO = 2;
+static constexpr uint32_t JIT_CODE_CLOSE = 3;
+
+struct JitHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct JitRecord {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+// Followed by the name and the code
+struct JitCodeLoad {
+  JitRecord record;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+};
+
+// Followed by the entries, each with the name of the source file
+struct JitDebugInfo {
+  JitRecord record;
+  uint64_t code_addr;
+  uint64_t nr_entry;
+};
+
+struct JitDebugEntry {
+  uint64_t addr;
+  int32_t lineno;
+  int32_t discrim;
+};
+
+/**
+ * Code which belongs to the same loop, or to no loop at all.
+ */
+struct Segment {
+  const uint8_t *start;
+  const uint8_t *end;
+  // The label of the innermost loop, nullptr outside of loops
+  const Operation *loop;
+  // The code of the operations in the segment and their source line
+  std::vector<std::pair<const uint8_t *, uint32_t>> lines;
+};
+
+/**
+ * perf record -k 1 uses the same clock.
+ */
+static uint64_t timestamp() {
+  return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static bool is_loop(const Operation *label) {
+  return label->Is(Instruction::LABEL) && ((const Operation *) label->Operand1())->IsAny({Instruction::JNZ,
+                                                                                         Instruction::DJNZ});
+}
+
+/**
+ * Splits the code into segments of the innermost loops around the
+ * operations.  The entry and the exit are outside of loops.
+ */
+static std::vector<Segment> segments(const uint8_t *code,
+                                     size_t size,
+                                     const std::vector<std::pair<const Operation *, uint8_t *>> &operations,
+                                     const SourceLines &lines) {
+  std::vector<Segment> result{};
+  const auto add = [&result](const uint8_t *start, const uint8_t *end, const Operation *loop) {
+    if (!result.empty() && result.back().loop == loop && result.back().end == start) {
+      result.back().end = end;
+    } else if (start != end) {
+      result.push_back(Segment{.start = start, .end = end, .loop = loop, .lines = {}});
+    }
+  };
+  add(code, operations.empty() ? code + size : operations.front().second, nullptr);
+  std::vector<const Operation *> loops{};
+  for (size_t i = 0; i < operations.size(); ++i) {
+    const auto &[op, start] = operations[i];
+    const uint8_t *end = i + 1 < operations.size() ? operations[i + 1].second : code + size;
+    if (nullptr == op) {
+      add(start, end, nullptr);
+      continue;
+    }
+    if (is_loop(op)) {
+      loops.push_back(op);
+    }
+    add(start, end, loops.empty() ? nullptr : loops.back());
+    if (start != end && Operation::NO_SOURCE != op->Source()) {
+      result.back().lines.emplace_back(start, lines.Position(op->Source()).line);
+    }
+    if (!loops.empty() && (const Operation *) loops.back()->Operand1() == op) {
+      loops.pop_back();
+    }
+  }
+  return result;
+}
+
+std::variant<PerfLog, Err> PerfLog::Create(unsigned int outputs,
+                                           std::string_view program,
+                                           std::string_view program_path) noexcept {
+  const uint32_t pid = ProcessId();
+  PerfLog log(M{.map = nullptr,
+                .dump = nullptr,
+                .marker = nullptr,
+                .program_path = std::string(program_path),
+                .lines = SourceLines::Create(program),
+                .code_index = 0});
+  if (0 != (outputs & Output::MAP)) {
+    const std::string path = "/tmp/perf-" + std::to_string(pid) + ".map";
+    log.m.map = std::fopen(path.c_str(), "w");
+    if (nullptr == log.m.map) {
+      return Err::IO(errno);
+    }
+  }
+  if (0 != (outputs & Output::JITDUMP)) {
+    const std::string path = "jit-" + std::to_string(pid) + ".dump";
+    log.m.dump = std::fopen(path.c_str(), "wb");
+    if (nullptr == log.m.dump) {
+      return Err::IO(errno);
+    }
+    const JitHeader header{.magic = JITDUMP_MAGIC,
+                           .version = JITDUMP_VERSION,
+                           .total_size = sizeof(JitHeader),
+                           .elf_mach = MACHINE,
+                           .pad = 0,
+                           .pid = pid,
+                           .timestamp = timestamp(),
+                           .flags = 0};
+    if (1 != std::fwrite(&header, sizeof(header), 1, log.m.dump) || 0 != std::fflush(log.m.dump)) {
+      return Err::IO(errno);
+    }
+    auto marker = MapFileExecutable(path, Pagesize());
+    if (marker.index() != 0) {
+      return std::get<Err>(marker);
+    }
+    log.m.marker = std::get<uint8_t *>(marker);
+  }
+  return log;
+}
+
+PerfLog::~PerfLog() {
+  if (m.dump) {
+    const JitRecord close{.id = JIT_CODE_CLOSE, .total_size = sizeof(JitRecord), .timestamp = timestamp()};
+    std::fwrite(&close, sizeof(close), 1, m.dump);
+    std::fclose(m.dump);
+    m.dump = nullptr;
+  }
+  if (m.marker) {
+    Deallocate(m.marker, Pagesize());
+    m.marker = nullptr;
+  }
+  if (m.map) {
+    std::fclose(m.map);
+    m.map = nullptr;
+  }
+}
+
+void PerfLog::RecordCode(const uint8_t *code,
+                         size_t size,
+                         const std::vector<std::pair<const Operation *, uint8_t *>> &operations) {
+  for (const Segment &segment : segments(code, size, operations, m.lines)) {
+    char name[64];
+    if (nullptr == segment.loop) {
+      std::snprintf(name, sizeof(name), "bf_program");
+    } else if (Operation::NO_SOURCE == segment.loop->Source()) {
+      std::snprintf(name, sizeof(name), "bf_loop");
+    } else {
+      const SourcePosition position = m.lines.Position(segment.loop->Source());
+      std::snprintf(name, sizeof(name), "bf_loop_%" PRIu32 "_%" PRIu32, position.line, position.column);
+    }
+    const size_t code_size = (size_t) (segment.end - segment.start);
+    if (m.map) {
+      std::fprintf(m.map, "%" PRIxPTR " %zx %s\n", (uintptr_t) segment.start, code_size, name);
+    }
+    if (nullptr == m.dump) {
+      continue;
+    }
+    // The debug info comes before the code it describes
+    if (!segment.lines.empty()) {
+      const size_t entry_size = sizeof(JitDebugEntry) + m.program_path.size() + 1;
+      const JitDebugInfo info{
+          .record = {.id = JIT_CODE_DEBUG_INFO,
+                     .total_size = (uint32_t) (sizeof(JitDebugInfo) + segment.lines.size() * entry_size),
+                     .timestamp = timestamp()},
+          .code_addr = (uint64_t) (uintptr_t) segment.start,
+          .nr_entry = segment.lines.size()};
+      std::fwrite(&info, sizeof(info), 1, m.dump);
+      for (const auto &[address, line] : segment.lines) {
+        const JitDebugEntry entry{.addr = (uint64_t) (uintptr_t) address, .lineno = (int32_t) line, .discrim = 0};
+        std::fwrite(&entry, sizeof(entry), 1, m.dump);
+        std::fwrite(m.program_path.c_str(), m.program_path.size() + 1, 1, m.dump);
+      }
+    }
+    const size_t name_size = std::strlen(name) + 1;
+    const JitCodeLoad load{
+        .record = {.id = JIT_CODE_LOAD,
+                   .total_size = (uint32_t) (sizeof(JitCodeLoad) + name_size + code_size),
+                   .timestamp = timestamp()},
+        .pid = ProcessId(),
+        .tid = ThreadId(),
+        .vma = (uint64_t) (uintptr_t) segment.start,
+        .code_addr = (uint64_t) (uintptr_t) segment.start,
+        .code_size = code_size,
+        .code_index = m.code_index++};
+    std::fwrite(&load, sizeof(load), 1, m.dump);
+    std::fwrite(name, name_size, 1, m.dump);
+    std::fwrite(segment.start, code_size, 1, m.dump);
+  }
+  if (m.map) {
+    std::fflush(m.map);
+  }
+  if (m.dump) {
+    std::fflush(m.dump);
+  }
+}
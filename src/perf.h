@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_PERF_H
+#define BF_CC_PERF_H 1
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "error.h"
+#include "instr.h"
+#include "parse.h"
+
+/**
+ * Describes compiled code to the Linux perf tools, which otherwise see
+ * anonymous memory without symbols.
+ *
+ * The code of every loop is a symbol named after the line and column of
+ * its opening bracket, like bf_loop_3_5, the code outside of loops is
+ * bf_program.  The perf map /tmp/perf-<pid>.map lists the symbols for perf
+ * report.  The jitdump jit-<pid>.dump in the current directory also holds
+ * the code and the source line of every operation, for perf inject --jit
+ * and perf annotate.
+ */
+class PerfLog final {
+public:
+  enum Output : unsigned int {
+    MAP = 1,
+    JITDUMP = 2,
+  };
+
+private:
+  struct M {
+    FILE *map;
+    FILE *dump;
+    // The executable mapping of the jitdump, which perf record sees
+    uint8_t *marker;
+    std::string program_path;
+    SourceLines lines;
+    uint64_t code_index;
+  } m;
+
+  explicit PerfLog(M m) noexcept : m(std::move(m)) {
+  }
+
+  PerfLog(const PerfLog &) = delete;
+  PerfLog &operator=(const PerfLog &) = delete;
+
+public:
+  /**
+   * Creates the outputs, a combination of Output values, for the program
+   * from the file.
+   */
+  static std::variant<PerfLog, Err> Create(unsigned int outputs,
+                                           std::string_view program,
+                                           std::string_view program_path) noexcept;
+
+  ~PerfLog();
+
+  PerfLog(PerfLog &&other) noexcept
+      : m(std::exchange(other.m,
+                        {nullptr, nullptr, nullptr, std::string{}, SourceLines::Create(std::string_view{}), 0})) {
+  }
+
+  PerfLog &operator=(PerfLog &&other) noexcept {
+    std::swap(m, other.m);
+    return *this;
+  }
+
+  /**
+   * Describes the code, which is executable already.  The operations are
+   * where the code of each operation starts, in the order of the code,
+   * followed by the start of the exit with nullptr.
+   */
+  void RecordCode(const uint8_t *code, size_t size, const std::vector<std::pair<const Operation *, uint8_t *>> &);
+};
+
+#endif /* BF_CC_PERF_H */
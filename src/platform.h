@@ -35,6 +35,7 @@
 #endif
 
 #include <cstdint>
+#include <cstdio>
 #include <string>
 
 #include "error.h"
@@ -65,6 +66,42 @@ extern size_t Pagesize();
 
 extern std::variant<std::string, Err> ReadWholeFile(const std::string_view);
 
+/**
+ * Replaces the file with the content, and allows to execute it.
+ */
+extern Err WriteExecutableFile(const std::string_view, const std::string_view);
+
+extern std::variant<size_t, Err> FileSize(const std::string_view);
+
+/**
+ * Maps size bytes of the file from the offset, which must be a multiple
+ * of the page size.  The mapping is a private copy, writes do not reach
+ * the file.  Release it with Deallocate.
+ */
+extern std::variant<uint8_t *, Err> MapFile(const std::string_view, size_t offset, size_t size);
+
+/**
+ * Maps size bytes from the start of the file readable and executable,
+ * without accessing them.  This is how a jitdump file announces itself to
+ * perf record.  Release it with Deallocate.
+ */
+extern std::variant<uint8_t *, Err> MapFileExecutable(const std::string_view, size_t size);
+
+/**
+ * Creates the directory, unless it exists already.
+ */
+extern Err MakeDirectory(const std::string_view);
+
+extern uint32_t ProcessId();
+
+extern uint32_t ThreadId();
+
+/**
+ * Redirects bf_read and bf_write to the given files, nullptr restores
+ * stdin and stdout.
+ */
+extern void SetProgramIO(FILE *input, FILE *output);
+
 extern "C" void bf_write(uint8_t *);
 
 extern "C" void bf_read(uint8_t *, uint32_t);
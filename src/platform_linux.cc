@@ -5,8 +5,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <memory>
@@ -66,13 +69,101 @@ std::variant<std::string, Err> ReadWholeFile(const std::string_view filename) {
   return content;
 }
 
+Err WriteExecutableFile(const std::string_view filename, const std::string_view content) {
+  const std::unique_ptr<int, void (*)(int *)> fp{new int(open(filename.data(), O_WRONLY | O_CREAT | O_TRUNC, 0755)),
+                                                 close_file};
+  if (0 > *fp) {
+    return Err::IO(errno);
+  }
+  size_t bytes_written{0};
+  while (content.size() > bytes_written) {
+    const ssize_t w = write(*fp, content.data() + bytes_written, content.size() - bytes_written);
+    if (0 > w && errno != EINTR) {
+      return Err::IO(errno);
+    }
+    bytes_written += (size_t) std::max<ssize_t>(w, 0);
+  }
+  // The mode of open only applies to new files
+  if (0 > fchmod(*fp, 0755)) {
+    return Err::IO(errno);
+  }
+  return Err::Ok();
+}
+
+std::variant<size_t, Err> FileSize(const std::string_view filename) {
+  struct stat st {};
+  if (0 > stat(filename.data(), &st)) {
+    return Err::IO(errno);
+  }
+  return (size_t) st.st_size;
+}
+
+std::variant<uint8_t *, Err> MapFile(const std::string_view filename, size_t offset, size_t size) {
+  const std::unique_ptr<int, void (*)(int *)> fp{new int(open(filename.data(), O_RDONLY)), close_file};
+  if (0 > *fp) {
+    return Err::IO(errno);
+  }
+  // Accessing a mapping behind the end of the file raises SIGBUS
+  struct stat st {};
+  if (0 > fstat(*fp, &st)) {
+    return Err::IO(errno);
+  }
+  if ((size_t) st.st_size < offset + size) {
+    return Err::IO(EINVAL);
+  }
+  uint8_t *mem = (uint8_t *) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, *fp, (off_t) offset);
+  if (mem == MAP_FAILED) {
+    return Err::MemAllocate(errno);
+  }
+  return mem;
+}
+
+std::variant<uint8_t *, Err> MapFileExecutable(const std::string_view filename, size_t size) {
+  const std::unique_ptr<int, void (*)(int *)> fp{new int(open(filename.data(), O_RDONLY)), close_file};
+  if (0 > *fp) {
+    return Err::IO(errno);
+  }
+  uint8_t *mem = (uint8_t *) mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE, *fp, 0);
+  if (mem == MAP_FAILED) {
+    return Err::MemAllocate(errno);
+  }
+  return mem;
+}
+
+Err MakeDirectory(const std::string_view path) {
+  if (0 > mkdir(path.data(), 0755) && errno != EEXIST) {
+    return Err::IO(errno);
+  }
+  return Err::Ok();
+}
+
+uint32_t ProcessId() {
+  return (uint32_t) getpid();
+}
+
+uint32_t ThreadId() {
+  return (uint32_t) syscall(SYS_gettid);
+}
+
+static FILE *program_input = nullptr;
+static FILE *program_output = nullptr;
+
+void SetProgramIO(FILE *input, FILE *output) {
+  program_input = input;
+  program_output = output;
+}
+
 extern "C" void bf_write(uint8_t *c) {
-  std::putchar((int) *c);
-  std::fflush(stdout);
+  if (program_output) {
+    std::putc((int) *c, program_output);
+  } else {
+    std::putchar((int) *c);
+    std::fflush(stdout);
+  }
 }
 
 extern "C" void bf_read(uint8_t *c, uint32_t mode) {
-  int input = std::getchar();
+  int input = program_input ? std::getc(program_input) : std::getchar();
   if (EOF == input) {
     switch (mode) {
     case 1: {  // KEEP
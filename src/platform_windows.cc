@@ -75,12 +75,93 @@ std::variant<std::string, Err> ReadWholeFile(const std::string_view filename) {
   return content;
 }
 
+Err WriteExecutableFile(const std::string_view filename, const std::string_view content) {
+  const std::unique_ptr<HANDLE, void (*)(HANDLE *)> fp{
+      new HANDLE(CreateFile(filename.data(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)),
+      close_handle};
+  if (INVALID_HANDLE_VALUE == *fp) {
+    return Err::IO(GetLastError());
+  }
+  DWORD bytes_written{0};
+  if (!WriteFile(*fp, content.data(), (DWORD) content.size(), &bytes_written, NULL)) {
+    return Err::IO(GetLastError());
+  }
+  return Err::Ok();
+}
+
+std::variant<size_t, Err> FileSize(const std::string_view filename) {
+  WIN32_FILE_ATTRIBUTE_DATA data{};
+  if (!GetFileAttributesExA(filename.data(), GetFileExInfoStandard, &data)) {
+    return Err::IO(GetLastError());
+  }
+  return ((size_t) data.nFileSizeHigh << 32) | (size_t) data.nFileSizeLow;
+}
+
+std::variant<uint8_t *, Err> MapFile(const std::string_view filename, size_t offset, size_t size) {
+  const std::unique_ptr<HANDLE, void (*)(HANDLE *)> fp{
+      new HANDLE(
+          CreateFile(filename.data(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)),
+      close_handle};
+  if (INVALID_HANDLE_VALUE == *fp) {
+    return Err::IO(GetLastError());
+  }
+  // Views of file mappings can't be released with VirtualFree, the file is
+  // read into allocated memory instead
+  auto alloc_result = Allocate(size);
+  if (alloc_result.index() != 0) {
+    return std::get<Err>(alloc_result);
+  }
+  uint8_t *mem = std::get<uint8_t *>(alloc_result);
+  LARGE_INTEGER position{};
+  position.QuadPart = (LONGLONG) offset;
+  DWORD bytes_read{0};
+  if (Err err = Protect(mem, size, PROTECT_RW); !err.IsOk()) {
+    Deallocate(mem, size);
+    return err;
+  }
+  if (!SetFilePointerEx(*fp, position, NULL, FILE_BEGIN) || !ReadFile(*fp, mem, (DWORD) size, &bytes_read, NULL) ||
+      bytes_read != size) {
+    const DWORD error = GetLastError();
+    Deallocate(mem, size);
+    return Err::IO(error);
+  }
+  return mem;
+}
+
+std::variant<uint8_t *, Err> MapFileExecutable(const std::string_view, size_t) {
+  // There is no perf on Windows
+  return Err::IO(ERROR_NOT_SUPPORTED);
+}
+
+Err MakeDirectory(const std::string_view path) {
+  if (!CreateDirectoryA(path.data(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+    return Err::IO(GetLastError());
+  }
+  return Err::Ok();
+}
+
+uint32_t ProcessId() {
+  return (uint32_t) GetCurrentProcessId();
+}
+
+uint32_t ThreadId() {
+  return (uint32_t) GetCurrentThreadId();
+}
+
+static FILE *program_input = nullptr;
+static FILE *program_output = nullptr;
+
+void SetProgramIO(FILE *input, FILE *output) {
+  program_input = input;
+  program_output = output;
+}
+
 extern "C" void bf_write(uint8_t *c) {
-  std::putchar((int) *c);
+  std::putc((int) *c, program_output ? program_output : stdout);
 }
 
 extern "C" void bf_read(uint8_t *c, uint32_t mode) {
-  int input = std::getchar();
+  int input = program_input ? std::getc(program_input) : std::getchar();
   if (EOF == input) {
     switch (mode) {
     case 1: {  // KEEP
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: MIT License
+#include "profile.h"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+#include <vector>
+
+#include "parse.h"
+
+void LoopStats::Record(uint64_t count) noexcept {
+  ++entries;
+  iterations += count;
+  ++trips[std::min((size_t) std::bit_width(count), TRIP_BUCKETS - 1)];
+}
+
+/**
+ * FNV-1a hash of the program.  Loops are identified by their offset in the
+ * file, so comments count as well as the commands.
+ */
+static uint64_t fingerprint(std::string_view program) {
+  uint64_t hash = 0xCBF29CE484222325;
+  for (const char c : program) {
+    hash = (hash ^ (uint8_t) c) * 0x100000001B3;
+  }
+  return hash;
+}
+
+LoopProfile LoopProfile::Create(std::string_view program) noexcept {
+  return LoopProfile(M{.program = fingerprint(program), .loops = {}});
+}
+
+LoopStats &LoopProfile::Loop(uint32_t id) {
+  return m.loops.try_emplace(id, LoopStats{.entries = 0, .iterations = 0, .trips = {}, .cost = 0}).first->second;
+}
+
+const LoopStats *LoopProfile::Find(uint32_t id) const noexcept {
+  auto iter = m.loops.find(id);
+  return iter == m.loops.end() ? nullptr : &iter->second;
+}
+
+bool LoopProfile::IsCold(uint32_t id) const noexcept {
+  const LoopStats *stats = Find(id);
+  return stats && 0 == stats->iterations;
+}
+
+bool LoopProfile::IsHot(uint32_t id) const noexcept {
+  const LoopStats *stats = Find(id);
+  return stats && stats->iterations >= HOT_ITERATIONS && stats->iterations >= HOT_TRIPS * stats->entries;
+}
+
+void LoopProfile::Add(const CodeCounters &counters) {
+  for (const auto &[id, loop] : counters.loops) {
+    LoopStats &stats = Loop(id);
+    stats.entries += loop.entries;
+    stats.iterations += loop.iterations;
+    stats.cost += loop.ticks;
+  }
+}
+
+/**
+ * Line and column of the offset, like 3:5.
+ */
+static std::string position(const SourceLines &lines, uint32_t offset) {
+  const SourcePosition pos = lines.Position(offset);
+  return std::to_string(pos.line) + ":" + std::to_string(pos.column);
+}
+
+std::string LoopProfile::Report(std::string_view program, uint64_t total, std::string_view unit) const {
+  const SourceLines lines = SourceLines::Create(program);
+  const std::unordered_map<uint32_t, uint32_t> ends = LoopEnds(program);
+  std::vector<std::pair<uint32_t, const LoopStats *>> loops{};
+  for (const auto &[id, stats] : m.loops) {
+    loops.emplace_back(id, &stats);
+  }
+  // The most expensive loops first, the others in program order
+  std::stable_sort(loops.begin(), loops.end(), [](const auto &a, const auto &b) {
+    return a.second->cost > b.second->cost;
+  });
+  const std::string unit_name{unit};
+  char buffer[160];
+  std::snprintf(buffer, sizeof(buffer), "Loop profile: %" PRIu64 " %s\n", total, unit_name.c_str());
+  std::string result{buffer};
+  std::snprintf(buffer,
+                sizeof(buffer),
+                "%-10s %-10s %12s %16s %16s %7s\n",
+                "[",
+                "]",
+                "entries",
+                "iterations",
+                unit_name.c_str(),
+                "share");
+  result += buffer;
+  for (const auto &[id, stats] : loops) {
+    const double share = 0 == total ? 0.0 : 100.0 * (double) stats->cost / (double) total;
+    auto end = ends.find(id);
+    std::snprintf(buffer,
+                  sizeof(buffer),
+                  "%-10s %-10s %12" PRIu64 " %16" PRIu64 " %16" PRIu64 " %6.2f%%\n",
+                  position(lines, id).c_str(),
+                  end == ends.end() ? "?" : position(lines, end->second).c_str(),
+                  stats->entries,
+                  stats->iterations,
+                  stats->cost,
+                  share);
+    result += buffer;
+  }
+  return result;
+}
+
+std::string LoopProfile::Serialize() const {
+  std::string result{"# bf-cc loop profile: loop OFFSET ENTRIES ITERATIONS TRIPS...\n"};
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "program %016" PRIx64 "\n", m.program);
+  result += buffer;
+  for (const auto &[id, stats] : m.loops) {
+    std::snprintf(buffer, sizeof(buffer), "loop %" PRIu32, id);
+    result += buffer;
+    std::snprintf(buffer, sizeof(buffer), " %" PRIu64 " %" PRIu64, stats.entries, stats.iterations);
+    result += buffer;
+    for (const uint64_t count : stats.trips) {
+      std::snprintf(buffer, sizeof(buffer), " %" PRIu64, count);
+      result += buffer;
+    }
+    result += '\n';
+  }
+  return result;
+}
+
+/**
+ * Reads the next number of the line, returns false if there is none.
+ */
+static bool next_number(std::string_view &line, uint64_t &value, int base = 10) {
+  while (!line.empty() && std::isspace((unsigned char) line.front())) {
+    line.remove_prefix(1);
+  }
+  if (line.empty() || !std::isxdigit((unsigned char) line.front())) {
+    return false;
+  }
+  const std::string token{line.substr(0, std::min(line.find_first_of(" \t\r"), line.size()))};
+  char *end = nullptr;
+  errno = 0;
+  value = std::strtoull(token.c_str(), &end, base);
+  if (errno == ERANGE || nullptr == end || *end != '\0') {
+    return false;
+  }
+  line.remove_prefix(token.size());
+  return true;
+}
+
+std::variant<LoopProfile, Err> LoopProfile::Parse(std::string_view content, std::string_view program) {
+  LoopProfile profile = LoopProfile::Create(program);
+  bool program_found = false;
+  int64_t line_number = 0;
+  while (!content.empty()) {
+    ++line_number;
+    const size_t newline = content.find('\n');
+    std::string_view line = content.substr(0, newline);
+    content.remove_prefix(newline == std::string_view::npos ? content.size() : newline + 1);
+    while (!line.empty() && std::isspace((unsigned char) line.back())) {
+      line.remove_suffix(1);
+    }
+    if (line.empty() || line.front() == '#') {
+      continue;
+    }
+    uint64_t value = 0;
+    if (line.starts_with("program ")) {
+      line.remove_prefix(8);
+      if (!next_number(line, value, 16) || !line.empty()) {
+        return Err::InvalidProfile(line_number);
+      }
+      if (value != profile.m.program) {
+        return Err::ProfileMismatch();
+      }
+      program_found = true;
+    } else if (line.starts_with("loop ")) {
+      line.remove_prefix(5);
+      if (!next_number(line, value) || value >= UINT32_MAX) {
+        return Err::InvalidProfile(line_number);
+      }
+      LoopStats &stats = profile.Loop((uint32_t) value);
+      bool valid = next_number(line, stats.entries) && next_number(line, stats.iterations);
+      for (uint64_t &count : stats.trips) {
+        valid = valid && next_number(line, count);
+      }
+      if (!valid || !line.empty()) {
+        return Err::InvalidProfile(line_number);
+      }
+    } else {
+      return Err::InvalidProfile(line_number);
+    }
+  }
+  if (!program_found) {
+    return Err::ProfileMismatch();
+  }
+  return profile;
+}
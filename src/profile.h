@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_PROFILE_H
+#define BF_CC_PROFILE_H 1
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+
+#include "error.h"
+
+/**
+ * Execution counts of a single loop.
+ *
+ * The number of iterations per entry is recorded in a histogram with
+ * buckets of powers of two.  Bucket 0 counts entries which skipped the
+ * loop, bucket n counts entries with 2^(n-1) up to 2^n - 1 iterations.
+ * The last bucket takes everything above.
+ */
+struct LoopStats {
+  static constexpr size_t TRIP_BUCKETS = 16;
+
+  uint64_t entries;
+  uint64_t iterations;
+  std::array<uint64_t, TRIP_BUCKETS> trips;
+  // Operations or clock ticks from reaching the loop to leaving it,
+  // including inner loops.  Not serialized.
+  uint64_t cost;
+
+  void Record(uint64_t iterations) noexcept;
+};
+
+/**
+ * Counters of a loop, which instrumented code updates while it runs.
+ * The clock is the time stamp counter, or the virtual counter on AArch64.
+ */
+struct LoopCounters {
+  uint64_t entries;
+  uint64_t iterations;
+  // Clock ticks from reaching the loop to leaving it
+  uint64_t ticks;
+  // The clock when the loop was reached
+  uint64_t start;
+};
+
+/**
+ * Counters of instrumented code, for the whole program and for every
+ * loop by the source offset of its opening bracket.
+ */
+struct CodeCounters {
+  LoopCounters program;
+  std::map<uint32_t, LoopCounters> loops;
+};
+
+/**
+ * Loop execution profile of a program.
+ *
+ * Loops are identified by the source offset of their opening bracket,
+ * which does not depend on the optimizations applied to the program.
+ * The profile is bound to the program it was recorded for.
+ */
+class LoopProfile final {
+public:
+  // Loops with at least this many iterations in total are hot ...
+  static constexpr uint64_t HOT_ITERATIONS = 1 << 12;
+  // ... if they also run this many iterations per entry on average
+  static constexpr uint64_t HOT_TRIPS = 8;
+
+private:
+  struct M {
+    uint64_t program;
+    std::map<uint32_t, LoopStats> loops;
+  } m;
+
+  explicit LoopProfile(M m) noexcept : m(std::move(m)) {
+  }
+
+  LoopProfile(const LoopProfile &) = delete;
+  LoopProfile &operator=(const LoopProfile &) = delete;
+
+public:
+  LoopProfile(LoopProfile &&) noexcept = default;
+  LoopProfile &operator=(LoopProfile &&) noexcept = default;
+
+  static LoopProfile Create(std::string_view program) noexcept;
+
+  /**
+   * The counters of the loop, created on first use.
+   */
+  LoopStats &Loop(uint32_t id);
+
+  /**
+   * The counters of the loop, nullptr if it was not recorded.
+   */
+  const LoopStats *Find(uint32_t id) const noexcept;
+
+  /**
+   * Returns true, if the loop was recorded but never ran an iteration.
+   * A loop that was reached but always skipped by its guard is cold.
+   */
+  bool IsCold(uint32_t id) const noexcept;
+
+  /**
+   * Returns true, if the loop runs often and long enough that its
+   * speed matters more than its size.
+   */
+  bool IsHot(uint32_t id) const noexcept;
+
+  const std::map<uint32_t, LoopStats> &Loops() const noexcept {
+    return m.loops;
+  }
+
+  /**
+   * Adds the counters of instrumented code, the ticks are the cost.
+   */
+  void Add(const CodeCounters &);
+
+  /**
+   * Table of the loops by their share of the total cost, with the line
+   * and column of their brackets in the program.
+   */
+  std::string Report(std::string_view program, uint64_t total, std::string_view unit) const;
+
+  /**
+   * Text format, one loop per line, which Parse reads back.
+   */
+  std::string Serialize() const;
+
+  /**
+   * Reads a serialized profile.  Fails if the profile was recorded for
+   * another program.
+   */
+  static std::variant<LoopProfile, Err> Parse(std::string_view content, std::string_view program);
+};
+
+#endif /* BF_CC_PROFILE_H */
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: MIT License
+#include "serialize.h"
+
+#include <bit>
+#include <cstring>
+#include <unordered_map>
+
+static constexpr char MAGIC[8] = {'b', 'f', '-', 'c', 'c', '-', 'i', 'r'};
+static constexpr size_t VERSION_OFFSET = sizeof(MAGIC);
+static constexpr size_t COUNT_OFFSET = VERSION_OFFSET + 4;
+static constexpr size_t HEADER_SIZE = COUNT_OFFSET + 8;
+// An op code and four numbers of a single byte
+static constexpr size_t MIN_OPERATION_SIZE = 5;
+
+static constexpr uint32_t VALID_OP_CODES =
+    (uint32_t) Instruction::NOP | (uint32_t) Instruction::INCR_CELL | (uint32_t) Instruction::DECR_CELL |
+    (uint32_t) Instruction::IMUL_CELL | (uint32_t) Instruction::DMUL_CELL | (uint32_t) Instruction::SET_CELL |
+    (uint32_t) Instruction::INCR_PTR | (uint32_t) Instruction::DECR_PTR | (uint32_t) Instruction::READ |
+    (uint32_t) Instruction::WRITE | (uint32_t) Instruction::JZ | (uint32_t) Instruction::JNZ |
+    (uint32_t) Instruction::LABEL | (uint32_t) Instruction::FIND_CELL_LOW | (uint32_t) Instruction::FIND_CELL_HIGH |
+    (uint32_t) Instruction::DJNZ;
+
+/**
+ * The first operand of jumps and labels is their partner.
+ */
+static bool is_linked(const Operation *op) {
+  return op->IsJump() || op->Is(Instruction::LABEL);
+}
+
+static void put_fixed(std::string &out, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; ++i) {
+    out += (char) (uint8_t) (value >> (8 * i));
+  }
+}
+
+static uint64_t get_fixed(std::string_view content, size_t offset, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; ++i) {
+    value |= (uint64_t) (uint8_t) content[offset + i] << (8 * i);
+  }
+  return value;
+}
+
+static void put_unsigned(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out += (char) (uint8_t) ((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out += (char) (uint8_t) value;
+}
+
+static void put_signed(std::string &out, int64_t value) {
+  put_unsigned(out, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+/**
+ * Reads the next number, returns false if it is truncated or too large.
+ */
+static bool get_unsigned(std::string_view content, size_t &offset, uint64_t &value) {
+  value = 0;
+  for (unsigned int shift = 0; shift < 64 && offset < content.size(); shift += 7) {
+    const uint8_t byte = (uint8_t) content[offset++];
+    value |= (uint64_t) (byte & 0x7F) << shift;
+    if (0 == (byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool get_signed(std::string_view content, size_t &offset, int64_t &value) {
+  uint64_t zigzag = 0;
+  if (!get_unsigned(content, offset, zigzag)) {
+    return false;
+  }
+  value = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+  return true;
+}
+
+bool IsSerializedStream(std::string_view content) {
+  return content.size() >= sizeof(MAGIC) && 0 == std::memcmp(content.data(), MAGIC, sizeof(MAGIC));
+}
+
+std::string SerializeStream(OperationStream &stream) {
+  std::unordered_map<const Operation *, int64_t> indices{};
+  indices.reserve(stream.Size());
+  int64_t index = 0;
+  for (const Operation *op : stream) {
+    indices.emplace(op, index++);
+  }
+  std::string result{MAGIC, sizeof(MAGIC)};
+  put_fixed(result, IR_VERSION, 4);
+  put_fixed(result, stream.Size(), 8);
+  index = 0;
+  for (const Operation *op : stream) {
+    result += (char) (uint8_t) std::countr_zero((uint32_t) op->OpCode());
+    put_unsigned(result, Operation::NO_SOURCE == op->Source() ? 0 : (uint64_t) op->Source() + 1);
+    if (is_linked(op)) {
+      const Operation *partner = (const Operation *) op->Operand1();
+      put_signed(result, nullptr == partner ? 0 : indices.at(partner) - index);
+    } else {
+      put_signed(result, op->Operand1());
+    }
+    put_signed(result, op->Operand2());
+    put_signed(result, op->Operand3());
+    ++index;
+  }
+  return result;
+}
+
+std::variant<OperationStream, Err> DeserializeStream(std::string_view content) {
+  if (!IsSerializedStream(content) || content.size() < HEADER_SIZE) {
+    return Err::InvalidIR(0);
+  }
+  if (IR_VERSION != get_fixed(content, VERSION_OFFSET, 4)) {
+    return Err::InvalidIR(VERSION_OFFSET);
+  }
+  const uint64_t count = get_fixed(content, COUNT_OFFSET, 8);
+  if (count > (content.size() - HEADER_SIZE) / MIN_OPERATION_SIZE) {
+    return Err::InvalidIR(COUNT_OFFSET);
+  }
+  OperationStream stream = OperationStream::CreateBlock(count);
+  Operation *const block = stream.First();
+  size_t offset = HEADER_SIZE;
+  for (uint64_t index = 0; index < count; ++index) {
+    const size_t start = offset;
+    const uint8_t bit = (uint8_t) content[offset++];
+    const uint32_t code = bit < 32 ? UINT32_C(1) << bit : 0;
+    uint64_t source = 0;
+    int64_t operands[3] = {0, 0, 0};
+    if (0 == (code & VALID_OP_CODES) || !get_unsigned(content, offset, source) || source > UINT32_MAX ||
+        !get_signed(content, offset, operands[0]) || !get_signed(content, offset, operands[1]) ||
+        !get_signed(content, offset, operands[2])) {
+      return Err::InvalidIR((int64_t) start);
+    }
+    Operation *op = block + index;
+    op->SetOpCode((Instruction) code);
+    op->SetSource(0 == source ? Operation::NO_SOURCE : (uint32_t) (source - 1));
+    if (is_linked(op) && 0 != operands[0]) {
+      // The partner must be in the stream
+      if (operands[0] < -(int64_t) index || operands[0] >= (int64_t) (count - index)) {
+        return Err::InvalidIR((int64_t) start);
+      }
+      op->SetOperand1((Operation::operand_type) (op + operands[0]));
+    } else {
+      op->SetOperand1((Operation::operand_type) operands[0]);
+    }
+    op->SetOperand2((Operation::operand_type) operands[1]);
+    op->SetOperand3((Operation::operand_type) operands[2]);
+  }
+  if (offset != content.size()) {
+    return Err::InvalidIR((int64_t) offset);
+  }
+  if (!stream.IsStructured()) {
+    return Err::InvalidIR(HEADER_SIZE);
+  }
+  return stream;
+}
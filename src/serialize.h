@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_SERIALIZE_H
+#define BF_CC_SERIALIZE_H 1
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <variant>
+
+#include "error.h"
+#include "instr.h"
+
+/**
+ * Binary format of an optimized program, which runs without the parser
+ * and the optimizer.
+ *
+ * The format starts with the magic "bf-cc-ir", the version as a 32 bit
+ * and the number of operations as a 64 bit little endian integer.  Every
+ * operation follows as the bit number of its op code in a byte, then its
+ * source offset plus one and its three operands as LEB128 numbers, signed
+ * ones zigzag encoded.  Jumps and labels refer to their partner by the
+ * distance in operations, 0 if there is none.
+ */
+static constexpr uint32_t IR_VERSION = 1;
+
+/**
+ * Returns true, if the content starts like a serialized program.
+ */
+bool IsSerializedStream(std::string_view);
+
+std::string SerializeStream(OperationStream &);
+
+/**
+ * Reads a serialized program into a stream, whose operations are
+ * allocated as a single block.  Fails on other versions of the format.
+ */
+std::variant<OperationStream, Err> DeserializeStream(std::string_view);
+
+#endif /* BF_CC_SERIALIZE_H */
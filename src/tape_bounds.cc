@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: MIT License
+#include "tape_bounds.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "debug.h"
+
+static void touch(TapeRange &range, intptr_t cell) {
+  range.low = std::min(range.low, cell);
+  range.high = std::max(range.high, cell);
+}
+
+/**
+ * Leaves the innermost region, returns false if the cell pointer is not
+ * where it was when the region was entered.
+ */
+static bool leave(std::vector<intptr_t> &entries, intptr_t position) {
+  ASSERT(!entries.empty(), "Unbalanced regions");
+  const intptr_t entry = entries.back();
+  entries.pop_back();
+  return entry == position;
+}
+
+/**
+ * Walks the stream once and tracks the position of the cell pointer.
+ * Every region remembers the position it was entered at.  A backward
+ * jump must be reached at the position of its label, and the end of a
+ * guard at the position of its JZ, which means all paths through the
+ * region agree on the position afterwards.  Cells written or read are
+ * collected on the way.
+ */
+std::optional<TapeRange> AnalyzeTapeBounds(OperationStream &stream) {
+  TapeRange range{.low = 0, .high = 0};
+  std::vector<intptr_t> entries{};
+  intptr_t position = 0;
+  for (const Operation *op : stream) {
+    switch (op->OpCode()) {
+    case Instruction::NOP:
+      break;
+    case Instruction::INCR_CELL:
+    case Instruction::DECR_CELL:
+    case Instruction::SET_CELL:
+    case Instruction::READ:
+    case Instruction::WRITE:
+      touch(range, position + op->Operand2());
+      break;
+    case Instruction::IMUL_CELL:
+    case Instruction::DMUL_CELL:
+      touch(range, position + op->Operand2());
+      touch(range, position + op->Operand3());
+      break;
+    case Instruction::INCR_PTR:
+      position += op->Operand1();
+      break;
+    case Instruction::DECR_PTR:
+      position -= op->Operand1();
+      break;
+    case Instruction::JZ:
+      touch(range, position + op->Operand2());
+      entries.push_back(position);
+      break;
+    case Instruction::JNZ:
+      touch(range, position + op->Operand2());
+      if (!leave(entries, position)) {
+        return std::nullopt;
+      }
+      break;
+    case Instruction::DJNZ:
+      if (!leave(entries, position)) {
+        return std::nullopt;
+      }
+      break;
+    case Instruction::LABEL:
+      if (((const Operation *) op->Operand1())->IsAny({Instruction::JNZ, Instruction::DJNZ})) {
+        // The head of a loop
+        entries.push_back(position);
+      } else if (!leave(entries, position)) {
+        return std::nullopt;
+      }
+      break;
+    case Instruction::FIND_CELL_LOW:
+    case Instruction::FIND_CELL_HIGH:
+      return std::nullopt;
+    }
+  }
+  return range;
+}
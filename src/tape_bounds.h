@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_TAPE_BOUNDS_H
+#define BF_CC_TAPE_BOUNDS_H 1
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "instr.h"
+
+/**
+ * The cells a program touches, relative to the cell it starts at.
+ */
+struct TapeRange {
+  intptr_t low;
+  intptr_t high;
+
+  inline size_t Size() const noexcept {
+    return (size_t) (high - low + 1);
+  }
+};
+
+/**
+ * Derives the range of cells the program can reach.  The range is only
+ * known if every loop and guard leaves the cell pointer where it was
+ * before, and the program does not scan for cells.
+ */
+std::optional<TapeRange> AnalyzeTapeBounds(OperationStream &);
+
+#endif /* BF_CC_TAPE_BOUNDS_H */
@@ -0,0 +1,369 @@
+// SPDX-License-Identifier: MIT License
+#include "trace.h"
+
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "assembler.h"
+#include "debug.h"
+#include "error.h"
+
+/**
+ * A recorded trace, and the side traces which start at its guards.
+ */
+struct TraceNode {
+  Trace trace;
+  // Side traces by the index of the step of their guard
+  std::unordered_map<size_t, TraceNode *> sides;
+};
+
+struct TraceTree {
+  TraceNode *root;
+  TraceJit::CodeEntry entry;
+  // The head and the end of the loop, where side traces continue
+  uint8_t *head;
+  uint8_t *end;
+};
+
+/**
+ * All trace trees.  Nodes and exits live as long as the trace compiler,
+ * since inlined copies and old code refer to them.
+ */
+struct TraceTrees {
+  std::unordered_map<const Operation *, TraceTree> trees;
+  std::vector<std::unique_ptr<TraceNode>> nodes;
+  std::vector<std::unique_ptr<TraceExit>> exits;
+};
+
+/**
+ * A compiled copy of a loop, either the loop of the tree or an inlined
+ * inner loop.
+ */
+struct LoopCopy {
+  Operation *back;
+  uint8_t *head;
+  uint8_t *end;
+  // Set for inlined loops, whose guards can't start side traces
+  bool inlined;
+};
+
+/**
+ * The jump of a guard, which is patched to code out of line: the side
+ * trace of the guard, or an exit to the interpreter.
+ */
+struct PendingGuard {
+  uint8_t *jump;
+  bool if_zero;
+  TraceNode *node;
+  size_t step;
+  LoopCopy *copy;
+};
+
+struct TraceContext {
+  CodeArea &mem;
+  TraceTrees &trees;
+  EOFMode eof_mode;
+  // The loop of the tree which is compiled
+  Operation *loop;
+  std::deque<LoopCopy> copies;
+  std::deque<PendingGuard> guards;
+};
+
+static void emit_steps(TraceContext &, TraceNode *, size_t, LoopCopy *);
+
+static void emit_guard(TraceContext &ctx, TraceNode *node, size_t step, LoopCopy *copy, bool if_zero) {
+  ctx.guards.push_back(PendingGuard{
+      .jump = ctx.mem.CurrentWriteAddr(), .if_zero = if_zero, .node = node, .step = step, .copy = copy});
+}
+
+static void patch_guard(CodeArea &mem, uint8_t *jump, bool if_zero, uint8_t *target) {
+  if (if_zero) {
+    PatchJumpZero(mem, jump, (uintptr_t) (target - jump));
+  } else {
+    PatchJumpNonZero(mem, jump, (uintptr_t) (target - jump));
+  }
+}
+
+/**
+ * Emits the exit of a guard, the interpreter continues with the operation
+ * of the guard, which takes the other path.
+ */
+static void emit_exit(TraceContext &ctx, const PendingGuard &guard) {
+  Operation *op = guard.node->trace[guard.step].op;
+  auto exit = std::make_unique<TraceExit>(TraceExit{
+      .loop = ctx.loop,
+      .resume = op,
+      .count = 0,
+      .recordings = 0,
+      .linkable = !guard.copy->inlined && op->Is(Instruction::JZ),
+      .linked = false,
+      .node = guard.node,
+      .step = guard.step,
+      .guard = guard.jump,
+      .guard_if_zero = guard.if_zero,
+  });
+  EmitExit(ctx.mem, op, (uintptr_t) exit.get());
+  ctx.trees.exits.push_back(std::move(exit));
+}
+
+/**
+ * Emits the end of a loop, which was not inlined.  The interpreter runs
+ * the backward jump, which is not taken.  A counted loop needs a loop
+ * counter of one for that.
+ */
+static void emit_loop_end(TraceContext &ctx, LoopCopy *copy) {
+  Operation *back = copy->back;
+  if (back->Is(Instruction::DJNZ)) {
+    EmitSetLoopCounter(ctx.mem, 1);
+  }
+  auto exit = std::make_unique<TraceExit>(TraceExit{
+      .loop = ctx.loop,
+      .resume = back,
+      .count = 0,
+      .recordings = 0,
+      .linkable = false,
+      .linked = false,
+      .node = nullptr,
+      .step = 0,
+      .guard = nullptr,
+      .guard_if_zero = false,
+  });
+  EmitExit(ctx.mem, back, (uintptr_t) exit.get());
+  ctx.trees.exits.push_back(std::move(exit));
+}
+
+/**
+ * Emits the side trace after the steps of the trace have been emitted.
+ * The side trace starts with the guard, which failed, and needs no check.
+ */
+static void emit_side_trace(TraceContext &ctx, TraceNode *side, LoopCopy *copy) {
+  emit_steps(ctx, side, 1, copy);
+  // Leave the loop after the backward jump
+  EmitJump(ctx.mem);
+  ctx.guards.push_back(PendingGuard{
+      .jump = ctx.mem.CurrentWriteAddr(), .if_zero = false, .node = nullptr, .step = 0, .copy = copy});
+}
+
+/**
+ * Emits the code of the guards, after the code of the trace.  Side traces
+ * add more guards.  The end of a side trace is a guard without a node,
+ * which jumps to the end of its loop.
+ */
+static void emit_pending_guards(TraceContext &ctx) {
+  while (!ctx.guards.empty()) {
+    const PendingGuard guard = ctx.guards.front();
+    ctx.guards.pop_front();
+    if (nullptr == guard.node) {
+      PatchJump(ctx.mem, guard.jump, (uintptr_t) (guard.copy->end - guard.jump));
+      continue;
+    }
+    uint8_t *code = ctx.mem.CurrentWriteAddr();
+    auto side = guard.node->sides.find(guard.step);
+    if (side != guard.node->sides.end()) {
+      emit_side_trace(ctx, side->second, guard.copy);
+    } else {
+      emit_exit(ctx, guard);
+    }
+    patch_guard(ctx.mem, guard.jump, guard.if_zero, code);
+  }
+}
+
+/**
+ * Emits the trace tree of an inner loop, whose code continues with the
+ * trace around it when the loop ends.
+ */
+static void emit_inlined_loop(TraceContext &ctx, const Operation *label) {
+  const TraceTree &tree = ctx.trees.trees.at(label);
+  Operation *back = (Operation *) label->Operand1();
+  if (back->Is(Instruction::DJNZ)) {
+    EmitSetLoopCounter(ctx.mem, (uint32_t) back->Operand2());
+  }
+  LoopCopy *copy = &ctx.copies.emplace_back(
+      LoopCopy{.back = back, .head = ctx.mem.CurrentWriteAddr(), .end = nullptr, .inlined = true});
+  emit_steps(ctx, tree.root, 0, copy);
+  copy->end = ctx.mem.CurrentWriteAddr();
+}
+
+/**
+ * Emits the steps of the trace from first on, up to the backward jump of
+ * the loop, which jumps to the head of the copy.
+ */
+static void emit_steps(TraceContext &ctx, TraceNode *node, size_t first, LoopCopy *copy) {
+  CodeArea &mem = ctx.mem;
+  for (size_t i = first; i < node->trace.size(); ++i) {
+    const TraceStep &step = node->trace[i];
+    const Operation *op = step.op;
+    switch (op->OpCode()) {
+    case Instruction::NOP:
+      break;
+    case Instruction::INCR_CELL:
+      EmitIncrCell(mem, (uint8_t) op->Operand1(), op->Operand2());
+      break;
+    case Instruction::DECR_CELL:
+      EmitDecrCell(mem, (uint8_t) op->Operand1(), op->Operand2());
+      break;
+    case Instruction::IMUL_CELL:
+      EmitImullCell(mem, (uint8_t) op->Operand1(), op->Operand2(), op->Operand3());
+      break;
+    case Instruction::DMUL_CELL:
+      EmitDmullCell(mem, (uint8_t) op->Operand1(), op->Operand2(), op->Operand3());
+      break;
+    case Instruction::SET_CELL:
+      EmitSetCell(mem, (uint8_t) op->Operand1(), op->Operand2());
+      break;
+    case Instruction::INCR_PTR:
+      EmitIncrPtr(mem, op->Operand1());
+      break;
+    case Instruction::DECR_PTR:
+      EmitDecrPtr(mem, op->Operand1());
+      break;
+    case Instruction::READ:
+      EmitIncrPtr(mem, op->Operand2());
+      EmitRead(mem, ctx.eof_mode);
+      EmitDecrPtr(mem, op->Operand2());
+      break;
+    case Instruction::WRITE:
+      EmitIncrPtr(mem, op->Operand2());
+      EmitWrite(mem);
+      EmitDecrPtr(mem, op->Operand2());
+      break;
+    case Instruction::JZ:
+      // The guard leaves the trace on the path which was not recorded
+      if (step.taken) {
+        EmitJumpNonZero(mem, op->Operand2());
+        emit_guard(ctx, node, i, copy, false);
+      } else {
+        EmitJumpZero(mem, op->Operand2());
+        emit_guard(ctx, node, i, copy, true);
+      }
+      break;
+    case Instruction::JNZ:
+      EmitJumpNonZero(mem, op->Operand2());
+      if (op == copy->back) {
+        PatchJumpNonZero(mem, mem.CurrentWriteAddr(), (uintptr_t) (copy->head - mem.CurrentWriteAddr()));
+      } else {
+        // Inner loops in the trace ran a single iteration
+        emit_guard(ctx, node, i, copy, false);
+      }
+      break;
+    case Instruction::DJNZ:
+      // Counted inner loops in the trace run a single iteration, always
+      if (op == copy->back) {
+        EmitLoopCounterJump(mem);
+        PatchLoopCounterJump(mem, mem.CurrentWriteAddr(), (uintptr_t) (copy->head - mem.CurrentWriteAddr()));
+      }
+      break;
+    case Instruction::LABEL:
+      if (step.taken) {
+        emit_inlined_loop(ctx, op);
+      } else if (((const Operation *) op->Operand1())->Is(Instruction::DJNZ)) {
+        EmitSetLoopCounter(mem, (uint32_t) ((const Operation *) op->Operand1())->Operand2());
+      }
+      break;
+    case Instruction::FIND_CELL_HIGH:
+      EmitFindCellHigh(mem, (uint8_t) op->Operand1(), (uintptr_t) op->Operand2());
+      break;
+    case Instruction::FIND_CELL_LOW:
+      EmitFindCellLow(mem, (uint8_t) op->Operand1(), (uintptr_t) op->Operand2());
+      break;
+    }
+  }
+}
+
+TraceJit::TraceJit(M m) noexcept : m(std::move(m)) {
+}
+
+std::variant<TraceJit, Err> TraceJit::Create() {
+  auto mem = CodeArea::Create();
+  if (0 != mem.index()) {
+    return std::get<Err>(std::move(mem));
+  }
+  return TraceJit(M{.mem = std::make_unique<CodeArea>(std::move(std::get<CodeArea>(mem))),
+                    .trees = std::make_unique<TraceTrees>()});
+}
+
+TraceJit::~TraceJit() = default;
+
+TraceJit::TraceJit(TraceJit &&other) noexcept : m(std::exchange(other.m, {nullptr, nullptr})) {
+}
+
+TraceJit &TraceJit::operator=(TraceJit &&other) noexcept {
+  m = std::move(other.m);
+  return *this;
+}
+
+Err TraceJit::CompileTrace(Operation *label, const Trace &trace, EOFMode eof_mode) noexcept {
+  ASSERT(!trace.empty() && trace.back().op == (Operation *) label->Operand1(), "Traces end with the backward jump");
+  if (Err err = m.mem->MakeWritable(); !err.IsOk()) {
+    return err;
+  }
+  TraceNode *root = m.trees->nodes.emplace_back(std::make_unique<TraceNode>(TraceNode{.trace = trace, .sides = {}}))
+                        .get();
+  TraceContext ctx{
+      .mem = *m.mem, .trees = *m.trees, .eof_mode = eof_mode, .loop = label, .copies = {}, .guards = {}};
+  uint8_t *entry = m.mem->CurrentWriteAddr();
+  EmitEntry(*m.mem);
+  LoopCopy *copy = &ctx.copies.emplace_back(LoopCopy{.back = (Operation *) label->Operand1(),
+                                                     .head = m.mem->CurrentWriteAddr(),
+                                                     .end = nullptr,
+                                                     .inlined = false});
+  emit_steps(ctx, root, 0, copy);
+  copy->end = m.mem->CurrentWriteAddr();
+  emit_loop_end(ctx, copy);
+  emit_pending_guards(ctx);
+  if (m.mem->HasWriteError()) {
+    return Err::OutOfMemory();
+  }
+  if (Err err = m.mem->MakeExecutable(); !err.IsOk()) {
+    return err;
+  }
+  m.trees->trees.insert_or_assign(label,
+                                  TraceTree{.root = root,
+                                            .entry = reinterpret_cast<CodeEntry>(entry),
+                                            .head = copy->head,
+                                            .end = copy->end});
+  return Err::Ok();
+}
+
+Err TraceJit::CompileSideTrace(TraceExit *exit, const Trace &trace, EOFMode eof_mode) noexcept {
+  ASSERT(exit->linkable && !exit->linked, "Exit can't be linked");
+  ASSERT(trace.size() > 1 && trace.front().op == exit->resume, "Side traces start at their guard");
+  const TraceTree &tree = m.trees->trees.at(exit->loop);
+  if (Err err = m.mem->MakeWritable(); !err.IsOk()) {
+    return err;
+  }
+  TraceNode *side = m.trees->nodes.emplace_back(std::make_unique<TraceNode>(TraceNode{.trace = trace, .sides = {}}))
+                        .get();
+  TraceContext ctx{
+      .mem = *m.mem, .trees = *m.trees, .eof_mode = eof_mode, .loop = exit->loop, .copies = {}, .guards = {}};
+  LoopCopy *copy = &ctx.copies.emplace_back(LoopCopy{
+      .back = (Operation *) exit->loop->Operand1(), .head = tree.head, .end = tree.end, .inlined = false});
+  uint8_t *code = m.mem->CurrentWriteAddr();
+  emit_side_trace(ctx, side, copy);
+  emit_pending_guards(ctx);
+  patch_guard(*m.mem, exit->guard, exit->guard_if_zero, code);
+  if (m.mem->HasWriteError()) {
+    return Err::OutOfMemory();
+  }
+  if (Err err = m.mem->MakeExecutable(); !err.IsOk()) {
+    return err;
+  }
+  exit->node->sides.insert_or_assign(exit->step, side);
+  exit->linked = true;
+  return Err::Ok();
+}
+
+void TraceJit::Discard(const Operation *label) noexcept {
+  auto tree = m.trees->trees.find(label);
+  if (tree != m.trees->trees.end()) {
+    tree->second.entry = nullptr;
+  }
+}
+
+TraceJit::CodeEntry TraceJit::Find(const Operation *label) const noexcept {
+  auto tree = m.trees->trees.find(label);
+  return tree == m.trees->trees.end() ? nullptr : tree->second.entry;
+}
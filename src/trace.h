@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_TRACE_H
+#define BF_CC_TRACE_H 1
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "assembler.h"
+#include "error.h"
+#include "instr.h"
+#include "mem.h"
+
+/**
+ * An operation as the interpreter executed it.  For jumps, taken tells
+ * whether the jump was taken.  For the label of a loop, taken tells that
+ * the loop ran in its own trace, which is inlined.
+ */
+struct TraceStep {
+  Operation *op;
+  bool taken;
+};
+
+using Trace = std::vector<TraceStep>;
+
+struct TraceNode;
+struct TraceTrees;
+
+/**
+ * A guard of compiled trace code, at which the code returns to the
+ * interpreter.  The code reports the exit in ExecState::exit.
+ */
+struct TraceExit {
+  // The label of the loop whose trace tree the exit belongs to
+  Operation *loop;
+  // The operation the interpreter runs next
+  Operation *resume;
+  // How often the code took the exit
+  uint64_t count;
+  // Failed attempts to record a side trace
+  uint32_t recordings;
+  // Only guards of the tree itself can start a side trace, guards of
+  // inlined loops and the end of the loop can't
+  bool linkable;
+  // Set once a side trace starts at the guard
+  bool linked;
+  // The trace and the step of the guard
+  TraceNode *node;
+  size_t step;
+  // The jump of the guard, which is patched to its side trace
+  uint8_t *guard;
+  bool guard_if_zero;
+};
+
+/**
+ * Trace compiler.
+ *
+ * The interpreter records the operations of a single iteration of a hot
+ * loop, the trace compiler turns them into linear code.  Every jump of the
+ * trace becomes a guard, which leaves the code if the program takes
+ * another path than the recorded one.  Guards which fail often start side
+ * traces, which are linked to the guard and jump back to the head of the
+ * loop.  A loop and its side traces form a trace tree.  Inner loops which
+ * have a trace tree of their own are inlined into the traces around them.
+ */
+class TraceJit final {
+public:
+  using CodeEntry = void (*)(ExecState *);
+  // Recordings longer than this are aborted
+  static constexpr size_t MAX_TRACE_LENGTH = 1 << 12;
+
+private:
+  struct M {
+    std::unique_ptr<CodeArea> mem;
+    std::unique_ptr<TraceTrees> trees;
+  } m;
+
+  explicit TraceJit(M m) noexcept;
+
+  TraceJit(const TraceJit &) = delete;
+  TraceJit &operator=(const TraceJit &) = delete;
+
+public:
+  static std::variant<TraceJit, Err> Create();
+
+  ~TraceJit();
+
+  TraceJit(TraceJit &&other) noexcept;
+
+  TraceJit &operator=(TraceJit &&other) noexcept;
+
+  /**
+   * Compiles the trace of an iteration of the loop, which starts right
+   * after its label and ends with its backward jump.  The code runs the
+   * loop until the loop ends or a guard fails, and reports the exit it
+   * took.  Replaces the trace tree of the loop, if there is one.
+   */
+  Err CompileTrace(Operation *label, const Trace &, EOFMode) noexcept;
+
+  /**
+   * Compiles a side trace, which starts at the operation of the exit and
+   * ends with the backward jump of its loop, and patches the guard of the
+   * exit to jump right to it.
+   */
+  Err CompileSideTrace(TraceExit *, const Trace &, EOFMode) noexcept;
+
+  /**
+   * Drops the trace tree of the loop, so that the loop can be recorded
+   * again.  Copies inlined into other trees stay valid.
+   */
+  void Discard(const Operation *label) noexcept;
+
+  /**
+   * The entry of the trace tree of the loop, nullptr if there is none.
+   * The code starts with the next iteration of the loop.
+   */
+  CodeEntry Find(const Operation *label) const noexcept;
+
+  size_t CodeSize() const noexcept {
+    return m.mem->Size();
+  }
+
+  void Dump() const noexcept {
+    m.mem->Dump();
+  }
+};
+
+#endif /* BF_CC_TRACE_H */
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: MIT License
+#include "tune.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <utility>
+
+#include "compiler.h"
+#include "mem.h"
+#include "parse.h"
+#include "platform.h"
+
+// Every candidate is executed this often, the fastest run counts
+static const unsigned int MEASUREMENTS = 3;
+
+// A candidate must be at least 2% faster to replace the best pipeline,
+// smaller differences are mostly noise
+static const double MIN_IMPROVEMENT = 0.98;
+
+struct Measurement {
+  std::string output;
+  double seconds;
+};
+
+static std::variant<std::string, Err> read_output(FILE *file) {
+  std::string output{};
+  if (0 != std::fflush(file) || 0 != std::fseek(file, 0, SEEK_SET)) {
+    return Err::IO(errno);
+  }
+  char buffer[4096];
+  size_t count = 0;
+  while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    output.append(buffer, count);
+  }
+  if (std::ferror(file)) {
+    return Err::IO(errno);
+  }
+  return output;
+}
+
+/**
+ * Optimizes, compiles, and runs the program with the pipeline.  The time
+ * covers all three steps, the program itself is parsed up front.
+ */
+static std::variant<Measurement, Err> run_once(const std::string &program,
+                                               FILE *input,
+                                               const std::vector<OptimizerPass> &pipeline,
+                                               const TuneOptions &options) {
+  auto parsed = Parse(program);
+  if (0 != parsed.index()) {
+    return std::get<Err>(std::move(parsed));
+  }
+  OperationStream stream = std::get<OperationStream>(std::move(parsed));
+  auto heap = Heap::Create(options.heap_size);
+  if (0 != heap.index()) {
+    return std::get<Err>(std::move(heap));
+  }
+  FILE *output = std::tmpfile();
+  if (nullptr == output) {
+    return Err::IO(errno);
+  }
+  if (0 != std::fseek(input, 0, SEEK_SET)) {
+    const int error = errno;
+    std::fclose(output);
+    return Err::IO(error);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  Optimizer::Create(pipeline).Run(stream);
+  auto compiler = Compiler::Create();
+  if (0 != compiler.index()) {
+    std::fclose(output);
+    return std::get<Err>(std::move(compiler));
+  }
+  if (Err err = std::get<Compiler>(compiler).Compile(stream, options.eof_mode); !err.IsOk()) {
+    std::fclose(output);
+    return err;
+  }
+  SetProgramIO(input, output);
+  std::get<Compiler>(compiler).RunCode(std::get<Heap>(heap));
+  SetProgramIO(nullptr, nullptr);
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  auto result = read_output(output);
+  std::fclose(output);
+  if (0 != result.index()) {
+    return std::get<Err>(std::move(result));
+  }
+  return Measurement{.output = std::get<std::string>(std::move(result)), .seconds = elapsed.count()};
+}
+
+static std::variant<Measurement, Err> measure(const std::string &program,
+                                              FILE *input,
+                                              const std::vector<OptimizerPass> &pipeline,
+                                              const TuneOptions &options) {
+  Measurement best{};
+  for (unsigned int i = 0; i < MEASUREMENTS; ++i) {
+    auto run = run_once(program, input, pipeline, options);
+    if (0 != run.index()) {
+      return run;
+    }
+    Measurement &measurement = std::get<Measurement>(run);
+    if (0 == i || measurement.seconds < best.seconds) {
+      best = std::move(measurement);
+    }
+  }
+  return best;
+}
+
+static std::string pipeline_id(const std::vector<OptimizerPass> &pipeline) {
+  std::string id{};
+  for (const auto &pass : pipeline) {
+    id += pass.Key();
+    id += ' ';
+  }
+  return id;
+}
+
+/**
+ * All pipelines which differ from the given one by removing a pass,
+ * moving a pass, or inserting a pass.  Inserting a pass which is already
+ * part of the pipeline repeats it.
+ */
+static std::vector<std::vector<OptimizerPass>> neighbours(const std::vector<OptimizerPass> &pipeline) {
+  std::vector<std::vector<OptimizerPass>> result{};
+  const size_t size = pipeline.size();
+  for (size_t i = 0; i < size; ++i) {
+    auto removed = pipeline;
+    removed.erase(removed.begin() + (ptrdiff_t) i);
+    result.push_back(std::move(removed));
+    for (size_t j = 0; j < size; ++j) {
+      if (i != j) {
+        auto moved = pipeline;
+        const OptimizerPass pass = moved[i];
+        moved.erase(moved.begin() + (ptrdiff_t) i);
+        moved.insert(moved.begin() + (ptrdiff_t) j, pass);
+        result.push_back(std::move(moved));
+      }
+    }
+  }
+  for (const auto &pass : Optimizer::DefaultPipeline(OptimizerLevel::O3)) {
+    for (size_t i = 0; i <= size; ++i) {
+      auto inserted = pipeline;
+      inserted.insert(inserted.begin() + (ptrdiff_t) i, pass);
+      result.push_back(std::move(inserted));
+    }
+  }
+  return result;
+}
+
+/**
+ * Hill climbing over pass orders, starting with the default pipeline of
+ * the level.  The neighbours of the best pipeline are tried in a fixed
+ * pseudo random order, and the first one which is faster becomes the new
+ * best pipeline.  The search ends at a local optimum or when the budget
+ * is used up.
+ *
+ * The unoptimized program produces the reference output.  Candidates
+ * which print anything else are rejected, whatever their speed.
+ */
+std::variant<TuneResult, Err> Tune(const std::string &program, const std::string &input, const TuneOptions &options) {
+  FILE *input_file = std::tmpfile();
+  if (nullptr == input_file) {
+    return Err::IO(errno);
+  }
+  if (input.size() != std::fwrite(input.data(), 1, input.size(), input_file)) {
+    std::fclose(input_file);
+    return Err::IO(errno);
+  }
+  auto run = [&](const std::vector<OptimizerPass> &pipeline) {
+    return measure(program, input_file, pipeline, options);
+  };
+
+  auto reference = run({});
+  if (0 != reference.index()) {
+    std::fclose(input_file);
+    return std::get<Err>(std::move(reference));
+  }
+  const std::string expected = std::get<Measurement>(reference).output;
+
+  TuneResult result{.pipeline = Optimizer::DefaultPipeline(options.level),
+                    .baseline_seconds = 0,
+                    .best_seconds = 0,
+                    .candidates = 0,
+                    .rejected = 0};
+  auto baseline = run(result.pipeline);
+  if (0 != baseline.index()) {
+    std::fclose(input_file);
+    return std::get<Err>(std::move(baseline));
+  }
+  if (std::get<Measurement>(baseline).output != expected) {
+    // Start with the unoptimized program, it is correct by definition
+    ++result.rejected;
+    result.pipeline.clear();
+    baseline = std::move(reference);
+  }
+  result.baseline_seconds = std::get<Measurement>(baseline).seconds;
+  result.best_seconds = result.baseline_seconds;
+
+  std::set<std::string> seen{pipeline_id(result.pipeline)};
+  std::mt19937 random{0};
+  bool improved = true;
+  while (improved && result.candidates < options.budget) {
+    improved = false;
+    auto candidates = neighbours(result.pipeline);
+    std::shuffle(candidates.begin(), candidates.end(), random);
+    for (auto &candidate : candidates) {
+      if (result.candidates >= options.budget) {
+        break;
+      }
+      if (!seen.insert(pipeline_id(candidate)).second) {
+        continue;
+      }
+      ++result.candidates;
+      auto measurement = run(candidate);
+      if (0 != measurement.index()) {
+        std::fclose(input_file);
+        return std::get<Err>(std::move(measurement));
+      }
+      if (std::get<Measurement>(measurement).output != expected) {
+        ++result.rejected;
+        continue;
+      }
+      const double seconds = std::get<Measurement>(measurement).seconds;
+      if (seconds < result.best_seconds * MIN_IMPROVEMENT) {
+        result.pipeline = std::move(candidate);
+        result.best_seconds = seconds;
+        improved = true;
+        break;
+      }
+    }
+  }
+  std::fclose(input_file);
+  return result;
+}
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_TUNE_H
+#define BF_CC_TUNE_H 1
+
+#include <cstddef>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "error.h"
+#include "instr.h"
+#include "optimize.h"
+
+struct TuneOptions {
+  // The pipeline of this level is the starting point of the search
+  OptimizerLevel level;
+  // Maximum number of candidate pipelines which are measured
+  unsigned int budget;
+  size_t heap_size;
+  EOFMode eof_mode;
+};
+
+struct TuneResult {
+  std::vector<OptimizerPass> pipeline;
+  double baseline_seconds;
+  double best_seconds;
+  unsigned int candidates;
+  // Candidates whose output differs from the unoptimized program
+  unsigned int rejected;
+};
+
+/**
+ * Searches for the pass order under which the program runs fastest on the
+ * given input.  Every candidate is optimized, compiled, and executed with
+ * the JIT, and its output must match the output of the unoptimized
+ * program.
+ */
+std::variant<TuneResult, Err> Tune(const std::string &program, const std::string &input, const TuneOptions &);
+
+#endif /* BF_CC_TUNE_H */
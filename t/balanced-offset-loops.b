@@ -0,0 +1,7 @@
+Loops which leave the cell pointer where it was keep their cells as offsets
+>++++++++[->+++++++++<]        cell 2 = 72
+>[->+>+<<]                     copy cell 2 into cells 3 and 4
+>.                             H
+>+++++++++++++++++++++++++++++++++.   i
+<<<++++++++++[->>>>+<<<<]      cell 5 = 10
+>>>>.
@@ -0,0 +1,6 @@
+Updates of the same cells in a single block are merged
+++++++++[>++++++++<-]>>+<+>-<<   cell 1 is 65
+[-]>[->+>+<<]>>[-<<+>>]<[<+>-]   cell 1 is 130 and cells 2 and 3 are 0
+<-----------------------------------------------------------------.   A
++++>>+<+++<->++++++++-   cell 1 is 67 and cell 2 is 10
+<.>.   C and newline
@@ -0,0 +1,7 @@
+Loop invariant stores
++++++[>[-]++++++++++++<-]
+>++++++++++++++++++++++++++++++++++++.
+>[<[-]+>-]
+<.
+>+++[>[-]+<->[-]++++++++++<]
+>.
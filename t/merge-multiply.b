@@ -0,0 +1,9 @@
+Copies with a temporary cell are merged into a single block
+++++++++[->++++++++<]>+            cell 1 is 65
+[->+>+<<]>>[-<<+>>]<<              copy cell 1 to cell 2 with cell 3
+[->>>+<<<]                         move cell 1 to cell 4
+>.+.<                              A B
+>>>[-<<<+>>>]<<<++.                C
+<++++++++++                        cell 0 is 10
+[->>>>>+<<<<<]>>>>>[-<<<<<+>>>>>]<<<<<   move cell 0 forth and back
+.>++++++++++.<.                    newline and M and newline
@@ -0,0 +1,2 @@
+Cells left of the start are available if the tape bounds are known
+<++++++++[>++++++++<-]>+.[-]++++++++++.
@@ -0,0 +1,8 @@
+Loops whose body leaves the condition cell at zero run at most once
+++++++++[>++++++++<-]>+        cell 1 is 65
+[>+<[->+<]]                    cell 2 is 66 and cell 1 is cleared
+>[.[-]]                        print B once
++++++[<++++++++>-]<++          cell 1 is 42 and cell 2 is cleared
+>[<+>[-]]<.                    skipped so print star
+>>++++++++++[<<->>[-]]<<.      cell 1 is 41 so print paren
+>>++++++++++.                  newline
@@ -13,6 +13,7 @@ THIS_DIR=$(cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd)
 COUNTER=0
 ERR_COUNTER=0
 EXE="${1:-${THIS_DIR}/../bf-cc}"
+C_COMPILER="${CC:-cc}"
 
 TEST_CASE_FLAG_MATRIX=("--interp --optimize=0"
                        "--interp --optimize=1"
@@ -21,7 +22,24 @@ TEST_CASE_FLAG_MATRIX=("--interp --optimize=0"
                        "--comp --optimize=0"
                        "--comp --optimize=1"
                        "--comp --optimize=2"
-                       "--comp --optimize=3")
+                       "--comp --optimize=3"
+                       "--comp --optimize=0 --lazy"
+                       "--comp --optimize=3 --lazy"
+                       "--tiered --optimize=2"
+                       "--tiered --optimize=3 --tier-up=1"
+                       "--trace --optimize=2"
+                       "--trace --optimize=0 --tier-up=1"
+                       "--interp --optimize=3 --fixpoint"
+                       "--comp --optimize=3 --fixpoint"
+                       "--interp --optimize=2 --profile"
+                       "--comp --optimize=3 --profile"
+                       "--comp --optimize=2 --cache"
+                       "--comp --optimize=3 --emit-ir"
+                       "--output --optimize=0"
+                       "--output --optimize=3")
+if command -v "${C_COMPILER}" > /dev/null; then
+    TEST_CASE_FLAG_MATRIX+=("--emit-c --optimize=3")
+fi
 
 function run_testcase () {
     name="$1"
@@ -30,6 +48,64 @@ function run_testcase () {
     if ! [[ -r "${input_file}" ]]; then
         input_file='/dev/null'
     fi
+    if [[ "$flags" == *--output* ]]; then
+        # Build a standalone executable and run that instead
+        executable="$(mktemp)"
+        flags="${flags/--output/--output=${executable}}"
+        if [[ $VERBOSE -ne 0 ]]; then
+            eval "${EXE}" "$flags" "${THIS_DIR}/${name}.b" && "${executable}" < "${input_file}"
+        else
+            eval "${EXE}" "$flags" "${THIS_DIR}/${name}.b" 2>/dev/null && "${executable}" < "${input_file}" 2>/dev/null
+        fi
+        status=$?
+        rm -f "${executable}"
+        return $status
+    fi
+    if [[ "$flags" == *--emit-ir* ]]; then
+        # Serialize the optimized program and run that instead
+        ir_file="$(mktemp)"
+        if [[ $VERBOSE -ne 0 ]]; then
+            eval "${EXE}" "${flags/--emit-ir/--emit-ir=${ir_file}}" "${THIS_DIR}/${name}.b" &&
+                eval "${EXE}" "${flags/--emit-ir/}" "${ir_file}" < "${input_file}"
+        else
+            eval "${EXE}" "${flags/--emit-ir/--emit-ir=${ir_file}}" "${THIS_DIR}/${name}.b" 2>/dev/null &&
+                eval "${EXE}" "${flags/--emit-ir/}" "${ir_file}" < "${input_file}" 2>/dev/null
+        fi
+        status=$?
+        rm -f "${ir_file}"
+        return $status
+    fi
+    if [[ "$flags" == *--emit-c* ]]; then
+        # Lower the program to C, compile and run that instead
+        c_dir="$(mktemp -d)"
+        if [[ $VERBOSE -ne 0 ]]; then
+            eval "${EXE}" "${flags/--emit-c/--emit-c=${c_dir}/${name}.c}" "${THIS_DIR}/${name}.b" &&
+                "${C_COMPILER}" -O1 -o "${c_dir}/${name}" "${c_dir}/${name}.c" &&
+                "${c_dir}/${name}" < "${input_file}"
+        else
+            eval "${EXE}" "${flags/--emit-c/--emit-c=${c_dir}/${name}.c}" "${THIS_DIR}/${name}.b" 2>/dev/null &&
+                "${C_COMPILER}" -O1 -o "${c_dir}/${name}" "${c_dir}/${name}.c" 2>/dev/null &&
+                "${c_dir}/${name}" < "${input_file}" 2>/dev/null
+        fi
+        status=$?
+        rm -rf "${c_dir}"
+        return $status
+    fi
+    if [[ "$flags" == *--cache* ]]; then
+        # Fill the cache, the second run uses the cached code
+        cache_dir="$(mktemp -d)"
+        flags="${flags/--cache/--cache=${cache_dir}}"
+        if [[ $VERBOSE -ne 0 ]]; then
+            eval "${EXE}" "$flags" "${THIS_DIR}/${name}.b" < "${input_file}" > /dev/null &&
+                eval "${EXE}" "$flags" "${THIS_DIR}/${name}.b" < "${input_file}"
+        else
+            eval "${EXE}" "$flags" "${THIS_DIR}/${name}.b" < "${input_file}" > /dev/null 2>&1 &&
+                eval "${EXE}" "$flags" "${THIS_DIR}/${name}.b" < "${input_file}" 2>/dev/null
+        fi
+        status=$?
+        rm -rf "${cache_dir}"
+        return $status
+    fi
     if [[ $VERBOSE -ne 0 ]]; then
         eval "${EXE}" "$flags" "${THIS_DIR}/${name}.b" < "${input_file}"
     else
@@ -0,0 +1,5 @@
+Loops with a constant trip count
++>[-]++++++++[->++++++++<]>+    cell 2 is 65
+<[-]+++[->.<]                   print A three times
+[-]++++++++++++++++++++++++++[->.+<]   print the alphabet
+>>++++++++++.                   newline
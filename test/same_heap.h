@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_TEST_SAME_HEAP_H
+#define BF_CC_TEST_SAME_HEAP_H 1
+
+#include <functional>
+
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "interp.h"
+#include "mem.h"
+#include "optimize.h"
+#include "parse.h"
+
+/**
+ * A way of running a program, the stream is optimized already.
+ */
+using RunMode = std::function<void(Heap &, OperationStream &)>;
+
+/**
+ * The reference mode, the plain interpreter.
+ */
+inline void Interpret(Heap &heap, OperationStream &stream) {
+  Interpreter::Create().Run(heap, stream, EOFMode::KEEP);
+}
+
+/**
+ * Runs the program with both modes, each on its own copy of the stream,
+ * and expects the same data pointer and cells after both runs.
+ */
+inline void ExpectSameHeap(const char *program,
+                           OptimizerLevel level,
+                           const RunMode &expected_mode,
+                           const RunMode &mode) {
+  OperationStream expected_stream = std::get<OperationStream>(Parse(program));
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  Optimizer::Create(level).Run(expected_stream);
+  Optimizer::Create(level).Run(stream);
+  Heap expected = std::get<Heap>(Heap::Create(128));
+  Heap heap = std::get<Heap>(Heap::Create(128));
+  expected_mode(expected, expected_stream);
+  mode(heap, stream);
+  EXPECT_EQ(expected.DataPointer(), heap.DataPointer()) << program;
+  for (int i = 0; i < 128; ++i) {
+    EXPECT_EQ(expected.GetCell(i - expected.DataPointer()), heap.GetCell(i - heap.DataPointer())) << program;
+  }
+}
+
+#endif /* BF_CC_TEST_SAME_HEAP_H */
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: MIT License
+#ifndef BF_CC_TEST_STREAM_HELPERS_H
+#define BF_CC_TEST_STREAM_HELPERS_H 1
+
+#include <cstddef>
+
+#include "instr.h"
+#include "optimize.h"
+
+/**
+ * Fuses runs of operations and delays pointer moves, so that the loops of
+ * the stream are in the shape the loop passes expect.
+ */
+inline void PrepareLoops(OperationStream &stream) {
+  OptFusionOp(stream);
+  OptPeep(stream);
+  OptDelayPtr(stream);
+}
+
+/**
+ * The number of operations with the op code.
+ */
+inline size_t CountInstructions(OperationStream &stream, Instruction code) {
+  size_t result = 0;
+  for (const Operation *op : stream) {
+    result += op->Is(code);
+  }
+  return result;
+}
+
+#endif /* BF_CC_TEST_STREAM_HELPERS_H */
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: MIT License
+#include <cstdio>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "code_cache.h"
+#include "compiler.h"
+#include "instr.h"
+#include "mem.h"
+#include "parse.h"
+
+static const CachedHeap HEAP{.size = 128, .origin = 0, .guard_pages = 0};
+
+static RelocatableCode compile(const char *program) {
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  return std::get<RelocatableCode>(Compiler::CompileRelocatable(stream, EOFMode::KEEP));
+}
+
+static CodeCache create_cache() {
+  return std::get<CodeCache>(CodeCache::Create(testing::TempDir() + "bf-cc-test-cache"));
+}
+
+TEST(TestCodeCache, load) {
+  CachedCode code = std::get<CachedCode>(CachedCode::Load(compile("++++++++[>++++++++<-]>+"), HEAP));
+  Heap heap = std::get<Heap>(Heap::Create(128));
+  code.RunCode(heap);
+  EXPECT_EQ(1, heap.DataPointer());
+  EXPECT_EQ(65, heap.GetCell(0));
+}
+
+TEST(TestCodeCache, storeAndFind) {
+  const CodeCache cache = create_cache();
+  const std::string key{"++++[>+++<-]>>+ -O2"};
+  std::remove(cache.Path(key).c_str());
+  EXPECT_FALSE(cache.Find(key));
+  ASSERT_TRUE(cache.Store(key, compile("++++[>+++<-]>>+"), HEAP).IsOk());
+  std::optional<CachedCode> code = cache.Find(key);
+  ASSERT_TRUE(code);
+  EXPECT_EQ(128, code->HeapLayout().size);
+  Heap heap = std::get<Heap>(Heap::Create(128));
+  code->RunCode(heap);
+  EXPECT_EQ(2, heap.DataPointer());
+  EXPECT_EQ(12, heap.GetCell(-1));
+  EXPECT_EQ(1, heap.GetCell(0));
+  std::remove(cache.Path(key).c_str());
+}
+
+TEST(TestCodeCache, damagedFile) {
+  const CodeCache cache = create_cache();
+  const std::string key{"+++ -O0"};
+  ASSERT_TRUE(cache.Store(key, compile("+++"), HEAP).IsOk());
+  FILE *file = std::fopen(cache.Path(key).c_str(), "r+b");
+  ASSERT_NE(nullptr, file);
+  std::fputc('x', file);
+  std::fclose(file);
+  EXPECT_FALSE(cache.Find(key));
+  std::remove(cache.Path(key).c_str());
+}
+
+TEST(TestCodeCache, otherKeyOfSameFile) {
+  const CodeCache cache = create_cache();
+  const std::string key{"+++ -O1"};
+  const std::string other{"+++ -O3"};
+  ASSERT_TRUE(cache.Store(key, compile("+++"), HEAP).IsOk());
+  // A hash collision puts the file of the key where the other key looks
+  ASSERT_EQ(0, std::rename(cache.Path(key).c_str(), cache.Path(other).c_str()));
+  EXPECT_FALSE(cache.Find(other));
+  std::remove(cache.Path(other).c_str());
+}
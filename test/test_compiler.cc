@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: MIT License
+#include <string>
+
+#include "gtest/gtest.h"
+#include "compiler.h"
+#include "instr.h"
+#include "mem.h"
+#include "optimize.h"
+#include "parse.h"
+#include "same_heap.h"
+
+static OperationStream parse(const char *program, OptimizerLevel level) {
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  Optimizer::Create(level).Run(stream);
+  return stream;
+}
+
+static void expect_same_heap(const char *program, OptimizerLevel level) {
+  const auto eager = [](Heap &heap, OperationStream &stream) {
+    Compiler compiler = std::get<Compiler>(Compiler::Create());
+    ASSERT_TRUE(compiler.Compile(stream, EOFMode::KEEP).IsOk());
+    compiler.RunCode(heap);
+  };
+  const auto lazy = [](Heap &heap, OperationStream &stream) {
+    Compiler compiler = std::get<Compiler>(Compiler::Create());
+    ASSERT_TRUE(compiler.CompileLazy(stream, EOFMode::KEEP).IsOk());
+    compiler.RunCode(heap);
+  };
+  ExpectSameHeap(program, level, eager, lazy);
+}
+
+TEST(TestCompiler, lazyEmptyStream) {
+  OperationStream stream = OperationStream::Create();
+  Heap heap = std::get<Heap>(Heap::Create(128));
+  Compiler compiler = std::get<Compiler>(Compiler::Create());
+  ASSERT_TRUE(compiler.CompileLazy(stream, EOFMode::KEEP).IsOk());
+  compiler.RunCode(heap);
+  EXPECT_EQ(0, heap.DataPointer());
+}
+
+TEST(TestCompiler, lazySameHeap) {
+  for (auto level : {OptimizerLevel::O0, OptimizerLevel::O3}) {
+    expect_same_heap("++++++++[>++++++++[>+>++<<-]<-]>>>>", level);
+    expect_same_heap(">++>+>+>+>+[<]>[[>]+[<]>-]", level);
+    expect_same_heap("++++++++++[>[>>>+<<<-]>[<+>-]>[<+>-]+<<<-]", level);
+    expect_same_heap("+[>+++++[>+<-]>[>++<-]<<+>[-]>>>>+<<<<<]", level);
+  }
+}
+
+TEST(TestCompiler, lazyRunsTwice) {
+  // The second run takes the patched stubs
+  OperationStream stream = parse("+++[>++[>+<-]<-]", OptimizerLevel::O0);
+  Compiler compiler = std::get<Compiler>(Compiler::Create());
+  ASSERT_TRUE(compiler.CompileLazy(stream, EOFMode::KEEP).IsOk());
+  for (int run = 0; run < 2; ++run) {
+    Heap heap = std::get<Heap>(Heap::Create(128));
+    compiler.RunCode(heap);
+    EXPECT_EQ(0, heap.DataPointer());
+    EXPECT_EQ(6, heap.GetCell(2));
+  }
+}
+
+TEST(TestCompiler, lazySkipsLoopsWhichNeverRun) {
+  const std::string program = "[>" + std::string(256, '+') + "[>++++<-]<-]>>+++[-]";
+  OperationStream eager_stream = parse(program.c_str(), OptimizerLevel::O0);
+  OperationStream lazy_stream = parse(program.c_str(), OptimizerLevel::O0);
+  Compiler eager = std::get<Compiler>(Compiler::Create());
+  Compiler lazy = std::get<Compiler>(Compiler::Create());
+  ASSERT_TRUE(eager.Compile(eager_stream, EOFMode::KEEP).IsOk());
+  ASSERT_TRUE(lazy.CompileLazy(lazy_stream, EOFMode::KEEP).IsOk());
+  const size_t stub_size = lazy.CodeSize();
+  Heap heap = std::get<Heap>(Heap::Create(128));
+  lazy.RunCode(heap);
+  EXPECT_LT(stub_size, lazy.CodeSize());
+  EXPECT_LT(lazy.CodeSize(), eager.CodeSize());
+}
+
+TEST(TestCompiler, lazyTopLevelRegions) {
+  std::string program{};
+  for (int i = 0; i < 1000; ++i) {
+    program += "++[>+<-]>[<++>-]<";
+  }
+  expect_same_heap(program.c_str(), OptimizerLevel::O0);
+  expect_same_heap(program.c_str(), OptimizerLevel::O3);
+}
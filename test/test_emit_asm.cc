@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: MIT License
+#include <string>
+
+#include "compiler.h"
+#include "emit_asm.h"
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "parse.h"
+
+static RelocatableCode compile(OperationStream &stream) {
+  return std::get<RelocatableCode>(Compiler::CompileRelocatable(stream, EOFMode::KEEP));
+}
+
+TEST(TestEmitAsm, operationsInCodeOrder) {
+  OperationStream stream = std::get<OperationStream>(Parse("+>-[.]"));
+  const RelocatableCode code = compile(stream);
+  // Every operation and the exit
+  ASSERT_EQ(stream.Size() + 1, code.operations.size());
+  auto iter = stream.Begin();
+  size_t previous = 0;
+  for (size_t i = 0; i < stream.Size(); ++i, ++iter) {
+    EXPECT_EQ(*iter, code.operations[i].second);
+    EXPECT_LE(previous, code.operations[i].first);
+    previous = code.operations[i].first;
+  }
+  EXPECT_EQ(nullptr, code.operations.back().second);
+  EXPECT_LT(code.operations.back().first, code.code.size());
+}
+
+TEST(TestEmitAsm, commentsAndSymbols) {
+  OperationStream stream = std::get<OperationStream>(Parse(",+."));
+  const std::string source = EmitAssemblySource(compile(stream));
+  EXPECT_NE(std::string::npos, source.find("bf_program:"));
+  EXPECT_NE(std::string::npos, source.find(" entry\n"));
+  EXPECT_NE(std::string::npos, source.find(" READ 0, 0, 0 (source 0)\n"));
+  EXPECT_NE(std::string::npos, source.find(" INCR_CELL 1, 0, 0 (source 1)\n"));
+  EXPECT_NE(std::string::npos, source.find(" WRITE 0, 0, 0 (source 2)\n"));
+  EXPECT_NE(std::string::npos, source.find(" exit\n"));
+  EXPECT_NE(std::string::npos, source.find("bf_read"));
+  EXPECT_NE(std::string::npos, source.find("bf_write"));
+}
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: MIT License
+#include <string>
+
+#include "emit_c.h"
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "optimize.h"
+#include "parse.h"
+
+static const CSourceHeap HEAP{.size = 16, .guard = 4, .origin = 2};
+
+static std::string emitted(const char *program, OptimizerLevel level, EOFMode eof_mode = EOFMode::KEEP) {
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  Optimizer::Create(level).Run(stream);
+  return EmitCSource(stream, eof_mode, HEAP);
+}
+
+TEST(TestEmitC, heap) {
+  const std::string source = emitted("+", OptimizerLevel::O0);
+  EXPECT_NE(std::string::npos, source.find("static uint8_t tape[24];"));
+  EXPECT_NE(std::string::npos, source.find("uint8_t *p = tape + 6;"));
+  EXPECT_NE(std::string::npos, source.find("p[0] += 1;"));
+  // Nothing reads, there is no runtime
+  EXPECT_EQ(std::string::npos, source.find("bf_read"));
+}
+
+TEST(TestEmitC, guardedLoopIsWhile) {
+  const std::string source = emitted(",[.>,]", OptimizerLevel::O0, EOFMode::ZERO);
+  EXPECT_NE(std::string::npos, source.find("while (p[0]) {"));
+  EXPECT_EQ(std::string::npos, source.find("do {"));
+  EXPECT_EQ(std::string::npos, source.find("goto"));
+  EXPECT_NE(std::string::npos, source.find("input = 0;"));
+}
+
+TEST(TestEmitC, multiplication) {
+  const std::string source = emitted(">+++[<++>-]<.", OptimizerLevel::O3);
+  EXPECT_NE(std::string::npos, source.find("u * p["));
+  EXPECT_EQ(std::string::npos, source.find("while"));
+}
+
+TEST(TestEmitC, countedLoop) {
+  const std::string source = emitted("+>[-]++++++++++++++++++++++++++[->.+<]", OptimizerLevel::O3);
+  EXPECT_NE(std::string::npos, source.find("counter = 26;"));
+  EXPECT_NE(std::string::npos, source.find("} while (--counter);"));
+}
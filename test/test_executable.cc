@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: MIT License
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "assembler.h"
+#include "compiler.h"
+#include "executable.h"
+#include "instr.h"
+#include "parse.h"
+
+template <typename T>
+static T read(const std::string &file, size_t offset) {
+  T value{};
+  std::memcpy(&value, file.data() + offset, sizeof(T));
+  return value;
+}
+
+static StandaloneCode compile(const char *program) {
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  const StandaloneHeap heap{.size = STANDALONE_ALIGNMENT, .guard = 0, .origin = 0};
+  return std::get<StandaloneCode>(Compiler::CompileStandalone(stream, EOFMode::KEEP, heap));
+}
+
+TEST(TestExecutable, header) {
+  const StandaloneCode code = compile("++++++++[>++++++++<-]>+.");
+  const std::string file = BuildExecutable(code);
+  ASSERT_GT(file.size(), 64);
+  EXPECT_EQ(0, std::memcmp(file.data(), "\x7F"
+                                         "ELF\x02\x01",
+                           6));
+  // Position independent
+  EXPECT_EQ(3, read<uint16_t>(file, 16));
+  const uint64_t entry = read<uint64_t>(file, 24);
+  EXPECT_EQ(file.size() - code.code.size() + code.entry, entry);
+  // The code ends the file
+  EXPECT_EQ(0, std::memcmp(file.data() + file.size() - code.code.size(), code.code.data(), code.code.size()));
+}
+
+TEST(TestExecutable, segments) {
+  const StandaloneCode code = compile(",[.,]");
+  EXPECT_EQ(0, code.data_offset % STANDALONE_ALIGNMENT);
+  EXPECT_LE(code.code.size(), code.data_offset);
+  const std::string file = BuildExecutable(code);
+  const uint64_t phoff = read<uint64_t>(file, 32);
+  ASSERT_EQ(3, read<uint16_t>(file, 56));
+  // Code, then the data without any bytes in the file
+  const size_t code_header = phoff;
+  const size_t data_header = phoff + 56;
+  EXPECT_EQ(1, read<uint32_t>(file, code_header));
+  EXPECT_EQ(file.size(), read<uint64_t>(file, code_header + 32));
+  EXPECT_EQ(1, read<uint32_t>(file, data_header));
+  EXPECT_EQ(0, read<uint64_t>(file, data_header + 32));
+  EXPECT_EQ(STANDALONE_DATA_SIZE, read<uint64_t>(file, data_header + 40));
+  const uint64_t code_end = read<uint64_t>(file, code_header + 16) + read<uint64_t>(file, code_header + 40);
+  EXPECT_LE(code_end, read<uint64_t>(file, data_header + 16));
+  // Mapping the file keeps the offsets to the alignment
+  EXPECT_EQ(read<uint64_t>(file, data_header + 8) % STANDALONE_ALIGNMENT,
+            read<uint64_t>(file, data_header + 16) % STANDALONE_ALIGNMENT);
+}
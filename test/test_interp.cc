@@ -1,9 +1,12 @@
 // SPDX-License-Identifier: MIT License
 #include "gtest/gtest.h"
+#include "compiler.h"
 #include "instr.h"
 #include "interp.h"
 #include "mem.h"
+#include "optimize.h"
 #include "parse.h"
+#include "same_heap.h"
 
 TEST(TestInterpreter, emptyStream) {
   OperationStream stream = OperationStream::Create();
@@ -51,3 +54,106 @@ TEST(TestInterpreter, twoCellOperations) {
     EXPECT_EQ(0, heap.GetCell(i));
   }
 }
+
+TEST(TestInterpreter, countedLoop) {
+  OperationStream stream = OperationStream::Create();
+  stream.Append(Instruction::LABEL);
+  Operation *label = stream.Last();
+  stream.Append(Instruction::INCR_CELL, 2, 0);
+  stream.Append(Instruction::INCR_CELL, 1, 1);
+  stream.Append(Instruction::DJNZ, (Operation::operand_type) label, 5);
+  label->SetOperand1((Operation::operand_type) stream.Last());
+  Heap heap = std::get<Heap>(Heap::Create(128));
+  Interpreter::Create().Run(heap, stream, EOFMode::KEEP);
+  EXPECT_EQ(0, heap.DataPointer());
+  EXPECT_EQ(10, heap.GetCell(0));
+  EXPECT_EQ(5, heap.GetCell(1));
+}
+
+TEST(TestInterpreter, cellsInFrontOfOrigin) {
+  OperationStream stream = std::get<OperationStream>(Parse("<<+++>>+"));
+  Heap heap = std::get<Heap>(Heap::Create(8, 2));
+  Interpreter::Create().Run(heap, stream, EOFMode::KEEP);
+  EXPECT_EQ(2, heap.DataPointer());
+  EXPECT_EQ(1, heap.GetCell(0));
+  EXPECT_EQ(3, heap.GetCell(-2));
+  EXPECT_EQ(heap.BaseAddress() + 2, heap.CellAddress());
+}
+
+static void expect_same_heap(const char *program, uint64_t threshold, OptimizerLevel level = OptimizerLevel::O3) {
+  ExpectSameHeap(program, level, Interpret, [threshold](Heap &heap, OperationStream &stream) {
+    Compiler compiler = std::get<Compiler>(Compiler::Create());
+    Interpreter::Create().RunTiered(heap, stream, EOFMode::KEEP, compiler, threshold);
+  });
+}
+
+TEST(TestInterpreter, tieredCompilesActiveLoop) {
+  // The outer loop runs once, its compiled code takes over mid loop
+  expect_same_heap("+[>+++++[>+<-]>[>++<-]<<+>[-]>>>>+<<<<<]", 1);
+  expect_same_heap("++++++++[>++++++++[>+>++<<-]<-]>>>>", 1);
+  expect_same_heap("++++++++[>++++++++[>+>++<<-]<-]>>>>", 100);
+}
+
+TEST(TestInterpreter, tieredMovingLoops) {
+  expect_same_heap(">++>+>+>+>+[<]>[[>]+[<]>-]", 1);
+  expect_same_heap("++++++++++[>>+<<-]>>[<+>-]<", 3);
+  expect_same_heap("+++++[>+++++[>+>+<<-]>>[-]<<<-]", 2);
+}
+
+TEST(TestInterpreter, tieredSideExit) {
+  // The inner loops are skipped until the outer loop is compiled, then
+  // their entries leave the compiled code, until it is compiled again
+  expect_same_heap("++++++++++[>[>+<-]+<-]", 1, OptimizerLevel::O0);
+  expect_same_heap("++++++++++[>[>>>+<<<-]>[<+>-]>[<+>-]+<<<-]", 1, OptimizerLevel::O0);
+  expect_same_heap("++++++++++[>[>>>+<<<-]>[<+>-]>[<+>-]+<<<-]", 2, OptimizerLevel::O0);
+}
+
+TEST(TestInterpreter, tieredCountedLoop) {
+  OperationStream stream = OperationStream::Create();
+  stream.Append(Instruction::LABEL);
+  Operation *label = stream.Last();
+  stream.Append(Instruction::INCR_CELL, 2, 0);
+  stream.Append(Instruction::INCR_CELL, 1, 1);
+  stream.Append(Instruction::DJNZ, (Operation::operand_type) label, 5);
+  label->SetOperand1((Operation::operand_type) stream.Last());
+  Compiler compiler = std::get<Compiler>(Compiler::Create());
+  // The compiled loop takes over in the middle, with the loop counter of
+  // the interpreter
+  for (uint64_t threshold = 1; threshold <= 5; ++threshold) {
+    Heap heap = std::get<Heap>(Heap::Create(128));
+    Interpreter::Create().RunTiered(heap, stream, EOFMode::KEEP, compiler, threshold);
+    EXPECT_EQ(0, heap.DataPointer());
+    EXPECT_EQ(10, heap.GetCell(0));
+    EXPECT_EQ(5, heap.GetCell(1));
+  }
+}
+
+TEST(TestInterpreter, tieredSpeculatedValues) {
+  // The source cells of both multiplications are 0 in the first
+  // iteration, the compiled loop speculates on that and fails later
+  OperationStream stream = OperationStream::Create();
+  stream.Append(Instruction::SET_CELL, 10, 0);
+  stream.Append(Instruction::LABEL);
+  Operation *label = stream.Last();
+  stream.Append(Instruction::IMUL_CELL, 3, 1, 2);
+  stream.Append(Instruction::IMUL_CELL, 1, 2, 4);
+  stream.Append(Instruction::INCR_CELL, 1, 4);
+  stream.Append(Instruction::DECR_CELL, 1, 0);
+  stream.Append(Instruction::JNZ, (Operation::operand_type) label, 0);
+  label->SetOperand1((Operation::operand_type) stream.Last());
+  Heap expected = std::get<Heap>(Heap::Create(128));
+  Interpreter::Create().Run(expected, stream, EOFMode::KEEP);
+  // With a higher threshold the interpreter sees the values change
+  const uint64_t failures[] = {2, 1, 0};
+  for (uint64_t threshold = 1; threshold <= 3; ++threshold) {
+    Compiler compiler = std::get<Compiler>(Compiler::Create());
+    Heap heap = std::get<Heap>(Heap::Create(128));
+    TieredStats stats = Interpreter::Create().RunTiered(heap, stream, EOFMode::KEEP, compiler, threshold);
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(expected.GetCell(i), heap.GetCell(i)) << threshold;
+    }
+    EXPECT_EQ(failures[threshold - 1], stats.failures) << threshold;
+    EXPECT_EQ(failures[threshold - 1], stats.deoptimizations) << threshold;
+    EXPECT_EQ(failures[threshold - 1] + 1, stats.compilations) << threshold;
+  }
+}
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: MIT License
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "loop_tree.h"
+#include "optimize.h"
+#include "parse.h"
+
+TEST(TestLoopTree, emptyStream) {
+  OperationStream stream = OperationStream::Create();
+  LoopTree tree = LoopTree::Build(stream);
+  EXPECT_EQ(nullptr, tree.FirstTopLevel());
+  EXPECT_EQ(0, tree.Size());
+}
+
+TEST(TestLoopTree, singleLoop) {
+  OperationStream stream = std::get<OperationStream>(Parse("+[-]+"));
+  LoopTree tree = LoopTree::Build(stream);
+  LoopNode *guard = tree.FirstTopLevel();
+  ASSERT_NE(nullptr, guard);
+  EXPECT_TRUE(guard->IsGuard());
+  EXPECT_EQ(nullptr, guard->Parent());
+  EXPECT_EQ(nullptr, guard->NextSibling());
+  LoopNode *loop = guard->FirstChild();
+  ASSERT_NE(nullptr, loop);
+  EXPECT_TRUE(loop->IsLoop());
+  EXPECT_TRUE(loop->IsInnermost());
+  EXPECT_EQ(guard, loop->Parent());
+  EXPECT_EQ(loop, tree.Find(loop->First()));
+  EXPECT_EQ(loop, tree.Find(loop->Last()));
+  EXPECT_EQ(guard, tree.Find(guard->Last()));
+  EXPECT_EQ(2, tree.Size());
+}
+
+TEST(TestLoopTree, postOrder) {
+  OperationStream stream = std::get<OperationStream>(Parse("[[-]][+]"));
+  LoopTree tree = LoopTree::Build(stream);
+  const auto &order = tree.PostOrder();
+  ASSERT_EQ(6, order.size());
+  // Every parent comes after all of its children
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (size_t j = 0; j < i; ++j) {
+      EXPECT_NE(order[j], order[i]->Parent());
+      EXPECT_NE(order[j]->Id(), order[i]->Id());
+    }
+  }
+}
+
+TEST(TestLoopTree, deleteKeepsTreeUpToDate) {
+  OperationStream stream = std::get<OperationStream>(Parse("[[-]+]"));
+  LoopTree tree = LoopTree::Build(stream);
+  stream.SetLoops(&tree);
+  LoopNode *outer_guard = tree.FirstTopLevel();
+  LoopNode *outer_loop = outer_guard->FirstChild();
+  LoopNode *inner_guard = outer_loop->FirstChild();
+  LoopNode *inner_loop = inner_guard->FirstChild();
+  // Remove the inner guard, the inner loop moves up
+  stream.Delete(inner_guard->Last());
+  stream.Delete(inner_guard->First());
+  EXPECT_TRUE(inner_guard->IsRemoved());
+  EXPECT_EQ(inner_loop, outer_loop->FirstChild());
+  EXPECT_EQ(outer_loop, inner_loop->Parent());
+  // Remove the outer loop, the inner loop moves up again
+  stream.Delete(outer_loop->First());
+  stream.Delete(outer_loop->Last());
+  EXPECT_EQ(inner_loop, outer_guard->FirstChild());
+  EXPECT_EQ(outer_guard, inner_loop->Parent());
+  EXPECT_EQ(nullptr, inner_loop->NextSibling());
+  EXPECT_EQ(2, tree.Size());
+  stream.SetLoops(nullptr);
+}
+
+TEST(TestLoopTree, deleteKeepsSiblingOrder) {
+  OperationStream stream = std::get<OperationStream>(Parse("[[-][+]]"));
+  LoopTree tree = LoopTree::Build(stream);
+  stream.SetLoops(&tree);
+  LoopNode *outer_loop = tree.FirstTopLevel()->FirstChild();
+  LoopNode *first = outer_loop->FirstChild();
+  LoopNode *second = first->NextSibling();
+  ASSERT_NE(nullptr, second);
+  LoopNode *first_loop = first->FirstChild();
+  stream.Delete(first->First());
+  stream.Delete(first->Last());
+  EXPECT_EQ(first_loop, outer_loop->FirstChild());
+  EXPECT_EQ(second, first_loop->NextSibling());
+  stream.SetLoops(nullptr);
+}
+
+TEST(TestLoopTree, deepNesting) {
+  std::string program{};
+  for (int i = 0; i < 10000; ++i) {
+    program += '[';
+  }
+  for (int i = 0; i < 10000; ++i) {
+    program += ']';
+  }
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  LoopTree tree = LoopTree::Build(stream);
+  EXPECT_EQ(20000, tree.Size());
+  size_t depth = 0;
+  for (LoopNode *node = tree.FirstTopLevel(); node; node = node->FirstChild()) {
+    ++depth;
+  }
+  EXPECT_EQ(20000, depth);
+}
+
+TEST(TestLoopTree, optimizerDetachesTree) {
+  OperationStream stream = std::get<OperationStream>(Parse("+[->+<]>[[-]<]"));
+  Optimizer::Create(OptimizerLevel::O3).Run(stream);
+  // The tree lives only while the optimizer runs, no pointer to it is left
+  EXPECT_EQ(nullptr, stream.Loops());
+}
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: MIT License
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "optimize.h"
+#include "parse.h"
+
+TEST(TestOptCanonicalize, emptyStream) {
+  OperationStream stream = OperationStream::Create();
+  EXPECT_EQ(0, OptCanonicalize(stream));
+  EXPECT_EQ(nullptr, stream.First());
+  EXPECT_EQ(nullptr, stream.Last());
+}
+
+TEST(TestOptCanonicalize, netEffectPerOffset) {
+  OperationStream stream = OperationStream::Create();
+  stream.Append(Instruction::INCR_CELL, 1, 2);
+  stream.Append(Instruction::INCR_CELL, 1, 3);
+  stream.Append(Instruction::DECR_CELL, 1, 2);
+  stream.Append(Instruction::SET_CELL, 0, 1);
+  EXPECT_EQ(1, OptCanonicalize(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::SET_CELL, Instruction::INCR_CELL}));
+  EXPECT_EQ(2, stream.Size());
+  EXPECT_EQ(1, stream.Begin()->Operand2());
+  EXPECT_EQ(1, (stream.Begin() + 1)->Operand1());
+  EXPECT_EQ(3, (stream.Begin() + 1)->Operand2());
+}
+
+TEST(TestOptCanonicalize, setAbsorbsUpdates) {
+  OperationStream stream = OperationStream::Create();
+  stream.Append(Instruction::INCR_CELL, 7, 0);
+  stream.Append(Instruction::SET_CELL, 3, 0);
+  stream.Append(Instruction::DECR_CELL, 5, 0);
+  EXPECT_EQ(1, OptCanonicalize(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::SET_CELL}));
+  EXPECT_EQ(1, stream.Size());
+  EXPECT_EQ(254, stream.Begin()->Operand1());
+}
+
+TEST(TestOptCanonicalize, largeAmountBecomesDecrement) {
+  OperationStream stream = OperationStream::Create();
+  stream.Append(Instruction::INCR_CELL, 200, 0);
+  stream.Append(Instruction::INCR_CELL, 50, 1);
+  EXPECT_EQ(1, OptCanonicalize(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::DECR_CELL, Instruction::INCR_CELL}));
+  EXPECT_EQ(56, stream.Begin()->Operand1());
+}
+
+TEST(TestOptCanonicalize, multiplicationsFirst) {
+  OperationStream stream = OperationStream::Create();
+  stream.Append(Instruction::INCR_CELL, 1, 1);
+  stream.Append(Instruction::IMUL_CELL, 2, 1, 0);
+  stream.Append(Instruction::IMUL_CELL, 3, 1, 0);
+  stream.Append(Instruction::SET_CELL, 0, 0);
+  EXPECT_EQ(1, OptCanonicalize(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::IMUL_CELL, Instruction::SET_CELL, Instruction::INCR_CELL}));
+  EXPECT_EQ(5, stream.Begin()->Operand1());
+  EXPECT_EQ(0, stream.Begin()->Operand3());
+}
+
+TEST(TestOptCanonicalize, multiplicationReadsWrittenCell) {
+  OperationStream stream = OperationStream::Create();
+  stream.Append(Instruction::INCR_CELL, 1, 1);
+  stream.Append(Instruction::INCR_CELL, 1, 0);
+  stream.Append(Instruction::IMUL_CELL, 2, 1, 0);
+  // The multiplication must see the incremented cell
+  OptCanonicalize(stream);
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::INCR_CELL, Instruction::INCR_CELL, Instruction::IMUL_CELL}));
+  EXPECT_EQ(0, stream.Begin()->Operand2());
+  EXPECT_EQ(1, (stream.Begin() + 1)->Operand2());
+}
+
+TEST(TestOptCanonicalize, stopAtIO) {
+  OperationStream stream = std::get<OperationStream>(Parse("+>+<+.-"));
+  OptDelayPtr(stream);
+  EXPECT_EQ(1, OptCanonicalize(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt(
+      {Instruction::INCR_CELL, Instruction::INCR_CELL, Instruction::WRITE, Instruction::DECR_CELL}));
+  EXPECT_EQ(2, stream.Begin()->Operand1());
+  EXPECT_EQ(1, (stream.Begin() + 1)->Operand2());
+  EXPECT_EQ(4, stream.Size());
+}
+
+TEST(TestOptCanonicalize, canonicalFormIsStable) {
+  OperationStream stream = std::get<OperationStream>(Parse("+>>+<-<[->+>>+<<<]>>-"));
+  OptDelayPtr(stream);
+  OptCanonicalize(stream);
+  EXPECT_EQ(0, OptCanonicalize(stream));
+}
@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: MIT License
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "optimize.h"
+#include "parse.h"
+
+TEST(TestOptDelayPtr, emptyStream) {
+  OperationStream stream = OperationStream::Create();
+  OptDelayPtr(stream);
+  EXPECT_EQ(nullptr, stream.First());
+  EXPECT_EQ(nullptr, stream.Last());
+}
+
+TEST(TestOptDelayPtr, delayIntoOperands) {
+  OperationStream stream = std::get<OperationStream>(Parse(">>+<-"));
+  OptFusionOp(stream);
+  OptDelayPtr(stream);
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::INCR_CELL, Instruction::DECR_CELL}));
+  EXPECT_EQ(2, stream.Begin()->Operand2());
+  EXPECT_EQ(1, (stream.Begin() + 1)->Operand2());
+}
+
+TEST(TestOptDelayPtr, delayThroughBalancedLoop) {
+  OperationStream stream = std::get<OperationStream>(Parse(">[->+<]<+"));
+  OptFusionOp(stream);
+  OptDelayPtr(stream);
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::JZ,
+      Instruction::LABEL,
+      Instruction::DECR_CELL,
+      Instruction::INCR_CELL,
+      Instruction::JNZ,
+      Instruction::LABEL,
+      Instruction::INCR_CELL,
+  }));
+  EXPECT_EQ(1, stream.Begin()->Operand2());
+  EXPECT_EQ(1, (stream.Begin() + 2)->Operand2());
+  EXPECT_EQ(2, (stream.Begin() + 3)->Operand2());
+  EXPECT_EQ(1, (stream.Begin() + 4)->Operand2());
+  EXPECT_EQ(0, (stream.Begin() + 6)->Operand2());
+}
+
+TEST(TestOptDelayPtr, delayThroughNestedBalancedLoops) {
+  OperationStream stream = std::get<OperationStream>(Parse(">>[<[-]>-]"));
+  OptFusionOp(stream);
+  OptDelayPtr(stream);
+  for (auto *instr : stream) {
+    EXPECT_FALSE(instr->IsAny({Instruction::INCR_PTR, Instruction::DECR_PTR}));
+  }
+}
+
+TEST(TestOptDelayPtr, flushBeforeUnbalancedLoop) {
+  OperationStream stream = std::get<OperationStream>(Parse(">[>]+"));
+  OptFusionOp(stream);
+  OptDelayPtr(stream);
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::INCR_PTR, Instruction::JZ}));
+  EXPECT_EQ(1, stream.Begin()->Operand1());
+  EXPECT_EQ(0, (stream.Begin() + 1)->Operand2());
+}
+
+TEST(TestOptDelayPtr, multiplyLoopWithOffsetCounter) {
+  OperationStream stream = std::get<OperationStream>(Parse(">[->++<]"));
+  OptFusionOp(stream);
+  OptDelayPtr(stream);
+  OptMultiplyLoop(stream);
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::JZ, Instruction::IMUL_CELL, Instruction::SET_CELL}));
+  EXPECT_EQ(2, (stream.Begin() + 1)->Operand1());
+  EXPECT_EQ(2, (stream.Begin() + 1)->Operand2());
+  EXPECT_EQ(1, (stream.Begin() + 1)->Operand3());
+  EXPECT_EQ(1, (stream.Begin() + 2)->Operand2());
+}
@@ -57,3 +57,15 @@ TEST(TestDoubleGuard, doubleExit) {
                                         Instruction::LABEL,
                                         Instruction::LABEL}));
 }
+
+TEST(TestDoubleGuard, keepGuardOnOtherCell) {
+  OperationStream stream = std::get<OperationStream>(Parse("[>[-]<-]"));
+  OptFusionOp(stream);
+  OptDelayPtr(stream);
+  OptDoubleGuard(stream);
+  size_t guards = 0;
+  for (auto *instr : stream) {
+    guards += instr->Is(Instruction::JZ);
+  }
+  EXPECT_EQ(2, guards);
+}
@@ -134,3 +134,11 @@ TEST(TestOptFusionOp, doNotFuseAfterDelayIncrement) {
   }
   EXPECT_EQ(7, count);
 }
+
+TEST(TestOptFusionOp, pointerDoesNotWrap) {
+  OperationStream stream = std::get<OperationStream>(Parse(std::string(256, '>')));
+  OptFusionOp(stream);
+  ASSERT_EQ(1, stream.Size());
+  EXPECT_EQ(Instruction::INCR_PTR, stream.First()->OpCode());
+  EXPECT_EQ(256, stream.First()->Operand1());
+}
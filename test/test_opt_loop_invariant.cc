@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: MIT License
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "optimize.h"
+#include "parse.h"
+#include "stream_helpers.h"
+
+TEST(TestOptLoopInvariant, emptyStream) {
+  OperationStream stream = OperationStream::Create();
+  EXPECT_EQ(0, OptLoopInvariant(stream));
+  EXPECT_EQ(nullptr, stream.First());
+  EXPECT_EQ(nullptr, stream.Last());
+}
+
+TEST(TestOptLoopInvariant, hoistSingleStore) {
+  OperationStream stream = std::get<OperationStream>(Parse("[>[-]<-]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(1, OptLoopInvariant(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::JZ,
+      Instruction::SET_CELL,
+      Instruction::LABEL,
+      Instruction::DECR_CELL,
+      Instruction::JNZ,
+      Instruction::LABEL,
+  }));
+  EXPECT_EQ(0, (stream.Begin() + 1)->Operand1());
+  EXPECT_EQ(1, (stream.Begin() + 1)->Operand2());
+}
+
+TEST(TestOptLoopInvariant, sinkLastStore) {
+  OperationStream stream = std::get<OperationStream>(Parse("[>[-]+<->[-]++<]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(2, OptLoopInvariant(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::JZ,
+      Instruction::LABEL,
+      Instruction::DECR_CELL,
+      Instruction::JNZ,
+      Instruction::SET_CELL,
+      Instruction::LABEL,
+  }));
+  EXPECT_EQ(2, (stream.Begin() + 4)->Operand1());
+  EXPECT_EQ(1, (stream.Begin() + 4)->Operand2());
+}
+
+TEST(TestOptLoopInvariant, keepStoreWhichIsRead) {
+  OperationStream stream = std::get<OperationStream>(Parse("[>[-]<.>.<-]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(0, OptLoopInvariant(stream));
+}
+
+TEST(TestOptLoopInvariant, keepStoreInUnbalancedLoop) {
+  OperationStream stream = std::get<OperationStream>(Parse("[>[-]]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(0, OptLoopInvariant(stream));
+}
+
+TEST(TestOptLoopInvariant, keepConditionalStore) {
+  OperationStream stream = std::get<OperationStream>(Parse("[-[>[-]<]]"));
+  PrepareLoops(stream);
+  // The store of the inner loop moves in front of the inner loop,
+  // but it stays within the inner guard
+  EXPECT_EQ(1, OptLoopInvariant(stream));
+  EXPECT_EQ(0, OptLoopInvariant(stream));
+}
+
+TEST(TestOptLoopInvariant, nestedBalancedLoops) {
+  OperationStream stream = std::get<OperationStream>(Parse("[>>[-]<<[>[-]<-]-]"));
+  PrepareLoops(stream);
+  // The inner store is hoisted out of the inner loop, but is conditional,
+  // the outer store is hoisted out of the outer loop
+  EXPECT_EQ(2, OptLoopInvariant(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::JZ,
+      Instruction::SET_CELL,
+      Instruction::LABEL,
+      Instruction::JZ,
+      Instruction::SET_CELL,
+      Instruction::LABEL,
+  }));
+  EXPECT_EQ(2, (stream.Begin() + 1)->Operand2());
+  EXPECT_EQ(1, (stream.Begin() + 4)->Operand2());
+}
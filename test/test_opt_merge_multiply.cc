@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: MIT License
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "optimize.h"
+#include "parse.h"
+
+static OperationStream optimize(const char *program) {
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  OptFusionOp(stream);
+  OptDelayPtr(stream);
+  OptMultiplyLoop(stream);
+  OptMergeMultiply(stream);
+  return stream;
+}
+
+TEST(TestOptMergeMultiply, emptyStream) {
+  OperationStream stream = OperationStream::Create();
+  EXPECT_EQ(0, OptMergeMultiply(stream));
+  EXPECT_EQ(nullptr, stream.First());
+  EXPECT_EQ(nullptr, stream.Last());
+}
+
+TEST(TestOptMergeMultiply, copyAndRestore) {
+  OperationStream stream = optimize(",[->+>+<<]>>[-<<+>>]<<");
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::READ,
+      Instruction::JZ,
+      Instruction::IMUL_CELL,
+      Instruction::LABEL,
+  }));
+  EXPECT_EQ(0, (stream.Begin() + 1)->Operand2());
+  EXPECT_EQ(1, (stream.Begin() + 2)->Operand1());
+  EXPECT_EQ(1, (stream.Begin() + 2)->Operand2());
+  EXPECT_EQ(0, (stream.Begin() + 2)->Operand3());
+}
+
+TEST(TestOptMergeMultiply, moveForthAndBack) {
+  OperationStream stream = optimize(",[->+<]>[-<+>]<.");
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::READ, Instruction::WRITE}));
+  EXPECT_EQ(2, stream.Size());
+}
+
+TEST(TestOptMergeMultiply, sameCounter) {
+  OperationStream stream = optimize(",[->+>+<<]>>[-<<+>>]<<[->>>++<<<]");
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::READ,
+      Instruction::JZ,
+      Instruction::IMUL_CELL,
+      Instruction::IMUL_CELL,
+      Instruction::SET_CELL,
+      Instruction::LABEL,
+  }));
+  EXPECT_EQ(1, (stream.Begin() + 2)->Operand2());
+  EXPECT_EQ(2, (stream.Begin() + 3)->Operand1());
+  EXPECT_EQ(3, (stream.Begin() + 3)->Operand2());
+  EXPECT_EQ(0, (stream.Begin() + 4)->Operand2());
+}
+
+TEST(TestOptMergeMultiply, keepUnknownTemporary) {
+  OperationStream stream = optimize(",>>,<<[->+>+<<]>>[-<<+>>]<<");
+  EXPECT_EQ(0, OptMergeMultiply(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::READ,
+      Instruction::READ,
+      Instruction::JZ,
+      Instruction::IMUL_CELL,
+      Instruction::IMUL_CELL,
+      Instruction::SET_CELL,
+      Instruction::LABEL,
+      Instruction::JZ,
+  }));
+}
+
+TEST(TestOptMergeMultiply, keepScaledCounter) {
+  OperationStream stream = optimize(",[->++<]>[-<+>]<");
+  EXPECT_EQ(0, OptMergeMultiply(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::READ,
+      Instruction::JZ,
+      Instruction::IMUL_CELL,
+      Instruction::SET_CELL,
+      Instruction::LABEL,
+      Instruction::JZ,
+  }));
+}
+
+TEST(TestOptMergeMultiply, temporaryClearedByBlock) {
+  OperationStream stream = optimize(",>>,[-<+>]<<[->+>+<<]>>[-<<+>>]<<");
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::READ,
+      Instruction::READ,
+      Instruction::JZ,
+      Instruction::IMUL_CELL,
+      Instruction::SET_CELL,
+      Instruction::LABEL,
+      Instruction::JZ,
+      Instruction::IMUL_CELL,
+      Instruction::LABEL,
+  }));
+  EXPECT_EQ(0, (stream.Begin() + 6)->Operand2());
+  EXPECT_EQ(1, (stream.Begin() + 7)->Operand2());
+  EXPECT_EQ(9, stream.Size());
+}
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: MIT License
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "optimize.h"
+#include "parse.h"
+#include "stream_helpers.h"
+
+TEST(TestOptOnceLoop, emptyStream) {
+  OperationStream stream = OperationStream::Create();
+  EXPECT_EQ(0, OptOnceLoop(stream));
+  EXPECT_EQ(nullptr, stream.First());
+  EXPECT_EQ(nullptr, stream.Last());
+}
+
+TEST(TestOptOnceLoop, clearAtEnd) {
+  OperationStream stream = std::get<OperationStream>(Parse("[->+<[-]]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(1, OptOnceLoop(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::JZ,
+      Instruction::DECR_CELL,
+      Instruction::INCR_CELL,
+      Instruction::SET_CELL,
+      Instruction::LABEL,
+  }));
+  EXPECT_EQ(5, stream.Size());
+}
+
+TEST(TestOptOnceLoop, clearAtOffset) {
+  OperationStream stream = std::get<OperationStream>(Parse(">[<+>[-]]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(1, OptOnceLoop(stream));
+  for (auto *instr : stream) {
+    EXPECT_FALSE(instr->Is(Instruction::JNZ));
+  }
+}
+
+TEST(TestOptOnceLoop, clearBeforeOtherCells) {
+  OperationStream stream = std::get<OperationStream>(Parse("[[-]>+<]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(1, OptOnceLoop(stream));
+}
+
+TEST(TestOptOnceLoop, keepLoopWhichChangesConditionAfterClear) {
+  OperationStream stream = std::get<OperationStream>(Parse("[[-]+]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(0, OptOnceLoop(stream));
+}
+
+TEST(TestOptOnceLoop, keepLoopWhichSetsNonZero) {
+  OperationStream stream = std::get<OperationStream>(Parse("[[-]+>,<]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(0, OptOnceLoop(stream));
+}
+
+TEST(TestOptOnceLoop, keepLoopWhichMovesAfterClear) {
+  OperationStream stream = std::get<OperationStream>(Parse("[[-]>]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(0, OptOnceLoop(stream));
+}
+
+TEST(TestOptOnceLoop, keepLoopWithNestedLoopAfterClear) {
+  OperationStream stream = std::get<OperationStream>(Parse("[[-]>[-<+>]<]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(0, OptOnceLoop(stream));
+}
+
+TEST(TestOptOnceLoop, unguardedLoop) {
+  OperationStream stream = std::get<OperationStream>(Parse("[>+<[-]]"));
+  PrepareLoops(stream);
+  Operation *jz = stream.First();
+  stream.Delete((Operation *) jz->Operand1());
+  stream.Delete(jz);
+  EXPECT_EQ(1, OptOnceLoop(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::INCR_CELL, Instruction::SET_CELL}));
+  EXPECT_EQ(2, stream.Size());
+}
+
+TEST(TestOptOnceLoop, exitOfNestedLoop) {
+  OperationStream stream = std::get<OperationStream>(Parse("[>+<[->+<]]"));
+  PrepareLoops(stream);
+  // Either the nested loop is skipped or it exits, the cell is zero both ways
+  EXPECT_EQ(1, OptOnceLoop(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::JZ,
+      Instruction::INCR_CELL,
+      Instruction::JZ,
+      Instruction::LABEL,
+  }));
+}
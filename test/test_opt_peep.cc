@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MIT License
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "optimize.h"
+#include "parse.h"
+
+static OperationStream optimize(const char *program) {
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  OptFusionOp(stream);
+  OptPeep(stream);
+  return stream;
+}
+
+TEST(TestOptPeep, emptyStream) {
+  OperationStream stream = OperationStream::Create();
+  EXPECT_EQ(0, OptPeep(stream));
+  EXPECT_EQ(nullptr, stream.First());
+  EXPECT_EQ(nullptr, stream.Last());
+}
+
+TEST(TestOptPeep, clearLoop) {
+  OperationStream stream = optimize("[-]>[+++]");
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::SET_CELL, Instruction::INCR_PTR, Instruction::SET_CELL}));
+  EXPECT_EQ(3, stream.Size());
+  EXPECT_EQ(0, stream.First()->Operand1());
+  EXPECT_EQ(0, stream.Last()->Operand1());
+}
+
+TEST(TestOptPeep, keepEvenClearLoop) {
+  OperationStream stream = optimize("[--]");
+  EXPECT_EQ(0, OptPeep(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::JZ, Instruction::LABEL, Instruction::DECR_CELL}));
+}
+
+TEST(TestOptPeep, findCell) {
+  OperationStream stream = optimize("[>>][<]");
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::FIND_CELL_HIGH, Instruction::FIND_CELL_LOW}));
+  EXPECT_EQ(2, stream.Size());
+  EXPECT_EQ(2, stream.First()->Operand2());
+  EXPECT_EQ(1, stream.Last()->Operand2());
+}
+
+TEST(TestOptPeep, updateAfterSet) {
+  OperationStream stream = optimize("[-]+++++[-]--");
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::SET_CELL}));
+  EXPECT_EQ(1, stream.Size());
+  EXPECT_EQ(254, stream.First()->Operand1());
+}
+
+TEST(TestOptPeep, updateBeforeSet) {
+  // The clear loop is replaced after the increment has been passed
+  OperationStream stream = optimize("++[-]+");
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::SET_CELL}));
+  EXPECT_EQ(1, stream.Size());
+  EXPECT_EQ(1, stream.First()->Operand1());
+}
+
+TEST(TestOptPeep, differentCells) {
+  OperationStream stream = std::get<OperationStream>(Parse("+"));
+  stream.InsertBefore(stream.First(), Instruction::SET_CELL, 3, 1);
+  EXPECT_EQ(0, OptPeep(stream));
+  EXPECT_EQ(2, stream.Size());
+}
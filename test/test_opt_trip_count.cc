@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: MIT License
+#include <string>
+
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "optimize.h"
+#include "parse.h"
+#include "stream_helpers.h"
+
+TEST(TestOptTripCount, emptyStream) {
+  OperationStream stream = OperationStream::Create();
+  EXPECT_EQ(0, OptTripCount(stream));
+  EXPECT_EQ(nullptr, stream.First());
+  EXPECT_EQ(nullptr, stream.Last());
+}
+
+TEST(TestOptTripCount, evaluateConstantBody) {
+  OperationStream stream = std::get<OperationStream>(Parse("+>[-]+++++[->+++>[-]+<<]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(1, OptTripCount(stream));
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::INCR_CELL,
+      Instruction::SET_CELL,
+      Instruction::INCR_CELL,
+      Instruction::SET_CELL,
+  }));
+  EXPECT_EQ(4, stream.Size());
+  EXPECT_EQ(0, (stream.Begin() + 1)->Operand1());
+  EXPECT_EQ(1, (stream.Begin() + 1)->Operand2());
+  EXPECT_EQ(15, (stream.Begin() + 2)->Operand1());
+  EXPECT_EQ(2, (stream.Begin() + 2)->Operand2());
+  EXPECT_EQ(1, (stream.Begin() + 3)->Operand1());
+  EXPECT_EQ(3, (stream.Begin() + 3)->Operand2());
+}
+
+TEST(TestOptTripCount, tripCountWrapsAround) {
+  // 255 iterations, the counter goes 1, 2, ..., 255, 0
+  OperationStream stream = std::get<OperationStream>(Parse("+>[-]+[+>++<]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(1, OptTripCount(stream));
+  EXPECT_EQ(0, CountInstructions(stream, Instruction::JNZ));
+  ASSERT_TRUE((stream.Begin() + 2)->Is(Instruction::INCR_CELL));
+  EXPECT_EQ((255 * 2) % 256, (stream.Begin() + 2)->Operand1());
+}
+
+TEST(TestOptTripCount, skipLoopWithZeroCounter) {
+  OperationStream stream = std::get<OperationStream>(Parse("+>[-][->.<]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(1, OptTripCount(stream));
+  EXPECT_EQ(0, CountInstructions(stream, Instruction::WRITE));
+  EXPECT_EQ(0, CountInstructions(stream, Instruction::JZ));
+}
+
+TEST(TestOptTripCount, unrollSmallBody) {
+  OperationStream stream = std::get<OperationStream>(Parse("+>[-]+++[->.<]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(1, OptTripCount(stream));
+  EXPECT_EQ(3, CountInstructions(stream, Instruction::WRITE));
+  EXPECT_EQ(0, CountInstructions(stream, Instruction::JZ));
+  EXPECT_EQ(0, CountInstructions(stream, Instruction::DECR_CELL));
+}
+
+TEST(TestOptTripCount, countedLoop) {
+  OperationStream stream = std::get<OperationStream>(Parse("+>[-]" + std::string(40, '+') + "[->.<]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(1, OptTripCount(stream));
+  EXPECT_EQ(0, CountInstructions(stream, Instruction::JZ));
+  EXPECT_EQ(0, CountInstructions(stream, Instruction::JNZ));
+  EXPECT_EQ(0, CountInstructions(stream, Instruction::DECR_CELL));
+  ASSERT_TRUE(stream.Last()->Is(Instruction::DJNZ));
+  EXPECT_EQ(40, stream.Last()->Operand2());
+  EXPECT_EQ(stream.Last(), (Operation *) ((Operation *) stream.Last()->Operand1())->Operand1());
+  // Later passes leave counted loops alone
+  EXPECT_EQ(0, OptTripCount(stream));
+  EXPECT_EQ(0, OptMultiplyLoop(stream));
+  EXPECT_EQ(0, OptOnceLoop(stream));
+  EXPECT_EQ(0, OptDoubleGuard(stream));
+}
+
+TEST(TestOptTripCount, keepEndlessLoop) {
+  OperationStream stream = std::get<OperationStream>(Parse("+>[-]+++[-->+<]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(0, OptTripCount(stream));
+}
+
+TEST(TestOptTripCount, keepLoopReadingCounter) {
+  OperationStream stream = std::get<OperationStream>(Parse("+>[-]+++[-.]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(0, OptTripCount(stream));
+}
+
+TEST(TestOptTripCount, keepUnknownCounter) {
+  OperationStream stream = std::get<OperationStream>(Parse("+>,[->+<]"));
+  PrepareLoops(stream);
+  EXPECT_EQ(0, OptTripCount(stream));
+}
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: MIT License
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "optimize.h"
+#include "parse.h"
+
+TEST(TestOptimize, singleIteration) {
+  OperationStream stream = std::get<OperationStream>(Parse("+[>+<->-<]"));
+  OptimizerStats stats = Optimizer::Create(OptimizerLevel::O2).Run(stream);
+  EXPECT_EQ(1, stats.Iterations());
+  EXPECT_FALSE(stats.ReachedFixpoint());
+  ASSERT_TRUE(stream.Begin().LookingAt({
+      Instruction::INCR_CELL,
+      Instruction::JZ,
+      Instruction::LABEL,
+      Instruction::DECR_CELL,
+      Instruction::JNZ,
+      Instruction::LABEL,
+  }));
+}
+
+TEST(TestOptimize, fixpoint) {
+  // Canonicalizing the body leaves a clear loop for the peephole pass
+  OperationStream stream = std::get<OperationStream>(Parse("+[>+<->-<]"));
+  OptimizerStats stats = Optimizer::Create(OptimizerLevel::O2, Optimizer::MAX_ITERATIONS).Run(stream);
+  EXPECT_EQ(3, stats.Iterations());
+  EXPECT_TRUE(stats.ReachedFixpoint());
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::SET_CELL}));
+  EXPECT_EQ(1, stream.Size());
+  EXPECT_EQ(0, stream.Begin()->Operand1());
+}
+
+TEST(TestOptimize, statsPerPass) {
+  OperationStream stream = std::get<OperationStream>(Parse("++>>+<<[->+<]"));
+  const size_t ops = stream.Size();
+  OptimizerStats stats = Optimizer::Create(OptimizerLevel::O3, 2).Run(stream);
+  const auto &passes = stats.Passes();
+  ASSERT_EQ(22, passes.size());
+  EXPECT_EQ(ops, passes.front().ops_before);
+  EXPECT_EQ(stream.Size(), passes.back().ops_after);
+  for (size_t i = 1; i < passes.size(); ++i) {
+    EXPECT_EQ(passes[i - 1].ops_after, passes[i].ops_before);
+  }
+  for (const auto &pass : passes) {
+    if (pass.iteration == 2) {
+      EXPECT_EQ(0, pass.rewrites);
+    }
+  }
+}
+
+TEST(TestOptimize, budget) {
+  OperationStream stream = std::get<OperationStream>(Parse("+[>+<->-<]"));
+  OptimizerStats stats = Optimizer::Create(OptimizerLevel::O2, 2).Run(stream);
+  EXPECT_EQ(2, stats.Iterations());
+  EXPECT_FALSE(stats.ReachedFixpoint());
+}
+
+TEST(TestOptimize, smallProgramNotSplit) {
+  OperationStream stream = std::get<OperationStream>(Parse("++>>+<<[->+<]"));
+  OptimizerStats stats = Optimizer::Create(OptimizerLevel::O3, 1, 4).Run(stream);
+  EXPECT_EQ(11, stats.Passes().size());
+}
+
+TEST(TestOptimize, parallelMatchesSequential) {
+  std::string program{};
+  for (size_t i = 0; i < 4 * Optimizer::MIN_PARTITION_SIZE / 8; ++i) {
+    program += "+[->+<]>,[-[<+>-]]";
+  }
+  OperationStream sequential = std::get<OperationStream>(Parse(program));
+  OperationStream parallel = std::get<OperationStream>(Parse(program));
+  Optimizer::Create(OptimizerLevel::O3, Optimizer::MAX_ITERATIONS).Run(sequential);
+  OptimizerStats stats = Optimizer::Create(OptimizerLevel::O3, Optimizer::MAX_ITERATIONS, 4).Run(parallel);
+  ASSERT_EQ(sequential.Size(), parallel.Size());
+  EXPECT_EQ(stats.Passes().back().ops_after, parallel.Size());
+  auto left = sequential.Begin();
+  auto right = parallel.Begin();
+  for (; left != sequential.End(); ++left, ++right) {
+    ASSERT_EQ(left->OpCode(), right->OpCode());
+    if (!left->IsJump() && !left->Is(Instruction::LABEL)) {
+      ASSERT_EQ(left->Operand1(), right->Operand1());
+    }
+    ASSERT_EQ(left->Operand2(), right->Operand2());
+    ASSERT_EQ(left->Operand3(), right->Operand3());
+  }
+  parallel.Verify();
+}
+
+TEST(TestOptimize, pipelineRoundTrip) {
+  const std::vector<OptimizerPass> pipeline = Optimizer::DefaultPipeline(OptimizerLevel::O3);
+  auto parsed = ParsePipeline(FormatPipeline(pipeline));
+  ASSERT_EQ(0, parsed.index());
+  const auto &result = std::get<std::vector<OptimizerPass>>(parsed);
+  ASSERT_EQ(pipeline.size(), result.size());
+  for (size_t i = 0; i < pipeline.size(); ++i) {
+    EXPECT_STREQ(pipeline[i].Key(), result[i].Key());
+  }
+}
+
+TEST(TestOptimize, pipelineRepeatsPasses) {
+  auto parsed = ParsePipeline("# comment\n\n  fusion \nmultiply-loop\npeephole\nfusion");
+  ASSERT_EQ(0, parsed.index());
+  const auto &result = std::get<std::vector<OptimizerPass>>(parsed);
+  ASSERT_EQ(4, result.size());
+  EXPECT_STREQ("fusion", result[0].Key());
+  EXPECT_STREQ("multiply-loop", result[1].Key());
+  EXPECT_STREQ("peephole", result[2].Key());
+  EXPECT_STREQ("fusion", result[3].Key());
+}
+
+TEST(TestOptimize, pipelineUnknownPass) {
+  auto parsed = ParsePipeline("fusion\n\nnot-a-pass\n");
+  ASSERT_EQ(1, parsed.index());
+  EXPECT_EQ(Err::Code::INVALID_PIPELINE, std::get<Err>(parsed).Code());
+  EXPECT_EQ(3, std::get<Err>(parsed).NativeErrno());
+}
+
+TEST(TestOptimize, customPipelineIgnoresLevel) {
+  OperationStream stream = std::get<OperationStream>(Parse("+[-]"));
+  auto pipeline = std::get<std::vector<OptimizerPass>>(ParsePipeline("fusion\npeephole\n"));
+  Optimizer::Create(std::move(pipeline)).Run(stream);
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::SET_CELL}));
+  EXPECT_EQ(1, stream.Size());
+}
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: MIT License
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "compiler.h"
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "parse.h"
+#include "perf.h"
+#include "platform.h"
+
+TEST(TestPerf, sourcePositions) {
+  const SourceLines lines = SourceLines::Create("+\n  [-]\n\n.");
+  EXPECT_EQ(1, lines.Position(0).line);
+  EXPECT_EQ(1, lines.Position(0).column);
+  EXPECT_EQ(2, lines.Position(4).line);
+  EXPECT_EQ(3, lines.Position(4).column);
+  // The newline is the last character of its line
+  EXPECT_EQ(2, lines.Position(7).line);
+  EXPECT_EQ(4, lines.Position(9).line);
+  EXPECT_EQ(1, lines.Position(9).column);
+}
+
+TEST(TestPerf, mapNamesLoops) {
+  const char *program = "+\n[>+\n  [-]<-]";
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  const std::string path = "/tmp/perf-" + std::to_string(ProcessId()) + ".map";
+  {
+    PerfLog perf = std::get<PerfLog>(PerfLog::Create(PerfLog::Output::MAP, program, "program.b"));
+    Compiler compiler = std::get<Compiler>(Compiler::Create());
+    ASSERT_TRUE(compiler.Compile(stream, EOFMode::KEEP, &perf).IsOk());
+  }
+  const std::string map = std::get<std::string>(ReadWholeFile(path));
+  std::remove(path.c_str());
+  EXPECT_NE(std::string::npos, map.find(" bf_program\n"));
+  EXPECT_NE(std::string::npos, map.find(" bf_loop_2_1\n"));
+  EXPECT_NE(std::string::npos, map.find(" bf_loop_3_3\n"));
+  // The outer loop continues after the inner loop
+  EXPECT_NE(map.find(" bf_loop_2_1\n"), map.rfind(" bf_loop_2_1\n"));
+}
+
+TEST(TestPerf, jitdumpHeader) {
+  const char *program = "+[-]";
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  const std::string path = "jit-" + std::to_string(ProcessId()) + ".dump";
+  {
+    PerfLog perf = std::get<PerfLog>(PerfLog::Create(PerfLog::Output::JITDUMP, program, "program.b"));
+    Compiler compiler = std::get<Compiler>(Compiler::Create());
+    ASSERT_TRUE(compiler.Compile(stream, EOFMode::KEEP, &perf).IsOk());
+  }
+  const std::string dump = std::get<std::string>(ReadWholeFile(path));
+  std::remove(path.c_str());
+  uint32_t magic = 0;
+  ASSERT_LE(sizeof(magic), dump.size());
+  std::memcpy(&magic, dump.data(), sizeof(magic));
+  EXPECT_EQ(0x4A695444, magic);
+  EXPECT_NE(std::string::npos, dump.find("bf_loop_1_2"));
+  EXPECT_NE(std::string::npos, dump.find("program.b"));
+}
@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: MIT License
+#include <string>
+
+#include "compiler.h"
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "interp.h"
+#include "mem.h"
+#include "optimize.h"
+#include "parse.h"
+#include "profile.h"
+#include "stream_helpers.h"
+
+static LoopProfile record(const char *program) {
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  Heap heap = std::get<Heap>(Heap::Create(128));
+  LoopProfile profile = LoopProfile::Create(program);
+  Interpreter::Create().Profile(heap, stream, EOFMode::KEEP, profile);
+  return profile;
+}
+
+TEST(TestProfile, loopsKeepTheirSource) {
+  OperationStream stream = std::get<OperationStream>(Parse("+ [->+<]"));
+  ASSERT_TRUE(stream.Begin().LookingAt({Instruction::INCR_CELL, Instruction::JZ, Instruction::LABEL}));
+  EXPECT_EQ(0, stream.First()->Source());
+  EXPECT_EQ(3, (stream.Begin() + 3)->Source());
+  for (const Operation *op : stream) {
+    if (op->IsJump() || op->Is(Instruction::LABEL)) {
+      EXPECT_EQ(2, op->Source());
+    }
+  }
+  Optimizer::Create(OptimizerLevel::O2).Run(stream);
+  EXPECT_EQ(2, stream.Last()->Source());
+}
+
+TEST(TestProfile, countsIterations) {
+  LoopProfile profile = record("+++[->++<]>[-]");
+  ASSERT_NE(nullptr, profile.Find(3));
+  EXPECT_EQ(1, profile.Find(3)->entries);
+  EXPECT_EQ(3, profile.Find(3)->iterations);
+  EXPECT_EQ(1, profile.Find(3)->trips[2]);
+  ASSERT_NE(nullptr, profile.Find(11));
+  EXPECT_EQ(6, profile.Find(11)->iterations);
+  EXPECT_EQ(1, profile.Find(11)->trips[3]);
+}
+
+TEST(TestProfile, nestedLoops) {
+  LoopProfile profile = record("++[>+++[-]<-]");
+  EXPECT_EQ(1, profile.Find(2)->entries);
+  EXPECT_EQ(2, profile.Find(2)->iterations);
+  EXPECT_EQ(2, profile.Find(7)->entries);
+  EXPECT_EQ(6, profile.Find(7)->iterations);
+}
+
+TEST(TestProfile, skippedLoopIsCold) {
+  LoopProfile profile = record("[+]+[-]");
+  EXPECT_TRUE(profile.IsCold(0));
+  EXPECT_EQ(1, profile.Find(0)->trips[0]);
+  EXPECT_FALSE(profile.IsCold(4));
+  EXPECT_FALSE(profile.IsHot(4));
+  EXPECT_FALSE(profile.IsCold(100));
+}
+
+TEST(TestProfile, reachedLoopIsColdUntilItIterates) {
+  // The inner loop is reached on every iteration of the outer loop
+  const LoopProfile skipped = record("+++[>[-]<-]");
+  ASSERT_NE(nullptr, skipped.Find(5));
+  EXPECT_EQ(3, skipped.Find(5)->entries);
+  EXPECT_EQ(0, skipped.Find(5)->iterations);
+  EXPECT_TRUE(skipped.IsCold(5));
+  const LoopProfile iterated = record("+++[>[-]+<-]");
+  ASSERT_NE(nullptr, iterated.Find(5));
+  EXPECT_EQ(3, iterated.Find(5)->entries);
+  EXPECT_EQ(2, iterated.Find(5)->iterations);
+  EXPECT_FALSE(iterated.IsCold(5));
+}
+
+TEST(TestProfile, hotLoop) {
+  LoopProfile profile = record("++++++++++++++++[>++++++++++++++++[>++++++++++++++++[-]<-]<-]");
+  EXPECT_FALSE(profile.IsHot(16));
+  EXPECT_TRUE(profile.IsHot(52));
+}
+
+TEST(TestProfile, serializeRoundTrip) {
+  const char *program = "+++[->++<]>[-]";
+  LoopProfile profile = record(program);
+  auto parsed = LoopProfile::Parse(profile.Serialize(), program);
+  ASSERT_EQ(0, parsed.index());
+  EXPECT_EQ(profile.Serialize(), std::get<LoopProfile>(parsed).Serialize());
+}
+
+TEST(TestProfile, otherProgram) {
+  LoopProfile profile = record("+[-]");
+  auto parsed = LoopProfile::Parse(profile.Serialize(), "+[-]+");
+  ASSERT_EQ(1, parsed.index());
+  EXPECT_EQ(Err::Code::PROFILE_MISMATCH, std::get<Err>(parsed).Code());
+}
+
+TEST(TestProfile, editedComments) {
+  // The same commands, but the loop moves to another offset
+  LoopProfile profile = record("+[-]");
+  auto parsed = LoopProfile::Parse(profile.Serialize(), "a comment\n+[-]");
+  ASSERT_EQ(1, parsed.index());
+  EXPECT_EQ(Err::Code::PROFILE_MISMATCH, std::get<Err>(parsed).Code());
+  EXPECT_EQ(1, LoopProfile::Parse(profile.Serialize(), "+[-] comment").index());
+}
+
+TEST(TestProfile, invalidLine) {
+  LoopProfile profile = record("+[-]");
+  auto parsed = LoopProfile::Parse(profile.Serialize() + "loop 1 2\n", "+[-]");
+  ASSERT_EQ(1, parsed.index());
+  EXPECT_EQ(Err::Code::INVALID_PROFILE, std::get<Err>(parsed).Code());
+  EXPECT_EQ(4, std::get<Err>(parsed).NativeErrno());
+}
+
+TEST(TestProfile, coldLoopIsNotUnrolled) {
+  const char *program = ",[-]+++++[->.<]";
+  OperationStream unrolled = std::get<OperationStream>(Parse(program));
+  Optimizer::Create(OptimizerLevel::O3).Run(unrolled);
+  EXPECT_EQ(0, CountInstructions(unrolled, Instruction::JZ) + CountInstructions(unrolled, Instruction::DJNZ));
+  EXPECT_EQ(5, CountInstructions(unrolled, Instruction::WRITE));
+
+  LoopProfile profile = LoopProfile::Create(program);
+  profile.Loop(9);
+  OperationStream counted = std::get<OperationStream>(Parse(program));
+  counted.SetProfile(&profile);
+  Optimizer::Create(OptimizerLevel::O3).Run(counted);
+  EXPECT_EQ(1, CountInstructions(counted, Instruction::DJNZ));
+  EXPECT_EQ(1, CountInstructions(counted, Instruction::WRITE));
+}
+
+TEST(TestProfile, loopEnds) {
+  const auto ends = LoopEnds("+[>[-]\n<-]");
+  EXPECT_EQ(2, ends.size());
+  EXPECT_EQ(9, ends.at(1));
+  EXPECT_EQ(5, ends.at(3));
+}
+
+TEST(TestProfile, costIncludesInnerLoops) {
+  const char *program = "++[>+++[-]<-]>[-]";
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  Heap heap = std::get<Heap>(Heap::Create(128));
+  LoopProfile profile = LoopProfile::Create(program);
+  const uint64_t total = Interpreter::Create().Profile(heap, stream, EOFMode::KEEP, profile);
+  EXPECT_LT(0, profile.Find(7)->cost);
+  EXPECT_LT(profile.Find(7)->cost, profile.Find(2)->cost);
+  EXPECT_LT(profile.Find(2)->cost, total);
+  // Skipped right away
+  EXPECT_EQ(0, profile.Find(14)->cost);
+}
+
+TEST(TestProfile, compiledCodeCountsLikeTheInterpreter) {
+  const char *program = "++[>+++[-]<-]>[-]+++[->+++++++++++++++++++<]>[->+<]";
+  for (const OptimizerLevel level : {OptimizerLevel::O0, OptimizerLevel::O3}) {
+    OperationStream stream = std::get<OperationStream>(Parse(program));
+    Optimizer::Create(level).Run(stream);
+    Heap interpreted_heap = std::get<Heap>(Heap::Create(128));
+    LoopProfile interpreted = LoopProfile::Create(program);
+    Interpreter::Create().Profile(interpreted_heap, stream, EOFMode::KEEP, interpreted);
+
+    CodeCounters counters{.program = {0, 0, 0, 0}, .loops = {}};
+    Compiler compiler = std::get<Compiler>(Compiler::Create());
+    ASSERT_TRUE(compiler.Compile(stream, EOFMode::KEEP, nullptr, &counters).IsOk());
+    Heap compiled_heap = std::get<Heap>(Heap::Create(128));
+    compiler.RunCode(compiled_heap);
+    LoopProfile compiled = LoopProfile::Create(program);
+    compiled.Add(counters);
+
+    ASSERT_EQ(interpreted.Loops().size(), compiled.Loops().size());
+    for (const auto &[id, stats] : interpreted.Loops()) {
+      ASSERT_NE(nullptr, compiled.Find(id));
+      EXPECT_EQ(stats.entries, compiled.Find(id)->entries);
+      EXPECT_EQ(stats.iterations, compiled.Find(id)->iterations);
+      EXPECT_LE(compiled.Find(id)->cost, counters.program.ticks);
+    }
+  }
+}
+
+TEST(TestProfile, report) {
+  const char *program = "+\n[>++\n  [-]<-]";
+  LoopProfile profile = record(program);
+  const std::string report = profile.Report(program, 100, "operations");
+  EXPECT_EQ(0, report.find("Loop profile: 100 operations\n"));
+  // The outer loop costs more, so it comes first
+  const size_t outer = report.find("\n2:1        3:8 ");
+  const size_t inner = report.find("\n3:3        3:5 ");
+  ASSERT_NE(std::string::npos, outer);
+  ASSERT_NE(std::string::npos, inner);
+  EXPECT_LT(outer, inner);
+}
@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: MIT License
+#include <bit>
+#include <initializer_list>
+#include <string>
+#include <utility>
+
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "interp.h"
+#include "mem.h"
+#include "optimize.h"
+#include "parse.h"
+#include "same_heap.h"
+#include "serialize.h"
+
+static OperationStream optimized(const char *program) {
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  Optimizer::Create(OptimizerLevel::O3).Run(stream);
+  return stream;
+}
+
+/**
+ * A serialized stream of jumps and labels, each given by its op code and
+ * the distance to its partner.
+ */
+static std::string links(std::initializer_list<std::pair<Instruction, int8_t>> ops) {
+  OperationStream empty = OperationStream::Create();
+  std::string result = SerializeStream(empty).substr(0, 12);
+  for (size_t i = 0; i < 8; ++i) {
+    result += (char) (uint8_t) (ops.size() >> (8 * i));
+  }
+  for (const auto &[code, distance] : ops) {
+    result += (char) std::countr_zero((uint32_t) code);
+    result += '\0';
+    result += (char) (distance < 0 ? -2 * distance - 1 : 2 * distance);
+    result += std::string(2, '\0');
+  }
+  return result;
+}
+
+TEST(TestSerialize, emptyStream) {
+  OperationStream stream = OperationStream::Create();
+  const std::string serialized = SerializeStream(stream);
+  EXPECT_TRUE(IsSerializedStream(serialized));
+  OperationStream loaded = std::get<OperationStream>(DeserializeStream(serialized));
+  EXPECT_EQ(0, loaded.Size());
+}
+
+TEST(TestSerialize, roundTrip) {
+  OperationStream stream = optimized("++++++++[>++++++++<-]>[>+>[-]<<-]>>+++[<+>-]<<,[.,]+[>[-]<-]");
+  OperationStream loaded = std::get<OperationStream>(DeserializeStream(SerializeStream(stream)));
+  ASSERT_EQ(stream.Size(), loaded.Size());
+  auto expected = stream.Begin();
+  for (Operation *op : loaded) {
+    EXPECT_EQ(expected->OpCode(), op->OpCode());
+    EXPECT_EQ(expected->Source(), op->Source());
+    if (op->IsJump() || op->Is(Instruction::LABEL)) {
+      // The partners are at the same positions
+      size_t expected_index = 0;
+      for (Operation *other : stream) {
+        if (other == (Operation *) expected->Operand1()) {
+          break;
+        }
+        ++expected_index;
+      }
+      EXPECT_EQ(loaded.First() + expected_index, (Operation *) op->Operand1());
+    } else {
+      EXPECT_EQ(expected->Operand1(), op->Operand1());
+    }
+    EXPECT_EQ(expected->Operand2(), op->Operand2());
+    EXPECT_EQ(expected->Operand3(), op->Operand3());
+    ++expected;
+  }
+}
+
+TEST(TestSerialize, run) {
+  ExpectSameHeap("++++++++[>++++++++<-]>[>+>++<<-]<++[>>>+++<<<-]",
+                 OptimizerLevel::O3,
+                 Interpret,
+                 [](Heap &heap, OperationStream &stream) {
+                   OperationStream loaded = std::get<OperationStream>(DeserializeStream(SerializeStream(stream)));
+                   Interpret(heap, loaded);
+                 });
+}
+
+TEST(TestSerialize, editLoadedStream) {
+  OperationStream stream = optimized("+++[>+<-]>.");
+  OperationStream loaded = std::get<OperationStream>(DeserializeStream(SerializeStream(stream)));
+  const size_t size = loaded.Size();
+  // Operations of the block and new ones can be deleted
+  loaded.Append(Instruction::INCR_CELL, 1, 0);
+  loaded.Delete(loaded.Last());
+  loaded.Delete(loaded.First());
+  EXPECT_EQ(size - 1, loaded.Size());
+  Optimizer::Create(OptimizerLevel::O3).Run(loaded);
+}
+
+TEST(TestSerialize, invalid) {
+  OperationStream stream = optimized("+[>+<-]");
+  const std::string serialized = SerializeStream(stream);
+  EXPECT_FALSE(IsSerializedStream("+[>+<-]"));
+  // Truncated
+  auto result = DeserializeStream(serialized.substr(0, serialized.size() - 1));
+  ASSERT_EQ(1, result.index());
+  EXPECT_EQ(Err::Code::INVALID_IR, std::get<Err>(result).Code());
+  // Another version
+  std::string version{serialized};
+  version[8] = 2;
+  EXPECT_EQ(1, DeserializeStream(version).index());
+  // Unknown op code
+  std::string op_code{serialized};
+  op_code[20] = 30;
+  EXPECT_EQ(1, DeserializeStream(op_code).index());
+  // Trailing garbage
+  EXPECT_EQ(1, DeserializeStream(serialized + "x").index());
+}
+
+TEST(TestSerialize, invalidLinks) {
+  // An empty guard is fine
+  EXPECT_EQ(0, DeserializeStream(links({{Instruction::JZ, 1}, {Instruction::LABEL, -1}})).index());
+  // Linked to itself
+  auto result = DeserializeStream(links({{Instruction::JZ, 0}}));
+  ASSERT_EQ(1, result.index());
+  EXPECT_EQ(Err::Code::INVALID_IR, std::get<Err>(result).Code());
+  // Without a partner
+  EXPECT_EQ(1, DeserializeStream(links({{Instruction::JNZ, 0}, {Instruction::LABEL, 0}})).index());
+  // The guard jumps backward
+  EXPECT_EQ(1, DeserializeStream(links({{Instruction::LABEL, 1}, {Instruction::JZ, -1}})).index());
+  // The loop jumps forward
+  EXPECT_EQ(1, DeserializeStream(links({{Instruction::JNZ, 1}, {Instruction::LABEL, -1}})).index());
+  // The label belongs to another jump
+  EXPECT_EQ(1,
+            DeserializeStream(links({{Instruction::JZ, 1}, {Instruction::LABEL, 1}, {Instruction::JNZ, -1}})).index());
+  // Loops which cross each other
+  EXPECT_EQ(1,
+            DeserializeStream(links({{Instruction::LABEL, 2},
+                                     {Instruction::LABEL, 2},
+                                     {Instruction::JNZ, -2},
+                                     {Instruction::JNZ, -2}}))
+                .index());
+}
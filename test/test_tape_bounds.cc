@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: MIT License
+#include <optional>
+
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "optimize.h"
+#include "parse.h"
+#include "tape_bounds.h"
+
+static std::optional<TapeRange> analyze(const char *program, OptimizerLevel level = OptimizerLevel::O0) {
+  OperationStream stream = std::get<OperationStream>(Parse(program));
+  Optimizer::Create(level).Run(stream);
+  return AnalyzeTapeBounds(stream);
+}
+
+TEST(TestTapeBounds, emptyProgram) {
+  auto range = analyze("");
+  ASSERT_TRUE(range.has_value());
+  EXPECT_EQ(0, range->low);
+  EXPECT_EQ(0, range->high);
+  EXPECT_EQ(1, range->Size());
+}
+
+TEST(TestTapeBounds, straightLine) {
+  auto range = analyze(">>>+<<<<<-");
+  ASSERT_TRUE(range.has_value());
+  EXPECT_EQ(-2, range->low);
+  EXPECT_EQ(3, range->high);
+  EXPECT_EQ(6, range->Size());
+}
+
+TEST(TestTapeBounds, balancedLoops) {
+  for (OptimizerLevel level : {OptimizerLevel::O0, OptimizerLevel::O3}) {
+    auto range = analyze("++[>+++[->>+<<]<-]>>>.", level);
+    ASSERT_TRUE(range.has_value());
+    EXPECT_EQ(0, range->low);
+    EXPECT_EQ(3, range->high);
+  }
+}
+
+TEST(TestTapeBounds, movesOnlyInsideLoop) {
+  // The pointer moves, but not further than a cell which is touched
+  auto range = analyze(">>>>>[-]<<<<<");
+  ASSERT_TRUE(range.has_value());
+  EXPECT_EQ(0, range->low);
+  EXPECT_EQ(5, range->high);
+}
+
+TEST(TestTapeBounds, unbalancedLoop) {
+  EXPECT_FALSE(analyze("+[>+]").has_value());
+  EXPECT_FALSE(analyze("+[<]").has_value());
+  EXPECT_FALSE(analyze("+[<]", OptimizerLevel::O2).has_value());
+}
+
+TEST(TestTapeBounds, unbalancedOuterLoop) {
+  // The outer loop moves one cell to the right in every iteration
+  EXPECT_FALSE(analyze(",[>,[-]]").has_value());
+}
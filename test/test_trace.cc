@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: MIT License
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "interp.h"
+#include "mem.h"
+#include "optimize.h"
+#include "parse.h"
+#include "same_heap.h"
+#include "trace.h"
+
+static void expect_same_heap(const char *program, uint64_t threshold, OptimizerLevel level = OptimizerLevel::O3) {
+  ExpectSameHeap(program, level, Interpret, [threshold](Heap &heap, OperationStream &stream) {
+    TraceJit jit = std::get<TraceJit>(TraceJit::Create());
+    Interpreter::Create().RunTraced(heap, stream, EOFMode::KEEP, jit, threshold);
+  });
+}
+
+TEST(TestTrace, emptyStream) {
+  OperationStream stream = OperationStream::Create();
+  Heap heap = std::get<Heap>(Heap::Create(128));
+  TraceJit jit = std::get<TraceJit>(TraceJit::Create());
+  Interpreter::Create().RunTraced(heap, stream, EOFMode::KEEP, jit);
+  EXPECT_EQ(0, heap.DataPointer());
+  EXPECT_EQ(0, jit.CodeSize());
+}
+
+TEST(TestTrace, recordsHotLoop) {
+  OperationStream stream = std::get<OperationStream>(Parse("++++++++[>++++++++<-]"));
+  Operation *label = *(stream.Begin() + 9);
+  ASSERT_TRUE(label->Is(Instruction::LABEL));
+  Heap heap = std::get<Heap>(Heap::Create(128));
+  TraceJit jit = std::get<TraceJit>(TraceJit::Create());
+  Interpreter::Create().RunTraced(heap, stream, EOFMode::KEEP, jit, 2);
+  EXPECT_NE(nullptr, jit.Find(label));
+  EXPECT_EQ(64, heap.GetCell(1));
+}
+
+TEST(TestTrace, coldLoopIsNotRecorded) {
+  OperationStream stream = std::get<OperationStream>(Parse("++++++++[>++++++++<-]"));
+  Heap heap = std::get<Heap>(Heap::Create(128));
+  TraceJit jit = std::get<TraceJit>(TraceJit::Create());
+  Interpreter::Create().RunTraced(heap, stream, EOFMode::KEEP, jit, 100);
+  EXPECT_EQ(0, jit.CodeSize());
+  EXPECT_EQ(64, heap.GetCell(1));
+}
+
+TEST(TestTrace, sameHeap) {
+  for (uint64_t threshold = 1; threshold <= 4; ++threshold) {
+    for (auto level : {OptimizerLevel::O0, OptimizerLevel::O3}) {
+      expect_same_heap("+[>+++++[>+<-]>[>++<-]<<+>[-]>>>>+<<<<<]", threshold, level);
+      expect_same_heap("++++++++[>++++++++[>+>++<<-]<-]>>>>", threshold, level);
+      expect_same_heap(">++>+>+>+>+[<]>[[>]+[<]>-]", threshold, level);
+      expect_same_heap("++++++++++[>[>>>+<<<-]>[<+>-]>[<+>-]+<<<-]", threshold, level);
+    }
+  }
+}
+
+TEST(TestTrace, sideTraces) {
+  // The branches of the inner loop alternate, the first recorded path
+  // fails every second iteration and gets a side trace
+  const char *program = "++++++++++[>++++++++++[>>[-]+<[>-<-]>[<+>-]<[>>+>+<<<-]>>>[<<<+>>>-]<<<<-]<-]";
+  for (uint64_t threshold = 1; threshold <= 4; ++threshold) {
+    expect_same_heap(program, threshold, OptimizerLevel::O0);
+    expect_same_heap(program, threshold, OptimizerLevel::O3);
+  }
+}
+
+TEST(TestTrace, countedLoop) {
+  OperationStream stream = OperationStream::Create();
+  stream.Append(Instruction::LABEL);
+  Operation *label = stream.Last();
+  stream.Append(Instruction::INCR_CELL, 2, 0);
+  stream.Append(Instruction::INCR_CELL, 1, 1);
+  stream.Append(Instruction::DJNZ, (Operation::operand_type) label, 5);
+  label->SetOperand1((Operation::operand_type) stream.Last());
+  // The trace takes over in the middle, with the loop counter of the
+  // interpreter, and returns with the last iteration
+  for (uint64_t threshold = 1; threshold <= 5; ++threshold) {
+    TraceJit jit = std::get<TraceJit>(TraceJit::Create());
+    Heap heap = std::get<Heap>(Heap::Create(128));
+    Interpreter::Create().RunTraced(heap, stream, EOFMode::KEEP, jit, threshold);
+    EXPECT_EQ(0, heap.DataPointer());
+    EXPECT_EQ(10, heap.GetCell(0));
+    EXPECT_EQ(5, heap.GetCell(1));
+  }
+}
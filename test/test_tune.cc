@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: MIT License
+#include <string>
+
+#include "gtest/gtest.h"
+#include "instr.h"
+#include "mem.h"
+#include "optimize.h"
+#include "tune.h"
+
+static TuneOptions options(unsigned int budget) {
+  return TuneOptions{
+      .level = OptimizerLevel::O2,
+      .budget = budget,
+      .heap_size = DEFAULT_HEAP_SIZE,
+      .eof_mode = EOFMode::KEEP,
+  };
+}
+
+TEST(TestTune, respectsBudget) {
+  auto result = Tune(",[->+<]>.", "A", options(5));
+  ASSERT_EQ(0, result.index());
+  const TuneResult &tuned = std::get<TuneResult>(result);
+  EXPECT_GE(5, tuned.candidates);
+  EXPECT_EQ(0, tuned.rejected);
+  EXPECT_LE(tuned.best_seconds, tuned.baseline_seconds);
+}
+
+TEST(TestTune, resultIsLoadable) {
+  auto result = Tune("++++++++[->++++++++<]>+.", "", options(3));
+  ASSERT_EQ(0, result.index());
+  auto parsed = ParsePipeline(FormatPipeline(std::get<TuneResult>(result).pipeline));
+  EXPECT_EQ(0, parsed.index());
+}